@@ -0,0 +1,34 @@
+#ifndef _checksum_h_
+#define _checksum_h_
+
+#include <stdint.h>
+#include <string.h>
+
+/* Frame checksums. Every function takes the running value and returns the
+   updated one, so a frame can be checked piecewise as it is built or read.
+   The _copy variants also copy the bytes, so that filling a buffer and
+   checksumming it takes a single pass.
+*/
+
+/* 8-bit additive checksum; a good frame, checksum byte included, sums to 0xff */
+uint8_t cs_sum8(uint8_t acc, const uint8_t *data, size_t n);
+uint8_t cs_sum8_copy(uint8_t acc, uint8_t *dst, const uint8_t *src, size_t n);
+
+/* CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xffff, MSB first,
+   no final xor. The check value of "123456789" is 0x29b1.
+*/
+#define CS_CRC16_INIT           (0xffff)
+
+/* CRC-16 using a 16-entry table (32 bytes of flash) */
+uint16_t cs_crc16_nibble(uint16_t crc, const uint8_t *data, size_t n);
+
+/* CRC-16 using a 256-entry table (512 bytes of flash), about twice as fast */
+uint16_t cs_crc16_table(uint16_t crc, const uint8_t *data, size_t n);
+
+/* CRC-16 with the table selected at build time: the nibble table unless
+   CS_CRC16_BYTE_TABLE is defined.
+*/
+uint16_t cs_crc16(uint16_t crc, const uint8_t *data, size_t n);
+uint16_t cs_crc16_copy(uint16_t crc, uint8_t *dst, const uint8_t *src, size_t n);
+
+#endif
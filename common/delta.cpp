@@ -0,0 +1,197 @@
+#include "delta.h"
+
+/** Read a little endian field of the given width */
+static uint32_t delta_read(const uint8_t *p, uint8_t width){
+        uint32_t v = 0;
+        while(width-- > 0){
+                v = (v << 8) | p[width];
+        }
+        return v;
+}
+
+/** Write a little endian field of the given width */
+static void delta_write(uint8_t *p, uint8_t width, uint32_t v){
+        uint8_t i;
+        for(i = 0; i < width; i++){
+                p[i] = v;
+                v >>= 8;
+        }
+}
+
+/** Append v as a base-128 varint, returns the number of bytes written */
+static uint8_t delta_varint(uint8_t *p, uint32_t v){
+        uint8_t n = 0;
+        while(v >= 0x80){
+                p[n++] = v | 0x80;
+                v >>= 7;
+        }
+        p[n++] = v;
+        return n;
+}
+
+/** Read a base-128 varint of at most 5 bytes, returns the bytes consumed or
+    0 if it runs past the end
+*/
+static size_t delta_read_varint(const uint8_t *p, size_t n, uint32_t *v){
+        size_t i;
+        *v = 0;
+        for(i = 0; i < n && i < 5; i++){
+                *v |= (uint32_t) (p[i] & 0x7f) << (7 * i);
+                if(!(p[i] & 0x80)){
+                        return i + 1;
+                }
+        }
+        return 0;
+}
+
+/** Difference of two fields, sign extended from the field width and zigzag
+    mapped so that small negative differences stay small
+*/
+static uint32_t delta_zigzag(uint32_t v, uint32_t prev, uint8_t width){
+        uint8_t shift = 32 - 8 * width;
+        int32_t d = (int32_t) ((v - prev) << shift) >> shift;
+        return ((uint32_t) d << 1) ^ (uint32_t) (d >> 31);
+}
+
+bool delta_layout_init(delta_layout *layout, const uint8_t *widths, uint8_t count){
+        uint8_t i;
+        if(count > DELTA_MAX_FIELDS){
+                return false;
+        }
+        for(i = 0; i < count; i++){
+                if(widths[i] != 1 && widths[i] != 2 && widths[i] != 4){
+                        return false;
+                }
+        }
+        memcpy(layout->width, widths, count);
+        layout->count = count;
+        return true;
+}
+
+void delta_encode_begin(delta_encoder *e, const delta_layout *layout, const uint8_t *src, size_t len){
+        uint8_t i;
+
+        e->layout   = layout;
+        e->src      = src;
+        e->len      = len;
+        e->pos      = 0;
+        e->field    = 0;
+        e->started  = false;
+        e->unit_len = 0;
+        e->unit_pos = 0;
+        e->record   = 0;
+        for(i = 0; i < layout->count; i++){
+                e->record += layout->width[i];
+        }
+        e->records  = e->record ? len - len % e->record : 0;
+}
+
+size_t delta_encode(delta_encoder *e, uint8_t *dst, size_t n){
+        size_t done = 0;
+
+        while(done < n){
+                /* write out what is left of the current unit */
+                if(e->unit_pos < e->unit_len){
+                        size_t k = e->unit_len - e->unit_pos;
+                        if(k > n - done){
+                                k = n - done;
+                        }
+                        if(dst){
+                                memcpy(dst + done, &e->unit[e->unit_pos], k);
+                        }
+                        e->unit_pos += k;
+                        done += k;
+                        continue;
+                }
+
+                /* code the next unit: the header, one field, or trailing bytes */
+                e->unit_pos = 0;
+                if(!e->started){
+                        uint8_t i;
+                        e->unit_len = delta_varint(e->unit, e->len);
+                        e->unit[e->unit_len++] = e->layout->count;
+                        for(i = 0; i < e->layout->count; i += 2){
+                                uint8_t hi = (i + 1 < e->layout->count) ? e->layout->width[i + 1] : 0;
+                                e->unit[e->unit_len++] = e->layout->width[i] | (hi << 4);
+                        }
+                        e->started = true;
+                }
+                else if(e->pos < e->records){
+                        uint8_t w = e->layout->width[e->field];
+                        uint32_t v = delta_read(&e->src[e->pos], w);
+                        uint32_t prev = (e->pos >= e->record) ? delta_read(&e->src[e->pos - e->record], w) : 0;
+                        e->unit_len = delta_varint(e->unit, delta_zigzag(v, prev, w));
+                        e->pos += w;
+                        e->field = (e->field + 1 == e->layout->count) ? 0 : e->field + 1;
+                }
+                else if(e->pos < e->len){
+                        e->unit_len = (e->len - e->pos > sizeof(e->unit)) ? sizeof(e->unit) : e->len - e->pos;
+                        memcpy(e->unit, &e->src[e->pos], e->unit_len);
+                        e->pos += e->unit_len;
+                }
+                else{
+                        e->unit_len = 0;
+                        break;
+                }
+        }
+        return done;
+}
+
+size_t delta_coded_size(const delta_layout *layout, const uint8_t *src, size_t len){
+        delta_encoder e;
+        size_t total = 0, k;
+
+        delta_encode_begin(&e, layout, src, len);
+        while((k = delta_encode(&e, 0, 64)) > 0){
+                total += k;
+        }
+        return total;
+}
+
+size_t delta_decode(const uint8_t *in, size_t n, uint8_t *out, size_t cap){
+        uint8_t width[DELTA_MAX_FIELDS];
+        uint8_t count, record = 0, f = 0, i;
+        uint32_t len, z;
+        size_t k, pos = 0, o = 0, records;
+
+        /* header */
+        if((k = delta_read_varint(in, n, &len)) == 0 || len > cap || k >= n){
+                return 0;
+        }
+        pos = k;
+        count = in[pos++];
+        if(count > DELTA_MAX_FIELDS || pos + (count + 1) / 2 > n){
+                return 0;
+        }
+        for(i = 0; i < count; i++){
+                width[i] = (in[pos + i / 2] >> ((i & 1) ? 4 : 0)) & 0xf;
+                if(width[i] != 1 && width[i] != 2 && width[i] != 4){
+                        return 0;
+                }
+                record += width[i];
+        }
+        pos += (count + 1) / 2;
+        records = record ? len - len % record : 0;
+
+        /* records */
+        while(o < records){
+                uint8_t w = width[f];
+                uint32_t prev = (o >= record) ? delta_read(&out[o - record], w) : 0;
+                int32_t d;
+                if((k = delta_read_varint(&in[pos], n - pos, &z)) == 0){
+                        return 0;
+                }
+                pos += k;
+                d = (int32_t) (z >> 1) ^ -(int32_t) (z & 1);
+                delta_write(&out[o], w, prev + d);
+                o += w;
+                f = (f + 1 == count) ? 0 : f + 1;
+        }
+
+        /* trailing bytes */
+        if(n - pos != len - o){
+                return 0;
+        }
+        memcpy(&out[o], &in[pos], len - o);
+        return len;
+}
@@ -0,0 +1,69 @@
+#ifndef _delta_h_
+#define _delta_h_
+
+#include <stdint.h>
+#include <string.h>
+
+/* Delta + varint coding for payloads made of fixed-layout records, such as
+   sensor time series. Each field of a record (1, 2 or 4 bytes, little
+   endian) is replaced by its difference from the same field of the
+   previous record, zigzag mapped and written as a base-128 varint, so
+   slowly changing values take a single byte. Bytes after the last whole
+   record are copied as they are.
+
+   Coded stream:
+     varint   length of the original payload
+     uint8_t  number of fields
+     uint8_t  field widths, two per byte, low nibble first
+     varint   deltas, record by record and field by field
+     uint8_t  trailing bytes
+*/
+
+#define DELTA_MAX_FIELDS        (8)
+
+/* Record layout */
+typedef struct delta_layout_s {
+    uint8_t count;                      // number of fields, 0 for none
+    uint8_t width[DELTA_MAX_FIELDS];    // field widths in bytes: 1, 2 or 4
+} delta_layout;
+
+/* Encoder state. The coded stream is produced in pieces of any size, so it
+   can be written straight into consecutive segments; the only state kept
+   besides the position is the varint being written out.
+*/
+typedef struct delta_encoder_s {
+    const delta_layout *layout;
+    const uint8_t      *src;
+    size_t             len;
+    size_t             pos;        // next source byte to code
+    size_t             records;    // bytes of whole records in src
+    uint8_t            record;     // record size
+    uint8_t            field;      // field starting at pos
+    bool               started;    // the stream header has been coded
+    uint8_t            unit[10];   // coded bytes not written out yet
+    uint8_t            unit_len;
+    uint8_t            unit_pos;
+} delta_encoder;
+
+/* Fill in a layout from a list of field widths.
+   Returns false if there are too many fields or a width is not 1, 2 or 4.
+*/
+bool delta_layout_init(delta_layout *layout, const uint8_t *widths, uint8_t count);
+
+/* Start coding len bytes of src, which must stay unchanged until done */
+void delta_encode_begin(delta_encoder *e, const delta_layout *layout, const uint8_t *src, size_t len);
+
+/* Write the next n coded bytes into dst, or skip them if dst is 0.
+   Returns the number of bytes produced, less than n at the end of the stream.
+*/
+size_t delta_encode(delta_encoder *e, uint8_t *dst, size_t n);
+
+/* Return the size of the coded stream for len bytes of src */
+size_t delta_coded_size(const delta_layout *layout, const uint8_t *src, size_t len);
+
+/* Decode n bytes of coded stream into out, which holds cap bytes.
+   Returns the decoded length, or 0 if the stream is malformed or too long.
+*/
+size_t delta_decode(const uint8_t *in, size_t n, uint8_t *out, size_t cap);
+
+#endif
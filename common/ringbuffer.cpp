@@ -1,24 +1,61 @@
 #include "ringbuffer.h"
 
+/** Index in buf of the byte offset bytes from the front. Offsets never
+    exceed the stored bytes, so at most one wrap is needed and we can get
+    away without a division.
+*/
+static inline size_t rb_index(const ringbuffer *rb, size_t offset){
+        size_t i = rb->start + offset;
+        size_t lim = rb->size - rb->pad;
+        if(rb->mask && !rb->pad){
+                return i & rb->mask;
+        }
+        return (i >= lim) ? i - lim : i;
+}
+
+/** Number of bytes which can be read contiguously from index i */
+static inline size_t rb_run(const ringbuffer *rb, size_t i){
+        return (i >= rb->start) ? rb->size - rb->pad - i : rb->start - i;
+}
+
+/** Copy n bytes starting offset bytes from the front, in at most two chunks */
+static void rb_copy_out(const ringbuffer *rb, size_t offset, uint8_t *buffer, size_t n){
+        size_t i = rb_index(rb, offset);
+        size_t first = rb_run(rb, i);
+        if(first >= n){
+                memcpy(buffer, &rb->buf[i], n);
+        }
+        else{
+                memcpy(buffer, &rb->buf[i], first);
+                memcpy(buffer + first, rb->buf, n - first);
+        }
+}
+
 void rb_init(ringbuffer* rb, uint8_t *buffer, size_t len){
         rb->buf   = buffer;
         rb->size  = len;
+        rb->mask  = (len & (len - 1)) ? 0 : len - 1;
         rb->start = 0;
         rb->avail = 0;
+        rb->pad   = 0;
 }
 
 size_t rb_get(ringbuffer *rb, uint8_t *buffer, size_t n){
         if (n > rb->avail) {
                 return 0;
         }
-        else{
-                size_t i;
-                for(i = 0; i < n; i++){
-                        buffer[i] = rb->buf[rb->start];
-                        rb->start = (rb->start + 1) % rb->size;
-                        rb->avail--;
+        else if(n == 1){
+                /* single bytes are common on the per-frame paths: skip the chunking */
+                *buffer = rb->buf[rb->start++];
+                if(--rb->avail == 0 || rb->start >= rb->size - rb->pad){
+                        rb->start = 0;
+                        rb->pad = 0;
                 }
-                return n;
+                return 1;
+        }
+        else{
+                rb_copy_out(rb, 0, buffer, n);
+                return rb_del(rb, n);
         }
 }
 
@@ -27,39 +64,121 @@ size_t rb_del(ringbuffer *rb, size_t n){
                 return 0;
         }
         else{
-                rb->start = (rb->start + n) % rb->size;
+                size_t i = rb->start + n;
+                if(i >= rb->size - rb->pad){
+                        i -= rb->size - rb->pad;
+                        rb->pad = 0;
+                }
+                rb->start = i;
                 rb->avail -= n;
+
+                /* start over at the front to keep reservations contiguous */
+                if(rb->avail == 0){
+                        rb->start = 0;
+                        rb->pad = 0;
+                }
                 return n;
         }
 }
 
-size_t rb_peek(const ringbuffer *rb, uint8_t *buffer, size_t n){
+size_t rb_truncate(ringbuffer *rb, size_t n){
         if (n > rb->avail) {
                 return 0;
         }
+        rb->avail -= n;
+
+        /* the end of the buffer skipped by a reservation is free again
+           once nothing after it is kept */
+        if(rb->start + rb->avail <= rb->size - rb->pad){
+                rb->pad = 0;
+        }
+        if(rb->avail == 0){
+                rb->start = 0;
+        }
+        return n;
+}
+
+size_t rb_peek(const ringbuffer *rb, uint8_t *buffer, size_t n){
+        return rb_peek_at(rb, 0, buffer, n);
+}
+
+size_t rb_peek_at(const ringbuffer *rb, size_t offset, uint8_t *buffer, size_t n){
+        if (offset + n > rb->avail) {
+                return 0;
+        }
+        else if(n == 1){
+                *buffer = rb->buf[rb_index(rb, offset)];
+                return 1;
+        }
         else{
-                size_t i;
-                for(i = 0; i < n; i++){
-                        buffer[i] = rb->buf[(rb->start + i) % rb->size];
-                }
+                rb_copy_out(rb, offset, buffer, n);
                 return n;
         }
 }
 
+const uint8_t *rb_peek_ptr(const ringbuffer *rb, size_t offset, size_t n){
+        size_t i;
+        if (offset + n > rb->avail) {
+                return 0;
+        }
+        i = rb_index(rb, offset);
+        if (rb_run(rb, i) < n) {
+                return 0;
+        }
+        return &rb->buf[i];
+}
+
 size_t rb_put(ringbuffer *rb, const uint8_t *buffer, size_t n){
-        if(rb->size - rb->avail < n){
+        if(rb_free(rb) < n){
                 return 0;
         }
+        else if(n == 1){
+                rb->buf[rb_index(rb, rb->avail)] = *buffer;
+                rb->avail++;
+                return 1;
+        }
         else{
-                size_t i;
-                for(i = 0; i < n; i++){
-                        rb->buf[(rb->start + rb->avail) % rb->size] = buffer[i];
-                        rb->avail++;
-                }     
-                return i;
+                size_t i = rb_index(rb, rb->avail);
+                size_t first = (i >= rb->start) ? rb->size - i : rb->start - i;
+                if(rb->avail == 0 || first >= n){
+                        memcpy(&rb->buf[i], buffer, n);
+                }
+                else{
+                        memcpy(&rb->buf[i], buffer, first);
+                        memcpy(rb->buf, buffer + first, n - first);
+                }
+                rb->avail += n;
+                return n;
+        }
+}
+
+uint8_t *rb_reserve(const ringbuffer *rb, size_t n){
+        size_t end = rb->start + rb->avail;
+
+        if(end >= rb->size - rb->pad){
+                /* data wraps, free space is between the back and the front */
+                end -= rb->size - rb->pad;
+                return (rb->start - end >= n) ? &rb->buf[end] : 0;
+        }
+        if(rb->size - end >= n){
+                return &rb->buf[end];
+        }
+        if(rb->start >= n){
+                return rb->buf;
+        }
+        return 0;
+}
+
+void rb_commit(ringbuffer *rb, size_t n){
+        size_t end = rb->start + rb->avail;
+
+        /* the reservation skipped the end of the buffer */
+        if(end < rb->size - rb->pad && rb->size - end < n){
+                rb->pad = rb->size - end;
         }
+        rb->avail += n;
 }
 
 size_t rb_free(const ringbuffer *rb){
-        return rb->size - rb->avail;
+        return rb->size - rb->pad - rb->avail;
 }
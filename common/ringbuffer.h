@@ -7,8 +7,10 @@
 typedef struct ringbuffer_s {
         uint8_t *buf;
         size_t  size;
+        size_t  mask;   // size - 1 if size is a power of two, 0 otherwise
         size_t  start;
         size_t  avail;
+        size_t  pad;    // bytes at the end of buf skipped by rb_reserve
 } ringbuffer;
 
 /* Initialize a ringbuffer on the given flat array. */
@@ -24,17 +26,48 @@ size_t rb_get(ringbuffer *rb, uint8_t *buffer, size_t n);
 */
 size_t rb_peek(const ringbuffer *rb, uint8_t *buffer, size_t n);
 
+/* Peek n bytes into the flat array, starting offset bytes from the
+   front of the ringbuffer.
+   Returns the number of bytes retrieved.
+*/
+size_t rb_peek_at(const ringbuffer *rb, size_t offset, uint8_t *buffer, size_t n);
+
+/* Return a pointer to n bytes starting offset bytes from the front of the
+   ringbuffer, without copying them.
+   Returns 0 if the bytes are not available or wrap around the end of the
+   buffer. Bytes written with rb_reserve/rb_commit never wrap.
+*/
+const uint8_t *rb_peek_ptr(const ringbuffer *rb, size_t offset, size_t n);
+
 /* Push n bytes from the flat array into the ringbuffer.
    Returns 0 if there is insufficient space in the ringbuffer;
    otherwise returns the number of bytes written.
 */
 size_t rb_put(ringbuffer *rb, const uint8_t *buffer, size_t n);
 
+/* Reserve n contiguous bytes at the back of the ringbuffer to be filled
+   in place. If they do not fit before the end of the buffer, the rest of
+   it is skipped and the space is taken from the front instead.
+   Returns 0 if there is no such space. Nothing is added to the
+   ringbuffer until rb_commit is called.
+*/
+uint8_t *rb_reserve(const ringbuffer *rb, size_t n);
+
+/* Add the n bytes filled in after rb_reserve(rb, n) to the ringbuffer.
+   n must match the preceding reservation.
+*/
+void rb_commit(ringbuffer *rb, size_t n);
+
 /* Remove n bytes from the ringbuffer.
    Returns 0 if there are less than n bytes available.
 */
 size_t rb_del(ringbuffer *rb, size_t n);
 
+/* Remove the n bytes added last to the ringbuffer.
+   Returns 0 if there are less than n bytes available.
+*/
+size_t rb_truncate(ringbuffer *rb, size_t n);
+
 /* Return the amount of free space in the ringbuffer */
 size_t rb_free(const ringbuffer *rb);
 
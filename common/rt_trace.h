@@ -0,0 +1,45 @@
+#ifndef _rt_trace_h_
+#define _rt_trace_h_
+
+#include <stdint.h>
+
+/* Frame traces, written by the slave driver (into a ringbuffer the sketch
+   drains, see rt_trace_read()) and the native master (to a file), and read
+   by rtrans_replay. A trace is an rt_trace_file followed by records, each
+   an rt_trace_record and its len bytes: a frame as it went over the air,
+   or for RT_TRACE_SEND the type and length (little endian) the
+   application passed to rt_send().
+*/
+
+#define RT_TRACE_MAGIC          (0x52545452)  // "RTTR", little endian
+#define RT_TRACE_VERSION        (1)
+
+/* Who wrote the trace */
+#define RT_TRACE_SLAVE          (0)
+#define RT_TRACE_MASTER         (1)
+
+/* Record kinds */
+#define RT_TRACE_RX             (0x01)  // frame received, peer is its source
+#define RT_TRACE_TX             (0x02)  // frame sent, peer is its destination
+#define RT_TRACE_SEND           (0x03)  // rt_send() call, peer is the master
+#define RT_TRACE_KIND_MASK      (0x0f)
+#define RT_TRACE_LOST           (0x80)  // records right before this one were dropped
+
+/* Bytes of an RT_TRACE_SEND record after its header */
+#define RT_TRACE_SEND_LEN       (3)
+
+typedef struct __attribute__ ((__packed__)) rt_trace_file_s {
+    uint32_t magic;     // RT_TRACE_MAGIC
+    uint8_t  version;   // RT_TRACE_VERSION
+    uint8_t  role;      // RT_TRACE_SLAVE or RT_TRACE_MASTER
+    uint16_t addr;      // 16-bit address of the node which wrote it
+} rt_trace_file;
+
+typedef struct __attribute__ ((__packed__)) rt_trace_record_s {
+    uint32_t time;      // ms on the node's clock
+    uint16_t peer;
+    uint8_t  kind;      // RT_TRACE_*, with RT_TRACE_LOST
+    uint8_t  len;       // bytes which follow
+} rt_trace_record;
+
+#endif
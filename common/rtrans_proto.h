@@ -0,0 +1,193 @@
+#ifndef _rtrans_proto_h_
+#define _rtrans_proto_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Wire format shared by the slave driver (slave/rtrans.h) and the native
+   master (master/native). Every frame is an rt_out_header, up to len bytes
+   of payload and a checksum trailer.
+*/
+
+/* Frame checksums. Receivers tell them apart by the length of the trailer
+   left after the payload, so either end may use either one.
+*/
+#define RTRANS_CHECKSUM_SUM8    (0)   // 1 byte, 0xff minus the sum of header and payload
+#define RTRANS_CHECKSUM_CRC16   (1)   // 2 bytes, CRC-16/CCITT-FALSE, little endian
+
+/* Largest payload of a single XBee 802.15.4 frame */
+#define RTRANS_XBEE_MAX_PAYLOAD (100)
+
+/* Special uuid for no master configured */
+#define RTRANS_NO_MASTER        (0xffff)
+
+/* Packet types */
+#define RTRANS_TYPE_PROBE       (0)   // from master to slave only - broadcast message to detect slaves
+#define RTRANS_TYPE_JOIN        (1)   // from slave to master only - response to 
+#define RTRANS_TYPE_POLL        (2)   // from master to slave only - request for data
+#define RTRANS_TYPE_DATA        (3)   // from slave to master only - response containing sensing data
+#define RTRANS_TYPE_SET         (4)   // from master to slave only - set control params
+#define RTRANS_TYPE_ERR         (5)   // from slave to master only - report high-priority hardware error
+#define RTRANS_TYPE_STATS       (6)   // from master: request for the slave's counters; from slave: the rt_counters
+#define RTRANS_TYPE_ACK         (254) // general acknowledgment pkt - confirm join, ack data, ack set
+#define RTRANS_TYPE_NAK         (255) // negative acknowledgment - refuse join, retx request, error
+
+/* Flags or'ed into the type of the application packets (PROBE to ERR) */
+#define RTRANS_FLAG_ACK         (0x80) // POLL/SET from the master: payload starts with an rt_ack_header
+#define RTRANS_FLAG_DELTA       (0x40) // payload is delta + varint coded, see delta.h
+#define RTRANS_FLAG_BATCH       (0x20) // payload is several records, each a length byte and its data
+#define RTRANS_TYPE_MASK        (0x1f) // type without flags
+
+/* Capabilities a slave announces in the first payload byte of its JOIN;
+   the master uses none of them with a slave which did not announce them
+*/
+#define RTRANS_CAP_CACK         (0x01) // takes cumulative and piggybacked ACKs
+#define RTRANS_CAP_COMPACT      (0x02) // takes compact headers, see rt_compact_encode()
+
+/* Longest (ms) a master holds back a cumulative ACK of a package which is
+   still coming in; slaves allow for it in their retransmit timeout
+*/
+#define RTRANS_ACK_DELAY        (50)
+
+/* Duplicate suppression. Each side remembers the last RTRANS_DUP_WINDOW
+   packages (a slave: POLL and SET segments by master, package and segment
+   number) it took from the other, and acknowledges a copy of one of them
+   again instead of handing it on a second time. A slave ACKs every SET
+   segment and every copy of a POLL, with seg_ct 1 like a plain ACK; a
+   master sends an unanswered POLL or unacknowledged SET segment again under
+   the same package number.
+*/
+#define RTRANS_DUP_WINDOW       (8)
+
+/* SET packages of several segments: every segment but the last carries
+   RTRANS_SET_PAYLOAD bytes, which fit a frame with either trailer, and the
+   whole package is handed to the callback at once, so it is at most 255
+   bytes
+*/
+#define RTRANS_SET_PAYLOAD      (RTRANS_XBEE_MAX_PAYLOAD - sizeof(rt_out_header) - 2)
+#define RTRANS_SET_MAX_SEGMENTS (255 / RTRANS_SET_PAYLOAD)
+
+/* Outgoing packet header */
+typedef struct __attribute__ ((__packed__)) rt_out_header_s {
+    uint16_t master;    // master mac
+    uint16_t slave;     // slave mac
+    uint16_t pkg_no;    // package number
+    uint8_t  type;      // message type
+    uint8_t  seg_ct;    // number of segments in package
+    uint8_t  seg_no;    // segment number
+    uint8_t  len;       // payload length
+} rt_out_header;
+
+/* Incoming packet header */
+typedef struct __attribute__ ((__packed__)) rt_in_header_s {
+    uint16_t master;    // master mac
+    uint16_t slave;     // slave mac
+    uint8_t  type;      // message type
+    uint8_t  len;       // payload length
+} rt_in_header;
+
+/* Compact headers. A master sends a slave which announced
+   RTRANS_CAP_COMPACT frames with a compact header instead of an
+   rt_out_header, and the slave sends its own that way once it got one. Both
+   addresses are left out, as the XBee frame carries them, and so is the
+   payload length: the rest of the frame but the trailer, which is the size
+   of the checksum the slave uses. The header is the type, a byte with seg_ct
+   in the high and seg_no in the low nibble, and the package number: one
+   byte from a slave, whose package numbers do not go past 255, two from a
+   master. A frame is a full one if it starts with the master's address, so
+   a frame whose compact header would start so goes with a full header, as
+   does one whose segment fields do not fit a nibble.
+*/
+#define RTRANS_COMPACT_SLAVE    (3)   // bytes of a compact header from a slave
+#define RTRANS_COMPACT_MASTER   (4)   // and from a master
+
+/** Whether a frame of len bytes starts with an rt_out_header rather than
+    a compact header
+*/
+static inline bool rt_frame_full(const uint8_t *frame, size_t len, uint16_t master){
+        return len >= 2 && (uint16_t) (frame[0] | (frame[1] << 8)) == master;
+}
+
+/** Write the compact header of h, of RTRANS_COMPACT_SLAVE or
+    RTRANS_COMPACT_MASTER bytes, to frame. Returns its size, or 0 if the
+    frame has to go with the full header.
+*/
+static inline uint8_t rt_compact_encode(uint8_t *frame, const rt_out_header *h, uint8_t size){
+        if(h->seg_ct > 0x0f || h->seg_no > 0x0f || (size == RTRANS_COMPACT_SLAVE && h->pkg_no > 0xff)){
+                return 0;
+        }
+        frame[0] = h->type;
+        frame[1] = (h->seg_ct << 4) | h->seg_no;
+        if(rt_frame_full(frame, 2, h->master)){
+                return 0;
+        }
+        frame[2] = h->pkg_no;
+        if(size == RTRANS_COMPACT_MASTER){
+                frame[3] = h->pkg_no >> 8;
+        }
+        return size;
+}
+
+/** Read a compact header of the given size from a frame of len bytes,
+    sent between master and slave with a trailer of trailer bytes, into h.
+    Returns false if the frame is too short.
+*/
+static inline bool rt_compact_decode(rt_out_header *h, const uint8_t *frame, size_t len, uint8_t size,
+                                     uint8_t trailer, uint16_t master, uint16_t slave){
+        if(len < (size_t) size + trailer || len - size - trailer > 0xff){
+                return false;
+        }
+        h->master = master;
+        h->slave  = slave;
+        h->pkg_no = (size == RTRANS_COMPACT_MASTER) ? frame[2] | (frame[3] << 8) : frame[2];
+        h->type   = frame[0];
+        h->seg_ct = frame[1] >> 4;
+        h->seg_no = frame[1] & 0x0f;
+        h->len    = len - size - trailer;
+        return true;
+}
+
+/* Cumulative ACKs. An ACK with seg_ct 0 acknowledges every segment of
+   package pkg_no below seg_no, and its payload, if any, is a bitmap of the
+   segments received past that: bit k of byte k / 8 stands for segment
+   seg_no + k. A POLL or SET with RTRANS_FLAG_ACK carries the same as an
+   rt_ack_header and map_len bytes of bitmap ahead of its own payload.
+*/
+typedef struct __attribute__ ((__packed__)) rt_ack_header_s {
+    uint16_t pkg_no;    // package acknowledged
+    uint8_t  count;     // segments below this one arrived
+    uint8_t  map_len;   // bytes of bitmap following
+} rt_ack_header;
+
+/* Slave counters, see rt_basic_state::rt_stats(). A slave answers a STATS
+   request with this as the payload of a STATS package, little endian.
+   Counters wrap around; take differences between two snapshots.
+*/
+#define RTRANS_STATS_VERSION    (2)
+
+typedef struct __attribute__ ((__packed__)) rt_counters_s {
+    uint8_t  version;           // RTRANS_STATS_VERSION
+    uint32_t elapsed;           // ms since the counters were reset
+    uint16_t tx_packages;       // packages queued
+    uint16_t tx_segments;       // segments sent, first transmissions
+    uint16_t tx_retransmits;    // segments sent again, on timeout or NAK
+    uint16_t tx_timeouts;       // retransmit timers which expired
+    uint16_t tx_dropped;        // packages given up after the retransmit limit
+    uint16_t tx_queue_full;     // packages refused for lack of transmit queue space
+    uint16_t rx_packets;        // PROBE, POLL and SET packets handed to the callback
+    uint16_t rx_acks;           // ACKs, including piggybacked ones
+    uint16_t rx_naks;
+    uint16_t rx_bad_checksum;
+    uint16_t rx_bad_length;     // frames too short for their header or length, and
+                                // receive queue entries cut short (the queue is dropped)
+    uint16_t rx_queue_full;     // packets dropped for lack of receive queue space
+    uint16_t tx_queue_hwm;      // most bytes ever in the transmit queue
+    uint16_t rx_queue_hwm;      // most bytes ever in the receive queue
+    uint16_t rtt_min;           // ms, 0 before the first sample
+    uint16_t rtt_max;           // ms
+    uint16_t rtt_samples;
+    uint32_t rtt_sum;           // ms, the average is rtt_sum / rtt_samples
+    uint16_t rx_duplicates;     // POLL and SET segments acknowledged again, since version 2
+} rt_counters;
+
+#endif
@@ -2,9 +2,10 @@
 #include <XBee.h>
 #include "rtrans.h"
 #include "ringbuffer.h"
-#include "xbee_init.h"
 
 void callback(rt_in_header *header, uint8_t payload[]);
+/* A sketch which does not print to Serial can use rt_uart xs; instead,
+   and raise the rate with rtrans_state.rt_init(true, 115200) */
 SoftwareSerial xs(6,7);
 rt_state rtrans_state(xs, callback);
 
@@ -34,19 +35,23 @@ void setup(){
   delay(1000);
   Serial.println("ok.");
   
-  Serial.print("Initializing xbee... ");
-  if(xbee_init(xs)){
-    Serial.println("ok.");
-  }
-  else{
-    Serial.println("fail."); 
-  }
-    
-  Serial.print("Initializing rt... ");
-  rtrans_state.rt_init();
-  Serial.println("ok");
+  /* Configures the xbee and assigns our address from rt_loop() */
+  Serial.println("Initializing xbee and rt... ");
+  rtrans_state.rt_init(true);
 }
 
 void loop(){
+  static uint8_t status = RTRANS_STATUS_IDLE;
+  
   rtrans_state.rt_loop();
+  
+  if(status != rtrans_state.rt_status()){
+    status = rtrans_state.rt_status();
+    if(status == RTRANS_STATUS_READY){
+      Serial.println("rt ok.");
+    }
+    else if(status == RTRANS_STATUS_FAILED){
+      Serial.println("rt fail.");
+    }
+  }
 }
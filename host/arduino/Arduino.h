@@ -0,0 +1,20 @@
+#ifndef _host_arduino_h_
+#define _host_arduino_h_
+
+/* Host stand-in for the parts of the Arduino core used by rtrans. Time comes
+   from the simulated clock in host/sim, truncated to 32 bits like on AVR.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "Stream.h"
+
+typedef bool    boolean;
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+#endif
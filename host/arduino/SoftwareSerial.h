@@ -0,0 +1,16 @@
+#ifndef _host_softwareserial_h_
+#define _host_softwareserial_h_
+
+#include "Arduino.h"
+
+/** Host stand-in for SoftwareSerial; pins are ignored and the bytes go to
+    the simulated radio connected with sim_connect().
+*/
+class SoftwareSerial : public Stream {
+
+public:
+        SoftwareSerial(uint8_t rx_pin, uint8_t tx_pin) { (void) rx_pin; (void) tx_pin; }
+        void begin(long baud) { (void) baud; }
+};
+
+#endif
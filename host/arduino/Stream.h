@@ -0,0 +1,33 @@
+#ifndef _host_stream_h_
+#define _host_stream_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+class sim_xbee;
+
+/** Host stand-in for the Arduino Stream class. The far end of every stream
+    is a simulated XBee module, which the XBee library stub reaches through
+    sim_radio().
+*/
+class Stream {
+
+protected:
+        sim_xbee *radio;
+
+public:
+        Stream() : radio(0) {}
+        virtual ~Stream() {}
+
+        virtual int available();
+        virtual int read();
+        virtual size_t write(uint8_t c);
+        size_t write(const char *str);
+        size_t write(const uint8_t *buffer, size_t size);
+
+        /* Host only: wire the stream to a simulated radio */
+        void sim_connect(sim_xbee &xb) { radio = &xb; }
+        sim_xbee *sim_radio() const { return radio; }
+};
+
+#endif
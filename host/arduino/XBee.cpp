@@ -0,0 +1,46 @@
+#include "XBee.h"
+#include "sim_xbee.h"
+
+void XBee::send(XBeeRequest &request){
+        sim_xbee *radio = this->_serial ? this->_serial->sim_radio() : 0;
+
+        if(radio == 0){
+                return;
+        }
+
+        if(request.getApiId() == TX_16_REQUEST){
+                Tx16Request &tx = static_cast<Tx16Request &>(request);
+                radio->tx16(tx.getAddress16(), tx.getPayload(), tx.getPayloadLength());
+        }
+        else if(request.getApiId() == AT_COMMAND_REQUEST){
+                AtCommandRequest &at = static_cast<AtCommandRequest &>(request);
+                radio->at_command(at.getCommand(), at.getCommandValue(), at.getCommandValueLength());
+        }
+}
+
+void XBee::readPacket(){
+        sim_xbee *radio = this->_serial ? this->_serial->sim_radio() : 0;
+        sim_api_frame f;
+
+        this->_response._available = false;
+        if(radio == 0 || !radio->next_frame(f)){
+                return;
+        }
+
+        /* oversized frames would not fit the library's buffer either */
+        if(f.data.size() > MAX_FRAME_DATA_SIZE){
+                return;
+        }
+
+        if(!f.data.empty()){
+                memcpy(this->_buffer, f.data.data(), f.data.size());
+        }
+        this->_response._apiId      = f.api_id;
+        this->_response._available  = true;
+        this->_response._src16      = f.src;
+        this->_response._command[0] = f.cmd[0];
+        this->_response._command[1] = f.cmd[1];
+        this->_response._status     = f.status;
+        this->_response._data       = this->_buffer;
+        this->_response._dataLength = f.data.size();
+}
@@ -0,0 +1,117 @@
+#ifndef _host_xbee_h_
+#define _host_xbee_h_
+
+/* Host stand-in for the subset of the xbee-arduino library used by rtrans.
+   Requests are handed to the simulated module behind the serial stream
+   directly instead of being framed and escaped on the byte stream.
+*/
+
+#include "Arduino.h"
+
+#define TX_16_REQUEST           (0x01)
+#define AT_COMMAND_REQUEST      (0x08)
+#define RX_16_RESPONSE          (0x81)
+#define AT_COMMAND_RESPONSE     (0x88)
+
+#define MAX_FRAME_DATA_SIZE     (110)
+
+class XBeeRequest {
+
+private:
+        uint8_t _apiId;
+
+public:
+        XBeeRequest(uint8_t apiId) : _apiId(apiId) {}
+        uint8_t getApiId() const { return _apiId; }
+};
+
+class Tx16Request : public XBeeRequest {
+
+private:
+        uint16_t _addr16;
+        uint8_t  *_payload;
+        uint8_t  _payloadLength;
+
+public:
+        Tx16Request(uint16_t addr16, uint8_t *data, uint8_t dataLength)
+                : XBeeRequest(TX_16_REQUEST), _addr16(addr16), _payload(data), _payloadLength(dataLength) {}
+        uint16_t getAddress16() const { return _addr16; }
+        uint8_t *getPayload() const { return _payload; }
+        uint8_t getPayloadLength() const { return _payloadLength; }
+};
+
+class AtCommandRequest : public XBeeRequest {
+
+private:
+        uint8_t *_command;
+        uint8_t *_commandValue;
+        uint8_t _commandValueLength;
+
+public:
+        AtCommandRequest(uint8_t *command)
+                : XBeeRequest(AT_COMMAND_REQUEST), _command(command), _commandValue(0), _commandValueLength(0) {}
+        AtCommandRequest(uint8_t *command, uint8_t *commandValue, uint8_t commandValueLength)
+                : XBeeRequest(AT_COMMAND_REQUEST), _command(command), _commandValue(commandValue),
+                  _commandValueLength(commandValueLength) {}
+        uint8_t *getCommand() const { return _command; }
+        uint8_t *getCommandValue() const { return _commandValue; }
+        uint8_t getCommandValueLength() const { return _commandValueLength; }
+};
+
+class XBeeResponse {
+
+protected:
+        uint8_t  _apiId;
+        bool     _available;
+        uint16_t _src16;
+        uint8_t  _command[2];
+        uint8_t  _status;
+        uint8_t  *_data;
+        uint8_t  _dataLength;
+
+public:
+        XBeeResponse() : _apiId(0), _available(false), _src16(0), _status(0), _data(0), _dataLength(0) {}
+        uint8_t getApiId() const { return _apiId; }
+        bool isAvailable() const { return _available; }
+        void getRx16Response(XBeeResponse &response) const { response = *this; }
+        void getAtCommandResponse(XBeeResponse &response) const { response = *this; }
+
+        friend class XBee;
+};
+
+class Rx16Response : public XBeeResponse {
+
+public:
+        uint16_t getRemoteAddress16() const { return _src16; }
+        uint8_t *getData() const { return _data; }
+        uint8_t getData(int index) const { return _data[index]; }
+        uint8_t getDataLength() const { return _dataLength; }
+};
+
+class AtCommandResponse : public XBeeResponse {
+
+public:
+        uint8_t *getCommand() { return _command; }
+        uint8_t getStatus() const { return _status; }
+        uint8_t *getValue() const { return _data; }
+        uint8_t getValueLength() const { return _dataLength; }
+        bool isOk() const { return _status == 0; }
+};
+
+class XBee {
+
+private:
+        Stream       *_serial;
+        XBeeResponse _response;
+        uint8_t      _buffer[MAX_FRAME_DATA_SIZE];
+
+public:
+        XBee() : _serial(0) {}
+        void setSerial(Stream &serial) { _serial = &serial; }
+        void begin(Stream &serial) { _serial = &serial; }
+        void send(XBeeRequest &request);
+        void readPacket();
+        XBeeResponse &getResponse() { return _response; }
+};
+
+#endif
@@ -0,0 +1,42 @@
+#include "Arduino.h"
+#include "sim_clock.h"
+#include "sim_xbee.h"
+
+unsigned long millis(){
+        return (uint32_t) (sim_local_us() / 1000);
+}
+
+unsigned long micros(){
+        return (uint32_t) sim_local_us();
+}
+
+void delay(unsigned long ms){
+        sim_advance(ms);
+}
+
+int Stream::available(){
+        return this->radio ? this->radio->uart_available() : 0;
+}
+
+int Stream::read(){
+        return this->radio ? this->radio->uart_read() : -1;
+}
+
+size_t Stream::write(uint8_t c){
+        if(this->radio){
+                this->radio->uart_write(c);
+        }
+        return 1;
+}
+
+size_t Stream::write(const char *str){
+        return write((const uint8_t *) str, strlen(str));
+}
+
+size_t Stream::write(const uint8_t *buffer, size_t size){
+        size_t i;
+        for(i = 0; i < size; i++){
+                write(buffer[i]);
+        }
+        return size;
+}
@@ -0,0 +1,39 @@
+#include "rt_uart.h"
+#include "sim_xbee.h"
+
+/* Host build of the hardware UART stream: the bytes go to the simulated
+   radio as with any Stream, which is told the rate the port is at. */
+
+void rt_uart::begin(uint32_t baud){
+        this->rate = baud;
+        if(this->radio){
+                this->radio->set_host_baud(baud);
+        }
+}
+
+void rt_uart::end(){
+        this->rate = 0;
+}
+
+int rt_uart::available(){
+        return Stream::available();
+}
+
+int rt_uart::read(){
+        return Stream::read();
+}
+
+int rt_uart::peek(){
+        return this->radio ? this->radio->uart_peek() : -1;
+}
+
+size_t rt_uart::write(uint8_t c){
+        return Stream::write(c);
+}
+
+void rt_uart::flush(){
+}
+
+uint16_t rt_uart::overruns() const{
+        return 0;
+}
@@ -0,0 +1,186 @@
+/* Alarm latency benchmark: a slave keeps its transmit queue full of
+   multi-segment DATA packages and raises an ERR every second; the master
+   stand-in records how long each alarm took from the sketch's first
+   rt_send() attempt to its delivery. Runs with the urgent queue of the
+   default configuration and with ERR queued behind the DATA (tx_urgent 0),
+   over a sweep of loss rates and baud rates.
+
+   Usage: rtrans_alarm_bench [seconds] [seed]
+*/
+
+#include "rtrans.h"
+#include "SoftwareSerial.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_xbee.h"
+#include "sim_master.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define MASTER_ADDR     (0xc088)
+#define SLAVE_SERIAL    (0x40a1b2c3)
+#define PROBE_INTERVAL  (500)
+#define JOIN_TIMEOUT    (30000)
+#define ALARM_INTERVAL  (1000)
+#define DATA_SEGMENTS   (3)
+
+/* ERR queued with the DATA, as before there were transmit classes */
+struct fifo_config : rt_default_config {
+    static const size_t   tx_urgent    = 0;
+};
+
+/* Payload of an alarm */
+typedef struct __attribute__ ((__packed__)) alarm_s {
+    uint32_t id;
+    uint32_t raised;    // sim time of the first rt_send() attempt
+} alarm;
+
+/* Everything measured during a run */
+typedef struct alarm_run_s {
+    bool                  joined;
+    bool                  slave_joined;
+    uint16_t              master_addr;
+    std::vector<bool>     seen;        // alarm id has been delivered
+    std::vector<uint64_t> latency;     // per delivered alarm
+    unsigned long         data_bytes;  // DATA payload delivered
+    unsigned long         data_packages;
+} alarm_run;
+
+static alarm_run *run_ctx;
+
+static void slave_callback(rt_in_header *header, uint8_t payload[]){
+        (void) payload;
+        if(header->type == RTRANS_TYPE_PROBE && !run_ctx->slave_joined){
+                run_ctx->slave_joined = true;
+                run_ctx->master_addr = header->master;
+        }
+}
+
+static void master_callback(void *ctx, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        alarm_run *r = (alarm_run *) ctx;
+        alarm a;
+        (void) slave;
+
+        if(type == RTRANS_TYPE_JOIN){
+                r->joined = true;
+        }
+        else if(type == RTRANS_TYPE_DATA){
+                r->data_bytes += len;
+                r->data_packages++;
+        }
+        else if(type == RTRANS_TYPE_ERR && len == sizeof(alarm)){
+                memcpy(&a, payload, sizeof(a));
+                if(a.id < r->seen.size() && !r->seen[a.id]){
+                        r->seen[a.id] = true;
+                        r->latency.push_back(sim_now() - a.raised);
+                }
+        }
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, unsigned p){
+        if(sorted.empty()){
+                return 0;
+        }
+        return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+/** Bring the slave up and joined, then load it for the given time */
+template <class CFG>
+static bool run(const char *name, sim_link_cfg link, uint64_t duration){
+        static uint8_t data[DATA_SEGMENTS * rt_basic_state<CFG>::payload_size];
+        alarm_run r;
+        alarm pending;
+        bool raised = false, join_sent = false;
+        uint64_t start, next_alarm;
+
+        sim_reset(0);
+        sim_channel channel(link);
+        sim_xbee radio(channel, SLAVE_SERIAL);
+        SoftwareSerial xs(6, 7);
+        xs.sim_connect(radio);
+
+        r.joined = false;
+        r.slave_joined = false;
+        r.data_bytes = 0;
+        r.data_packages = 0;
+        run_ctx = &r;
+        rt_basic_state<CFG> state(xs, slave_callback);
+        sim_master m(channel, MASTER_ADDR, master_callback, &r);
+        memset(data, 0x5a, sizeof(data));
+
+        /* come up and join */
+        state.rt_init(true);
+        while(!r.joined && sim_now() < JOIN_TIMEOUT){
+                state.rt_loop();
+                if(r.slave_joined && !join_sent){
+                        state.rt_join(r.master_addr);
+                        join_sent = true;
+                }
+                m.loop();
+                if(!r.joined && sim_now() % PROBE_INTERVAL == 0){
+                        m.probe();
+                }
+                sim_advance(1);
+        }
+        if(!r.joined){
+                fprintf(stderr, "%s: slave did not join\n", name);
+                return false;
+        }
+
+        /* keep the transmit queue full and raise an alarm every interval */
+        start = sim_now();
+        next_alarm = start + ALARM_INTERVAL / 2;
+        pending.id = 0;
+        while(sim_now() < start + duration){
+                if(!raised && sim_now() >= next_alarm){
+                        pending.raised = sim_now();
+                        r.seen.push_back(false);
+                        raised = true;
+                        next_alarm += ALARM_INTERVAL;
+                }
+                if(raised && state.rt_send(RTRANS_TYPE_ERR, (const uint8_t *) &pending, sizeof(pending)) > 0){
+                        pending.id++;
+                        raised = false;
+                }
+                while(state.rt_send(RTRANS_TYPE_DATA, data, sizeof(data)) > 0){
+                }
+                state.rt_loop();
+                m.loop();
+                sim_advance(1);
+        }
+
+        std::sort(r.latency.begin(), r.latency.end());
+        printf("%s,%u,%.3f,%zu,%zu,%llu,%llu,%llu,%llu,%lu,%.1f\n", name, link.baud, link.loss,
+               r.seen.size(), r.latency.size(),
+               (unsigned long long) percentile(r.latency, 50), (unsigned long long) percentile(r.latency, 90),
+               (unsigned long long) percentile(r.latency, 99), (unsigned long long) percentile(r.latency, 100),
+               r.data_packages, r.data_bytes * 1000.0 / duration);
+        return true;
+}
+
+int main(int argc, char *argv[]){
+        static const uint32_t bauds[] = { 9600, 115200 };
+        static const double losses[] = { 0.0, 0.05, 0.1, 0.2 };
+        uint64_t duration = (argc > 1) ? atoi(argv[1]) * 1000ULL : 120000;
+        sim_link_cfg link;
+        size_t b, l;
+        bool ok = true;
+
+        link.latency = 5;
+        link.jitter  = 0;
+        link.seed    = (argc > 2) ? atoi(argv[2]) : 1;
+
+        printf("queue,baud,loss,alarms,delivered,lat_p50_ms,lat_p90_ms,lat_p99_ms,lat_max_ms,data_packages,goodput_Bps\n");
+        for(b = 0; b < sizeof(bauds) / sizeof(bauds[0]); b++){
+                for(l = 0; l < sizeof(losses) / sizeof(losses[0]); l++){
+                        link.baud = bauds[b];
+                        link.loss = losses[l];
+                        ok &= run<fifo_config>("fifo", link, duration);
+                        ok &= run<rt_default_config>("urgent", link, duration);
+                }
+        }
+        return ok ? 0 : 1;
+}
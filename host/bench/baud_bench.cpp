@@ -0,0 +1,267 @@
+/* Serial rate benchmark: one slave on the hardware UART stream (rt_uart)
+   is brought up with rt_init(true, rate), which configures the radio from
+   transparent mode and raises its rate with ATBD, then polled back to back
+   by the master stand-in, whose coordinator stays at -M baud. Reports the
+   bring-up time, the rate both ends ended up at and the goodput, per rate
+   and package size. -w 1 starts from a radio still at the rate from an
+   earlier run, as after a reset of the MCU alone.
+
+   Usage: rtrans_baud_bench [-r baud,...] [-p payload,...] [-t seconds]
+                            [-l loss] [-M master_baud] [-w 0|1] [-S seed]
+*/
+
+#include "rtrans.h"
+#include "rt_uart.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_xbee.h"
+#include "sim_master.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define MASTER_ADDR     (0xc088)
+#define SLAVE_SERIAL    (0x40a1b2c3)
+#define POLL_RETX       (2000)
+#define PROBE_INTERVAL  (500)
+#define INIT_TIMEOUT    (60000)
+
+/* One point of the sweep */
+typedef struct bench_cfg_s {
+    uint32_t rate;          // rate the slave asks for
+    uint32_t master_baud;   // rate of the coordinator's serial line
+    size_t   payload;
+    double   loss;
+    uint32_t seed;
+    uint64_t duration;
+    bool     warm;          // the radio is already at rate
+} bench_cfg;
+
+/* Everything measured during a run */
+typedef struct bench_run_s {
+    const bench_cfg       *cfg;
+    rt_state              *slave;
+    sim_master            *master;
+    uint16_t              slave_addr;
+    bool                  joined;
+    uint64_t              last_poll;
+    uint64_t              sent_at;
+    uint32_t              next_id;
+    std::vector<uint8_t>  payload;
+    std::vector<uint64_t> latency;
+    unsigned long         delivered;
+    uint64_t              init_ms;     // rt_init() to RTRANS_STATUS_READY
+    uint8_t               status;
+    uint32_t              radio_baud;
+    uint32_t              host_baud;
+} bench_run;
+
+static bench_run *run_ctx;
+
+static void slave_callback(rt_in_header *header, uint8_t payload[]){
+        bench_run *r = run_ctx;
+        (void) payload;
+
+        if(header->type == RTRANS_TYPE_PROBE){
+                r->slave->rt_join(header->master);
+        }
+        else if(header->type == RTRANS_TYPE_POLL){
+                memcpy(r->payload.data(), &r->next_id, sizeof(r->next_id));
+                if(r->slave->rt_send(RTRANS_TYPE_DATA, r->payload.data(), r->payload.size()) > 0){
+                        r->sent_at = sim_now();
+                        r->next_id++;
+                }
+        }
+}
+
+static void master_callback(void *ctx, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        bench_run *r = (bench_run *) ctx;
+        uint32_t id;
+
+        if(type == RTRANS_TYPE_JOIN){
+                r->joined = true;
+                r->slave_addr = slave;
+                return;
+        }
+        if(type != RTRANS_TYPE_DATA || len != r->payload.size()){
+                return;
+        }
+        memcpy(&id, payload, sizeof(id));
+        if(id + 1 != r->next_id){
+                return;
+        }
+        r->delivered++;
+        r->latency.push_back(sim_now() - r->sent_at);
+        r->last_poll = sim_now();
+        r->master->poll(slave);
+}
+
+static bool run(const bench_cfg &cfg, bench_run &r){
+        sim_link_cfg link;
+        uint64_t start, end;
+
+        link.loss    = cfg.loss;
+        link.latency = 5;
+        link.jitter  = 0;
+        link.baud    = XBEE_DEFAULT_BAUD;
+        link.seed    = cfg.seed;
+
+        sim_channel channel(link);
+        sim_master master(channel, MASTER_ADDR, master_callback, &r);
+        sim_xbee radio(channel, SLAVE_SERIAL);
+        rt_uart xs;
+        channel.set_baud(master.channel_port(), cfg.master_baud);
+        if(cfg.warm){
+                radio.set_uart_baud(cfg.rate);
+        }
+        xs.sim_connect(radio);
+        xs.begin(XBEE_DEFAULT_BAUD);
+        rt_state slave(xs, slave_callback);
+
+        r.cfg    = &cfg;
+        r.slave  = &slave;
+        r.master = &master;
+        r.payload.assign(cfg.payload, 0);
+        for(size_t i = sizeof(uint32_t); i < cfg.payload; i++){
+                r.payload[i] = i;
+        }
+        run_ctx = &r;
+
+        /* bring-up, then join */
+        start = sim_now();
+        slave.rt_init(true, cfg.rate);
+        while(slave.rt_status() != RTRANS_STATUS_READY && slave.rt_status() != RTRANS_STATUS_FAILED &&
+              sim_now() - start < INIT_TIMEOUT){
+                slave.rt_loop();
+                sim_advance(1);
+        }
+        r.init_ms    = sim_now() - start;
+        r.status     = slave.rt_status();
+        r.radio_baud = radio.uart_baud();
+        r.host_baud  = xs.baud();
+        if(r.status != RTRANS_STATUS_READY){
+                return false;
+        }
+        start = sim_now();
+        while(!r.joined){
+                if(sim_now() - start > INIT_TIMEOUT){
+                        return false;
+                }
+                if(sim_now() % PROBE_INTERVAL == 0){
+                        master.probe();
+                }
+                slave.rt_loop();
+                master.loop();
+                sim_advance(1);
+        }
+
+        /* measure back-to-back polling */
+        r.last_poll = sim_now();
+        master.poll(r.slave_addr);
+        end = sim_now() + cfg.duration;
+        while(sim_now() < end){
+                slave.rt_loop();
+                master.loop();
+                if(sim_now() - r.last_poll >= POLL_RETX){
+                        r.last_poll = sim_now();
+                        master.poll(r.slave_addr);
+                }
+                sim_advance(1);
+        }
+        return true;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, unsigned p){
+        if(sorted.empty()){
+                return 0;
+        }
+        return sorted[(sorted.size() - 1) * p / 100];
+}
+
+/** Parse a comma separated list of numbers */
+static std::vector<double> parse_list(const char *arg){
+        std::vector<double> v;
+        char *end;
+        while(*arg){
+                v.push_back(strtod(arg, &end));
+                if(end == arg){
+                        break;
+                }
+                arg = (*end == ',') ? end + 1 : end;
+        }
+        return v;
+}
+
+int main(int argc, char *argv[]){
+        std::vector<double> rates, payloads;
+        bench_cfg cfg;
+        size_t a, b;
+        int i;
+
+        rates.push_back(9600);
+        rates.push_back(19200);
+        rates.push_back(57600);
+        rates.push_back(115200);
+        payloads.push_back(12);
+        payloads.push_back(RTRANS_PAYLOAD_SIZE);
+        payloads.push_back(3 * RTRANS_PAYLOAD_SIZE);
+
+        cfg.master_baud = 115200;
+        cfg.loss     = 0.0;
+        cfg.seed     = 1;
+        cfg.duration = 60000;
+        cfg.warm     = false;
+
+        for(i = 1; i + 1 < argc; i += 2){
+                if(strcmp(argv[i], "-r") == 0){
+                        rates = parse_list(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-p") == 0){
+                        payloads = parse_list(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-t") == 0){
+                        cfg.duration = atof(argv[i + 1]) * 1000;
+                }
+                else if(strcmp(argv[i], "-l") == 0){
+                        cfg.loss = atof(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-M") == 0){
+                        cfg.master_baud = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-w") == 0){
+                        cfg.warm = atoi(argv[i + 1]) != 0;
+                }
+                else if(strcmp(argv[i], "-S") == 0){
+                        cfg.seed = atoi(argv[i + 1]);
+                }
+                else{
+                        break;
+                }
+        }
+        if(i < argc){
+                fprintf(stderr, "usage: %s [-r baud,...] [-p payload,...] [-t seconds] [-l loss]"
+                        " [-M master_baud] [-w 0|1] [-S seed]\n", argv[0]);
+                return 2;
+        }
+
+        printf("baud,warm,payload,ready,init_ms,radio_baud,host_baud,packages,goodput_Bps,latency_p50,latency_p99\n");
+        for(a = 0; a < rates.size(); a++){
+                for(b = 0; b < payloads.size(); b++){
+                        bench_run r = bench_run();
+                        bool ok;
+
+                        cfg.rate    = rates[a];
+                        cfg.payload = payloads[b];
+                        sim_reset(0);
+                        ok = run(cfg, r);
+                        std::sort(r.latency.begin(), r.latency.end());
+                        printf("%u,%d,%zu,%d,%llu,%u,%u,%lu,%.1f,%llu,%llu\n",
+                               cfg.rate, cfg.warm ? 1 : 0, cfg.payload, ok ? 1 : 0, (unsigned long long) r.init_ms,
+                               r.radio_baud, r.host_baud, r.delivered, r.delivered * cfg.payload / (cfg.duration / 1000.0),
+                               (unsigned long long) percentile(r.latency, 50), (unsigned long long) percentile(r.latency, 99));
+                }
+        }
+        return 0;
+}
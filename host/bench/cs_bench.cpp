@@ -0,0 +1,195 @@
+/* Checksum micro-benchmark: throughput of the 8-bit additive checksum and
+   the CRC-16 kernels over frame-sized buffers, the fused copy+checksum used
+   when building and reading frames against a memcpy followed by a second
+   pass, and how many corrupted frames each checksum fails to detect.
+
+   Usage: rtrans_cs_bench [iterations]
+*/
+
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#define FRAME_SIZE      (100)
+
+/* Bit-at-a-time CRC-16, the reference for the table-driven kernels */
+__attribute__((noinline)) static uint16_t crc16_bitwise(uint16_t crc, const uint8_t *data, size_t n){
+        size_t i;
+        int b;
+        for(i = 0; i < n; i++){
+                crc ^= data[i] << 8;
+                for(b = 0; b < 8; b++){
+                        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+                }
+        }
+        return crc;
+}
+
+typedef enum { K_SUM8, K_CRC_BITWISE, K_CRC_NIBBLE, K_CRC_TABLE, K_COUNT } bench_kernel;
+
+static const char *kernel_name[] = { "sum8", "crc16_bitwise", "crc16_nibble", "crc16_table" };
+
+static uint16_t kernel(bench_kernel k, const uint8_t *data, size_t n){
+        switch(k){
+                case K_SUM8:        return cs_sum8(0, data, n);
+                case K_CRC_BITWISE: return crc16_bitwise(CS_CRC16_INIT, data, n);
+                case K_CRC_NIBBLE:  return cs_crc16_nibble(CS_CRC16_INIT, data, n);
+                case K_CRC_TABLE:   return cs_crc16_table(CS_CRC16_INIT, data, n);
+                default:            return 0;
+        }
+}
+
+/** Returns ns per byte of checksumming n bytes, iters times */
+static double run_kernel(bench_kernel k, const uint8_t *data, size_t n, unsigned long iters, unsigned long *sum){
+        unsigned long it;
+
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for(it = 0; it < iters; it++){
+                *sum += kernel(k, data + (it & 7), n);
+        }
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(t1 - t0).count() / ((double) iters * n);
+}
+
+/** Returns ns per byte of copying n bytes and checksumming them, either in
+    one pass or as memcpy plus a second pass over the copy
+*/
+static double run_copy(bool crc, bool fused, const uint8_t *data, size_t n, unsigned long iters, unsigned long *sum){
+        uint8_t dst[FRAME_SIZE + 8];
+        unsigned long it;
+
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for(it = 0; it < iters; it++){
+                const uint8_t *src = data + (it & 7);
+                if(fused){
+                        *sum += crc ? cs_crc16_copy(CS_CRC16_INIT, dst, src, n) : cs_sum8_copy(0, dst, src, n);
+                }
+                else{
+                        memcpy(dst, src, n);
+                        *sum += crc ? cs_crc16(CS_CRC16_INIT, dst, n) : cs_sum8(0, dst, n);
+                }
+        }
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(t1 - t0).count() / ((double) iters * n);
+}
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(){
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        return rng_state;
+}
+
+typedef enum { E_SWAP, E_TWO_BITS, E_BURST, E_COUNT } bench_error;
+
+static const char *error_name[] = { "byte_swap", "two_bit_flips", "burst_16" };
+
+/** Corrupt the frame in place; returns false if the corruption happened to
+    leave it unchanged
+*/
+static bool corrupt(bench_error e, uint8_t *f, size_t n){
+        size_t a = rng() % n, b;
+        uint8_t t;
+
+        switch(e){
+                case E_SWAP:
+                        b = (a + 1 + rng() % (n - 1)) % n;
+                        if(f[a] == f[b]){
+                                return false;
+                        }
+                        t = f[a];
+                        f[a] = f[b];
+                        f[b] = t;
+                        return true;
+                case E_TWO_BITS:
+                        a = rng() % (n * 8);
+                        b = (a + 1 + rng() % (n * 8 - 1)) % (n * 8);
+                        f[a / 8] ^= 1 << (a % 8);
+                        f[b / 8] ^= 1 << (b % 8);
+                        return true;
+                case E_BURST: {
+                        /* up to 16 bits, first and last flipped */
+                        size_t bit = rng() % (n * 8 - 15), len = 2 + rng() % 15, i;
+                        uint32_t pattern = (1u << (len - 1)) | 1u | (rng() & ((1u << len) - 1));
+                        for(i = 0; i < len; i++){
+                                if(pattern & (1u << i)){
+                                        f[(bit + i) / 8] ^= 1 << ((bit + i) % 8);
+                                }
+                        }
+                        return true;
+                }
+                default:
+                        return false;
+        }
+}
+
+/** Count corruptions of random frames which leave the checksum unchanged */
+static unsigned long undetected(bool crc, bench_error e, unsigned long trials){
+        uint8_t f[FRAME_SIZE];
+        unsigned long t, missed = 0;
+        size_t i;
+
+        for(t = 0; t < trials; t++){
+                uint16_t before, after;
+                for(i = 0; i < FRAME_SIZE; i++){
+                        f[i] = rng();
+                }
+                before = crc ? cs_crc16(CS_CRC16_INIT, f, FRAME_SIZE) : cs_sum8(0, f, FRAME_SIZE);
+                if(!corrupt(e, f, FRAME_SIZE)){
+                        --t;
+                        continue;
+                }
+                after = crc ? cs_crc16(CS_CRC16_INIT, f, FRAME_SIZE) : cs_sum8(0, f, FRAME_SIZE);
+                missed += before == after;
+        }
+        return missed;
+}
+
+int main(int argc, char *argv[]){
+        static const size_t sizes[] = { 12, 100 };
+        static const uint8_t check[] = "123456789";
+        unsigned long iters = (argc > 1) ? strtoul(argv[1], 0, 10) : 2000000;
+        uint8_t data[FRAME_SIZE + 8];
+        size_t s, i;
+        int k;
+
+        for(i = 0; i < sizeof(data); i++){
+                data[i] = i * 31 + 7;
+        }
+
+        /* every CRC kernel must agree with the reference */
+        for(k = K_CRC_BITWISE; k < K_COUNT; k++){
+                if(kernel((bench_kernel) k, check, 9) != 0x29b1 ||
+                   kernel((bench_kernel) k, data, sizeof(data)) != crc16_bitwise(CS_CRC16_INIT, data, sizeof(data))){
+                        fprintf(stderr, "%s gives the wrong CRC\n", kernel_name[k]);
+                        return 1;
+                }
+        }
+
+        printf("test,bytes,variant,ns_per_byte,MB_per_s\n");
+        for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+                for(k = K_SUM8; k < K_COUNT; k++){
+                        unsigned long sum = 0;
+                        double ns = run_kernel((bench_kernel) k, data, sizes[s], iters, &sum);
+                        printf("kernel,%zu,%s,%.3f,%.1f\n", sizes[s], kernel_name[k], ns, 1000.0 / ns);
+                }
+                for(k = 0; k < 4; k++){
+                        unsigned long sum = 0;
+                        bool crc = k & 2, fused = k & 1;
+                        double ns = run_copy(crc, fused, data, sizes[s], iters, &sum);
+                        printf("copy,%zu,%s_%s,%.3f,%.1f\n", sizes[s], crc ? "crc16" : "sum8",
+                               fused ? "fused" : "two_pass", ns, 1000.0 / ns);
+                }
+        }
+
+        printf("\nerror,checksum,trials,undetected\n");
+        for(k = E_SWAP; k < E_COUNT; k++){
+                unsigned long trials = 100000;
+                printf("%s,sum8,%lu,%lu\n", error_name[k], trials, undetected(false, (bench_error) k, trials));
+                printf("%s,crc16,%lu,%lu\n", error_name[k], trials, undetected(true, (bench_error) k, trials));
+        }
+        return 0;
+}
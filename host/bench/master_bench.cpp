@@ -0,0 +1,340 @@
+/* Native master benchmark: one rt_master drives many slave rt_states over
+   the simulated link, talking to its coordinator radio through a real
+   socketpair in XBee API frames. With -w 0 every slave is polled again as
+   soon as its data is in, as master/main.py does; otherwise the slaves are
+   handed to the master's poll scheduler with that many polls outstanding,
+   budgeted at -a percent of the baud rate.
+
+   Usage: rtrans_master_bench [-n nodes,...] [-w window,...] [-t seconds]
+                              [-l loss] [-p payload] [-b baud] [-a airtime]
+                              [-S seed] [-T trace_file]
+
+   Reports per node count and window the packages delivered, the time
+   between two packages of a node, the collection cycle time (until every
+   node delivered once more), how evenly the nodes were served and the
+   host CPU time the master spent per frame from the coordinator, and the
+   frames either way per package delivered. -T traces the master's frames
+   of the last run for rtrans_replay.
+*/
+
+#include "rtrans.h"
+#include "SoftwareSerial.h"
+#include "rt_master.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_coordinator.h"
+#include "sim_xbee.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#define MASTER_ADDR     (0xc088)
+#define SLAVE_SERIAL    (0x40a11000)
+#define JOIN_TIME       (10000)
+
+/* One simulated slave */
+typedef struct bench_node_s {
+    sim_xbee       *radio;
+    SoftwareSerial *xs;
+    rt_state       *state;
+    bool           slave_joined;    // slave side: JOIN sent
+    bool           joined;
+    uint64_t       last;        // master side: time of the last package, or of the join
+    unsigned long  packages;    // master side: packages delivered
+    unsigned       cycle;       // master side: last cycle the node delivered in
+} bench_node;
+
+/* Everything measured during a run */
+typedef struct bench_run_s {
+    size_t                  payload;
+    unsigned                window;     // 0 to poll each node back to back
+    std::vector<bench_node> nodes;
+    std::vector<int>        by_addr;    // slave address to node number + 1
+    rt_master               *master;
+    unsigned long           joined;
+    unsigned long           delivered;
+    std::vector<uint64_t>   latency;    // between two packages of a node, ms
+    std::vector<uint64_t>   cycles;     // collection cycle times, ms
+    unsigned                cycle;
+    unsigned long           cycle_left; // nodes yet to deliver this cycle
+    uint64_t                cycle_start;
+    bool                    measuring;
+    unsigned                current;    // slave whose rt_loop is running
+} bench_run;
+
+static bench_run *run_ctx;
+static const char *trace_path;
+
+static uint64_t bench_clock(){
+        return sim_now();
+}
+
+/** Slave application: join on the first probe, answer polls with a
+    package, as example/trans_example.ino. PROBE is broadcast, so the slave
+    is the one being run rather than the addressee.
+*/
+static void slave_callback(rt_in_header *header, uint8_t payload[]){
+        bench_run *r = run_ctx;
+        unsigned i = r->current;
+        uint8_t data[RTRANS_MAX_SEGMENTS * RTRANS_PAYLOAD_SIZE];
+        (void) payload;
+
+        if(header->type == RTRANS_TYPE_PROBE && !r->nodes[i].slave_joined){
+                r->nodes[i].slave_joined = true;
+                r->nodes[i].state->rt_join(header->master);
+        }
+        else if(header->type == RTRANS_TYPE_POLL){
+                memset(data, i, r->payload);
+                r->nodes[i].state->rt_send(RTRANS_TYPE_DATA, data, r->payload);
+        }
+}
+
+/** Master application: poll or schedule every slave which joined; without
+    the scheduler, poll again after its data
+*/
+static void master_callback(void *ctx, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        bench_run *r = (bench_run *) ctx;
+        int i = r->by_addr[slave] - 1;
+        (void) payload;
+
+        if(i < 0){
+                return;
+        }
+        bench_node &n = r->nodes[i];
+        if(type == RTRANS_TYPE_JOIN){
+                if(n.joined){
+                        return;
+                }
+                n.joined = true;
+                r->joined++;
+                if(r->window > 0){
+                        n.last = sim_now();
+                        r->master->schedule(slave);
+                        return;
+                }
+        }
+        else if(type == RTRANS_TYPE_DATA && len == r->payload){
+                if(r->measuring){
+                        r->latency.push_back(sim_now() - n.last);
+                        r->delivered++;
+                        n.packages++;
+                        if(n.cycle != r->cycle){
+                                n.cycle = r->cycle;
+                                if(--r->cycle_left == 0){
+                                        r->cycles.push_back(sim_now() - r->cycle_start);
+                                        r->cycle++;
+                                        r->cycle_left  = r->joined;
+                                        r->cycle_start = sim_now();
+                                }
+                        }
+                }
+                n.last = sim_now();
+                if(r->window > 0){
+                        return;
+                }
+        }
+        else{
+                return;
+        }
+        n.last = sim_now();
+        r->master->poll(slave);
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, unsigned p){
+        if(sorted.empty()){
+                return 0;
+        }
+        return sorted[(sorted.size() - 1) * p / 100];
+}
+
+static void run(unsigned count, unsigned window, const sim_link_cfg &link, size_t payload,
+                unsigned airtime, uint64_t duration){
+        bench_run r = bench_run();
+        rt_master_config mcfg;
+        rt_master_stats before = rt_master_stats();
+        uint64_t end, t;
+        double master_ns = 0.0;
+        unsigned long least = ~0UL, most = 0;
+        int sv[2];
+        unsigned i;
+
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0){
+                perror("socketpair");
+                exit(1);
+        }
+        sim_reset(0);
+        sim_channel channel(link);
+        sim_coordinator coord(channel, MASTER_ADDR, sv[1], false);
+
+        rt_master_config_init(&mcfg, MASTER_ADDR);
+        mcfg.max_nodes   = count;
+        mcfg.clock       = bench_clock;
+        mcfg.poll_window = window;
+        mcfg.baud        = airtime ? link.baud : 0;
+        mcfg.airtime     = airtime;
+        if(trace_path && (mcfg.trace = fopen(trace_path, "wb")) == 0){
+                perror(trace_path);
+                exit(1);
+        }
+        rt_master master(sv[0], mcfg, master_callback, &r);
+
+        r.payload = payload;
+        r.window  = window;
+        r.master  = &master;
+        r.by_addr.assign(0x10000, 0);
+        r.nodes.resize(count);
+        run_ctx = &r;
+        for(i = 0; i < count; i++){
+                bench_node &n = r.nodes[i];
+                n.radio = new sim_xbee(channel, SLAVE_SERIAL + i);
+                n.xs    = new SoftwareSerial(6, 7);
+                n.xs->sim_connect(*n.radio);
+                n.state = new rt_state(*n.xs, slave_callback);
+                r.by_addr[(SLAVE_SERIAL + i) & 0xffff] = i + 1;
+                n.state->rt_init();
+        }
+
+        /* join, then measure polling */
+        master.probe(JOIN_TIME / 2);
+        end = JOIN_TIME + duration;
+        for(t = 0; t < end; t++){
+                if(t == JOIN_TIME){
+                        r.measuring   = true;
+                        r.cycle       = 1;
+                        r.cycle_left  = r.joined;
+                        r.cycle_start = t;
+                        before = master.statistics();
+                        master_ns = 0.0;
+                }
+                for(i = 0; i < count; i++){
+                        r.current = i;
+                        r.nodes[i].state->rt_loop();
+                }
+                coord.loop();
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                master.loop(0);
+                master_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+                sim_advance(1);
+        }
+
+        const rt_master_stats &s = master.statistics();
+        unsigned long frames = s.rx_frames - before.rx_frames;
+        unsigned long tx = s.tx_frames - before.tx_frames;
+        for(i = 0; i < count; i++){
+                least = std::min(least, r.nodes[i].packages);
+                most  = std::max(most, r.nodes[i].packages);
+        }
+        std::sort(r.latency.begin(), r.latency.end());
+        std::sort(r.cycles.begin(), r.cycles.end());
+        printf("%u,%u,%lu,%lu,%.1f,%llu,%llu,%llu,%zu,%llu,%llu,%lu,%lu,%lu,%lu,%lu,%lu,%.2f,%lu,%.2f\n",
+               count, window, r.joined, r.delivered, r.delivered * payload / (duration / 1000.0),
+               (unsigned long long) percentile(r.latency, 50), (unsigned long long) percentile(r.latency, 99),
+               (unsigned long long) percentile(r.latency, 100), r.cycles.size(),
+               (unsigned long long) percentile(r.cycles, 50), (unsigned long long) percentile(r.cycles, 100),
+               least, most, s.polls - before.polls, s.timeouts - before.timeouts, frames,
+               s.tx_dropped - before.tx_dropped, frames ? master_ns / frames / 1000.0 : 0.0,
+               tx, r.delivered ? (double) (frames + tx) / r.delivered : 0.0);
+        fflush(stdout);
+
+        for(i = 0; i < count; i++){
+                delete r.nodes[i].state;
+                delete r.nodes[i].xs;
+                delete r.nodes[i].radio;
+        }
+        if(mcfg.trace){
+                fclose(mcfg.trace);
+        }
+        close(sv[0]);
+        close(sv[1]);
+}
+
+int main(int argc, char *argv[]){
+        std::vector<unsigned> counts, windows;
+        sim_link_cfg link;
+        size_t payload = 12;
+        uint64_t duration = 30000;
+        unsigned airtime = RT_MASTER_AIRTIME;
+        const char *list = "10,100,1000", *wlist = "0";
+        int i;
+
+        link.loss    = 0.0;
+        link.latency = 5;
+        link.jitter  = 0;
+        link.baud    = 115200;
+        link.seed    = 1;
+
+        for(i = 1; i + 1 < argc; i += 2){
+                if(strcmp(argv[i], "-n") == 0){
+                        list = argv[i + 1];
+                }
+                else if(strcmp(argv[i], "-w") == 0){
+                        wlist = argv[i + 1];
+                }
+                else if(strcmp(argv[i], "-a") == 0){
+                        airtime = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-t") == 0){
+                        duration = atof(argv[i + 1]) * 1000;
+                }
+                else if(strcmp(argv[i], "-l") == 0){
+                        link.loss = atof(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-p") == 0){
+                        payload = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-b") == 0){
+                        link.baud = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-S") == 0){
+                        link.seed = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-T") == 0){
+                        trace_path = argv[i + 1];
+                }
+                else{
+                        break;
+                }
+        }
+        if(i < argc || payload == 0 || payload > RTRANS_MAX_SEGMENTS * RTRANS_PAYLOAD_SIZE){
+                fprintf(stderr, "usage: %s [-n nodes,...] [-w window,...] [-t seconds] [-l loss] [-p payload] "
+                        "[-b baud] [-a airtime] [-S seed] [-T trace_file]\n", argv[0]);
+                return 2;
+        }
+        while(*list){
+                char *next;
+                unsigned n = strtoul(list, &next, 10);
+                if(next == list){
+                        break;
+                }
+                if(n > 0 && n < 0xf000){
+                        counts.push_back(n);
+                }
+                list = (*next == ',') ? next + 1 : next;
+        }
+        while(*wlist){
+                char *next;
+                unsigned w = strtoul(wlist, &next, 10);
+                if(next == wlist){
+                        break;
+                }
+                if(w < 256){
+                        windows.push_back(w);
+                }
+                wlist = (*next == ',') ? next + 1 : next;
+        }
+
+        printf("nodes,window,joined,packages,goodput_Bps,gap_p50_ms,gap_p99_ms,gap_max_ms,"
+               "cycles,cycle_p50_ms,cycle_max_ms,node_min,node_max,polls,timeouts,rx_frames,"
+               "tx_dropped,master_us_per_frame,tx_frames,frames_per_pkg\n");
+        for(size_t c = 0; c < counts.size(); c++){
+                for(size_t w = 0; w < windows.size(); w++){
+                        run(counts[c], windows[w], link, payload, airtime, duration);
+                }
+        }
+        return 0;
+}
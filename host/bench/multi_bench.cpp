@@ -0,0 +1,365 @@
+/* Multi-coordinator master load test: an rt_multi_master drives several
+   coordinators, each with its own simulated link and slaves, in real time,
+   while the application callback takes a given time over every package.
+   The slaves and radios run on the main thread with the simulated clock
+   kept in step with the wall clock; the master runs its I/O and worker
+   threads on the monotonic clock, over a socketpair per coordinator.
+
+   Usage: rtrans_multi_bench [-c coordinators] [-n nodes] [-k callback_ms,...]
+                             [-w workers,...] [-t seconds] [-p payload] [-b baud]
+                             [-q queue_bytes]
+
+   Reports per number of workers and callback time the packages delivered,
+   how long the slaves waited for the ACK of their DATA, from the segment
+   going out to the ACK going out, the DATA segments they sent again and
+   the times an I/O thread waited for a worker, which it does once a
+   worker is a whole queue (-q) behind. Workers 0 runs the
+   callback on the I/O threads, as a bare rt_master does. The callback
+   sleeps, as one waiting on a disk or database would; one which keeps a
+   CPU busy competes with the I/O threads for cores as well.
+*/
+
+#include "rtrans.h"
+#include "SoftwareSerial.h"
+#include "rt_multi.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_coordinator.h"
+#include "sim_xbee.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+
+#define MASTER_ADDR     (0xc000)        // plus the coordinator number
+#define SLAVE_SERIAL    (0x40a12000)    // plus 0x100 per coordinator and the node number
+#define JOIN_TIME       (3000)
+
+/* One coordinator and its slaves, on a link of their own */
+typedef struct bench_port_s {
+    int                         number;
+    uint16_t                    addr;
+    sim_channel                 *channel;
+    sim_coordinator             *coord;
+    int                         sv[2];
+    std::vector<sim_xbee *>     radios;
+    std::vector<SoftwareSerial *> xs;
+    std::vector<rt_state *>     states;
+    std::vector<bool>           joined;     // slave side: JOIN sent
+    std::map<uint32_t, uint64_t> unacked;   // slave and package to the time its DATA went out
+} bench_port;
+
+/* Everything measured during a run */
+typedef struct bench_run_s {
+    std::vector<bench_port>     ports;
+    rt_multi_master             *master;
+    size_t                      payload;
+    std::atomic<unsigned>       cost;       // ms the callback takes per package
+    std::atomic<bool>           measuring;
+    std::atomic<unsigned long>  delivered;
+    std::vector<uint64_t>       ack;        // ms from DATA to its ACK
+    unsigned long               data_frames;
+    unsigned long               retransmits;
+    int                         current_port;   // slave whose rt_loop is running
+    unsigned                    current;
+} bench_run;
+
+static bench_run *run_ctx;
+
+/** Slave application: join on the first probe, answer polls with a package */
+static void slave_callback(rt_in_header *header, uint8_t payload[]){
+        bench_run *r = run_ctx;
+        bench_port &p = r->ports[r->current_port];
+        unsigned i = r->current;
+        uint8_t data[RTRANS_MAX_SEGMENTS * RTRANS_PAYLOAD_SIZE];
+        (void) payload;
+
+        if(header->type == RTRANS_TYPE_PROBE && !p.joined[i]){
+                p.joined[i] = true;
+                p.states[i]->rt_join(header->master);
+        }
+        else if(header->type == RTRANS_TYPE_POLL){
+                memset(data, i, r->payload);
+                p.states[i]->rt_send(RTRANS_TYPE_DATA, data, r->payload);
+        }
+}
+
+/** Master application: schedule every slave which joins, and take cost ms
+    over each package
+*/
+static void master_callback(void *ctx, int port, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        bench_run *r = (bench_run *) ctx;
+        (void) payload;
+        (void) len;
+
+        if(type == RTRANS_TYPE_JOIN){
+                r->master->schedule(port, slave);
+        }
+        else if(type == RTRANS_TYPE_DATA){
+                if(r->cost > 0){
+                        std::this_thread::sleep_for(std::chrono::milliseconds(r->cost));
+                }
+                if(r->measuring){
+                        r->delivered++;
+                }
+        }
+}
+
+/** Time the DATA segments the slaves send and the ACKs the master sends
+    them, alone or along with a POLL or SET
+*/
+static void channel_tap(void *ctx, int port, uint16_t dst, const uint8_t *data, size_t len, double airtime){
+        bench_port *p = (bench_port *) ctx;
+        bench_run *r = run_ctx;
+        const rt_out_header *h = (const rt_out_header *) data;
+        rt_out_header compact;
+        bool from_slave = port != p->coord->channel_port();
+        uint16_t slave = from_slave ? p->channel->address(port) : dst;
+        size_t hlen = sizeof(rt_out_header);
+        uint32_t key;
+        (void) airtime;
+
+        if(!r->measuring){
+                return;
+        }
+        if(!rt_frame_full(data, len, p->addr)){
+                hlen = from_slave ? RTRANS_COMPACT_SLAVE : RTRANS_COMPACT_MASTER;
+                if(!rt_compact_decode(&compact, data, len, hlen, 0, p->addr, slave)){
+                        return;
+                }
+                h = &compact;
+        }
+        else if(len < sizeof(rt_out_header)){
+                return;
+        }
+
+        if(from_slave){
+                if((h->type & RTRANS_TYPE_MASK) != RTRANS_TYPE_DATA || h->type >= RTRANS_TYPE_ACK ||
+                   h->seg_no + 1 != h->seg_ct){
+                        return;
+                }
+                key = (slave << 8) | (h->pkg_no & 0xff);
+                r->data_frames++;
+                if(!p->unacked.insert(std::make_pair(key, sim_now())).second){
+                        r->retransmits++;
+                }
+                return;
+        }
+        if(h->type == RTRANS_TYPE_ACK){
+                key = (slave << 8) | (h->pkg_no & 0xff);
+        }
+        else if(h->type < RTRANS_TYPE_ACK && (h->type & RTRANS_FLAG_ACK) && len >= hlen + sizeof(rt_ack_header)){
+                rt_ack_header a;
+                memcpy(&a, data + hlen, sizeof(a));
+                key = (slave << 8) | (a.pkg_no & 0xff);
+        }
+        else{
+                return;
+        }
+        std::map<uint32_t, uint64_t>::iterator it = p->unacked.find(key);
+        if(it != p->unacked.end()){
+                r->ack.push_back(sim_now() - it->second);
+                p->unacked.erase(it);
+        }
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, unsigned p){
+        if(sorted.empty()){
+                return 0;
+        }
+        return sorted[(sorted.size() - 1) * p / 100];
+}
+
+static void run(unsigned coords, unsigned nodes, unsigned workers, unsigned cost, size_t payload,
+                uint32_t baud, size_t queue, uint64_t duration){
+        bench_run r;
+        rt_multi_config mcfg;
+        sim_link_cfg link = { 0.0, 5, 0, baud, 1 };
+        unsigned i, k;
+
+        r.payload      = payload;
+        r.cost         = cost;
+        r.measuring    = false;
+        r.delivered    = 0;
+        r.data_frames  = 0;
+        r.retransmits  = 0;
+        r.current_port = 0;
+        r.current      = 0;
+        run_ctx = &r;
+        sim_reset(0);
+
+        rt_multi_config_init(&mcfg);
+        mcfg.workers = workers;
+        if(queue){
+                mcfg.queue_bytes = queue;
+        }
+        rt_multi_master master(mcfg, master_callback, &r);
+        r.master = &master;
+
+        r.ports.resize(coords);
+        for(k = 0; k < coords; k++){
+                bench_port &p = r.ports[k];
+                rt_master_config cfg;
+
+                if(socketpair(AF_UNIX, SOCK_STREAM, 0, p.sv) < 0){
+                        perror("socketpair");
+                        exit(1);
+                }
+                link.seed = k + 1;
+                p.number  = k;
+                p.addr    = MASTER_ADDR + k;
+                p.channel = new sim_channel(link);
+                p.coord   = new sim_coordinator(*p.channel, p.addr, p.sv[1], false);
+                p.channel->set_tap(channel_tap, &p);
+                for(i = 0; i < nodes; i++){
+                        p.radios.push_back(new sim_xbee(*p.channel, SLAVE_SERIAL + k * 0x100 + i));
+                        p.xs.push_back(new SoftwareSerial(6, 7));
+                        p.xs[i]->sim_connect(*p.radios[i]);
+                        p.states.push_back(new rt_state(*p.xs[i], slave_callback));
+                        p.joined.push_back(false);
+                        p.states[i]->rt_init();
+                }
+
+                rt_master_config_init(&cfg, p.addr);
+                cfg.max_nodes    = nodes;
+                cfg.max_segments = RTRANS_MAX_SEGMENTS;
+                cfg.baud      = baud;
+                if(master.add_port(p.sv[0], cfg) < 0){
+                        fprintf(stderr, "queue too small or not a power of two\n");
+                        exit(2);
+                }
+                master.master(k).probe(JOIN_TIME / 2);
+        }
+
+        /* the simulation follows the wall clock, a millisecond at a time */
+        master.start();
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        while(sim_now() < JOIN_TIME + duration){
+                uint64_t wall = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - t0).count();
+                if(sim_now() >= wall){
+                        std::this_thread::sleep_for(std::chrono::microseconds(200));
+                        continue;
+                }
+                if(sim_now() == JOIN_TIME){
+                        r.measuring = true;
+                }
+                for(k = 0; k < coords; k++){
+                        r.current_port = k;
+                        for(i = 0; i < nodes; i++){
+                                r.current = i;
+                                r.ports[k].states[i]->rt_loop();
+                        }
+                        r.ports[k].coord->loop();
+                }
+                sim_advance(1);
+        }
+        /* what is still queued is not counted, and need not take its time */
+        r.measuring = false;
+        r.cost = 0;
+        unsigned long delivered = r.delivered;
+        rt_multi_stats s = master.statistics();
+        master.stop();
+
+        std::sort(r.ack.begin(), r.ack.end());
+        printf("%u,%u,%u,%u,%lu,%.1f,%llu,%llu,%llu,%lu,%lu,%lu\n", coords, nodes, workers, cost, delivered,
+               delivered / (duration / 1000.0), (unsigned long long) percentile(r.ack, 50),
+               (unsigned long long) percentile(r.ack, 99), (unsigned long long) percentile(r.ack, 100),
+               r.data_frames, r.retransmits, s.stalls);
+        fflush(stdout);
+
+        for(k = 0; k < coords; k++){
+                bench_port &p = r.ports[k];
+                for(i = 0; i < nodes; i++){
+                        delete p.states[i];
+                        delete p.xs[i];
+                        delete p.radios[i];
+                }
+                delete p.coord;
+                delete p.channel;
+                close(p.sv[0]);
+                close(p.sv[1]);
+        }
+}
+
+/** Parse a comma separated list of numbers */
+static std::vector<unsigned> numbers(const char *list){
+        std::vector<unsigned> out;
+        char *next;
+
+        while(*list){
+                unsigned n = strtoul(list, &next, 10);
+                if(next == list){
+                        break;
+                }
+                out.push_back(n);
+                list = (*next == ',') ? next + 1 : next;
+        }
+        return out;
+}
+
+int main(int argc, char *argv[]){
+        std::vector<unsigned> costs, workers;
+        unsigned coords = 2, nodes = 10;
+        size_t payload = 12;
+        uint32_t baud = 115200;
+        size_t queue = 0;
+        uint64_t duration = 5000;
+        const char *klist = "0,5,20,50", *wlist = "0,2";
+        size_t i, j;
+        int a;
+
+        for(a = 1; a + 1 < argc; a += 2){
+                if(strcmp(argv[a], "-c") == 0){
+                        coords = atoi(argv[a + 1]);
+                }
+                else if(strcmp(argv[a], "-n") == 0){
+                        nodes = atoi(argv[a + 1]);
+                }
+                else if(strcmp(argv[a], "-k") == 0){
+                        klist = argv[a + 1];
+                }
+                else if(strcmp(argv[a], "-w") == 0){
+                        wlist = argv[a + 1];
+                }
+                else if(strcmp(argv[a], "-t") == 0){
+                        duration = atof(argv[a + 1]) * 1000;
+                }
+                else if(strcmp(argv[a], "-p") == 0){
+                        payload = atoi(argv[a + 1]);
+                }
+                else if(strcmp(argv[a], "-b") == 0){
+                        baud = atoi(argv[a + 1]);
+                }
+                else if(strcmp(argv[a], "-q") == 0){
+                        queue = atoi(argv[a + 1]);
+                }
+                else{
+                        break;
+                }
+        }
+        costs   = numbers(klist);
+        workers = numbers(wlist);
+        if(a < argc || coords == 0 || coords > 16 || nodes == 0 || nodes > 0xff || payload == 0 ||
+           payload > RTRANS_MAX_SEGMENTS * RTRANS_PAYLOAD_SIZE){
+                fprintf(stderr, "usage: %s [-c coordinators] [-n nodes] [-k callback_ms,...] [-w workers,...] "
+                        "[-t seconds] [-p payload] [-b baud] [-q queue_bytes]\n", argv[0]);
+                return 2;
+        }
+
+        printf("coordinators,nodes,workers,callback_ms,packages,pkg_per_s,ack_p50_ms,ack_p99_ms,ack_max_ms,"
+               "data_frames,retransmits,stalls\n");
+        for(i = 0; i < workers.size(); i++){
+                for(j = 0; j < costs.size(); j++){
+                        run(coords, nodes, workers[i], costs[j], payload, baud, queue, duration);
+                }
+        }
+        return 0;
+}
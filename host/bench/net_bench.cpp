@@ -0,0 +1,463 @@
+/* Network scale benchmark: one native master against 10 to 5000 slave
+   rt_states sharing one simulated 802.15.4 channel, where every radio
+   contends for the air with CSMA-CA and frames sent at the same time
+   collide. Each slave boots at a random time within -B seconds, on a
+   clock of its own (random start, up to -d ppm fast or slow), takes its
+   address from the radio's serial number in rt_init() and joins on the
+   master's probes. Once all have joined, or -J seconds have passed, the
+   master's poll scheduler collects from them for -t seconds.
+
+   Usage: rtrans_net_bench [-n nodes,...] [-w window] [-t seconds]
+                           [-J seconds] [-B seconds] [-P probe_ms]
+                           [-j join_jitter_ms] [-p payload] [-l loss] [-b baud] [-M baud]
+                           [-d ppm] [-i 0|1] [-C 0|1] [-S seed]
+
+   -j has each slave wait a random time up to that many ms before it
+   answers a probe. -b is the serial rate of the slaves' radios and -M
+   that of the coordinator. -i 1 has the slaves configure their radios from
+   transparent mode first. -C 0 turns contention off, leaving a channel on
+   which every frame gets through at once.
+
+   Reports per node count the nodes which joined and how long it took,
+   the packages delivered during the measurement and the collection cycle
+   time (until every node delivered once more), the time from a slave's
+   DATA to its ACK, how busy the air was, the collisions, frames given up
+   on with the channel busy and MAC retries, and the frames either way per
+   package delivered.
+*/
+
+#include "rtrans.h"
+#include "SoftwareSerial.h"
+#include "rt_master.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_coordinator.h"
+#include "sim_xbee.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#define MASTER_ADDR     (0xc088)
+#define SLAVE_SERIAL    (0x40a11000)
+
+/* Settings of every run */
+typedef struct bench_cfg_s {
+    unsigned window;        // polls outstanding
+    uint64_t duration;      // of the measurement, ms
+    uint64_t join_limit;    // longest the joining may take, ms
+    uint64_t boot_spread;   // slaves boot within this many ms
+    uint32_t probe;         // probe interval, ms
+    uint32_t join_jitter;   // slaves join within this many ms of a probe
+    size_t   payload;
+    uint32_t master_baud;
+    double   drift;         // ppm
+    bool     configure;     // rt_init(true)
+    bool     contention;
+    uint32_t seed;
+} bench_cfg;
+
+/* One simulated slave */
+typedef struct bench_node_s {
+    sim_xbee       *radio;
+    SoftwareSerial *xs;
+    rt_state       *state;
+    sim_node_clock clock;
+    uint64_t       boot;        // simulated time it is switched on
+    bool           polled;      // slave side: a POLL came, so stop joining
+    bool           join_sent;   // slave side: a JOIN was sent
+    uint16_t       join_dropped;    // slave side: packages given up on before it
+    uint64_t       join_at;     // slave side: time to send a JOIN, 0 for none
+    uint16_t       join_to;     // slave side: master to join
+    bool           joined;      // master side
+    unsigned       cycle;       // master side: last cycle the node delivered in
+} bench_node;
+
+/* Everything measured during a run */
+typedef struct bench_run_s {
+    const bench_cfg         *cfg;
+    std::vector<bench_node> nodes;
+    std::vector<int>        by_addr;    // slave address to node number + 1
+    rt_master               *master;
+    sim_channel             *channel;
+    int                     coord_port;
+    unsigned                current;    // slave whose rt_loop is running
+    unsigned long           joined;
+    uint64_t                join_ms;    // time the last node joined
+    bool                    measuring;
+    unsigned long           delivered;
+    std::vector<uint64_t>   cycles;     // collection cycle times, ms
+    unsigned                cycle;
+    unsigned long           cycle_left; // nodes yet to deliver this cycle
+    uint64_t                cycle_start;
+    std::map<uint32_t, uint64_t> unacked;   // slave and package to the time its DATA went out
+    std::vector<uint64_t>   ack;        // ms from DATA to its ACK
+} bench_run;
+
+static bench_run *run_ctx;
+static uint32_t rng;
+
+static uint64_t bench_clock(){
+        return sim_now();
+}
+
+/** xorshift32 in [0, 1), apart from the channel's so runs with and
+    without contention boot the same nodes at the same times */
+static double bench_random(){
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        return rng / 4294967296.0;
+}
+
+/** Slave application: join on a probe, at a random time up to -j ms
+    later, and again on a later one if the JOIN was given up on before a
+    POLL came, answer polls with a package. JOIN is sent as a package like
+    any other, so it is retransmitted until the master ACKs it; joining on
+    every probe would only pile them up. PROBE is broadcast, so the slave
+    is the one being run rather than the addressee.
+*/
+static void slave_callback(rt_in_header *header, uint8_t payload[]){
+        bench_run *r = run_ctx;
+        bench_node &n = r->nodes[r->current];
+        uint8_t data[RTRANS_MAX_SEGMENTS * RTRANS_PAYLOAD_SIZE];
+        (void) payload;
+
+        if(header->type == RTRANS_TYPE_PROBE && !n.polled && n.join_at == 0){
+                rt_counters c;
+                n.state->rt_stats(&c);
+                if(n.join_sent && c.tx_dropped == n.join_dropped){
+                        return;
+                }
+                n.join_sent    = true;
+                n.join_dropped = c.tx_dropped;
+                n.join_at      = sim_now() + 1 + (uint64_t) (bench_random() * r->cfg->join_jitter);
+                n.join_to      = header->master;
+        }
+        else if(header->type == RTRANS_TYPE_POLL){
+                n.polled = true;
+                memset(data, r->current, r->cfg->payload);
+                n.state->rt_send(RTRANS_TYPE_DATA, data, r->cfg->payload);
+        }
+}
+
+/** Master application: hand every slave which joins to the scheduler and
+    count collection cycles
+*/
+static void master_callback(void *ctx, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        bench_run *r = (bench_run *) ctx;
+        int i = r->by_addr[slave] - 1;
+        (void) payload;
+
+        if(i < 0){
+                return;
+        }
+        bench_node &n = r->nodes[i];
+        if(type == RTRANS_TYPE_JOIN && !n.joined){
+                n.joined = true;
+                r->joined++;
+                r->join_ms = sim_now();
+                r->master->schedule(slave);
+        }
+        else if(type == RTRANS_TYPE_DATA && len == r->cfg->payload && r->measuring){
+                r->delivered++;
+                if(n.cycle != r->cycle){
+                        n.cycle = r->cycle;
+                        if(--r->cycle_left == 0){
+                                r->cycles.push_back(sim_now() - r->cycle_start);
+                                r->cycle++;
+                                r->cycle_left  = r->joined;
+                                r->cycle_start = sim_now();
+                        }
+                }
+        }
+}
+
+/** Time the last DATA segment of each package and the ACK the master
+    sends for it, alone or along with a POLL
+*/
+static void channel_tap(void *ctx, int port, uint16_t dst, const uint8_t *data, size_t len, double airtime){
+        bench_run *r = (bench_run *) ctx;
+        const rt_out_header *h = (const rt_out_header *) data;
+        rt_out_header compact;
+        bool from_slave = port != r->coord_port;
+        uint16_t slave;
+        size_t hlen = sizeof(rt_out_header);
+        uint32_t key;
+        (void) airtime;
+
+        if(!r->measuring){
+                return;
+        }
+        slave = from_slave ? r->channel->address(port) : dst;
+        if(!rt_frame_full(data, len, MASTER_ADDR)){
+                hlen = from_slave ? RTRANS_COMPACT_SLAVE : RTRANS_COMPACT_MASTER;
+                if(!rt_compact_decode(&compact, data, len, hlen, 0, MASTER_ADDR, slave)){
+                        return;
+                }
+                h = &compact;
+        }
+        else if(len < sizeof(rt_out_header)){
+                return;
+        }
+
+        if(from_slave){
+                if((h->type & RTRANS_TYPE_MASK) != RTRANS_TYPE_DATA || h->type >= RTRANS_TYPE_ACK ||
+                   h->seg_no + 1 != h->seg_ct){
+                        return;
+                }
+                key = (slave << 8) | (h->pkg_no & 0xff);
+                r->unacked.insert(std::make_pair(key, sim_now()));
+                return;
+        }
+        if(h->type == RTRANS_TYPE_ACK){
+                key = (slave << 8) | (h->pkg_no & 0xff);
+        }
+        else if(h->type < RTRANS_TYPE_ACK && (h->type & RTRANS_FLAG_ACK) && len >= hlen + sizeof(rt_ack_header)){
+                rt_ack_header a;
+                memcpy(&a, data + hlen, sizeof(a));
+                key = (slave << 8) | (a.pkg_no & 0xff);
+        }
+        else{
+                return;
+        }
+        std::map<uint32_t, uint64_t>::iterator it = r->unacked.find(key);
+        if(it != r->unacked.end()){
+                r->ack.push_back(sim_now() - it->second);
+                r->unacked.erase(it);
+        }
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, unsigned p){
+        if(sorted.empty()){
+                return 0;
+        }
+        return sorted[(sorted.size() - 1) * p / 100];
+}
+
+/** Run every booted slave, then the coordinator and the master, for 1 ms */
+static void step(bench_run &r, sim_coordinator &coord, rt_master &master){
+        unsigned i;
+
+        for(i = 0; i < r.nodes.size(); i++){
+                bench_node &n = r.nodes[i];
+                if(sim_now() < n.boot){
+                        continue;
+                }
+                r.current = i;
+                sim_clock_select(&n.clock);
+                if(sim_now() == n.boot){
+                        n.state->rt_init(r.cfg->configure);
+                }
+                if(n.join_at != 0 && sim_now() >= n.join_at){
+                        n.join_at = 0;
+                        n.state->rt_join(n.join_to);
+                }
+                n.state->rt_loop();
+        }
+        sim_clock_select(0);
+        coord.loop();
+        master.loop(0);
+        sim_advance(1);
+}
+
+static void run(unsigned count, const bench_cfg &cfg, const sim_link_cfg &link){
+        bench_run r = bench_run();
+        rt_master_config mcfg;
+        rt_master_stats before = rt_master_stats();
+        sim_channel_stats air = sim_channel_stats();
+        uint64_t end;
+        int sv[2];
+        unsigned i;
+
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0){
+                perror("socketpair");
+                exit(1);
+        }
+        sim_reset(0);
+        rng = cfg.seed | 1;
+        sim_channel channel(link);
+        channel.set_contention(cfg.contention);
+        sim_coordinator coord(channel, MASTER_ADDR, sv[1], false);
+        channel.set_baud(coord.channel_port(), cfg.master_baud);
+
+        rt_master_config_init(&mcfg, MASTER_ADDR);
+        mcfg.max_nodes   = count;
+        mcfg.clock       = bench_clock;
+        mcfg.poll_window = cfg.window;
+        mcfg.baud        = cfg.master_baud;
+        mcfg.probe_every = cfg.probe;
+        rt_master master(sv[0], mcfg, master_callback, &r);
+
+        r.cfg        = &cfg;
+        r.master     = &master;
+        r.channel    = &channel;
+        r.coord_port = coord.channel_port();
+        r.by_addr.assign(0x10000, 0);
+        r.nodes.resize(count);
+        run_ctx = &r;
+        for(i = 0; i < count; i++){
+                bench_node &n = r.nodes[i];
+                n.radio = new sim_xbee(channel, SLAVE_SERIAL + i);
+                n.xs    = new SoftwareSerial(6, 7);
+                n.xs->sim_connect(*n.radio);
+                n.state = new rt_state(*n.xs, slave_callback);
+                n.clock.offset = (uint32_t) (bench_random() * 4294967296.0);
+                n.clock.drift  = (bench_random() * 2.0 - 1.0) * cfg.drift;
+                n.boot = (uint64_t) (bench_random() * cfg.boot_spread);
+                r.by_addr[(SLAVE_SERIAL + i) & 0xffff] = i + 1;
+        }
+        channel.set_tap(channel_tap, &r);
+
+        /* join, then measure polling */
+        master.probe(cfg.join_limit);
+        while(r.joined < count && sim_now() < cfg.join_limit){
+                step(r, coord, master);
+        }
+        master.probe(0);
+        r.measuring   = true;
+        r.cycle       = 1;
+        r.cycle_left  = r.joined;
+        r.cycle_start = sim_now();
+        before = master.statistics();
+        air = channel.statistics();
+        end = sim_now() + cfg.duration;
+        while(sim_now() < end){
+                step(r, coord, master);
+        }
+
+        const rt_master_stats &s = master.statistics();
+        const sim_channel_stats &c = channel.statistics();
+        unsigned long frames = (s.rx_frames - before.rx_frames) + (s.tx_frames - before.tx_frames);
+        std::sort(r.cycles.begin(), r.cycles.end());
+        std::sort(r.ack.begin(), r.ack.end());
+        printf("%u,%u,%lu,%llu,%lu,%.1f,%zu,%llu,%llu,%llu,%llu,%llu,%.3f,%lu,%lu,%lu,%lu,%lu,%.2f\n",
+               count, cfg.contention ? 1 : 0, r.joined, (unsigned long long) r.join_ms,
+               r.delivered, r.delivered * cfg.payload / (cfg.duration / 1000.0),
+               r.cycles.size(), (unsigned long long) percentile(r.cycles, 50),
+               (unsigned long long) percentile(r.cycles, 100),
+               (unsigned long long) percentile(r.ack, 50), (unsigned long long) percentile(r.ack, 99),
+               (unsigned long long) percentile(r.ack, 100),
+               (c.air_busy - air.air_busy) / cfg.duration,
+               c.collisions - air.collisions, c.cca_failures - air.cca_failures, c.mac_retries - air.mac_retries,
+               s.polls - before.polls, s.timeouts - before.timeouts,
+               r.delivered ? (double) frames / r.delivered : 0.0);
+        fflush(stdout);
+
+        channel.set_tap(0, 0);
+        for(i = 0; i < count; i++){
+                delete r.nodes[i].state;
+                delete r.nodes[i].xs;
+                delete r.nodes[i].radio;
+        }
+        close(sv[0]);
+        close(sv[1]);
+}
+
+int main(int argc, char *argv[]){
+        std::vector<unsigned> counts;
+        sim_link_cfg link;
+        bench_cfg cfg;
+        const char *list = "10,100,1000,5000";
+        int i;
+
+        link.loss    = 0.0;
+        link.latency = 0;
+        link.jitter  = 0;
+        link.baud    = 9600;
+        link.seed    = 1;
+
+        cfg.window      = 4;
+        cfg.duration    = 60000;
+        cfg.join_limit  = 120000;
+        cfg.boot_spread = 5000;
+        cfg.probe       = 1000;
+        cfg.join_jitter = 0;
+        cfg.payload     = 12;
+        cfg.master_baud = 115200;
+        cfg.drift       = 100;
+        cfg.configure   = false;
+        cfg.contention  = true;
+        cfg.seed        = 1;
+
+        for(i = 1; i + 1 < argc; i += 2){
+                if(strcmp(argv[i], "-n") == 0){
+                        list = argv[i + 1];
+                }
+                else if(strcmp(argv[i], "-w") == 0){
+                        cfg.window = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-t") == 0){
+                        cfg.duration = atof(argv[i + 1]) * 1000;
+                }
+                else if(strcmp(argv[i], "-J") == 0){
+                        cfg.join_limit = atof(argv[i + 1]) * 1000;
+                }
+                else if(strcmp(argv[i], "-B") == 0){
+                        cfg.boot_spread = atof(argv[i + 1]) * 1000;
+                }
+                else if(strcmp(argv[i], "-P") == 0){
+                        cfg.probe = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-j") == 0){
+                        cfg.join_jitter = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-p") == 0){
+                        cfg.payload = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-l") == 0){
+                        link.loss = atof(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-b") == 0){
+                        link.baud = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-M") == 0){
+                        cfg.master_baud = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-d") == 0){
+                        cfg.drift = atof(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-i") == 0){
+                        cfg.configure = atoi(argv[i + 1]) != 0;
+                }
+                else if(strcmp(argv[i], "-C") == 0){
+                        cfg.contention = atoi(argv[i + 1]) != 0;
+                }
+                else if(strcmp(argv[i], "-S") == 0){
+                        cfg.seed = link.seed = atoi(argv[i + 1]);
+                }
+                else{
+                        break;
+                }
+        }
+        if(i < argc || cfg.payload == 0 || cfg.payload > RTRANS_MAX_SEGMENTS * RTRANS_PAYLOAD_SIZE ||
+           cfg.window == 0 || cfg.window > 255 || cfg.duration == 0){
+                fprintf(stderr, "usage: %s [-n nodes,...] [-w window] [-t seconds] [-J seconds] [-B seconds] "
+                        "[-P probe_ms] [-j join_jitter_ms] [-p payload] [-l loss] [-b baud] [-M baud] [-d ppm] [-i 0|1] [-C 0|1] "
+                        "[-S seed]\n", argv[0]);
+                return 2;
+        }
+        while(*list){
+                char *next;
+                unsigned n = strtoul(list, &next, 10);
+                if(next == list){
+                        break;
+                }
+                if(n > 0 && n < 0xf000){
+                        counts.push_back(n);
+                }
+                list = (*next == ',') ? next + 1 : next;
+        }
+
+        printf("nodes,contention,joined,join_ms,packages,goodput_Bps,cycles,cycle_p50_ms,cycle_max_ms,"
+               "ack_p50_ms,ack_p99_ms,ack_max_ms,air_util,collisions,cca_failures,mac_retries,"
+               "polls,timeouts,frames_per_pkg\n");
+        for(size_t c = 0; c < counts.size(); c++){
+                run(counts[c], cfg, link);
+        }
+        return 0;
+}
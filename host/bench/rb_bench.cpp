@@ -0,0 +1,145 @@
+/* Ringbuffer micro-benchmark: the original byte-at-a-time, modulo per byte
+   implementation against the current block-copy one, for a power-of-two
+   and a non power-of-two buffer, plus the in-place reserve/commit and
+   rb_peek_ptr path used for tx segments.
+
+   Usage: rtrans_rb_bench [iterations]
+*/
+
+#include "ringbuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+/* Original implementation, kept for comparison; out of line like the
+   library functions so that neither side is inlined into the loop */
+__attribute__((noinline)) static size_t old_rb_get(ringbuffer *rb, uint8_t *buffer, size_t n){
+        if (n > rb->avail) {
+                return 0;
+        }
+        size_t i;
+        for(i = 0; i < n; i++){
+                buffer[i] = rb->buf[rb->start];
+                rb->start = (rb->start + 1) % rb->size;
+                rb->avail--;
+        }
+        return n;
+}
+
+__attribute__((noinline)) static size_t old_rb_peek(const ringbuffer *rb, uint8_t *buffer, size_t n){
+        if (n > rb->avail) {
+                return 0;
+        }
+        size_t i;
+        for(i = 0; i < n; i++){
+                buffer[i] = rb->buf[(rb->start + i) % rb->size];
+        }
+        return n;
+}
+
+__attribute__((noinline)) static size_t old_rb_put(ringbuffer *rb, const uint8_t *buffer, size_t n){
+        if(rb->size - rb->avail < n){
+                return 0;
+        }
+        size_t i;
+        for(i = 0; i < n; i++){
+                rb->buf[(rb->start + rb->avail) % rb->size] = buffer[i];
+                rb->avail++;
+        }
+        return i;
+}
+
+typedef enum { PATH_OLD, PATH_COPY, PATH_INPLACE } bench_path;
+
+static const char *path_name[] = { "old", "copy", "inplace" };
+
+/** Queue segments of n bytes, peek each one as if transmitting it and
+    pop it again, keeping the buffer about half full so that copies wrap.
+    Returns ns per byte moved; sum collects the data to defeat the optimizer
+    and to check that every path sees the same bytes.
+*/
+static double run(bench_path path, size_t size, size_t n, unsigned long iters, unsigned long *sum){
+        uint8_t *mem = (uint8_t *) malloc(size);
+        uint8_t src[256], dst[256];
+        ringbuffer rb;
+        unsigned long it;
+        size_t i;
+
+        for(i = 0; i < sizeof(src); i++){
+                src[i] = i * 31 + 7;
+        }
+        rb_init(&rb, mem, size);
+
+        /* prefill so that reads and writes are at different positions */
+        while(rb_free(&rb) > size / 2 + n){
+                if(path == PATH_OLD){
+                        old_rb_put(&rb, src, n);
+                }
+                else{
+                        rb_put(&rb, src, n);
+                }
+        }
+
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for(it = 0; it < iters; it++){
+                src[0] = it;
+                switch(path){
+                        case PATH_OLD:
+                                old_rb_put(&rb, src, n);
+                                old_rb_peek(&rb, dst, n);
+                                *sum += dst[0] + dst[n - 1];
+                                old_rb_get(&rb, dst, n);
+                                break;
+                        case PATH_COPY:
+                                rb_put(&rb, src, n);
+                                rb_peek(&rb, dst, n);
+                                *sum += dst[0] + dst[n - 1];
+                                rb_get(&rb, dst, n);
+                                break;
+                        case PATH_INPLACE: {
+                                uint8_t *w = rb_reserve(&rb, n);
+                                const uint8_t *r;
+                                memcpy(w, src, n);
+                                rb_commit(&rb, n);
+                                r = rb_peek_ptr(&rb, 0, n);
+                                *sum += r[0] + r[n - 1];
+                                rb_del(&rb, n);
+                                break;
+                        }
+                }
+        }
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+        free(mem);
+        return std::chrono::duration<double, std::nano>(t1 - t0).count() / ((double) iters * n);
+}
+
+int main(int argc, char *argv[]){
+        static const size_t sizes[] = { 512, 600 };
+        static const size_t chunks[] = { 1, 11, 100 };
+        unsigned long iters = (argc > 1) ? strtoul(argv[1], 0, 10) : 2000000;
+        size_t s, c;
+        int p;
+
+        printf("buffer,chunk,path,ns_per_byte,speedup\n");
+        for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+                for(c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++){
+                        double base = 0.0;
+                        unsigned long check = 0;
+                        for(p = PATH_OLD; p <= PATH_INPLACE; p++){
+                                unsigned long sum = 0;
+                                double ns = run((bench_path) p, sizes[s], chunks[c], iters, &sum);
+                                if(p == PATH_OLD){
+                                        base = ns;
+                                        check = sum;
+                                }
+                                else if(sum != check){
+                                        fprintf(stderr, "%s path read different data\n", path_name[p]);
+                                        return 1;
+                                }
+                                printf("%zu,%zu,%s,%.3f,%.2f\n", sizes[s], chunks[c], path_name[p], ns, base / ns);
+                        }
+                }
+        }
+        return 0;
+}
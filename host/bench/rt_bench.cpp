@@ -0,0 +1,455 @@
+/* Protocol benchmark: one slave rt_state against the master stand-in over
+   the simulated link, swept over loss rate and package size. Each run
+   polls the slave back to back for a fixed simulated duration.
+
+   Usage: rtrans_bench [-l loss,...] [-p payload,...] [-s segments,...]
+                       [-t seconds] [-L latency_ms] [-j jitter_ms]
+                       [-b baud] [-S seed] [-z 0|1] [-m messages]
+                       [-B batch_ms] [-A 0|1] [-C 0|1] [-f csv|json]
+
+   -s adds packages of exactly that many full segments to the -p sizes.
+   -z 1 fills packages with sensor records (timestamp, voltage, current,
+   temperature) and has the slave delta code them.
+   -m has the slave answer each poll with that many packages, and -B lets
+   it batch them for up to that many ms.
+   -A 0 has the master ACK every segment rather than send cumulative ACKs,
+   which it piggybacks on the next POLL where it can. frames counts every
+   frame on the air, both ways.
+   -C 0 keeps both sides on full headers rather than compact ones.
+*/
+
+#include "rtrans.h"
+#include "SoftwareSerial.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_xbee.h"
+#include "sim_master.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#define MASTER_ADDR     (0xc088)
+#define SLAVE_SERIAL    (0x40a1b2c3)
+#define POLL_RETX       (2000)
+#define PROBE_INTERVAL  (500)
+#define JOIN_TIMEOUT    (30000)
+
+/* Sensor record of -z runs, as in the commented-out rapp_pkt parsing in master/main.py */
+typedef struct __attribute__ ((__packed__)) sensor_record_s {
+    uint32_t timestamp;
+    uint16_t voltage;
+    uint16_t current;
+    int16_t  temperature;
+} sensor_record;
+
+static const uint8_t sensor_fields[] = { 4, 2, 2, 2 };
+
+/* One point of the sweep */
+typedef struct bench_cfg_s {
+    double   loss;
+    size_t   payload;
+    uint32_t latency;
+    uint32_t jitter;
+    uint32_t baud;
+    uint32_t seed;
+    uint64_t duration;
+    bool     coded;
+    unsigned messages;  // packages sent per poll
+    uint16_t batch;     // slave batching window in ms, 0 for none
+    bool     cumulative;    // master sends cumulative ACKs
+    bool     compact;       // master sends, and so the slave answers with, compact headers
+} bench_cfg;
+
+/* Everything measured during a run */
+typedef struct bench_run_s {
+    const bench_cfg       *cfg;
+    rt_state              *slave;
+    sim_master            *master;
+    int                   slave_port;
+    uint16_t              slave_addr;
+    bool                  joined;
+    uint64_t              last_poll;
+    uint32_t              next_id;
+    uint32_t              noise;       // xorshift state for sensor readings
+    std::vector<uint8_t>  payload;
+    std::vector<uint64_t> sent_at;     // rt_send time per package id
+    std::vector<bool>     done;        // package id has been delivered
+    std::vector<uint64_t> latency;     // completion latency per delivered package
+    std::set<unsigned>    seen;        // (pkg_no, seg_no) already on the air
+    unsigned long         delivered;
+    unsigned long         refused;     // rt_send returned 0
+    unsigned long         duplicates;  // packages delivered more than once
+    unsigned long         tx_frames;   // DATA frames sent by the slave
+    unsigned long         retx;        // DATA frames which were retransmissions
+    double                airtime;     // slave DATA airtime
+    double                wasted;      // slave DATA airtime spent on retransmissions
+    unsigned long         frames;      // frames on the air, either way
+} bench_run;
+
+static bench_run *run_ctx;
+
+/** Fill the payload with sensor records one second apart with a little
+    noise on the readings; the first timestamp is the package id
+*/
+static void fill_records(bench_run *r, uint32_t id){
+        sensor_record rec;
+        size_t k;
+
+        rec.timestamp   = id;
+        rec.voltage     = 3300;
+        rec.current     = 120;
+        rec.temperature = 215;
+        for(k = 0; (k + 1) * sizeof(rec) <= r->payload.size(); k++){
+                memcpy(&r->payload[k * sizeof(rec)], &rec, sizeof(rec));
+                r->noise ^= r->noise << 13;
+                r->noise ^= r->noise >> 17;
+                r->noise ^= r->noise << 5;
+                rec.timestamp   += 1000 + (r->noise & 3);
+                rec.voltage     = 3300 + ((r->noise >> 2) & 7) - 4;
+                rec.current     = 120 + ((r->noise >> 5) & 15) - 8;
+                rec.temperature += ((r->noise >> 9) & 3) == 0;
+        }
+        if(k == 0){
+                memcpy(r->payload.data(), &id, sizeof(id));
+        }
+}
+
+static void slave_callback(rt_in_header *header, uint8_t payload[]){
+        bench_run *r = run_ctx;
+        (void) payload;
+
+        if(header->type == RTRANS_TYPE_PROBE){
+                r->slave->rt_join(header->master);
+        }
+        else if(header->type == RTRANS_TYPE_POLL){
+                unsigned m;
+                for(m = 0; m < r->cfg->messages; m++){
+                        uint32_t id = r->next_id;
+                        if(r->cfg->coded){
+                                fill_records(r, id);
+                        }
+                        else{
+                                memcpy(r->payload.data(), &id, sizeof(id));
+                        }
+                        if(r->slave->rt_send(RTRANS_TYPE_DATA, r->payload.data(), r->payload.size()) > 0){
+                                r->sent_at.push_back(sim_now());
+                                r->done.push_back(false);
+                        }
+                        else{
+                                r->sent_at.push_back(0);
+                                r->done.push_back(true);
+                                r->refused++;
+                        }
+                        r->next_id++;
+                }
+        }
+}
+
+static void master_callback(void *ctx, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        bench_run *r = (bench_run *) ctx;
+        uint32_t id;
+
+        if(type == RTRANS_TYPE_JOIN){
+                r->joined = true;
+                r->slave_addr = slave;
+        }
+        else if(type == RTRANS_TYPE_DATA && len == r->payload.size()){
+                memcpy(&id, payload, sizeof(id));
+                /* duplicates of a package do not count and do not trigger another poll */
+                if(id >= r->sent_at.size() || r->done[id]){
+                        r->duplicates++;
+                        return;
+                }
+                r->done[id] = true;
+                r->latency.push_back(sim_now() - r->sent_at[id]);
+                r->delivered++;
+                /* poll again once the last package of the round is in */
+                if(id % r->cfg->messages != r->cfg->messages - 1){
+                        return;
+                }
+        }
+        else{
+                return;
+        }
+
+        r->last_poll = sim_now();
+        r->master->poll(slave);
+}
+
+/** Count frames, and first transmissions and retransmissions of slave DATA
+    segments
+*/
+static void channel_tap(void *ctx, int port, uint16_t dst, const uint8_t *data, size_t len, double airtime){
+        bench_run *r = (bench_run *) ctx;
+        const rt_out_header *h = (const rt_out_header *) data;
+        rt_out_header compact;
+        unsigned key;
+        (void) dst;
+
+        r->frames++;
+        if(port != r->slave_port){
+                return;
+        }
+        if(!rt_frame_full(data, len, MASTER_ADDR)){
+                if(!rt_compact_decode(&compact, data, len, RTRANS_COMPACT_SLAVE, 0, MASTER_ADDR, r->slave_addr)){
+                        return;
+                }
+                h = &compact;
+        }
+        else if(len < sizeof(rt_out_header)){
+                return;
+        }
+        if((h->type & RTRANS_TYPE_MASK) != RTRANS_TYPE_DATA){
+                return;
+        }
+
+        /* forget the package numbers half a wrap away so they can be reused */
+        key = ((h->pkg_no & 0xff) << 8) | h->seg_no;
+        r->seen.erase(r->seen.lower_bound(((h->pkg_no + 128) & 0xff) << 8),
+                      r->seen.lower_bound((((h->pkg_no + 128) & 0xff) << 8) + 0x100));
+
+        r->tx_frames++;
+        r->airtime += airtime;
+        if(!r->seen.insert(key).second){
+                r->retx++;
+                r->wasted += airtime;
+        }
+}
+
+static bool run(const bench_cfg &cfg, bench_run &r){
+        sim_link_cfg link;
+        uint64_t start, end;
+
+        link.loss    = cfg.loss;
+        link.latency = cfg.latency;
+        link.jitter  = cfg.jitter;
+        link.baud    = cfg.baud;
+        link.seed    = cfg.seed;
+
+        sim_channel channel(link);
+        sim_xbee radio(channel, SLAVE_SERIAL);
+        SoftwareSerial xs(6, 7);
+        xs.sim_connect(radio);
+        rt_state slave(xs, slave_callback);
+        sim_master master(channel, MASTER_ADDR, master_callback, &r);
+        master.set_cumulative(cfg.cumulative);
+        master.set_compact(cfg.compact);
+
+        r.cfg        = &cfg;
+        r.slave      = &slave;
+        r.master     = &master;
+        r.slave_port = radio.channel_port();
+        r.payload.assign(cfg.payload, 0);
+        for(size_t i = sizeof(uint32_t); i < cfg.payload; i++){
+                r.payload[i] = i;
+        }
+        r.noise = cfg.seed | 1;
+        run_ctx = &r;
+
+        slave.rt_init();
+        if(cfg.coded){
+                slave.rt_compress(sensor_fields, sizeof(sensor_fields));
+        }
+        slave.rt_batch(cfg.batch);
+
+        /* join before measuring */
+        start = sim_now();
+        while(!r.joined){
+                if(sim_now() - start > JOIN_TIMEOUT){
+                        return false;
+                }
+                if(sim_now() % PROBE_INTERVAL == 0){
+                        master.probe();
+                }
+                slave.rt_loop();
+                master.loop();
+                sim_advance(1);
+        }
+
+        /* measure back-to-back polling */
+        channel.set_tap(channel_tap, &r);
+        r.last_poll = sim_now();
+        master.poll(r.slave_addr);
+        end = sim_now() + cfg.duration;
+        while(sim_now() < end){
+                slave.rt_loop();
+                master.loop();
+                if(sim_now() - r.last_poll >= POLL_RETX){
+                        r.last_poll = sim_now();
+                        master.poll(r.slave_addr);
+                }
+                sim_advance(1);
+        }
+        channel.set_tap(0, 0);
+        return true;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, unsigned p){
+        if(sorted.empty()){
+                return 0;
+        }
+        return sorted[(sorted.size() - 1) * p / 100];
+}
+
+static void report(const bench_cfg &cfg, bench_run &r, bool ok, bool json, bool first){
+        size_t segments = (cfg.payload + RTRANS_PAYLOAD_SIZE - 1) / RTRANS_PAYLOAD_SIZE;
+        double seconds = cfg.duration / 1000.0;
+        double goodput = r.delivered * cfg.payload / seconds;
+        double per_pkg = r.delivered ? (double) r.frames / r.delivered : 0.0;
+
+        std::sort(r.latency.begin(), r.latency.end());
+        if(json){
+                printf("%s  {\"loss\": %.3f, \"payload\": %zu, \"coded\": %s, \"messages\": %u, \"batch_ms\": %u, \"segments\": %zu, \"joined\": %s, "
+                       "\"packages\": %lu, \"duplicates\": %lu, \"refused\": %lu, \"goodput_Bps\": %.1f, "
+                       "\"latency_ms\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}, "
+                       "\"tx_frames\": %lu, \"retx\": %lu, \"airtime_ms\": %.1f, \"wasted_airtime_ms\": %.1f, "
+                       "\"cumulative\": %s, \"compact\": %s, \"frames\": %lu, \"frames_per_pkg\": %.2f}",
+                       first ? "" : ",\n", cfg.loss, cfg.payload, cfg.coded ? "true" : "false", cfg.messages, cfg.batch, segments, ok ? "true" : "false",
+                       r.delivered, r.duplicates, r.refused, goodput,
+                       (unsigned long long) percentile(r.latency, 50), (unsigned long long) percentile(r.latency, 90),
+                       (unsigned long long) percentile(r.latency, 99), (unsigned long long) percentile(r.latency, 100),
+                       r.tx_frames, r.retx, r.airtime, r.wasted, cfg.cumulative ? "true" : "false", cfg.compact ? "true" : "false",
+                       r.frames, per_pkg);
+        }
+        else{
+                printf("%.3f,%zu,%d,%u,%u,%zu,%d,%lu,%lu,%lu,%.1f,%llu,%llu,%llu,%llu,%lu,%lu,%.1f,%.1f,%d,%d,%lu,%.2f\n",
+                       cfg.loss, cfg.payload, cfg.coded ? 1 : 0, cfg.messages, cfg.batch, segments, ok ? 1 : 0, r.delivered, r.duplicates, r.refused, goodput,
+                       (unsigned long long) percentile(r.latency, 50), (unsigned long long) percentile(r.latency, 90),
+                       (unsigned long long) percentile(r.latency, 99), (unsigned long long) percentile(r.latency, 100),
+                       r.tx_frames, r.retx, r.airtime, r.wasted, cfg.cumulative ? 1 : 0, cfg.compact ? 1 : 0, r.frames, per_pkg);
+        }
+}
+
+/** Parse a comma separated list of numbers */
+static std::vector<double> parse_list(const char *arg){
+        std::vector<double> v;
+        char *end;
+        while(*arg){
+                v.push_back(strtod(arg, &end));
+                if(end == arg){
+                        break;
+                }
+                arg = (*end == ',') ? end + 1 : end;
+        }
+        return v;
+}
+
+int main(int argc, char *argv[]){
+        std::vector<double> losses, payloads, segments;
+        bench_cfg cfg;
+        bool json = false, first = true;
+        int i;
+
+        losses.push_back(0.0);
+        losses.push_back(0.05);
+        losses.push_back(0.1);
+        losses.push_back(0.2);
+        payloads.push_back(12);
+        payloads.push_back(RTRANS_PAYLOAD_SIZE);
+        segments.push_back(3);
+        segments.push_back(RTRANS_MAX_SEGMENTS);
+
+        cfg.latency  = 5;
+        cfg.jitter   = 0;
+        cfg.baud     = 9600;
+        cfg.seed     = 1;
+        cfg.duration = 120000;
+        cfg.coded    = false;
+        cfg.messages = 1;
+        cfg.batch    = 0;
+        cfg.cumulative = true;
+        cfg.compact  = true;
+
+        for(i = 1; i + 1 < argc; i += 2){
+                if(strcmp(argv[i], "-l") == 0){
+                        losses = parse_list(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-p") == 0){
+                        payloads = parse_list(argv[i + 1]);
+                        segments.clear();
+                }
+                else if(strcmp(argv[i], "-s") == 0){
+                        segments = parse_list(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-t") == 0){
+                        cfg.duration = atof(argv[i + 1]) * 1000;
+                }
+                else if(strcmp(argv[i], "-L") == 0){
+                        cfg.latency = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-j") == 0){
+                        cfg.jitter = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-b") == 0){
+                        cfg.baud = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-S") == 0){
+                        cfg.seed = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-z") == 0){
+                        cfg.coded = atoi(argv[i + 1]) != 0;
+                }
+                else if(strcmp(argv[i], "-m") == 0){
+                        cfg.messages = atoi(argv[i + 1]);
+                        if(cfg.messages == 0){
+                                cfg.messages = 1;
+                        }
+                }
+                else if(strcmp(argv[i], "-B") == 0){
+                        cfg.batch = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-A") == 0){
+                        cfg.cumulative = atoi(argv[i + 1]) != 0;
+                }
+                else if(strcmp(argv[i], "-C") == 0){
+                        cfg.compact = atoi(argv[i + 1]) != 0;
+                }
+                else if(strcmp(argv[i], "-f") == 0){
+                        json = strcmp(argv[i + 1], "json") == 0;
+                }
+                else{
+                        break;
+                }
+        }
+        if(i < argc){
+                fprintf(stderr, "usage: %s [-l loss,...] [-p payload,...] [-s segments,...] [-t seconds]"
+                        " [-L latency_ms] [-j jitter_ms] [-b baud] [-S seed] [-z 0|1] [-m messages] [-B batch_ms]"
+                        " [-A 0|1] [-C 0|1] [-f csv|json]\n", argv[0]);
+                return 2;
+        }
+        for(size_t s = 0; s < segments.size(); s++){
+                payloads.push_back(segments[s] * RTRANS_PAYLOAD_SIZE);
+        }
+
+        if(json){
+                printf("{\"config\": {\"packet_size\": %u, \"max_segments\": %u, \"window\": %u, "
+                       "\"retx_limit\": %u, \"retx_timeout\": %u, \"latency_ms\": %u, \"jitter_ms\": %u, "
+                       "\"baud\": %u, \"seconds\": %.1f, \"seed\": %u},\n \"runs\": [\n",
+                       RTRANS_PACKET_SIZE, RTRANS_MAX_SEGMENTS, RTRANS_WINDOW_SIZE, RTRANS_RETX_LIMIT,
+                       RTRANS_RETX_TIMEOUT, cfg.latency, cfg.jitter, cfg.baud, cfg.duration / 1000.0, cfg.seed);
+        }
+        else{
+                printf("loss,payload,coded,messages,batch_ms,segments,joined,packages,duplicates,refused,goodput_Bps,lat_p50_ms,lat_p90_ms,"
+                       "lat_p99_ms,lat_max_ms,tx_frames,retx,airtime_ms,wasted_airtime_ms,cumulative,compact,frames,frames_per_pkg\n");
+        }
+
+        for(size_t l = 0; l < losses.size(); l++){
+                for(size_t p = 0; p < payloads.size(); p++){
+                        bench_run r = bench_run();
+                        cfg.loss = losses[l];
+                        cfg.payload = (payloads[p] < sizeof(uint32_t)) ? sizeof(uint32_t) : (size_t) payloads[p];
+                        bool ok = run(cfg, r);
+                        report(cfg, r, ok, json, first);
+                        first = false;
+                        fflush(stdout);
+                }
+        }
+
+        if(json){
+                printf("\n ]}\n");
+        }
+        return 0;
+}
@@ -0,0 +1,223 @@
+/* Receive path micro-benchmark: cost per received PROBE/POLL/SET of the
+   slave driver, from rt_loop() picking the frame up to the callback, for
+   the queued path (copied into the rx queue, then out again onto the stack
+   for the callback) and the direct one (callback run on the frame in the
+   XBee buffer). Frames arrive alone or in bursts, to show the cost of the
+   rt_loop() calls needed to drain them.
+
+   The host XBee stand-in copies every frame out of the simulated channel,
+   which a real radio does not. That cost is timed on its own, for the same
+   frames pulled through a spare radio, and subtracted in the net columns.
+   Compare net_cycles between builds; the absolute figures move with the
+   host's clock.
+
+   Usage: rtrans_rx_bench [bursts]
+*/
+
+#include "rtrans.h"
+#include "SoftwareSerial.h"
+#include "checksum.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_xbee.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#define MASTER_ADDR     (0xc088)
+#define SLAVE_SERIAL    (0x40a1b2c3)
+#define SPARE_SERIAL    (0x40a1b2c4)
+
+/* Copy every packet through the rx queue */
+struct queued_config : rt_default_config {
+    static const bool     rx_direct    = false;
+};
+
+/* Run the callback on the received frame */
+struct direct_config : rt_default_config {
+    static const bool     rx_direct    = true;
+};
+
+static unsigned long delivered;
+static uint32_t      touched;
+
+/* Read the payload, like an application acting on a SET would */
+static void rx_callback(rt_in_header *header, uint8_t payload[]){
+        uint8_t i;
+        ++delivered;
+        for(i = 0; i < header->len; i++){
+                touched += payload[i];
+        }
+}
+
+static uint64_t cycles(){
+#ifdef HAVE_RDTSC
+        return __rdtsc();
+#else
+        return 0;
+#endif
+}
+
+/** Build a frame from the master of the given type and payload length */
+static size_t build_frame(uint8_t *frame, uint16_t slave, uint8_t type, uint8_t len, uint16_t pkg_no){
+        rt_out_header h;
+        uint8_t *payload = frame + sizeof(rt_out_header);
+        uint8_t i;
+
+        h.master = MASTER_ADDR;
+        h.slave  = slave;
+        h.pkg_no = pkg_no;
+        h.type   = type;
+        h.seg_ct = 1;
+        h.seg_no = 0;
+        h.len    = len;
+        memcpy(frame, &h, sizeof(h));
+        for(i = 0; i < len; i++){
+                payload[i] = (uint8_t) (pkg_no + i);
+        }
+        payload[len] = 0xff - cs_sum8(0, frame, sizeof(rt_out_header) + len);
+        return sizeof(rt_out_header) + len + 1;
+}
+
+typedef struct rx_result_s {
+        double ns;          // per packet, rt_loop() included
+        double cycles;
+        double stub_ns;     // per packet, spent in the XBee stand-in
+        double stub_cycles;
+        double net_ns;      // per packet, the difference of the two, burst by burst
+        double net_cycles;
+        double loops;       // rt_loop() calls per burst
+        unsigned long dropped;  // packets which never reached the callback
+} rx_result;
+
+/** Median of the samples, each divided by n */
+static double median(std::vector<double> &v, double n){
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        return v[v.size() / 2] / n;
+}
+
+/** Send bursts of the given size to the slave and time the rt_loop() calls
+    until the callback has seen all of them, or the radio has nothing left
+    and a call delivers nothing more (the rest was dropped). Each burst is
+    followed by the same frames pulled through the spare radio, so that
+    the stand-in's share is measured under the same conditions. Reports
+    the median burst, as preemption and frequency changes skew the mean.
+*/
+template <class CFG>
+static rx_result run(rt_basic_state<CFG> &state, sim_channel &channel, int master, sim_xbee &slave,
+                     sim_xbee &spare, uint8_t type, uint8_t len, unsigned burst, unsigned long bursts){
+        typedef std::chrono::steady_clock clock;
+        uint8_t frame[RTRANS_XBEE_MAX_PAYLOAD];
+        uint8_t copy[MAX_FRAME_DATA_SIZE];
+        std::vector<double> busy, busy_cycles, stub, stub_cycles, net, net_cycles;
+        unsigned long loops = 0, dropped = 0, n, k;
+        sim_api_frame f;
+        rx_result r;
+
+        for(n = 0; n < bursts; n++){
+                for(k = 0; k < burst; k++){
+                        size_t flen = build_frame(frame, slave.address(), type, len, (uint16_t) (n * burst + k));
+                        channel.transmit(master, slave.address(), frame, flen);
+                        channel.transmit(master, spare.address(), frame, flen);
+                }
+                unsigned long target = delivered + burst;
+                clock::time_point t0 = clock::now();
+                uint64_t c0 = cycles();
+                while(delivered < target){
+                        unsigned long before = delivered;
+                        state.rt_loop();
+                        ++loops;
+                        if(delivered == before && channel.pending(slave.channel_port()) == 0){
+                                break;
+                        }
+                }
+                uint64_t c1 = cycles();
+                clock::time_point t1 = clock::now();
+                dropped += target - delivered;
+                
+                while(spare.next_frame(f)){
+                        memcpy(copy, f.data.data(), f.data.size());
+                        touched += copy[0];
+                }
+                uint64_t c2 = cycles();
+                clock::time_point t2 = clock::now();
+                
+                busy.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count());
+                stub.push_back(std::chrono::duration<double, std::nano>(t2 - t1).count());
+                net.push_back(busy.back() - stub.back());
+                busy_cycles.push_back(c1 - c0);
+                stub_cycles.push_back(c2 - c1);
+                net_cycles.push_back((double) (c1 - c0) - (double) (c2 - c1));
+        }
+
+        r.ns = median(busy, burst);
+        r.cycles = median(busy_cycles, burst);
+        r.stub_ns = median(stub, burst);
+        r.stub_cycles = median(stub_cycles, burst);
+        r.net_ns = median(net, burst);
+        r.net_cycles = median(net_cycles, burst);
+        r.loops = (double) loops / bursts;
+        r.dropped = dropped;
+        return r;
+}
+
+/** Bring a slave with the given configuration up on its own channel and
+    run every case against it
+*/
+template <class CFG>
+static int bench(const char *name, unsigned long bursts){
+        static const uint8_t types[] = { RTRANS_TYPE_SET, RTRANS_TYPE_POLL };
+        static const uint8_t lens[] = { 0, 40, 80 };
+        static const unsigned sizes[] = { 1, 8 };
+        sim_link_cfg cfg = { 0.0, 0, 0, 0, 1 };
+        sim_channel channel(cfg);
+        sim_xbee radio(channel, SLAVE_SERIAL);
+        sim_xbee spare(channel, SPARE_SERIAL, (uint16_t) SPARE_SERIAL);
+        int master = channel.attach(MASTER_ADDR);
+        SoftwareSerial xs(6, 7);
+        size_t t, l, b;
+
+        xs.sim_connect(radio);
+        rt_basic_state<CFG> state(xs, rx_callback);
+        state.rt_init();
+        while(state.rt_status() != RTRANS_STATUS_READY){
+                if(state.rt_status() == RTRANS_STATUS_FAILED){
+                        fprintf(stderr, "%s: slave failed to come up\n", name);
+                        return 1;
+                }
+                state.rt_loop();
+                sim_advance(1);
+        }
+
+        for(t = 0; t < sizeof(types); t++){
+                for(l = 0; l < sizeof(lens); l++){
+                        for(b = 0; b < sizeof(sizes) / sizeof(sizes[0]); b++){
+                                rx_result r = run(state, channel, master, radio, spare, types[t], lens[l], sizes[b], bursts);
+                                printf("%s,%s,%u,%u,%.1f,%.0f,%.1f,%.0f,%.1f,%.0f,%.2f,%lu\n", name,
+                                       types[t] == RTRANS_TYPE_SET ? "set" : "poll", lens[l], sizes[b],
+                                       r.ns, r.cycles, r.stub_ns, r.stub_cycles,
+                                       r.net_ns, r.net_cycles, r.loops, r.dropped);
+                        }
+                }
+        }
+        return 0;
+}
+
+int main(int argc, char *argv[]){
+        unsigned long bursts = (argc > 1) ? strtoul(argv[1], 0, 10) : 200000;
+        int err = 0;
+
+        printf("path,type,payload,burst,ns,cycles,stub_ns,stub_cycles,net_ns,net_cycles,loops_per_burst,dropped\n");
+        err |= bench<queued_config>("queued", bursts);
+        err |= bench<direct_config>("direct", bursts);
+        if(touched == 1){
+                printf("\n");
+        }
+        return err;
+}
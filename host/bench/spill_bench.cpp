@@ -0,0 +1,352 @@
+/* Outage catch-up benchmark: a joined slave sends a small DATA package
+   every -r ms to the master stand-in; the link goes down (every frame
+   lost) for each of the -o outages in turn and comes back. Without a spill
+   log (drop) what does not get through is gone; with one, in an EEPROM
+   stand-in of -e bytes (a file with -f), it is sent once the link is back.
+   "spill" drains the log in batches of a segment, "single" (batching off)
+   one package per segment. -R 1 restarts the slave halfway through the
+   outage, which picks the log up again with begin(). Reports, of the
+   packages made before the link came back, how many were lost and how
+   many were still to come (the backlog); how long the first of these
+   took to arrive after the link came back, and how fast the rest
+   followed, counting the segments the slave sent meanwhile.
+
+   Usage: rtrans_spill_bench [-o seconds,...] [-r interval_ms] [-p payload]
+                             [-e eeprom_bytes] [-f file] [-b baud] [-l loss]
+                             [-R 0|1] [-S seed]
+*/
+
+#include "rtrans.h"
+#include "SoftwareSerial.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_eeprom.h"
+#include "sim_xbee.h"
+#include "sim_master.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define MASTER_ADDR     (0xc088)
+#define SLAVE_SERIAL    (0x40a1b2c3)
+#define PROBE_INTERVAL  (500)
+#define JOIN_TIMEOUT    (30000)
+#define WARM_UP         (10000)
+#define SETTLE          (5000)      // no backlog delivered for this long: caught up
+#define CATCH_UP_LIMIT  (600000)
+
+/* Spill log of packages up to a segment, drained in batches */
+struct spill_config : rt_default_config {
+    static const uint8_t  spill_record = RTRANS_PAYLOAD_SIZE;
+};
+
+/* Packages drained from the log one per segment */
+struct single_config : spill_config {
+    static const bool     batching     = false;
+};
+
+/* One point of the sweep */
+typedef struct bench_cfg_s {
+    uint64_t    outage;     // ms
+    uint32_t    interval;   // ms between packages
+    size_t      payload;
+    size_t      eeprom;
+    const char  *file;
+    uint32_t    baud;
+    double      loss;
+    bool        restart;    // restart the slave halfway through the outage
+    uint32_t    seed;
+} bench_cfg;
+
+/* Everything measured during a run */
+typedef struct bench_run_s {
+    bool              joined;
+    uint16_t          master_addr;
+    uint32_t          next_id;
+    uint32_t          restore_id;     // first package made after the link came back
+    uint64_t          restored;       // time the link came back, 0 before
+    std::vector<bool> seen;
+    unsigned long     delivered;
+    unsigned long     duplicates;
+    unsigned long     refused;        // rt_send() returned 0
+    unsigned long     backlog;        // packages from before restored, delivered after
+    uint64_t          first_backlog;  // time the first of them was delivered
+    uint64_t          last_backlog;   // and the last
+} bench_run;
+
+static bench_run *run_ctx;
+
+static void slave_callback(rt_in_header *header, uint8_t payload[]){
+        (void) payload;
+        if(header->type == RTRANS_TYPE_PROBE && !run_ctx->joined){
+                run_ctx->master_addr = header->master;
+        }
+}
+
+static void master_callback(void *ctx, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        bench_run *r = (bench_run *) ctx;
+        uint32_t id;
+        (void) slave;
+
+        if(type == RTRANS_TYPE_JOIN){
+                r->joined = true;
+                return;
+        }
+        if(type != RTRANS_TYPE_DATA || len < sizeof(id)){
+                return;
+        }
+        memcpy(&id, payload, sizeof(id));
+        if(id >= r->seen.size()){
+                return;
+        }
+        if(r->seen[id]){
+                r->duplicates++;
+                return;
+        }
+        r->seen[id] = true;
+        r->delivered++;
+        if(r->restored && id < r->restore_id){
+                if(r->backlog++ == 0){
+                        r->first_backlog = sim_now();
+                }
+                r->last_backlog = sim_now();
+        }
+}
+
+/** Make a package and hand it to the driver */
+template <class CFG>
+static void produce(rt_basic_state<CFG> &state, bench_run &r, std::vector<uint8_t> &payload){
+        uint32_t made = sim_now();
+
+        memcpy(&payload[0], &r.next_id, sizeof(r.next_id));
+        memcpy(&payload[4], &made, sizeof(made));
+        r.seen.push_back(false);
+        if(state.rt_send(RTRANS_TYPE_DATA, payload.data(), payload.size()) == 0){
+                r.refused++;
+        }
+        r.next_id++;
+}
+
+/** Bring a slave up and have it join */
+template <class CFG>
+static bool bring_up(rt_basic_state<CFG> &state, sim_master &m, bench_run &r, bool configure){
+        uint64_t start = sim_now();
+        bool join_sent = false;
+
+        r.master_addr = RTRANS_NO_MASTER;
+        state.rt_init(configure);
+        while(!r.joined && sim_now() - start < JOIN_TIMEOUT){
+                state.rt_loop();
+                if(r.master_addr != RTRANS_NO_MASTER && !join_sent){
+                        state.rt_join(r.master_addr);
+                        join_sent = true;
+                }
+                m.loop();
+                if(!r.joined && sim_now() % PROBE_INTERVAL == 0){
+                        m.probe();
+                }
+                sim_advance(1);
+        }
+        return r.joined;
+}
+
+template <class CFG>
+static bool run(const char *name, const bench_cfg &cfg){
+        sim_link_cfg link;
+        bench_run r = bench_run();
+        std::vector<uint8_t> payload(cfg.payload, 0xa5);
+        rt_counters c;
+        uint64_t down, up, next;
+        unsigned long backlog = 0, lost = 0;
+        uint16_t first_segments = 0, last_segments = 0, recovered = 0;
+        uint32_t id;
+        bool spilling = CFG::spill_record > 0;
+        bool restarted = false, broken = false;
+
+        link.loss    = cfg.loss;
+        link.latency = 5;
+        link.jitter  = 0;
+        link.baud    = cfg.baud;
+        link.seed    = cfg.seed;
+
+        sim_reset(0);
+        if(cfg.file){
+                remove(cfg.file);
+        }
+        sim_channel channel(link);
+        sim_xbee radio(channel, SLAVE_SERIAL);
+        SoftwareSerial xs(6, 7);
+        xs.sim_connect(radio);
+        sim_master m(channel, MASTER_ADDR, master_callback, &r);
+        sim_eeprom store(cfg.eeprom, cfg.file);
+        if(!store.ok()){
+                perror(cfg.file);
+                return false;
+        }
+        run_ctx = &r;
+
+        rt_spill_log *log = new rt_spill_log(store);
+        rt_basic_state<CFG> *state = new rt_basic_state<CFG>(xs, slave_callback);
+        log->begin();
+        state->rt_spill(log);
+        if(!bring_up(*state, m, r, true)){
+                fprintf(stderr, "%s: slave did not join\n", name);
+                return false;
+        }
+
+        /* up, down for the outage, then up until the backlog is through */
+        down = sim_now() + WARM_UP;
+        up = down + cfg.outage;
+        next = sim_now();
+        while(!r.restored || sim_now() - r.restored < CATCH_UP_LIMIT){
+                if(sim_now() >= down && !broken){
+                        channel.set_loss(1.0);
+                        broken = true;
+                }
+                if(cfg.restart && !restarted && sim_now() >= down + cfg.outage / 2){
+                        /* a reset: the RAM is gone, the radio and the EEPROM are not */
+                        delete state;
+                        delete log;
+                        log = new rt_spill_log(store);
+                        state = new rt_basic_state<CFG>(xs, slave_callback);
+                        log->begin();
+                        recovered = log->statistics().recovered;
+                        state->rt_spill(log);
+                        state->rt_init();
+                        while(state->rt_status() != RTRANS_STATUS_READY && state->rt_status() != RTRANS_STATUS_FAILED){
+                                state->rt_loop();
+                                sim_advance(1);
+                        }
+                        state->rt_join(MASTER_ADDR);
+                        restarted = true;
+                }
+                if(sim_now() >= up && !r.restored){
+                        channel.set_loss(cfg.loss);
+                        r.restored = sim_now();
+                        r.restore_id = r.next_id;
+                        r.last_backlog = sim_now();
+                }
+                if(r.restored && sim_now() - r.last_backlog >= SETTLE && (!spilling || log->empty())){
+                        break;
+                }
+                while(sim_now() >= next){
+                        produce(*state, r, payload);
+                        next += cfg.interval;
+                }
+                state->rt_loop();
+                m.loop();
+                sim_advance(1);
+
+                /* segments sent while the backlog drained */
+                if(r.backlog != backlog){
+                        state->rt_stats(&c);
+                        if(backlog == 0){
+                                first_segments = c.tx_segments;
+                        }
+                        last_segments = c.tx_segments;
+                        backlog = r.backlog;
+                }
+        }
+
+        for(id = 0; id < r.restore_id; id++){
+                lost += !r.seen[id];
+        }
+        uint64_t drain = r.last_backlog - r.first_backlog;
+        printf("%s,%llu,%d,%u,%lu,%lu,%u,%u,%u,%lu,%llu,%llu,%.1f,%.1f,%u,%lu\n",
+               name, (unsigned long long) cfg.outage / 1000, restarted ? 1 : 0,
+               r.restore_id, lost, r.duplicates,
+               log->statistics().appended, log->statistics().full, recovered,
+               r.backlog, (unsigned long long) (r.backlog ? r.first_backlog - r.restored : 0),
+               (unsigned long long) drain,
+               drain ? (r.backlog - 1) * 1000.0 / drain : 0.0,
+               drain ? (r.backlog - 1) * cfg.payload * 1000.0 / drain : 0.0,
+               (uint16_t) (last_segments - first_segments), store.write_count());
+        delete state;
+        delete log;
+        return true;
+}
+
+/** Parse a comma separated list of numbers */
+static std::vector<double> parse_list(const char *arg){
+        std::vector<double> v;
+        char *end;
+        while(*arg){
+                v.push_back(strtod(arg, &end));
+                if(end == arg){
+                        break;
+                }
+                arg = (*end == ',') ? end + 1 : end;
+        }
+        return v;
+}
+
+int main(int argc, char *argv[]){
+        std::vector<double> outages;
+        bench_cfg cfg;
+        size_t k;
+        bool ok = true;
+        int i;
+
+        outages.push_back(10);
+        outages.push_back(30);
+        outages.push_back(60);
+        outages.push_back(120);
+        cfg.interval = 500;
+        cfg.payload  = 12;
+        cfg.eeprom   = 1024;
+        cfg.file     = 0;
+        cfg.baud     = XBEE_DEFAULT_BAUD;
+        cfg.loss     = 0.0;
+        cfg.restart  = false;
+        cfg.seed     = 1;
+
+        for(i = 1; i + 1 < argc; i += 2){
+                if(strcmp(argv[i], "-o") == 0){
+                        outages = parse_list(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-r") == 0){
+                        cfg.interval = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-p") == 0){
+                        cfg.payload = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-e") == 0){
+                        cfg.eeprom = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-f") == 0){
+                        cfg.file = argv[i + 1];
+                }
+                else if(strcmp(argv[i], "-b") == 0){
+                        cfg.baud = atoi(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-l") == 0){
+                        cfg.loss = atof(argv[i + 1]);
+                }
+                else if(strcmp(argv[i], "-R") == 0){
+                        cfg.restart = atoi(argv[i + 1]) != 0;
+                }
+                else if(strcmp(argv[i], "-S") == 0){
+                        cfg.seed = atoi(argv[i + 1]);
+                }
+                else{
+                        break;
+                }
+        }
+        if(i < argc || cfg.interval == 0 || cfg.payload < 8 || cfg.payload > RTRANS_PAYLOAD_SIZE){
+                fprintf(stderr, "usage: %s [-o seconds,...] [-r interval_ms] [-p payload (8-%u)] [-e eeprom_bytes]"
+                        " [-f file] [-b baud] [-l loss] [-R 0|1] [-S seed]\n", argv[0], (unsigned) RTRANS_PAYLOAD_SIZE);
+                return 2;
+        }
+
+        printf("log,outage_s,restart,made,lost,duplicates,spilled,log_full,recovered,"
+               "backlog,resume_ms,drain_ms,drain_pps,drain_Bps,drain_segments,eeprom_writes\n");
+        for(k = 0; k < outages.size(); k++){
+                cfg.outage = outages[k] * 1000;
+                ok &= run<rt_default_config>("drop", cfg);
+                ok &= run<spill_config>("spill", cfg);
+                ok &= run<single_config>("single", cfg);
+        }
+        return ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+/* Timer benchmark: the master's timer wheel against a sorted multimap and
+   the deadline scan it replaced, under the master's timer pattern. Every
+   flow has a timer that is pushed back whenever a segment arrives, is
+   cancelled when the package completes and is re-armed when it fires,
+   like a poll retry.
+
+   Usage: rtrans_tw_bench [flows,...] [seconds]
+
+   All three run the same operations on a simulated millisecond clock and
+   must fire the same timers at the same ticks; a mismatch is an error.
+*/
+
+#include "timer_wheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <map>
+#include <vector>
+
+#define FLOW_TIMEOUT    (5000)
+#define POLL_TIMEOUT    (2000)
+
+/* Operations per simulated second, per flow: a segment every 3 s or so,
+   so that many timers run out before they are pushed back
+*/
+#define REARMS_PER_S    (0.3)
+#define CANCELS_PER_S   (0.05)
+
+/* Result of one run */
+typedef struct bench_result_s {
+    unsigned long ops;      // adds, re-arms and cancels
+    unsigned long fired;
+    uint64_t      digest;   // order-independent digest of (tick, flow) of every expiry
+    double        ns;
+} bench_result;
+
+static uint32_t rng_state;
+
+static uint32_t rng(){
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        return rng_state;
+}
+
+static uint64_t mix(uint64_t tick, size_t flow){
+        uint64_t x = tick * 0x9e3779b97f4a7c15ULL ^ (flow + 1) * 0xc2b2ae3d27d4eb4fULL;
+        x ^= x >> 31;
+        return x * 0x94d049bb133111ebULL;
+}
+
+/** Timer wheel, as used by rt_master */
+struct wheel_timers {
+        timer_wheel           w;
+        std::vector<tw_timer> t;
+        bench_result          *r;
+
+        static void fired(void *ctx, void *arg){
+                wheel_timers *self = (wheel_timers *) ctx;
+                size_t i = (tw_timer *) arg - self->t.data();
+                self->r->fired++;
+                self->r->digest += mix(self->w.now, i);
+                tw_add(&self->w, &self->t[i], self->w.now + POLL_TIMEOUT);
+        }
+        void init(size_t n, bench_result *res){
+                r = res;
+                t.resize(n);
+                tw_init(&w, 0);
+                for(size_t i = 0; i < n; i++){
+                        tw_timer_init(&t[i], fired, this, &t[i]);
+                }
+        }
+        void arm(size_t i, uint64_t when){ tw_add(&w, &t[i], when); }
+        void cancel(size_t i){ tw_cancel(&w, &t[i]); }
+        bool pending(size_t i){ return tw_pending(&t[i]); }
+        void advance(uint64_t now){ tw_advance(&w, now); }
+};
+
+/** Balanced tree keyed by deadline, one iterator per flow */
+struct map_timers {
+        typedef std::multimap<uint64_t, size_t> tree;
+        tree                          m;
+        std::vector<tree::iterator>   it;
+        std::vector<bool>             armed;
+        bench_result                  *r;
+
+        void init(size_t n, bench_result *res){
+                r = res;
+                it.resize(n);
+                armed.assign(n, false);
+        }
+        void arm(size_t i, uint64_t when){
+                if(armed[i]){
+                        m.erase(it[i]);
+                }
+                it[i] = m.insert(std::make_pair(when, i));
+                armed[i] = true;
+        }
+        void cancel(size_t i){
+                if(armed[i]){
+                        m.erase(it[i]);
+                        armed[i] = false;
+                }
+        }
+        bool pending(size_t i){ return armed[i]; }
+        void advance(uint64_t now){
+                while(!m.empty() && m.begin()->first <= now){
+                        size_t i = m.begin()->second;
+                        m.erase(m.begin());
+                        armed[i] = false;
+                        r->fired++;
+                        r->digest += mix(now, i);
+                        arm(i, now + POLL_TIMEOUT);
+                }
+        }
+};
+
+/** One deadline per flow and a scan of all of them whenever the earliest
+    is due, as rt_master did before the wheel
+*/
+struct scan_timers {
+        std::vector<uint64_t> deadline;
+        uint64_t              next;
+        bench_result          *r;
+
+        void init(size_t n, bench_result *res){
+                r = res;
+                deadline.assign(n, UINT64_MAX);
+                next = UINT64_MAX;
+        }
+        void arm(size_t i, uint64_t when){
+                deadline[i] = when;
+                if(when < next){
+                        next = when;
+                }
+        }
+        void cancel(size_t i){ deadline[i] = UINT64_MAX; }
+        bool pending(size_t i){ return deadline[i] != UINT64_MAX; }
+        void advance(uint64_t now){
+                if(now < next){
+                        return;
+                }
+                next = UINT64_MAX;
+                for(size_t i = 0; i < deadline.size(); i++){
+                        if(deadline[i] <= now){
+                                r->fired++;
+                                r->digest += mix(now, i);
+                                deadline[i] = now + POLL_TIMEOUT;
+                        }
+                        if(deadline[i] < next){
+                                next = deadline[i];
+                        }
+                }
+        }
+};
+
+template <class T>
+static bench_result run(size_t flows, uint64_t duration){
+        bench_result r = bench_result();
+        double rearms = flows * REARMS_PER_S / 1000, cancels = flows * CANCELS_PER_S / 1000;
+        double rearm_due = 0, cancel_due = 0;
+        uint64_t now;
+        T timers;
+
+        rng_state = 12345;
+        timers.init(flows, &r);
+
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < flows; i++){
+                timers.arm(i, 1 + rng() % FLOW_TIMEOUT);
+                r.ops++;
+        }
+        for(now = 1; now <= duration; now++){
+                /* segments arriving push their flow's timer back */
+                for(rearm_due += rearms; rearm_due >= 1; rearm_due--){
+                        timers.arm(rng() % flows, now + FLOW_TIMEOUT);
+                        r.ops++;
+                }
+                /* packages completing cancel it; a new one starts right after */
+                for(cancel_due += cancels; cancel_due >= 1; cancel_due--){
+                        size_t i = rng() % flows;
+                        if(timers.pending(i)){
+                                timers.cancel(i);
+                        }
+                        else{
+                                timers.arm(i, now + POLL_TIMEOUT);
+                        }
+                        r.ops++;
+                }
+                timers.advance(now);
+        }
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        r.ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        return r;
+}
+
+static void report(const char *name, size_t flows, const bench_result &r, uint64_t duration){
+        unsigned long events = r.ops + r.fired;
+        printf("%s,%zu,%lu,%lu,%.1f,%.2f,%.2f\n", name, flows, r.ops, r.fired, r.ns / events,
+               events / (r.ns / 1e9) / 1e6, r.ns / duration / 1000.0);
+}
+
+int main(int argc, char *argv[]){
+        std::vector<size_t> counts;
+        const char *list = (argc > 1) ? argv[1] : "1000,10000,100000";
+        uint64_t duration = (argc > 2) ? atof(argv[2]) * 1000 : 20000;
+        char *end;
+
+        while(*list){
+                size_t n = strtoul(list, &end, 10);
+                if(end == list){
+                        break;
+                }
+                if(n > 0){
+                        counts.push_back(n);
+                }
+                list = (*end == ',') ? end + 1 : end;
+        }
+
+        printf("timers,flows,ops,fired,ns_per_event,Mevents_per_s,us_per_tick\n");
+        for(size_t c = 0; c < counts.size(); c++){
+                bench_result w = run<wheel_timers>(counts[c], duration);
+                bench_result m = run<map_timers>(counts[c], duration);
+                bench_result s = run<scan_timers>(counts[c], duration);
+                report("wheel", counts[c], w, duration);
+                report("multimap", counts[c], m, duration);
+                report("scan", counts[c], s, duration);
+                if(w.fired != m.fired || w.digest != m.digest || w.fired != s.fired || w.digest != s.digest){
+                        fprintf(stderr, "timers disagree at %zu flows\n", counts[c]);
+                        return 1;
+                }
+                fflush(stdout);
+        }
+        return 0;
+}
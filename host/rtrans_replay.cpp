@@ -0,0 +1,640 @@
+/* Replay of a frame trace (see rt_trace.h) through a slave driver on the
+   simulated clock, to reproduce offline what a node did in the field.
+
+   Usage: rtrans_replay [-s slave] [-c default|small|large] [-o trace_file] [-v] trace_file
+
+   A slave's own trace (rt_trace_read(), rtrans_sim) replays the frames it
+   received and its rt_send() calls at the times they happened. A master's
+   trace (rtrans_base, rtrans_master_bench -T) replays the frames the master
+   sent the slave given with -s, by default the first one heard from, and
+   the slave answers each POLL with the next package the master got from it,
+   of the same type and length. The frames go through rt_loop() and so
+   rt_handle_incoming() as they would from the radio, under the trace's
+   timing; the slave's checksum is taken from the frames it sent, -c picks
+   the configuration it was built with.
+
+   The replay is open loop: the slave is fed the recorded frames whatever it
+   sends, so with the same driver and configuration it sends what was
+   recorded, frame for frame, and where it does not shows how a change to
+   the driver plays out on that trace. A trace should start before the
+   slave joined; otherwise it is joined first, one frame the recording does
+   not have, and its package numbers need not match the recorded ACKs.
+
+   Reports the frames the slave sent in the recording and the replay, their
+   retransmissions and how long packages took from the first to the last
+   transmission of their segments, the first frame in which the two part,
+   and the packages which took longest in the replay. -v lists every frame
+   the replayed slave sent, -o writes the replay out as a slave trace.
+*/
+
+#include "rtrans.h"
+#include "SoftwareSerial.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_xbee.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+
+#define SLAVE_SERIAL_HI (0x40a10000)    // upper half of the replayed radio's serial number
+#define UP_TIMEOUT      (10000)         // ms the slave may take to come up
+#define OUTLIERS        (5)             // packages listed
+
+/* Trace record, read into memory */
+typedef struct trace_rec_s {
+    uint32_t             time;
+    uint16_t             peer;
+    uint8_t              kind;      // without RT_TRACE_LOST
+    bool                 lost;      // records were dropped before this one
+    std::vector<uint8_t> data;
+} trace_rec;
+
+/* Frame the slave sent, recorded or replayed */
+typedef struct tx_frame_s {
+    uint64_t             time;      // trace time
+    uint16_t             master;
+    std::vector<uint8_t> data;
+} tx_frame;
+
+/* Package the slave sends in reply to a POLL, in master trace replays */
+typedef struct app_package_s {
+    uint8_t type;
+    size_t  len;
+} app_package;
+
+/* What one side of the comparison sent */
+typedef struct tx_summary_s {
+    unsigned long         frames;
+    unsigned long         segments;     // DATA and ERR segments, first transmissions
+    unsigned long         retransmits;
+    unsigned long         packages;
+    std::vector<uint64_t> spans;        // first to last transmission of a package, ms
+    struct outlier {
+        uint64_t span;
+        uint64_t time;
+        uint8_t  pkg_no;
+        unsigned tx;
+    };
+    std::vector<outlier>  outliers;
+} tx_summary;
+
+typedef struct options_s {
+    int         slave;      // -1 for the first one heard from
+    const char  *config;
+    const char  *out;
+    bool        verbose;
+} options;
+
+/* The trace and the replay state, shared with the slave callback */
+static std::vector<trace_rec>   records;
+static rt_trace_file            header;
+static uint16_t                 slave_addr;
+static uint8_t                  slave_trailer = 1;
+static std::deque<app_package>  app_queue;
+static std::vector<tx_frame>    replayed;
+static int64_t                  offset;        // replay time minus trace time
+static int                      slave_port;
+static FILE                     *out;
+
+/** Header of a frame between master and slave, either format */
+static bool frame_header(const std::vector<uint8_t> &d, uint16_t master, uint16_t slave, bool from_slave,
+                         rt_out_header *h){
+        if(rt_frame_full(d.data(), d.size(), master)){
+                if(d.size() < sizeof(rt_out_header)){
+                        return false;
+                }
+                memcpy(h, d.data(), sizeof(*h));
+                return true;
+        }
+        return rt_compact_decode(h, d.data(), d.size(), from_slave ? RTRANS_COMPACT_SLAVE : RTRANS_COMPACT_MASTER,
+                                 from_slave ? slave_trailer : 1, master, slave);
+}
+
+static void describe(char *buf, size_t n, const tx_frame &f){
+        rt_out_header h;
+
+        if(!frame_header(f.data, f.master, slave_addr, true, &h)){
+                snprintf(buf, n, "%llu ms, %zu bytes unreadable", (unsigned long long) f.time, f.data.size());
+        }
+        else{
+                snprintf(buf, n, "%llu ms, type %u pkg %u seg %u/%u, %u bytes%s", (unsigned long long) f.time,
+                         h.type, h.pkg_no, h.seg_no, h.seg_ct, h.len,
+                         rt_frame_full(f.data.data(), f.data.size(), f.master) ? "" : " (compact)");
+        }
+}
+
+/** Whether two frames the slave sent agree; application payloads are not
+    in the trace and are replayed as zeros, and counters in STATS replies
+    depend on how long the node had been up, so only their length counts
+*/
+static bool same_frame(const tx_frame &a, const tx_frame &b){
+        rt_out_header ha, hb;
+        bool full = rt_frame_full(a.data.data(), a.data.size(), a.master);
+
+        if(a.master != b.master || a.data.size() != b.data.size() ||
+           full != rt_frame_full(b.data.data(), b.data.size(), b.master)){
+                return false;
+        }
+        if(!frame_header(a.data, a.master, slave_addr, true, &ha) ||
+           !frame_header(b.data, b.master, slave_addr, true, &hb)){
+                return a.data == b.data;
+        }
+        if((ha.type & RTRANS_TYPE_MASK) == RTRANS_TYPE_DATA || (ha.type & RTRANS_TYPE_MASK) == RTRANS_TYPE_ERR ||
+            (ha.type & RTRANS_TYPE_MASK) == RTRANS_TYPE_STATS){
+                return memcmp(&ha, &hb, sizeof(ha)) == 0;
+        }
+        return a.data == b.data;
+}
+
+static void write_record(uint64_t time, uint16_t peer, uint8_t kind, const uint8_t *data, size_t len){
+        rt_trace_record r;
+
+        if(!out){
+                return;
+        }
+        r.time = time;
+        r.peer = peer;
+        r.kind = kind;
+        r.len  = len;
+        fwrite(&r, sizeof(r), 1, out);
+        fwrite(data, 1, len, out);
+}
+
+/** Count frames, first transmissions and retransmissions of segments, and
+    how long each package took; package numbers half a wrap away are taken
+    to be new packages
+*/
+static tx_summary summarize(const std::vector<tx_frame> &frames){
+        struct open_pkg {
+                uint64_t first;
+                uint64_t last;
+                unsigned tx;
+                std::map<uint8_t, bool> segs;
+        };
+        std::map<uint8_t, open_pkg> open;
+        tx_summary s = tx_summary();
+        size_t i;
+
+        for(i = 0; i <= frames.size(); i++){
+                rt_out_header h;
+                uint8_t type;
+                bool done = i == frames.size();
+
+                if(!done){
+                        s.frames++;
+                        if(!frame_header(frames[i].data, frames[i].master, slave_addr, true, &h)){
+                                continue;
+                        }
+                        type = h.type & RTRANS_TYPE_MASK;
+                        if(h.type >= RTRANS_TYPE_ACK || (type != RTRANS_TYPE_DATA && type != RTRANS_TYPE_ERR)){
+                                continue;
+                        }
+                }
+                std::map<uint8_t, open_pkg>::iterator it = open.begin();
+                while(it != open.end()){
+                        if(!done && it->first != (uint8_t) (h.pkg_no + 128)){
+                                ++it;
+                                continue;
+                        }
+                        tx_summary::outlier o = { it->second.last - it->second.first, it->second.first,
+                                                  it->first, it->second.tx };
+                        s.packages++;
+                        s.spans.push_back(o.span);
+                        s.outliers.push_back(o);
+                        open.erase(it++);
+                }
+                if(done){
+                        break;
+                }
+                open_pkg &p = open[h.pkg_no];
+                if(p.tx == 0){
+                        p.first = frames[i].time;
+                }
+                p.last = frames[i].time;
+                p.tx++;
+                if(p.segs[h.seg_no]){
+                        s.retransmits++;
+                }
+                else{
+                        p.segs[h.seg_no] = true;
+                        s.segments++;
+                }
+        }
+        std::sort(s.spans.begin(), s.spans.end());
+        return s;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &v, double p){
+        return v.empty() ? 0 : v[std::min(v.size() - 1, (size_t) (p / 100.0 * v.size()))];
+}
+
+static void channel_tap(void *ctx, int port, uint16_t dst, const uint8_t *data, size_t len, double airtime){
+        tx_frame f;
+        (void) ctx;
+        (void) airtime;
+
+        if(port != slave_port){
+                return;
+        }
+        f.time   = sim_now() - offset;
+        f.master = dst;
+        f.data.assign(data, data + len);
+        replayed.push_back(f);
+        write_record(f.time, dst, RT_TRACE_TX, data, len);
+}
+
+/* Configurations the slave may have been built with, and their CRC variants */
+template <class BASE>
+struct crc_config : BASE {
+    static const uint8_t  checksum     = RTRANS_CHECKSUM_CRC16;
+};
+
+template <class CFG>
+struct replay_slave {
+        static rt_basic_state<CFG> *state;
+        static bool joined;
+
+        /** Slave application of a master trace replay: join on the first
+            PROBE, answer each POLL with the next package the master got
+        */
+        static void callback(rt_in_header *hdr, uint8_t payload[]){
+                static uint8_t zeros[RTRANS_MAX_SEGMENTS * RTRANS_PAYLOAD_SIZE];
+                (void) payload;
+
+                if(header.role != RT_TRACE_MASTER){
+                        return;
+                }
+                if(hdr->type == RTRANS_TYPE_PROBE && !joined){
+                        state->rt_join(hdr->master);
+                        joined = true;
+                }
+                else if(hdr->type == RTRANS_TYPE_POLL && !app_queue.empty()){
+                        app_package p = app_queue.front();
+                        app_queue.pop_front();
+                        state->rt_send(p.type, zeros, std::min(p.len, sizeof(zeros)));
+                }
+        }
+};
+
+template <class CFG> rt_basic_state<CFG> *replay_slave<CFG>::state;
+template <class CFG> bool replay_slave<CFG>::joined;
+
+template <class CFG>
+static bool replay(){
+        sim_link_cfg link = { 0.0, 0, 0, 0, 1 };
+        sim_channel channel(link);
+        sim_xbee radio(channel, SLAVE_SERIAL_HI | slave_addr);
+        SoftwareSerial xs(6, 7);
+        xs.sim_connect(radio);
+        rt_basic_state<CFG> state(xs, replay_slave<CFG>::callback);
+        std::map<uint16_t, int> ports;
+        uint64_t up, end;
+        size_t next = 0;
+        sim_frame f;
+
+        replay_slave<CFG>::state = &state;
+        replay_slave<CFG>::joined = false;
+        slave_port = radio.channel_port();
+        channel.set_tap(channel_tap, 0);
+
+        sim_reset(0);
+        state.rt_init();
+        while(state.rt_status() != RTRANS_STATUS_READY){
+                if(state.rt_status() == RTRANS_STATUS_FAILED || sim_now() > UP_TIMEOUT){
+                        fprintf(stderr, "replayed slave did not come up\n");
+                        return false;
+                }
+                state.rt_loop();
+                sim_advance(1);
+        }
+        up = sim_now();
+        offset = (int64_t) up - records.front().time;
+        end = records.back().time + offset;
+        replayed.clear();
+
+        /* a trace which does not start with the slave joining: the first
+           thing it sends, or the first thing the master sends it, is not
+           part of a join
+        */
+        for(size_t i = 0; i < records.size(); i++){
+                const trace_rec &r = records[i];
+                uint16_t master;
+                if(header.role == RT_TRACE_SLAVE){
+                        if(r.kind != RT_TRACE_SEND && r.kind != RT_TRACE_TX){
+                                continue;
+                        }
+                        if(r.kind == RT_TRACE_SEND && r.data.size() == RT_TRACE_SEND_LEN &&
+                           r.data[0] == RTRANS_TYPE_JOIN){
+                                break;
+                        }
+                        master = r.peer;
+                }
+                else{
+                        if(r.kind != RT_TRACE_TX || (r.peer != slave_addr && r.peer != SIM_BROADCAST)){
+                                continue;
+                        }
+                        if(r.peer == SIM_BROADCAST){
+                                break;
+                        }
+                        master = header.addr;
+                }
+                printf("trace starts with the slave joined to %04x, joining it first\n", master);
+                state.rt_join(master);
+                replay_slave<CFG>::joined = true;
+                break;
+        }
+
+        while(true){
+                bool fed = false;
+
+                while(next < records.size() && (int64_t) records[next].time + offset <= (int64_t) sim_now()){
+                        const trace_rec &r = records[next++];
+                        if(header.role == RT_TRACE_SLAVE && r.kind == RT_TRACE_SEND && r.data.size() == RT_TRACE_SEND_LEN){
+                                static uint8_t zeros[RTRANS_MAX_SEGMENTS * RTRANS_PAYLOAD_SIZE];
+                                size_t len = std::min((size_t) (r.data[1] | (r.data[2] << 8)), sizeof(zeros));
+                                if(fed){
+                                        state.rt_loop();
+                                        fed = false;
+                                }
+                                write_record(r.time, r.peer, RT_TRACE_SEND, r.data.data(), r.data.size());
+                                if(r.data[0] == RTRANS_TYPE_STATS){
+                                        /* the driver's own answer to a STATS request, replayed with it */
+                                }
+                                else if(r.data[0] == RTRANS_TYPE_JOIN){
+                                        state.rt_join(r.peer);
+                                }
+                                else{
+                                        state.rt_send(r.data[0], zeros, len);
+                                }
+                                continue;
+                        }
+
+                        /* frames to the slave: what it received, or what the master sent it */
+                        uint16_t src = r.peer;
+                        if(header.role == RT_TRACE_MASTER){
+                                if(r.kind != RT_TRACE_TX || (r.peer != slave_addr && r.peer != SIM_BROADCAST)){
+                                        continue;
+                                }
+                                src = header.addr;
+                        }
+                        else if(r.kind != RT_TRACE_RX){
+                                continue;
+                        }
+                        if(ports.count(src) == 0){
+                                ports[src] = channel.attach(src);
+                        }
+                        channel.transmit(ports[src], slave_addr, r.data.data(), r.data.size());
+                        write_record(r.time, src, RT_TRACE_RX, r.data.data(), r.data.size());
+                        fed = true;
+                }
+                state.rt_loop();
+                for(std::map<uint16_t, int>::iterator p = ports.begin(); p != ports.end(); ++p){
+                        while(channel.receive(p->second, f)){
+                        }
+                }
+                if(sim_now() >= end){
+                        break;
+                }
+                sim_advance(1);
+        }
+        printf("replay: slave up after %llu ms, %llu ms replayed\n", (unsigned long long) up,
+               (unsigned long long) (end - up));
+        return true;
+}
+
+template <class CFG>
+static bool replay_checksum(){
+        return (slave_trailer == 2) ? replay<crc_config<CFG> >() : replay<CFG>();
+}
+
+static bool load(const char *path){
+        FILE *f = fopen(path, "rb");
+        rt_trace_record r;
+        trace_rec t;
+
+        if(!f){
+                perror(path);
+                return false;
+        }
+        if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != RT_TRACE_MAGIC ||
+           header.version != RT_TRACE_VERSION){
+                fprintf(stderr, "%s: not a trace\n", path);
+                fclose(f);
+                return false;
+        }
+        while(fread(&r, sizeof(r), 1, f) == 1){
+                t.time = r.time;
+                t.peer = r.peer;
+                t.kind = r.kind & RT_TRACE_KIND_MASK;
+                t.lost = (r.kind & RT_TRACE_LOST) != 0;
+                t.data.resize(r.len);
+                if(r.len > 0 && fread(t.data.data(), 1, r.len, f) != r.len){
+                        break;
+                }
+                records.push_back(t);
+        }
+        fclose(f);
+        if(records.empty()){
+                fprintf(stderr, "%s: no records\n", path);
+                return false;
+        }
+        return true;
+}
+
+int main(int argc, char *argv[]){
+        std::vector<tx_frame> recorded;
+        options opt = { -1, "default", 0, false };
+        unsigned long gaps = 0, fed = 0, sends = 0;
+        size_t i;
+        int a;
+        bool ok;
+
+        for(a = 1; a < argc - 1; a++){
+                if(strcmp(argv[a], "-s") == 0 && a + 2 < argc){
+                        opt.slave = strtoul(argv[++a], 0, 16);
+                }
+                else if(strcmp(argv[a], "-c") == 0 && a + 2 < argc){
+                        opt.config = argv[++a];
+                }
+                else if(strcmp(argv[a], "-o") == 0 && a + 2 < argc){
+                        opt.out = argv[++a];
+                }
+                else if(strcmp(argv[a], "-v") == 0){
+                        opt.verbose = true;
+                }
+                else{
+                        break;
+                }
+        }
+        if(a != argc - 1 || (strcmp(opt.config, "default") != 0 && strcmp(opt.config, "small") != 0 &&
+                             strcmp(opt.config, "large") != 0)){
+                fprintf(stderr, "usage: %s [-s slave] [-c default|small|large] [-o trace_file] [-v] trace_file\n", argv[0]);
+                return 2;
+        }
+        if(!load(argv[a])){
+                return 1;
+        }
+
+        /* the slave, and the frames it sent */
+        if(header.role == RT_TRACE_SLAVE){
+                slave_addr = header.addr;
+        }
+        else if(opt.slave >= 0){
+                slave_addr = opt.slave;
+        }
+        else{
+                for(i = 0; i < records.size() && records[i].kind != RT_TRACE_RX; i++){
+                }
+                if(i == records.size()){
+                        fprintf(stderr, "no slave was heard from\n");
+                        return 1;
+                }
+                slave_addr = records[i].peer;
+        }
+        for(i = 0; i < records.size(); i++){
+                const trace_rec &r = records[i];
+                gaps += r.lost ? 1 : 0;
+                if(header.role == RT_TRACE_SLAVE ? r.kind == RT_TRACE_TX : (r.kind == RT_TRACE_RX && r.peer == slave_addr)){
+                        tx_frame f;
+                        f.time   = r.time;
+                        f.master = (header.role == RT_TRACE_SLAVE) ? r.peer : header.addr;
+                        f.data   = r.data;
+                        recorded.push_back(f);
+                }
+                else if(header.role == RT_TRACE_SLAVE ? r.kind == RT_TRACE_RX :
+                        (r.kind == RT_TRACE_TX && (r.peer == slave_addr || r.peer == SIM_BROADCAST))){
+                        fed++;
+                }
+                else if(r.kind == RT_TRACE_SEND){
+                        sends++;
+                }
+        }
+        for(i = 0; i < recorded.size(); i++){
+                rt_out_header h;
+                if(rt_frame_full(recorded[i].data.data(), recorded[i].data.size(), recorded[i].master) &&
+                   frame_header(recorded[i].data, recorded[i].master, slave_addr, true, &h)){
+                        slave_trailer = (recorded[i].data.size() - sizeof(h) - h.len == 2) ? 2 : 1;
+                        break;
+                }
+        }
+
+        /* in a master trace, the packages the slave sent make up its answers to polls */
+        if(header.role == RT_TRACE_MASTER){
+                std::deque<uint8_t> recent;
+                std::map<uint8_t, size_t> pending;
+                std::map<uint8_t, uint32_t> segs;
+                for(i = 0; i < recorded.size(); i++){
+                        rt_out_header h;
+                        uint8_t type;
+                        if(!frame_header(recorded[i].data, recorded[i].master, slave_addr, true, &h)){
+                                continue;
+                        }
+                        type = h.type & RTRANS_TYPE_MASK;
+                        if(h.type >= RTRANS_TYPE_ACK || (type != RTRANS_TYPE_DATA && type != RTRANS_TYPE_ERR)){
+                                continue;
+                        }
+                        if(std::find(recent.begin(), recent.end(), (uint8_t) h.pkg_no) == recent.end()){
+                                app_package p = { type, 0 };
+                                recent.push_back(h.pkg_no);
+                                if(recent.size() > RTRANS_DUP_WINDOW){
+                                        recent.pop_front();
+                                }
+                                pending[h.pkg_no] = app_queue.size();
+                                segs[h.pkg_no] = 0;
+                                app_queue.push_back(p);
+                        }
+                        if(!(segs[h.pkg_no] & (1UL << h.seg_no))){
+                                segs[h.pkg_no] |= 1UL << h.seg_no;
+                                app_queue[pending[h.pkg_no]].len += h.len;
+                        }
+                }
+        }
+
+        printf("trace: %s %04x, %zu records over %.1f s, %lu gaps\n",
+               header.role == RT_TRACE_SLAVE ? "slave" : "master", header.addr, records.size(),
+               (records.back().time - records.front().time) / 1000.0, gaps);
+        printf("slave %04x: %zu frames %s, %s checksum; %lu frames to it, %lu %s\n", slave_addr, recorded.size(),
+               header.role == RT_TRACE_SLAVE ? "sent" : "heard", slave_trailer == 2 ? "CRC-16" : "8-bit", fed,
+               header.role == RT_TRACE_SLAVE ? sends : (unsigned long) app_queue.size(),
+               header.role == RT_TRACE_SLAVE ? "rt_send() calls" : "packages");
+
+        if(opt.out){
+                rt_trace_file h = { RT_TRACE_MAGIC, RT_TRACE_VERSION, RT_TRACE_SLAVE, slave_addr };
+                if((out = fopen(opt.out, "wb")) == 0){
+                        perror(opt.out);
+                        return 1;
+                }
+                fwrite(&h, sizeof(h), 1, out);
+        }
+        if(strcmp(opt.config, "small") == 0){
+                ok = replay_checksum<rt_small_config>();
+        }
+        else if(strcmp(opt.config, "large") == 0){
+                ok = replay_checksum<rt_large_config>();
+        }
+        else{
+                ok = replay_checksum<rt_default_config>();
+        }
+        if(out){
+                fclose(out);
+        }
+        if(!ok){
+                return 1;
+        }
+
+        tx_summary rs = summarize(recorded), ps = summarize(replayed);
+        printf("                       recorded    replayed\n");
+        printf("frames sent          %10lu  %10lu\n", rs.frames, ps.frames);
+        printf("segments             %10lu  %10lu\n", rs.segments, ps.segments);
+        printf("retransmissions      %10lu  %10lu\n", rs.retransmits, ps.retransmits);
+        printf("packages             %10lu  %10lu\n", rs.packages, ps.packages);
+        printf("span p50/p99/max ms  %4llu/%llu/%llu  %4llu/%llu/%llu\n",
+               (unsigned long long) percentile(rs.spans, 50), (unsigned long long) percentile(rs.spans, 99),
+               (unsigned long long) percentile(rs.spans, 100), (unsigned long long) percentile(ps.spans, 50),
+               (unsigned long long) percentile(ps.spans, 99), (unsigned long long) percentile(ps.spans, 100));
+
+        /* where the replay parts from the recording */
+        for(i = 0; i < recorded.size() && i < replayed.size(); i++){
+                if(recorded[i].time != replayed[i].time || !same_frame(recorded[i], replayed[i])){
+                        break;
+                }
+        }
+        if(i == recorded.size() && i == replayed.size()){
+                printf("the replay matches the recording frame for frame\n");
+        }
+        else{
+                char rb[96], pb[96];
+                snprintf(rb, sizeof(rb), "none");
+                snprintf(pb, sizeof(pb), "none");
+                if(i < recorded.size()){
+                        describe(rb, sizeof(rb), recorded[i]);
+                }
+                if(i < replayed.size()){
+                        describe(pb, sizeof(pb), replayed[i]);
+                }
+                printf("the replay parts from the recording at frame %zu\n  recorded: %s\n  replayed: %s\n", i, rb, pb);
+        }
+
+        std::sort(ps.outliers.begin(), ps.outliers.end(),
+                  [](const tx_summary::outlier &x, const tx_summary::outlier &y){ return x.span > y.span; });
+        if(!ps.outliers.empty()){
+                printf("longest packages in the replay:\n");
+        }
+        for(i = 0; i < ps.outliers.size() && i < OUTLIERS; i++){
+                const tx_summary::outlier &o = ps.outliers[i];
+                printf("  pkg %3u at %llu ms: %u transmissions over %llu ms\n", o.pkg_no,
+                       (unsigned long long) o.time, o.tx, (unsigned long long) o.span);
+        }
+        if(opt.verbose){
+                for(i = 0; i < replayed.size(); i++){
+                        char b[96];
+                        describe(b, sizeof(b), replayed[i]);
+                        printf("tx %s\n", b);
+                }
+        }
+        return 0;
+}
@@ -0,0 +1,214 @@
+/* Host-side simulation of one slave running the example sketch against a
+   master stand-in over a simulated lossy link. Given a file, the slave's
+   frame trace is written to it for rtrans_replay.
+
+   Usage: rtrans_sim [loss] [latency_ms] [jitter_ms] [baud] [seconds] [seed] [trace_file]
+*/
+
+#include "rtrans.h"
+#include "SoftwareSerial.h"
+#include "sim_clock.h"
+#include "sim_channel.h"
+#include "sim_xbee.h"
+#include "sim_master.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MASTER_ADDR     (0xc088)
+#define SLAVE_SERIAL    (0x40a1b2c3)
+#define POLL_RETX       (2000)
+#define PROBE_INTERVAL  (500)
+#define SET_INTERVAL    (10000)
+#define SET_LENGTH      (150)   // two segments
+
+/* The slave keeps a trace, drained every millisecond */
+struct sim_config : rt_default_config {
+    static const size_t   trace_buffer = 1024;
+};
+typedef rt_basic_state<sim_config> sim_state;
+
+static const uint8_t hello[] = "Hello world!";
+
+static sim_state   *slave_state;
+static sim_master  *master;
+static bool        joined = false;
+static uint64_t    last_poll = 0;
+static uint16_t    slave_addr = 0;
+static unsigned long received = 0;
+static unsigned long corrupt = 0;
+static rt_counters slave_counters;
+static bool        have_counters = false;
+static uint8_t     set_payload[SET_LENGTH];
+static unsigned long sets_sent = 0;
+static unsigned long sets_received = 0;
+static unsigned long sets_corrupt = 0;
+
+/* Slave application, as in example/trans_example.ino */
+static void slave_callback(rt_in_header *header, uint8_t payload[]){
+        static bool slave_joined = false;
+        if(header->type == RTRANS_TYPE_POLL){
+                slave_state->rt_send(RTRANS_TYPE_DATA, hello, sizeof(hello) - 1);
+        }
+        else if(header->type == RTRANS_TYPE_SET){
+                ++sets_received;
+                if(header->len != SET_LENGTH || memcmp(payload, set_payload, SET_LENGTH) != 0){
+                        ++sets_corrupt;
+                }
+        }
+        else if(header->type == RTRANS_TYPE_PROBE && !slave_joined){
+                slave_state->rt_join(header->master);
+                slave_joined = true;
+        }
+}
+
+/* Write out the slave's trace records, after the header once its address is known */
+static void trace_drain(FILE *trace){
+        static bool started = false;
+        uint8_t buf[256];
+        size_t n;
+
+        if(!trace || slave_state->rt_status() != RTRANS_STATUS_READY){
+                return;
+        }
+        if(!started){
+                rt_trace_file h;
+                slave_state->rt_trace_header(&h);
+                fwrite(&h, sizeof(h), 1, trace);
+                started = true;
+        }
+        while((n = slave_state->rt_trace_read(buf, sizeof(buf))) > 0){
+                fwrite(buf, 1, n, trace);
+        }
+}
+
+/* Master application, as in master/main.py */
+static void master_callback(void *ctx, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        (void) ctx;
+
+        if(type == RTRANS_TYPE_STATS && len >= sizeof(rt_counters)){
+                memcpy(&slave_counters, payload, sizeof(rt_counters));
+                have_counters = true;
+                return;
+        }
+        else if(type == RTRANS_TYPE_JOIN && !joined){
+                joined = true;
+                slave_addr = slave;
+        }
+        else if(type == RTRANS_TYPE_DATA){
+                ++received;
+                if(len != sizeof(hello) - 1 || memcmp(payload, hello, len) != 0){
+                        ++corrupt;
+                }
+        }
+        else{
+                return;
+        }
+
+        last_poll = sim_now();
+        master->poll(slave);
+}
+
+int main(int argc, char *argv[]){
+        sim_link_cfg cfg;
+        uint64_t duration;
+
+        cfg.loss    = (argc > 1) ? atof(argv[1]) : 0.0;
+        cfg.latency = (argc > 2) ? atoi(argv[2]) : 5;
+        cfg.jitter  = (argc > 3) ? atoi(argv[3]) : 0;
+        cfg.baud    = (argc > 4) ? atoi(argv[4]) : 9600;
+        duration    = (argc > 5) ? atoi(argv[5]) * 1000ULL : 60000;
+        cfg.seed    = (argc > 6) ? atoi(argv[6]) : 1;
+        FILE *trace = 0;
+        if(argc > 7 && (trace = fopen(argv[7], "wb")) == 0){
+                perror(argv[7]);
+                return 1;
+        }
+
+        sim_channel channel(cfg);
+        sim_xbee radio(channel, SLAVE_SERIAL);
+        SoftwareSerial xs(6, 7);
+        xs.sim_connect(radio);
+
+        sim_state state(xs, slave_callback);
+        sim_master m(channel, MASTER_ADDR, master_callback, 0);
+        slave_state = &state;
+        master = &m;
+
+        state.rt_init(true);
+        for(size_t i = 0; i < SET_LENGTH; i++){
+                set_payload[i] = (uint8_t) i;
+        }
+
+        duration += sim_now();
+        while(sim_now() < duration){
+                uint8_t status = state.rt_status();
+
+                state.rt_loop();
+                trace_drain(trace);
+                if(status != RTRANS_STATUS_READY && state.rt_status() == RTRANS_STATUS_READY){
+                        printf("slave up after %lu ms\n", (unsigned long) sim_now());
+                }
+                else if(status != RTRANS_STATUS_FAILED && state.rt_status() == RTRANS_STATUS_FAILED){
+                        fprintf(stderr, "slave failed to come up\n");
+                        return 1;
+                }
+                m.loop();
+
+                if(!joined && sim_now() % PROBE_INTERVAL == 0){
+                        m.probe();
+                }
+                else if(joined && sim_now() - last_poll >= POLL_RETX){
+                        last_poll = sim_now();
+                        m.poll(slave_addr);
+                }
+                if(joined && sim_now() % SET_INTERVAL == 0){
+                        m.set(slave_addr, set_payload, SET_LENGTH);
+                        ++sets_sent;
+                }
+
+                sim_advance(1);
+        }
+
+        /* ask the slave how it saw the run, again if the request or the
+           answer gets lost */
+        if(joined){
+                uint64_t deadline = sim_now() + 5 * POLL_RETX;
+                while(!have_counters && sim_now() < deadline){
+                        if(sim_now() % PROBE_INTERVAL == 0){
+                                m.request_stats(slave_addr);
+                        }
+                        state.rt_loop();
+                        trace_drain(trace);
+                        m.loop();
+                        sim_advance(1);
+                }
+        }
+
+        const sim_channel_stats &cs = channel.statistics();
+        const sim_master_stats &ms = m.statistics();
+        printf("slave %04x: %lu packages (%lu corrupt)\n", radio.address(), received, corrupt);
+        printf("channel: %lu frames, %lu bytes, %lu lost, %.0f ms airtime\n",
+               cs.frames, cs.bytes, cs.lost, cs.airtime);
+        printf("master: %lu segments, %lu duplicates, %lu acks (%lu piggybacked), %lu naks, %lu expired, "
+               "%lu polls and SET segments sent again\n",
+               ms.segments, ms.duplicates, ms.acks + ms.piggybacked, ms.piggybacked, ms.naks, ms.expired,
+               ms.retransmits);
+        printf("sets: %lu sent, %lu acknowledged, %lu given up, %lu received (%lu corrupt)\n",
+               sets_sent, ms.sets, ms.sets_lost, sets_received, sets_corrupt);
+        if(have_counters){
+                const rt_counters &c = slave_counters;
+                printf("slave counters: %u packages, %u segments, %u retransmits, %u timeouts, %u dropped, "
+                       "%u queue full, tx queue hwm %u bytes\n",
+                       c.tx_packages, c.tx_segments, c.tx_retransmits, c.tx_timeouts, c.tx_dropped,
+                       c.tx_queue_full, c.tx_queue_hwm);
+                printf("                %u packets, %u duplicates, %u acks, %u naks, %u bad checksums, %u bad lengths, "
+                       "rtt %u/%u/%u ms over %u samples\n",
+                       c.rx_packets, c.rx_duplicates, c.rx_acks, c.rx_naks, c.rx_bad_checksum, c.rx_bad_length,
+                       c.rtt_min, c.rtt_samples ? (unsigned) (c.rtt_sum / c.rtt_samples) : 0, c.rtt_max,
+                       c.rtt_samples);
+        }
+        if(trace){
+                fclose(trace);
+        }
+        return (corrupt || sets_corrupt) ? 1 : 0;
+}
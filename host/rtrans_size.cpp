@@ -0,0 +1,37 @@
+/* Footprint of rt_basic_state for the predefined configurations.
+
+   The buffer and window sizes follow directly from the configuration and
+   are the same on every target. The remaining fields are measured on the
+   host, where pointers and size_t are wider and the XBee object is the
+   host stand-in, so expect them to be smaller on AVR.
+
+   Usage: rtrans_size
+*/
+
+#include "rtrans.h"
+#include <stdio.h>
+
+/* Build the whole driver for every predefined configuration */
+template class rt_basic_state<rt_small_config>;
+template class rt_basic_state<rt_large_config>;
+
+template <class CFG>
+static void report(const char *name){
+        typedef rt_basic_state<CFG> state;
+        size_t buffers = CFG::tx_buffer + (CFG::tx_urgent ? CFG::tx_urgent : 1) + state::rx_queue_size;
+        size_t window = (CFG::window + 1) * sizeof(rt_tx_slot);
+
+        printf("%s,%u,%u,%u,%u,%zu,%zu,%zu,%zu,%zu,%zu\n", name,
+               CFG::packet_size, state::payload_size, CFG::max_segments, CFG::window,
+               (size_t) CFG::tx_buffer, (size_t) CFG::tx_urgent, state::rx_queue_size, window,
+               sizeof(state) - buffers - window, sizeof(state));
+}
+
+int main(){
+        printf("config,packet_size,payload_size,max_segments,window,tx_buffer,tx_urgent,rx_buffer,"
+               "window_bytes,other_bytes,total_bytes\n");
+        report<rt_small_config>("small");
+        report<rt_default_config>("default");
+        report<rt_large_config>("large");
+        return 0;
+}
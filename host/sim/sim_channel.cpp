@@ -0,0 +1,271 @@
+#include "sim_channel.h"
+#include "sim_clock.h"
+
+sim_channel::sim_channel(const sim_link_cfg &cfg){
+        this->cfg = cfg;
+        this->rng = cfg.seed ? cfg.seed : 1;
+        this->seq = 0;
+        this->stats = sim_channel_stats();
+        this->tap = 0;
+        this->tap_ctx = 0;
+        this->contention = false;
+        this->air_next = 0;
+}
+
+/** xorshift32, good enough for loss and jitter decisions */
+double sim_channel::random(){
+        this->rng ^= this->rng << 13;
+        this->rng ^= this->rng >> 17;
+        this->rng ^= this->rng << 5;
+        return this->rng / 4294967296.0;
+}
+
+/** Time needed to move a frame across one serial line (8N1, 10 bits/byte) */
+double sim_channel::serial_time(uint32_t baud, size_t len) const{
+        if(baud == 0){
+                return 0.0;
+        }
+        return (len + SIM_API_OVERHEAD) * 10 * 1000.0 / baud;
+}
+
+int sim_channel::attach(uint16_t addr){
+        port p;
+        p.addr    = addr;
+        p.baud    = this->cfg.baud;
+        p.tx_free = 0.0;
+        p.rx_free = 0.0;
+        p.air_free = 0.0;
+        this->ports.push_back(p);
+        return this->ports.size() - 1;
+}
+
+void sim_channel::set_address(int port, uint16_t addr){
+        this->ports[port].addr = addr;
+}
+
+uint16_t sim_channel::address(int port) const{
+        return this->ports[port].addr;
+}
+
+void sim_channel::set_baud(int port, uint32_t baud){
+        if(this->cfg.baud != 0){
+                this->ports[port].baud = baud;
+        }
+}
+
+void sim_channel::transmit(int port, uint16_t dst, const uint8_t *data, size_t len){
+        struct port *src = &this->ports[port];
+        double now = (double) sim_now();
+        double ser = serial_time(src->baud, len);
+        double start, sent;
+
+        /* the frame leaves once the sender's serial line has drained */
+        start = (src->tx_free > now) ? src->tx_free : now;
+        sent = start + ser;
+        src->tx_free = sent;
+
+        this->stats.frames++;
+        this->stats.bytes += len;
+        this->stats.airtime += ser;
+        if(this->tap){
+                this->tap(this->tap_ctx, port, dst, data, len, ser);
+        }
+
+        if(this->contention){
+                air_send(port, dst, std::vector<uint8_t>(data, data + len), sent, 0);
+        }
+        else{
+                queue_copies(port, dst, data, len, sent, SIM_NO_AIR);
+        }
+}
+
+/** Queue a copy of a frame off the air (or the sender's serial line) at
+    sent at every port it is addressed to, subject to the loss model
+*/
+void sim_channel::queue_copies(int port, uint16_t dst, const uint8_t *data, size_t len, double sent, uint64_t air){
+        struct port *src = &this->ports[port];
+        size_t i;
+
+        for(i = 0; i < this->ports.size(); i++){
+                struct port *p = &this->ports[i];
+                double arrive;
+
+                if((int) i == port || (dst != SIM_BROADCAST && p->addr != dst)){
+                        continue;
+                }
+                if(random() < this->cfg.loss){
+                        this->stats.lost++;
+                        continue;
+                }
+
+                /* propagation; jitter lets a later frame overtake an earlier
+                   one, the receiver's serial line is added on delivery */
+                arrive = sent + this->cfg.latency + random() * this->cfg.jitter;
+
+                sim_frame f;
+                f.src = src->addr;
+                f.dst = dst;
+                f.at  = (uint64_t) (arrive + 0.999);
+                f.seq = this->seq++;
+                f.air = air;
+                f.data.assign(data, data + len);
+                p->queue.push_back(f);
+                this->stats.delivered++;
+        }
+}
+
+/** Whether a clear channel assessment starting at t finds a transmission,
+    including one which starts before the assessment is over
+*/
+bool sim_channel::air_busy(double t) const{
+        size_t i;
+
+        for(i = 0; i < this->on_air.size(); i++){
+                const air &o = this->on_air[i];
+                if(!o.deferred && o.start < t + SIM_CCA_MS && o.end > t){
+                        return true;
+                }
+        }
+        return false;
+}
+
+/** Put a frame on the air once the sender is ready and the channel clear,
+    after the unslotted CSMA-CA of 802.15.4, and queue its copies. Frames
+    are placed in the order they are asked for, which is not the order
+    they start in: one placed earlier which was yet to sense the channel
+    when this one went on the air backs off and is placed again. Anything
+    else this overlaps collides with it; unicast frames which collide are
+    sent again from the end of their MAC ACK wait.
+*/
+void sim_channel::air_send(int port, uint16_t dst, const std::vector<uint8_t> &data, double ready, uint8_t tries){
+        struct port *src = &this->ports[port];
+        double now = (double) sim_now();
+        double t = (src->air_free > ready) ? src->air_free : ready;
+        unsigned be = SIM_MIN_BE, nb = 0;
+        std::vector<air> again, later;
+        air a;
+        size_t i;
+
+        /* nothing from now on starts before now */
+        while(!this->on_air.empty() && this->on_air.front().end <= now){
+                this->on_air.pop_front();
+        }
+
+        for(;;){
+                t += (unsigned) (random() * (1u << be)) * SIM_BACKOFF_MS;
+                if(!air_busy(t)){
+                        break;
+                }
+                if(++nb > SIM_MAX_BACKOFFS){
+                        this->stats.cca_failures++;
+                        src->air_free = t + SIM_CCA_MS;
+                        return;
+                }
+                be = (be < SIM_MAX_BE) ? be + 1 : SIM_MAX_BE;
+        }
+
+        a.id       = this->air_next++;
+        a.port     = port;
+        a.dst      = dst;
+        a.tries    = tries;
+        a.collided = false;
+        a.deferred = false;
+        a.start    = t + SIM_CCA_MS + SIM_TURNAROUND_MS;
+        a.end      = a.start + (data.size() + SIM_PHY_OVERHEAD) * SIM_PHY_BYTE_MS +
+                     ((dst != SIM_BROADCAST) ? SIM_MAC_ACK_MS : 0.0);
+        a.data     = data;
+        src->air_free = a.end;
+        this->stats.air_busy += a.end - a.start;
+        this->collided.push_back(false);
+
+        for(i = 0; i < this->on_air.size(); i++){
+                air &o = this->on_air[i];
+                if(o.deferred || o.start >= a.end || o.end <= a.start){
+                        continue;
+                }
+                if(a.start < o.start - SIM_TURNAROUND_MS){
+                        /* its assessment would have found this one: take it off
+                           the air, with the copies already queued */
+                        o.deferred = true;
+                        this->collided[o.id] = true;
+                        this->stats.air_busy -= o.end - o.start;
+                        later.push_back(o);
+                        continue;
+                }
+                a.collided = true;
+                if(!o.collided){
+                        o.collided = true;
+                        this->collided[o.id] = true;
+                        this->stats.collisions++;
+                        if(o.dst != SIM_BROADCAST && o.tries < SIM_MAC_RETRIES){
+                                again.push_back(o);
+                        }
+                }
+        }
+        if(a.collided){
+                this->collided[a.id] = true;
+                this->stats.collisions++;
+                if(dst != SIM_BROADCAST && tries < SIM_MAC_RETRIES){
+                        again.push_back(a);
+                }
+        }
+        else{
+                queue_copies(port, dst, data.data(), data.size(),
+                             a.end - ((dst != SIM_BROADCAST) ? SIM_MAC_ACK_MS : 0.0), a.id);
+        }
+        this->on_air.push_back(a);
+
+        for(i = 0; i < later.size(); i++){
+                this->ports[later[i].port].air_free = 0.0;
+                air_send(later[i].port, later[i].dst, later[i].data,
+                         later[i].start - SIM_TURNAROUND_MS, later[i].tries);
+        }
+        for(i = 0; i < again.size(); i++){
+                this->stats.mac_retries++;
+                air_send(again[i].port, again[i].dst, again[i].data, again[i].end, again[i].tries + 1);
+        }
+}
+
+bool sim_channel::receive(int port, sim_frame &out){
+        struct port *p = &this->ports[port];
+        std::vector<sim_frame> &q = p->queue;
+        double now = (double) sim_now();
+        double done;
+        size_t i, best;
+
+        /* copies of transmissions which collided after they were queued */
+        for(i = 0; i < q.size(); ){
+                if(q[i].air != SIM_NO_AIR && this->collided[q[i].air]){
+                        q.erase(q.begin() + i);
+                }
+                else{
+                        i++;
+                }
+        }
+
+        /* frames cross the receiver's serial line one at a time, in the
+           order they came off the air */
+        best = q.size();
+        for(i = 0; i < q.size(); i++){
+                if(best == q.size() || q[i].at < q[best].at ||
+                   (q[i].at == q[best].at && q[i].seq < q[best].seq)){
+                        best = i;
+                }
+        }
+        if(best == q.size()){
+                return false;
+        }
+        done = ((p->rx_free > q[best].at) ? p->rx_free : q[best].at) + serial_time(p->baud, q[best].data.size());
+        if(done > now){
+                return false;
+        }
+
+        p->rx_free = done;
+        out = q[best];
+        q.erase(q.begin() + best);
+        return true;
+}
+
+size_t sim_channel::pending(int port) const{
+        return this->ports[port].queue.size();
+}
@@ -0,0 +1,155 @@
+#ifndef _sim_channel_h_
+#define _sim_channel_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+
+/* Broadcast destination address */
+#define SIM_BROADCAST           (0xffff)
+
+/* Bytes the XBee API adds around a TX16/RX16 payload on the serial line */
+#define SIM_API_OVERHEAD        (9)
+
+/* 802.15.4 medium access at 2.4 GHz, for set_contention() */
+#define SIM_PHY_BYTE_MS         (0.032)     // 250 kbit/s
+#define SIM_PHY_OVERHEAD        (17)        // preamble, SFD, length, MAC header with 16-bit addresses, FCS
+#define SIM_BACKOFF_MS          (0.32)      // unit backoff period, 20 symbols
+#define SIM_CCA_MS              (0.128)     // clear channel assessment, 8 symbols
+#define SIM_TURNAROUND_MS       (0.192)     // from receiving to sending, 12 symbols
+#define SIM_MAC_ACK_MS          (0.544)     // turnaround and a MAC ACK, which unicast frames wait for
+#define SIM_MIN_BE              (3)         // macMinBE
+#define SIM_MAX_BE              (5)         // macMaxBE
+#define SIM_MAX_BACKOFFS        (4)         // macMaxCSMABackoffs
+#define SIM_MAC_RETRIES         (3)         // macMaxFrameRetries
+
+/* Frame copy which did not go over the modelled air */
+#define SIM_NO_AIR              (~(uint64_t) 0)
+
+/* Link model parameters */
+typedef struct sim_link_cfg_s {
+    double   loss;      // probability that a frame is dropped, per receiver
+    uint32_t latency;   // fixed delivery delay in ms
+    uint32_t jitter;    // uniformly distributed extra delay in ms (reorders frames)
+    uint32_t baud;      // serial rate between host and radio to start with, 0 for unthrottled
+    uint32_t seed;      // PRNG seed, runs with the same seed are identical
+} sim_link_cfg;
+
+/* Frame in flight or waiting to be picked up by a port */
+typedef struct sim_frame_s {
+    uint16_t             src;   // sender address
+    uint16_t             dst;   // destination address
+    uint64_t             at;    // time in ms the frame is off the air at the receiver
+    uint64_t             seq;   // send order, breaks ties between equal delivery times
+    uint64_t             air;   // transmission it is a copy of, SIM_NO_AIR without contention
+    std::vector<uint8_t> data;  // payload
+} sim_frame;
+
+/* Channel statistics */
+typedef struct sim_channel_stats_s {
+    unsigned long frames;       // frames handed to the channel
+    unsigned long delivered;    // frame copies queued at a receiver
+    unsigned long lost;         // frame copies dropped by the loss model
+    unsigned long bytes;        // payload bytes handed to the channel
+    double        airtime;      // total serialization time of all frames in ms
+    unsigned long collisions;   // transmissions lost to another one on the air at the same time
+    unsigned long cca_failures; // frames given up on as the channel stayed busy
+    unsigned long mac_retries;  // unicast transmissions repeated after a collision
+    double        air_busy;     // total time of all transmissions on the air in ms, MAC ACKs included
+} sim_channel_stats;
+
+/* Observer called for every frame handed to the channel */
+typedef void (*sim_channel_tap)(void *ctx, int port, uint16_t dst, const uint8_t *data, size_t len, double airtime);
+
+/** In-process model of an 802.15.4 link between XBee radios. Each radio
+    owns a port on the channel; frames sent to an address are copied to
+    every port carrying that address (or every other port for broadcast),
+    subject to loss, latency, jitter and serial baud-rate throttling.
+    With contention, every radio hears every other: a frame goes on the
+    air after the unslotted CSMA-CA of 802.15.4, or is dropped when the
+    channel stays busy, and frames on the air at the same time are all
+    lost, unicast ones to be sent again by the MAC. Only the MAC ACKs'
+    airtime is modelled, not their loss.
+*/
+class sim_channel {
+
+private:
+        struct port {
+                uint16_t               addr;
+                uint32_t               baud;     // rate of the serial line between host and radio
+                double                 tx_free;  // time the sender's serial line is idle again
+                double                 rx_free;  // time the receiver's serial line is idle again
+                double                 air_free; // time the radio is done with its last transmission
+                std::vector<sim_frame> queue;
+        };
+
+        /* Transmission on the air, kept until it is over */
+        struct air {
+                uint64_t               id;
+                int                    port;
+                uint16_t               dst;
+                uint8_t                tries;
+                bool                   collided;
+                bool                   deferred;    // backed off for a later one, placed again
+                double                 start;
+                double                 end;
+                std::vector<uint8_t>   data;
+        };
+
+        sim_link_cfg        cfg;
+        uint32_t            rng;
+        uint64_t            seq;
+        std::vector<port>   ports;
+        sim_channel_stats   stats;
+        sim_channel_tap     tap;
+        void                *tap_ctx;
+        bool                contention;
+        std::deque<air>     on_air;
+        std::vector<bool>   collided;   // per transmission id
+        uint64_t            air_next;
+
+        double serial_time(uint32_t baud, size_t len) const;
+        void queue_copies(int port, uint16_t dst, const uint8_t *data, size_t len, double sent, uint64_t air);
+        bool air_busy(double t) const;
+        void air_send(int port, uint16_t dst, const std::vector<uint8_t> &data, double ready, uint8_t tries);
+
+public:
+        sim_channel(const sim_link_cfg &cfg);
+
+        /* Deterministic uniform random number in [0, 1) */
+        double random();
+
+        /* Add a radio to the channel; returns its port number */
+        int attach(uint16_t addr);
+        void set_address(int port, uint16_t addr);
+        uint16_t address(int port) const;
+
+        /* Change the serial rate of a port; an unthrottled channel stays so */
+        void set_baud(int port, uint32_t baud);
+
+        /* Change the loss rate from now on; 1 takes the link down */
+        void set_loss(double loss) { cfg.loss = loss; }
+
+        /* Model medium access and collisions from now on (off by default) */
+        void set_contention(bool on) { contention = on; }
+
+        /* Install an observer for transmitted frames, 0 to remove it */
+        void set_tap(sim_channel_tap fn, void *ctx) { tap = fn; tap_ctx = ctx; }
+
+        /* Send a frame from the given port */
+        void transmit(int port, uint16_t dst, const uint8_t *data, size_t len);
+
+        /* Pop the earliest frame which has arrived at the port by now.
+           Returns false if there is none.
+        */
+        bool receive(int port, sim_frame &out);
+
+        /* Number of frames queued at the port, including ones still in flight */
+        size_t pending(int port) const;
+
+        const sim_link_cfg &config() const { return cfg; }
+        const sim_channel_stats &statistics() const { return stats; }
+};
+
+#endif
@@ -0,0 +1,27 @@
+#include "sim_clock.h"
+
+static uint64_t sim_time = 0;
+static const sim_node_clock *sim_selected = 0;
+
+uint64_t sim_now(){
+        return sim_time;
+}
+
+void sim_advance(uint64_t ms){
+        sim_time += ms;
+}
+
+void sim_reset(uint64_t start){
+        sim_time = start;
+}
+
+void sim_clock_select(const sim_node_clock *clock){
+        sim_selected = clock;
+}
+
+uint64_t sim_local_us(){
+        if(sim_selected == 0){
+                return sim_time * 1000;
+        }
+        return (uint64_t) sim_selected->offset * 1000 + (uint64_t) (sim_time * (1000.0 + sim_selected->drift / 1000.0));
+}
@@ -0,0 +1,34 @@
+#ifndef _sim_clock_h_
+#define _sim_clock_h_
+
+#include <stdint.h>
+
+/* Simulated wall clock shared by every node of a host-side simulation.
+   Nothing advances it implicitly: the driver loop (or delay()) moves it
+   forward, which keeps runs deterministic.
+*/
+
+/* Return the current simulated time in milliseconds. */
+uint64_t sim_now();
+
+/* Move the simulated clock forward by ms milliseconds. */
+void sim_advance(uint64_t ms);
+
+/* Set the simulated clock to an absolute time. */
+void sim_reset(uint64_t start);
+
+/* Clock of one simulated node: where it started and how fast it runs */
+typedef struct sim_node_clock_s {
+    uint32_t offset;    // its reading at simulated time 0, in ms
+    double   drift;     // parts per million it runs fast, or slow if negative
+} sim_node_clock;
+
+/* Have millis() and micros() read a node's clock from now on, 0 for the
+   simulated clock itself. The caller keeps the clock while selected.
+*/
+void sim_clock_select(const sim_node_clock *clock);
+
+/* Current reading of the selected clock in microseconds */
+uint64_t sim_local_us();
+
+#endif
@@ -0,0 +1,42 @@
+#include "sim_coordinator.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+sim_coordinator::sim_coordinator(sim_channel &ch, uint16_t addr, int fd, bool escaped){
+        this->channel = &ch;
+        this->port    = ch.attach(addr);
+        this->fd      = fd;
+        this->escaped = escaped;
+        xa_parser_init(&this->parser, escaped);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+void sim_coordinator::loop(){
+        uint8_t buf[512], enc[XA_MAX_ENCODED];
+        ssize_t r, i;
+        sim_frame f;
+
+        /* requests from the master */
+        while((r = read(this->fd, buf, sizeof(buf))) > 0){
+                for(i = 0; i < r; i++){
+                        if(xa_parse(&this->parser, buf[i]) == 1 && this->parser.len >= 5 &&
+                           this->parser.data[0] == XA_TX16){
+                                uint16_t dst = (this->parser.data[2] << 8) | this->parser.data[3];
+                                this->channel->transmit(this->port, dst, &this->parser.data[5], this->parser.len - 5);
+                        }
+                }
+        }
+
+        /* frames for the master */
+        while(this->channel->receive(this->port, f)){
+                size_t n = xa_rx16_encode(enc, this->escaped, f.src, 40, f.data.data(), f.data.size());
+                this->out.insert(this->out.end(), enc, enc + n);
+        }
+        if(!this->out.empty()){
+                r = write(this->fd, this->out.data(), this->out.size());
+                if(r > 0){
+                        this->out.erase(this->out.begin(), this->out.begin() + r);
+                }
+        }
+}
@@ -0,0 +1,34 @@
+#ifndef _sim_coordinator_h_
+#define _sim_coordinator_h_
+
+#include "sim_channel.h"
+#include "xbee_api.h"
+#include <stdint.h>
+#include <vector>
+
+/** Coordinator radio of a native master (master/native/rt_master.h) on a
+    sim_channel. The master talks to it over a real file descriptor, one end
+    of a socketpair or pty, in XBee API frames: TX16 frames read from it are
+    transmitted on the channel and frames received from the channel are
+    written back as RX16 frames.
+*/
+class sim_coordinator {
+
+private:
+        sim_channel          *channel;
+        int                  port;
+        int                  fd;
+        bool                 escaped;
+        xa_parser            parser;
+        std::vector<uint8_t> out;       // encoded frames the fd did not take yet
+
+public:
+        sim_coordinator(sim_channel &ch, uint16_t addr, int fd, bool escaped);
+
+        /* Move frames both ways; call once per simulated millisecond */
+        void loop();
+
+        int channel_port() const { return port; }
+};
+
+#endif
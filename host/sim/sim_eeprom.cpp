@@ -0,0 +1,59 @@
+#include "sim_eeprom.h"
+#include "sim_clock.h"
+
+/** Open the store, taking its contents from the file if it has any and
+    creating it otherwise.
+*/
+sim_eeprom::sim_eeprom(size_t size, const char *path) : bytes(size, 0xff){
+        this->file = 0;
+        this->failed = false;
+        this->write_us = SIM_EEPROM_WRITE_US;
+        this->owed_us = 0;
+        this->writes = 0;
+        if(path == 0){
+                return;
+        }
+        if((this->file = fopen(path, "r+b")) != 0){
+                if(fread(&this->bytes[0], 1, size, this->file) < size){
+                        clearerr(this->file);
+                }
+        }
+        else if((this->file = fopen(path, "w+b")) != 0){
+                fwrite(&this->bytes[0], 1, size, this->file);
+                fflush(this->file);
+        }
+        else{
+                this->failed = true;
+        }
+}
+
+sim_eeprom::~sim_eeprom(){
+        if(this->file){
+                fclose(this->file);
+        }
+}
+
+uint8_t sim_eeprom::read(size_t addr){
+        return (addr < this->bytes.size()) ? this->bytes[addr] : 0xff;
+}
+
+/** Write a byte through to the file, as eeprom_update_byte() only if it
+    changes.
+*/
+void sim_eeprom::write(size_t addr, uint8_t value){
+        if(addr >= this->bytes.size() || this->bytes[addr] == value){
+                return;
+        }
+        this->bytes[addr] = value;
+        ++this->writes;
+        if(this->file){
+                fseek(this->file, addr, SEEK_SET);
+                fputc(value, this->file);
+                fflush(this->file);
+        }
+        this->owed_us += this->write_us;
+        if(this->owed_us >= 1000){
+                sim_advance(this->owed_us / 1000);
+                this->owed_us %= 1000;
+        }
+}
@@ -0,0 +1,46 @@
+#ifndef _sim_eeprom_h_
+#define _sim_eeprom_h_
+
+#include "rt_spill.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/* Time the AVR takes to write an EEPROM byte, in microseconds */
+#define SIM_EEPROM_WRITE_US     (3400)
+
+/** Host stand-in for the EEPROM a spill log is kept in, rt_eeprom_store
+    on the board: size bytes, erased to 0xff, kept in a file if given one,
+    so that the log outlives the process as it would a reset. Writing a
+    byte which changes moves the simulated clock on by the time the AVR
+    takes, which the sketch spends waiting for it.
+*/
+class sim_eeprom : public rt_spill_store {
+
+private:
+        std::vector<uint8_t> bytes;
+        FILE                 *file;
+        bool                 failed;    // the file could not be opened
+        uint32_t             write_us;
+        uint32_t             owed_us;   // write time not yet a whole ms
+        unsigned long        writes;
+
+public:
+        sim_eeprom(size_t size, const char *path = 0);
+        ~sim_eeprom();
+
+        /* Whether the file could be opened, if there is one */
+        bool ok() const { return !failed; }
+
+        /* Time a byte write takes, 0 for none */
+        void set_write_time(uint32_t us) { write_us = us; }
+
+        /* Bytes written since the store was opened */
+        unsigned long write_count() const { return writes; }
+
+        virtual size_t size() const { return bytes.size(); }
+        virtual uint8_t read(size_t addr);
+        virtual void write(size_t addr, uint8_t value);
+};
+
+#endif
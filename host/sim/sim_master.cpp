@@ -0,0 +1,477 @@
+#include "sim_master.h"
+#include "sim_clock.h"
+#include <algorithm>
+
+sim_master::sim_master(sim_channel &ch, uint16_t addr, sim_master_callback cb, void *ctx){
+        this->channel  = &ch;
+        this->port     = ch.attach(addr);
+        this->addr     = addr;
+        this->frame_no = 0;
+        this->callback = cb;
+        this->ctx      = ctx;
+        this->cumulative = true;
+        this->compact  = true;
+        this->response = 0;
+        this->stats    = sim_master_stats();
+}
+
+void sim_master::send_segment(uint16_t dst, uint8_t type, uint16_t pkg_no, uint8_t seg_ct,
+                              uint8_t seg_no, const uint8_t *payload, size_t len){
+        uint8_t pkt[RTRANS_PACKET_SIZE];
+        std::map<uint16_t, uint8_t>::const_iterator cs = this->checksum.find(dst);
+        std::map<uint16_t, uint8_t>::const_iterator cp = this->caps.find(dst);
+        rt_out_header h;
+        size_t n = 0;
+
+        h.master = this->addr;
+        h.slave  = dst;
+        h.pkg_no = pkg_no;
+        h.type   = type;
+        h.seg_ct = seg_ct;
+        h.seg_no = seg_no;
+        h.len    = len;
+        if(this->compact && cp != this->caps.end() && (cp->second & RTRANS_CAP_COMPACT)){
+                n = rt_compact_encode(pkt, &h, RTRANS_COMPACT_MASTER);
+        }
+        if(n == 0){
+                memcpy(pkt, &h, sizeof(rt_out_header));
+                n = sizeof(rt_out_header);
+        }
+        if(len > 0){
+                memcpy(&pkt[n], payload, len);
+        }
+        n += len;
+        if(cs != this->checksum.end() && cs->second == RTRANS_CHECKSUM_CRC16){
+                uint16_t crc = cs_crc16(CS_CRC16_INIT, pkt, n);
+                pkt[n++] = crc;
+                pkt[n++] = crc >> 8;
+        }
+        else{
+                pkt[n] = 0xff - cs_sum8(0, pkt, n);
+                n++;
+        }
+        this->channel->transmit(this->port, dst, pkt, n);
+}
+
+/** Send a segment of a package, with the slave's pending cumulative ACK
+    if it is a POLL or SET and there is room. Returns whether it went along.
+*/
+bool sim_master::send_pkg(uint16_t dst, uint8_t type, uint16_t pkg_no, uint8_t seg_ct,
+                          uint8_t seg_no, const uint8_t *payload, size_t len){
+        std::map<uint16_t, pending_ack>::iterator it = this->pending.find(dst);
+        std::vector<uint8_t> buf;
+
+        if(it != this->pending.end() && (type == RTRANS_TYPE_POLL || type == RTRANS_TYPE_SET) &&
+           ack_build(dst, it->second, buf) && sizeof(rt_out_header) + buf.size() + len + 2 <= RTRANS_PACKET_SIZE){
+                buf.insert(buf.end(), payload, payload + len);
+                this->pending.erase(it);
+                this->stats.piggybacked++;
+                send_segment(dst, type | RTRANS_FLAG_ACK, pkg_no, seg_ct, seg_no, buf.data(), buf.size());
+                return true;
+        }
+        send_segment(dst, type, pkg_no, seg_ct, seg_no, payload, len);
+        return false;
+}
+
+void sim_master::send(uint16_t dst, uint8_t type, const uint8_t *payload, size_t len){
+        send_pkg(dst, type, this->frame_no++, 1, 0, payload, len);
+}
+
+void sim_master::poll(uint16_t slave){
+        std::map<uint16_t, pending_ack>::const_iterator a = this->pending.find(slave);
+        uint16_t ack = (a != this->pending.end()) ? a->second.pkg_no : 0;
+        poll_state &p = this->polls[slave];
+
+        if(p.open){
+                this->stats.retransmits++;
+        }
+        else{
+                p.pkg_no = this->frame_no++;
+                p.open   = true;
+                p.acked  = false;
+        }
+        p.sent = sim_now();
+        if(send_pkg(slave, RTRANS_TYPE_POLL, p.pkg_no, 1, 0, 0, 0)){
+                p.acked = true;
+                p.ack = ack;
+        }
+}
+
+bool sim_master::set(uint16_t slave, const uint8_t *payload, size_t len){
+        outgoing_set s;
+        size_t k, n;
+
+        if(len > RTRANS_SET_MAX_SEGMENTS * RTRANS_SET_PAYLOAD){
+                return false;
+        }
+        s.pkg_no = this->frame_no++;
+        for(k = 0; k == 0 || k < len; k += n){
+                n = std::min(len - k, (size_t) RTRANS_SET_PAYLOAD);
+                s.segs.push_back(std::vector<uint8_t>(payload + k, payload + k + n));
+        }
+        s.acked.assign(s.segs.size(), false);
+        s.tries = 0;
+        set_send(slave, this->sets[slave] = s);
+        return true;
+}
+
+/** Send the segments of a SET the slave has not acknowledged yet */
+void sim_master::set_send(uint16_t slave, outgoing_set &s){
+        size_t i;
+
+        for(i = 0; i < s.segs.size(); i++){
+                if(s.acked[i]){
+                        continue;
+                }
+                if(s.tries > 0){
+                        this->stats.retransmits++;
+                }
+                send_pkg(slave, RTRANS_TYPE_SET, s.pkg_no, s.segs.size(), i, s.segs[i].data(), s.segs[i].size());
+        }
+        s.tries++;
+        s.due = sim_now() + SIM_MASTER_SET_TIMEOUT;
+}
+
+/** The slave acknowledged a POLL or a SET segment */
+void sim_master::acked(uint16_t slave, uint16_t pkg_no, uint8_t seg_no){
+        std::map<uint16_t, poll_state>::iterator p = this->polls.find(slave);
+        std::map<uint16_t, outgoing_set>::iterator s = this->sets.find(slave);
+
+        if(p != this->polls.end() && p->second.pkg_no == pkg_no){
+                p->second.open = false;
+        }
+        if(s != this->sets.end() && s->second.pkg_no == pkg_no && seg_no < s->second.acked.size()){
+                s->second.acked[seg_no] = true;
+                if(std::find(s->second.acked.begin(), s->second.acked.end(), false) == s->second.acked.end()){
+                        this->stats.sets++;
+                        this->sets.erase(s);
+                }
+        }
+}
+
+/** Whether a package is one of the slave's last RTRANS_DUP_WINDOW */
+bool sim_master::delivered(uint16_t slave, uint16_t pkg_no) const{
+        std::map<uint16_t, std::deque<uint16_t> >::const_iterator it = this->recent.find(slave);
+
+        return it != this->recent.end() && std::find(it->second.begin(), it->second.end(), pkg_no) != it->second.end();
+}
+
+void sim_master::remember(uint16_t slave, uint16_t pkg_no){
+        std::deque<uint16_t> &r = this->recent[slave];
+
+        r.push_back(pkg_no);
+        if(r.size() > RTRANS_DUP_WINDOW){
+                r.pop_front();
+        }
+}
+
+/** Note a segment for a cumulative ACK: due right away once the package is
+    complete or SIM_MASTER_ACK_EVERY segments came in, otherwise
+    SIM_MASTER_ACK_DELAY after the first of them. An ACK pending for an older package goes out first.
+*/
+void sim_master::ack_later(uint16_t slave, uint16_t pkg_no, uint8_t seg_ct, bool complete){
+        std::map<uint16_t, pending_ack>::iterator it = this->pending.find(slave);
+
+        if(it != this->pending.end() && it->second.pkg_no != pkg_no){
+                ack_send(slave);
+                it = this->pending.end();
+        }
+        if(it == this->pending.end()){
+                pending_ack a;
+                a.pkg_no   = pkg_no;
+                a.segments = 0;
+                a.complete = false;
+                a.due      = sim_now() + SIM_MASTER_ACK_DELAY;
+                it = this->pending.insert(std::make_pair(slave, a)).first;
+        }
+        it->second.seg_ct = seg_ct;
+        it->second.complete |= complete;
+        if(complete || ++it->second.segments >= SIM_MASTER_ACK_EVERY){
+                it->second.due = sim_now();
+        }
+}
+
+/** Write a pending ACK as an rt_ack_header and its bitmap; false if there
+    is nothing left to acknowledge
+*/
+bool sim_master::ack_build(uint16_t slave, const pending_ack &a, std::vector<uint8_t> &out){
+        std::map<uint32_t, flow>::const_iterator it = this->flows.find(((uint32_t) slave << 16) | a.pkg_no);
+        rt_ack_header h;
+        uint8_t k;
+
+        h.pkg_no  = a.pkg_no;
+        h.count   = a.seg_ct;
+        h.map_len = 0;
+        out.assign(sizeof(h), 0);
+        if(it != this->flows.end()){
+                const flow &fl = it->second;
+                for(h.count = 0; h.count < fl.seg_ct && fl.segs.count(h.count); h.count++){
+                }
+                for(k = h.count + 1; k < fl.seg_ct; k++){
+                        if(!fl.segs.count(k)){
+                                continue;
+                        }
+                        while(h.map_len <= (k - h.count) / 8){
+                                out.push_back(0);
+                                h.map_len++;
+                        }
+                        out[sizeof(h) + (k - h.count) / 8] |= 1 << ((k - h.count) % 8);
+                }
+        }
+        else if(!a.complete){
+                return false;
+        }
+        memcpy(out.data(), &h, sizeof(h));
+        return true;
+}
+
+/** Send a slave's pending ACK on its own */
+void sim_master::ack_send(uint16_t slave){
+        std::map<uint16_t, pending_ack>::iterator it = this->pending.find(slave);
+        std::vector<uint8_t> buf;
+
+        if(it == this->pending.end()){
+                return;
+        }
+        if(ack_build(slave, it->second, buf)){
+                const rt_ack_header *h = (const rt_ack_header *) buf.data();
+                send_segment(slave, RTRANS_TYPE_ACK, h->pkg_no, 0, h->count, buf.data() + sizeof(*h), h->map_len);
+                this->stats.acks++;
+        }
+        this->pending.erase(it);
+}
+
+void sim_master::deliver(uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        std::vector<uint8_t> decoded;
+
+        /* undo delta coding; a varint covers at most 4 bytes of the original */
+        if(type < RTRANS_TYPE_ACK && (type & RTRANS_FLAG_DELTA)){
+                decoded.resize(4 * len);
+                len = delta_decode(payload, len, decoded.data(), decoded.size());
+                if(len == 0){
+                        this->stats.bad_coding++;
+                        return;
+                }
+                payload = decoded.data();
+                type &= ~RTRANS_FLAG_DELTA;
+                this->stats.coded++;
+        }
+
+        /* split a batch into its records, each a length byte and its data */
+        if(type < RTRANS_TYPE_ACK && (type & RTRANS_FLAG_BATCH)){
+                size_t i, n;
+                type &= RTRANS_TYPE_MASK;
+                for(i = 0; i < len; i += 1 + n){
+                        n = payload[i];
+                        if(i + 1 + n > len){
+                                this->stats.bad_coding++;
+                                return;
+                        }
+                }
+                for(i = 0; i < len; i += 1 + n){
+                        n = payload[i];
+                        this->stats.batched++;
+                        deliver(slave, type, &payload[i + 1], n);
+                }
+                return;
+        }
+
+        this->stats.packages++;
+        if(this->callback){
+                this->callback(this->ctx, slave, type, payload, len);
+        }
+}
+
+void sim_master::handle(const sim_frame &f){
+        const rt_out_header *h = (const rt_out_header *) f.data.data();
+        const uint8_t *payload = f.data.data() + sizeof(rt_out_header);
+        const uint8_t *trailer;
+        rt_out_header compact;
+        size_t i, n;
+        bool good;
+
+        if(rt_frame_full(f.data.data(), f.data.size(), this->addr)){
+                /* the trailer after the payload is either checksum */
+                n = sizeof(rt_out_header) + h->len;
+                if(f.data.size() < sizeof(rt_out_header) + 1 || f.data.size() < n + 1 || f.data.size() > n + 2){
+                        this->stats.bad_checksum++;
+                        return;
+                }
+        }
+        else{
+                /* a compact header, from a slave which joined with the
+                   checksum it still uses */
+                std::map<uint16_t, uint8_t>::const_iterator cs = this->checksum.find(f.src);
+                std::map<uint16_t, uint8_t>::const_iterator cp = this->caps.find(f.src);
+                if(cs == this->checksum.end() || cp == this->caps.end() || !(cp->second & RTRANS_CAP_COMPACT) ||
+                   !rt_compact_decode(&compact, f.data.data(), f.data.size(), RTRANS_COMPACT_SLAVE,
+                                      (cs->second == RTRANS_CHECKSUM_CRC16) ? 2 : 1, this->addr, f.src)){
+                        this->stats.bad_checksum++;
+                        return;
+                }
+                h = &compact;
+                payload = f.data.data() + RTRANS_COMPACT_SLAVE;
+                n = RTRANS_COMPACT_SLAVE + h->len;
+        }
+        trailer = f.data.data() + n;
+        if(f.data.size() == n + 2){
+                good = cs_crc16(CS_CRC16_INIT, f.data.data(), n) == (trailer[0] | (trailer[1] << 8));
+        }
+        else{
+                good = cs_sum8(trailer[0], f.data.data(), n) == 0xff;
+        }
+        if(!good){
+                this->stats.bad_checksum++;
+                return;
+        }
+        this->checksum[h->slave] = (f.data.size() == n + 2) ? RTRANS_CHECKSUM_CRC16 : RTRANS_CHECKSUM_SUM8;
+        if(f.data.size() == n + 2){
+                this->stats.crc++;
+        }
+        if(h == &compact){
+                this->stats.compact++;
+        }
+        if(h->type == RTRANS_TYPE_ACK){
+                acked(h->slave, h->pkg_no, h->seg_no);
+                return;
+        }
+        if(h->type == RTRANS_TYPE_NAK){
+                return;
+        }
+        this->stats.segments++;
+
+        /* a slave announces what it takes each time it joins, and numbers
+           its packages from 0 again */
+        if(h->type == RTRANS_TYPE_JOIN){
+                this->caps[h->slave] = (h->len > 0) ? payload[0] : 0;
+                this->recent.erase(h->slave);
+        }
+        bool cack = this->cumulative && (this->caps[h->slave] & RTRANS_CAP_CACK);
+
+        /* ack the segment, unless the slave takes cumulative ACKs */
+        if(!cack){
+                send_segment(h->slave, RTRANS_TYPE_ACK, h->pkg_no, 1, h->seg_no, 0, 0);
+                this->stats.acks++;
+        }
+
+        /* a copy of a package delivered already: our ACK was lost, and with
+           it the poll it went along with, if that is still unanswered and
+           the copy came in later than an answer to the poll would have */
+        std::map<uint16_t, poll_state>::iterator p = this->polls.find(h->slave);
+        if(delivered(h->slave, h->pkg_no)){
+                this->stats.duplicates++;
+                if(cack){
+                        ack_later(h->slave, h->pkg_no, h->seg_ct, true);
+                }
+                if(p != this->polls.end() && p->second.open && p->second.acked && p->second.ack == h->pkg_no &&
+                   sim_now() - p->second.sent > (this->response >> 3)){
+                        poll(h->slave);
+                }
+                return;
+        }
+        if((h->type & RTRANS_TYPE_MASK) == RTRANS_TYPE_DATA && p != this->polls.end()){
+                if(p->second.open){
+                        this->response += sim_now() - p->second.sent - (this->response >> 3);
+                }
+                this->polls.erase(p);
+        }
+
+        if(h->seg_ct <= 1){
+                if(cack){
+                        ack_later(h->slave, h->pkg_no, 1, true);
+                }
+                remember(h->slave, h->pkg_no);
+                deliver(h->slave, h->type, payload, h->len);
+                return;
+        }
+
+        /* multi-segment package, segments may arrive in any order */
+        uint32_t pid = ((uint32_t) h->slave << 16) | h->pkg_no;
+        std::map<uint32_t, flow>::iterator it = this->flows.find(pid);
+        if(it == this->flows.end()){
+                it = this->flows.insert(std::make_pair(pid, flow())).first;
+                it->second.seg_ct = h->seg_ct;
+        }
+        flow &fl = it->second;
+        fl.expire = sim_now() + SIM_MASTER_FLOW_TIMEOUT;
+
+        if(fl.segs.count(h->seg_no)){
+                this->stats.duplicates++;
+                if(cack){
+                        ack_later(h->slave, h->pkg_no, fl.seg_ct, false);
+                }
+                return;
+        }
+        fl.segs[h->seg_no].assign(payload, payload + h->len);
+
+        /* selectively NAK the gaps below this segment */
+        for(i = 0; i < h->seg_no; i++){
+                if(!fl.segs.count(i) && !fl.naked.count(i)){
+                        fl.naked[i] = true;
+                        send_segment(h->slave, RTRANS_TYPE_NAK, h->pkg_no, 1, i, 0, 0);
+                        this->stats.naks++;
+                }
+        }
+
+        if(fl.segs.size() == fl.seg_ct){
+                std::vector<uint8_t> all;
+                for(i = 0; i < fl.seg_ct; i++){
+                        all.insert(all.end(), fl.segs[i].begin(), fl.segs[i].end());
+                }
+                if(cack){
+                        ack_later(h->slave, h->pkg_no, fl.seg_ct, true);
+                }
+                this->flows.erase(it);
+                remember(h->slave, h->pkg_no);
+                deliver(h->slave, h->type, all.data(), all.size());
+        }
+        else if(cack){
+                ack_later(h->slave, h->pkg_no, fl.seg_ct, false);
+        }
+}
+
+void sim_master::loop(){
+        std::map<uint32_t, flow>::iterator it;
+        std::map<uint16_t, pending_ack>::iterator a;
+        sim_frame f;
+
+        while(this->channel->receive(this->port, f)){
+                handle(f);
+        }
+
+        /* SETs still unacknowledged */
+        std::map<uint16_t, outgoing_set>::iterator s;
+        for(s = this->sets.begin(); s != this->sets.end();){
+                if(sim_now() < s->second.due){
+                        ++s;
+                }
+                else if(s->second.tries >= SIM_MASTER_SET_TRIES){
+                        this->stats.sets_lost++;
+                        this->sets.erase(s++);
+                }
+                else{
+                        set_send(s->first, s->second);
+                        ++s;
+                }
+        }
+
+        /* ACKs no poll took along */
+        for(a = this->pending.begin(); a != this->pending.end();){
+                uint16_t slave = a->first;
+                bool due = sim_now() >= a->second.due;
+                ++a;
+                if(due){
+                        ack_send(slave);
+                }
+        }
+
+        for(it = this->flows.begin(); it != this->flows.end();){
+                if(sim_now() > it->second.expire){
+                        this->stats.expired++;
+                        this->flows.erase(it++);
+                }
+                else{
+                        ++it;
+                }
+        }
+}
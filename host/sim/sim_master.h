@@ -0,0 +1,164 @@
+#ifndef _sim_master_h_
+#define _sim_master_h_
+
+#include "sim_channel.h"
+#include "rtrans.h"
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+/* Master-side flow expiry, as in master/rtrans.py */
+#define SIM_MASTER_FLOW_TIMEOUT (5000)
+
+/* Longest a cumulative ACK waits for more segments or a poll to ride on */
+#define SIM_MASTER_ACK_DELAY    (RTRANS_ACK_DELAY)
+
+/* Segments after which a cumulative ACK goes out without waiting */
+#define SIM_MASTER_ACK_EVERY    (2)
+
+/* Unacknowledged SET segments are sent again after this long, up to this
+   many times in all */
+#define SIM_MASTER_SET_TIMEOUT  (1000)
+#define SIM_MASTER_SET_TRIES    (5)
+
+/* Completed package callback */
+typedef void (*sim_master_callback)(void *ctx, uint16_t slave, uint8_t type,
+                                    const uint8_t *payload, size_t len);
+
+/* Master statistics */
+typedef struct sim_master_stats_s {
+    unsigned long segments;     // valid segments received
+    unsigned long duplicates;   // segments received more than once, or of a package delivered
+    unsigned long bad_checksum; // segments dropped on checksum
+    unsigned long crc;          // segments carrying a CRC-16 rather than the additive checksum
+    unsigned long compact;      // segments with a compact header
+    unsigned long acks;         // ACK frames sent
+    unsigned long piggybacked;  // ACKs sent along with a POLL or SET
+    unsigned long naks;         // NAKs sent
+    unsigned long packages;     // packages delivered to the callback
+    unsigned long coded;        // packages which were delta coded
+    unsigned long batched;      // packages which arrived in a batch
+    unsigned long bad_coding;   // coded or batched packages which failed to decode
+    unsigned long expired;      // incomplete packages dropped
+    unsigned long retransmits;  // POLLs and SET segments sent again
+    unsigned long sets;         // SETs acknowledged by the slave
+    unsigned long sets_lost;    // SETs given up unacknowledged
+} sim_master_stats;
+
+/** Stand-in for the python master (master/rtrans.py) living on a sim_channel
+    port: ACKs every segment, NAKs gaps, reassembles packages whose segments
+    arrive out of order, decodes delta coded ones, splits batches and hands
+    them to a callback. Frames to a slave use the checksum the slave last
+    used, the additive one until it is heard from. Slaves which announce
+    RTRANS_CAP_CACK in their JOIN get cumulative ACKs instead, sent along
+    with the next POLL or SET where one comes soon enough. A copy of one of
+    the last RTRANS_DUP_WINDOW packages of a slave is acknowledged again but
+    not delivered. SETs are segmented and sent again until the slave has
+    acknowledged every segment, and a poll the slave neither answered nor
+    acknowledged is sent again under the same package number. Slaves which
+    announce RTRANS_CAP_COMPACT are sent compact headers.
+*/
+class sim_master {
+
+private:
+        struct flow {
+                uint8_t                                  seg_ct;
+                std::map<uint8_t, std::vector<uint8_t> > segs;
+                std::map<uint8_t, bool>                  naked;
+                uint64_t                                 expire;
+        };
+
+        /* ACK waiting to go out */
+        struct pending_ack {
+                uint16_t pkg_no;
+                uint8_t  seg_ct;
+                uint8_t  segments;      // new segments it covers
+                bool     complete;      // the whole package is in
+                uint64_t due;
+        };
+
+        /* Last POLL sent to a slave */
+        struct poll_state {
+                uint16_t pkg_no;
+                bool     open;          // neither answered nor acknowledged yet
+                bool     acked;         // it carried the ACK of package ack
+                uint16_t ack;
+                uint64_t sent;          // when it last went out
+        };
+
+        /* SET waiting for the slave's ACKs */
+        struct outgoing_set {
+                uint16_t                           pkg_no;
+                std::vector<std::vector<uint8_t> > segs;
+                std::vector<bool>                  acked;
+                uint8_t                            tries;
+                uint64_t                           due;
+        };
+
+        sim_channel                  *channel;
+        int                          port;
+        uint16_t                     addr;
+        uint16_t                     frame_no;
+        sim_master_callback          callback;
+        void                         *ctx;
+        std::map<uint32_t, flow>     flows;
+        std::map<uint16_t, uint8_t>  checksum;  // RTRANS_CHECKSUM_* per slave
+        std::map<uint16_t, uint8_t>  caps;      // RTRANS_CAP_* per slave, from its JOIN
+        std::map<uint16_t, pending_ack> pending;
+        std::map<uint16_t, std::deque<uint16_t> > recent;  // packages delivered, per slave
+        std::map<uint16_t, poll_state>   polls;
+        uint64_t                     response;  // smoothed time from a poll to its answer, scaled by 8
+        std::map<uint16_t, outgoing_set> sets;
+        bool                         cumulative;
+        bool                         compact;
+        sim_master_stats             stats;
+
+        void send_segment(uint16_t dst, uint8_t type, uint16_t pkg_no, uint8_t seg_ct,
+                          uint8_t seg_no, const uint8_t *payload, size_t len);
+        bool send_pkg(uint16_t dst, uint8_t type, uint16_t pkg_no, uint8_t seg_ct,
+                      uint8_t seg_no, const uint8_t *payload, size_t len);
+        void set_send(uint16_t slave, outgoing_set &s);
+        void acked(uint16_t slave, uint16_t pkg_no, uint8_t seg_no);
+        bool delivered(uint16_t slave, uint16_t pkg_no) const;
+        void remember(uint16_t slave, uint16_t pkg_no);
+        void deliver(uint16_t slave, uint8_t type, const uint8_t *payload, size_t len);
+        void handle(const sim_frame &f);
+        void ack_later(uint16_t slave, uint16_t pkg_no, uint8_t seg_ct, bool complete);
+        bool ack_build(uint16_t slave, const pending_ack &a, std::vector<uint8_t> &out);
+        void ack_send(uint16_t slave);
+
+public:
+        sim_master(sim_channel &ch, uint16_t addr, sim_master_callback cb, void *ctx);
+
+        /* Use cumulative ACKs with slaves which take them (the default),
+           or ACK every segment as the python master used to */
+        void set_cumulative(bool on) { cumulative = on; }
+
+        /* Send compact headers to slaves which take them (the default),
+           or full ones to every slave */
+        void set_compact(bool on) { compact = on; }
+
+        /* Send a single segment package; a POLL or SET carries a pending
+           cumulative ACK */
+        void send(uint16_t dst, uint8_t type, const uint8_t *payload, size_t len);
+        void probe() { send(SIM_BROADCAST, RTRANS_TYPE_PROBE, 0, 0); }
+
+        /* Poll a slave; the last poll again if it went unanswered */
+        void poll(uint16_t slave);
+
+        /* Send a SET of up to RTRANS_SET_MAX_SEGMENTS segments, replacing
+           one to the same slave still unacknowledged. False if too long.
+        */
+        bool set(uint16_t slave, const uint8_t *payload, size_t len);
+        void request_stats(uint16_t slave) { send(slave, RTRANS_TYPE_STATS, 0, 0); }
+
+        /* Process every frame which has arrived and expire stale flows */
+        void loop();
+
+        uint16_t address() const { return addr; }
+        int channel_port() const { return port; }
+        const sim_master_stats &statistics() const { return stats; }
+};
+
+#endif
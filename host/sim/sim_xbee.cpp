@@ -0,0 +1,214 @@
+#include "sim_xbee.h"
+#include <stdlib.h>
+
+sim_xbee::sim_xbee(sim_channel &ch, uint32_t serial_lo, uint16_t my){
+        this->channel   = &ch;
+        this->port      = ch.attach(my);
+        this->serial_hi = 0x0013a200;
+        this->serial_lo = serial_lo;
+        this->rate      = ch.config().baud ? ch.config().baud : SIM_DEFAULT_BAUD;
+        this->rate_reset = this->rate;
+        this->rate_next = 0;
+        this->host_rate = 0;
+}
+
+void sim_xbee::set_uart_baud(uint32_t baud){
+        this->rate_next = baud;
+        apply_rate();
+}
+
+/** Take a BD value: 0 to 7 for the standard rates, 1200 to 115200,
+    anything above for that rate. False if it is not one.
+*/
+bool sim_xbee::set_rate_code(uint32_t code){
+        static const uint32_t rates[] = { 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+
+        if(code < 8){
+                this->rate_next = rates[code];
+        }
+        else if(code >= 1200){
+                this->rate_next = code;
+        }
+        else{
+                return false;
+        }
+        return true;
+}
+
+/** Switch to the rate set with BD, if any */
+void sim_xbee::apply_rate(){
+        if(this->rate_next == 0){
+                return;
+        }
+        this->rate = this->rate_next;
+        this->rate_next = 0;
+        this->channel->set_baud(this->port, this->rate);
+}
+
+void sim_xbee::tx16(uint16_t dst, const uint8_t *data, size_t len){
+        if(!heard()){
+                return;
+        }
+        this->channel->transmit(this->port, dst, data, len);
+}
+
+void sim_xbee::at_command(const uint8_t cmd[2], const uint8_t *value, size_t len){
+        sim_api_frame f;
+        uint32_t v;
+
+        if(!heard()){
+                return;
+        }
+
+        f.api_id = SIM_API_AT_RESPONSE;
+        f.src    = 0;
+        f.cmd[0] = cmd[0];
+        f.cmd[1] = cmd[1];
+        f.status = 0;
+
+        if(cmd[0] == 'S' && (cmd[1] == 'L' || cmd[1] == 'H')){
+                v = (cmd[1] == 'L') ? this->serial_lo : this->serial_hi;
+                f.data.push_back(v >> 24);
+                f.data.push_back(v >> 16);
+                f.data.push_back(v >> 8);
+                f.data.push_back(v);
+        }
+        else if(cmd[0] == 'M' && cmd[1] == 'Y'){
+                if(len == 2){
+                        this->channel->set_address(this->port, (value[0] << 8) | value[1]);
+                }
+                else if(len == 0){
+                        f.data.push_back(address() >> 8);
+                        f.data.push_back(address());
+                }
+                else{
+                        f.status = 2;
+                }
+        }
+        else if(cmd[0] == 'B' && cmd[1] == 'D' && len == 0){
+                f.data.push_back(this->rate >> 24);
+                f.data.push_back(this->rate >> 16);
+                f.data.push_back(this->rate >> 8);
+                f.data.push_back(this->rate);
+        }
+        else if(cmd[0] == 'B' && cmd[1] == 'D'){
+                for(v = 0; len > 0 && len <= 4; len--){
+                        v = (v << 8) | *value++;
+                }
+                if(len != 0 || !set_rate_code(v)){
+                        f.status = 2;
+                }
+        }
+
+        this->local.push_back(f);
+        if(cmd[0] == 'A' && cmd[1] == 'C'){
+                apply_rate();
+        }
+        else if(cmd[0] == 'F' && cmd[1] == 'R'){
+                set_uart_baud(this->rate_reset);
+        }
+}
+
+bool sim_xbee::next_frame(sim_api_frame &out){
+        sim_frame rx;
+
+        if(!heard()){
+                /* whatever the radio sends is garbage at the host's rate */
+                this->local.clear();
+                while(this->channel->receive(this->port, rx));
+                return false;
+        }
+
+        if(!this->local.empty()){
+                out = this->local.front();
+                this->local.pop_front();
+                return true;
+        }
+
+        if(this->channel->receive(this->port, rx)){
+                out.api_id = SIM_API_RX16;
+                out.src    = rx.src;
+                out.status = 0;
+                out.data.swap(rx.data);
+                return true;
+        }
+
+        return false;
+}
+
+void sim_xbee::uart_reply(const char *s){
+        if(!heard()){
+                return;
+        }
+        while(*s){
+                this->uart_out.push_back(*s++);
+        }
+}
+
+/** Transparent mode command line, without the AT and \r. Only BD is
+    checked, and the commands which restart the radio or apply changes
+    acted on; the rest are answered with OK.
+*/
+void sim_xbee::uart_command(const std::string &cmd){
+        if(cmd.compare(0, 2, "BD") == 0){
+                char *end;
+                unsigned long code = strtoul(cmd.c_str() + 2, &end, 16);
+
+                uart_reply(cmd.size() > 2 && *end == 0 && set_rate_code(code) ? "OK\r" : "ERROR\r");
+                return;
+        }
+
+        uart_reply("OK\r");
+        if(cmd == "AC" || cmd == "CN"){
+                apply_rate();
+        }
+        else if(cmd == "FR"){
+                set_uart_baud(this->rate_reset);
+        }
+}
+
+/** Transparent mode: "+++" and every "AT...\r" line are answered, bytes
+    sent at the wrong rate are lost
+*/
+void sim_xbee::uart_write(uint8_t c){
+        if(!heard()){
+                this->line.clear();
+                return;
+        }
+        this->line.push_back(c);
+        if(this->line == "+++"){
+                uart_reply("OK\r");
+                this->line.clear();
+        }
+        else if(c == '\r'){
+                if(this->line.compare(0, 2, "AT") == 0){
+                        uart_command(this->line.substr(2, this->line.size() - 3));
+                }
+                else{
+                        uart_reply("ERROR\r");
+                }
+                this->line.clear();
+        }
+}
+
+int sim_xbee::uart_available() const{
+        return this->uart_out.size();
+}
+
+int sim_xbee::uart_read(){
+        int c;
+        if(this->uart_out.empty()){
+                return -1;
+        }
+        c = this->uart_out.front();
+        this->uart_out.pop_front();
+        return c;
+}
+
+int sim_xbee::uart_peek() const{
+        return this->uart_out.empty() ? -1 : this->uart_out.front();
+}
+
+uint16_t sim_xbee::address() const{
+        return this->channel->address(this->port);
+}
@@ -0,0 +1,90 @@
+#ifndef _sim_xbee_h_
+#define _sim_xbee_h_
+
+#include "sim_channel.h"
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+/* API identifiers understood by the simulated radio */
+#define SIM_API_RX16            (0x81)
+#define SIM_API_AT_RESPONSE     (0x88)
+
+/* Default 16-bit address of a radio which has not been configured */
+#define SIM_NO_ADDRESS          (0xfffe)
+
+/* Serial rate of a radio which has not been configured */
+#define SIM_DEFAULT_BAUD        (9600)
+
+/* Frame handed from the radio to the host in API mode */
+typedef struct sim_api_frame_s {
+    uint8_t              api_id;    // SIM_API_RX16 or SIM_API_AT_RESPONSE
+    uint16_t             src;       // sender address (RX16 only)
+    uint8_t              cmd[2];    // AT command (AT response only)
+    uint8_t              status;    // AT command status, 0 is OK (AT response only)
+    std::vector<uint8_t> data;      // RX16 payload or AT response value
+} sim_api_frame;
+
+/** Simulated XBee 802.15.4 module attached to a sim_channel. The host talks
+    to it either in transparent AT command mode (a byte stream, used by
+    xbee_init) or in API mode (whole frames, used by the XBee library stub).
+    Its serial rate starts at the channel's, or SIM_DEFAULT_BAUD on an
+    unthrottled channel, and is changed with BD,
+    either way, taking effect on AC or CN; a restart (FR) goes back to the
+    starting rate, as the new one is never written. A host which tells the radio its
+    own rate hears nothing, and is not heard, while the two differ; the
+    rate also sets the serial time of the radio's port on a throttled
+    channel.
+*/
+class sim_xbee {
+
+private:
+        sim_channel              *channel;
+        int                      port;
+        uint32_t                 serial_hi;
+        uint32_t                 serial_lo;
+        std::deque<sim_api_frame> local;    // AT responses waiting for the host
+        std::deque<uint8_t>      uart_out;  // transparent mode bytes waiting for the host
+        std::string              line;      // transparent mode command being received
+        uint32_t                 rate;      // serial rate of the radio
+        uint32_t                 rate_reset;// rate after a restart
+        uint32_t                 rate_next; // rate set with BD, 0 for none
+        uint32_t                 host_rate; // serial rate of the host, 0 if it did not say
+
+        void uart_reply(const char *s);
+        void uart_command(const std::string &cmd);
+        bool set_rate_code(uint32_t code);
+        void apply_rate();
+        bool heard() const { return this->host_rate == 0 || this->host_rate == this->rate; }
+
+public:
+        sim_xbee(sim_channel &ch, uint32_t serial_lo, uint16_t my = SIM_NO_ADDRESS);
+
+        /* API mode: transmit a frame to a 16-bit address */
+        void tx16(uint16_t dst, const uint8_t *data, size_t len);
+
+        /* API mode: run an AT command, queueing its response */
+        void at_command(const uint8_t cmd[2], const uint8_t *value, size_t len);
+
+        /* API mode: fetch the next frame for the host, false if there is none */
+        bool next_frame(sim_api_frame &out);
+
+        /* Transparent mode serial interface */
+        void uart_write(uint8_t c);
+        int uart_available() const;
+        int uart_read();
+        int uart_peek() const;
+
+        /* Serial rates: the host's, as its port is opened; the radio's, as
+           if it had been left there before the host started */
+        void set_host_baud(uint32_t baud) { host_rate = baud; }
+        void set_uart_baud(uint32_t baud);
+        uint32_t uart_baud() const { return rate; }
+
+        uint16_t address() const;
+        int channel_port() const { return port; }
+        uint32_t serial_low() const { return serial_lo; }
+};
+
+#endif
@@ -16,8 +16,15 @@ def cb(s, t, p):
         #data = rapp_pkt(p)
         #for v in data.parsed:
         #    print("time=%lu, voltage=%u, current=%u, temp=%d" % (v['timesta'], v['voltage'], v['current'], v['tempera']))
+    elif t == rt.ptype['STATS']:
+        st = rt.decode_stats(p)
+        if st:
+            print("Stats from %04x: %u retransmits, %u dropped, %u bad checksums, rtt %u/%u/%u ms" %
+                  (s, st['tx_retransmits'], st['tx_dropped'], st['rx_bad_checksum'],
+                   st['rtt_min'], st['rtt_avg'], st['rtt_max']))
     elif t == rt.ptype['JOIN']:
         print("Join from %04x." % (s))
+        transport.stats(s)
         transport.poll(s)
 
 #C088
@@ -0,0 +1,162 @@
+/* Base station on the native master, as master/main.py: probe for slaves,
+   hand each one that joins to the poll scheduler and print the data it
+   sends, and its counters once it has joined. Several coordinators are
+   served at once given their ttys and addresses separated by commas, each
+   by an I/O thread, with the printing done by worker threads. Given a
+   file, every frame sent and received is traced to it for rtrans_replay,
+   with the port number appended for more than one coordinator; "-" for
+   none.
+
+   Usage: rtrans_base [tty[,tty...]] [baud] [address[,address...]] [probe_seconds] [trace_file] [workers]
+*/
+
+#include "rt_multi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#define MAX_PORTS       (16)
+
+static rt_multi_master *transport;
+static volatile sig_atomic_t stopped;
+
+static void cb(void *ctx, int port, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        size_t i;
+        (void) ctx;
+
+        /* one printf per line, as workers print at the same time */
+        if(type == RTRANS_TYPE_DATA){
+                std::string line;
+                char hex[8];
+                snprintf(hex, sizeof(hex), "%04x", slave);
+                line = std::string("Data from ") + hex + ":";
+                for(i = 0; i < len; i++){
+                        snprintf(hex, sizeof(hex), " %02x", payload[i]);
+                        line += hex;
+                }
+                printf("%s\n", line.c_str());
+        }
+        else if(type == RTRANS_TYPE_STATS && len >= sizeof(rt_counters)){
+                rt_counters c;
+                memcpy(&c, payload, sizeof(c));
+                printf("Stats from %04x: %u retransmits, %u dropped, %u bad checksums, rtt %u/%u/%u ms\n",
+                       slave, c.tx_retransmits, c.tx_dropped, c.rx_bad_checksum,
+                       c.rtt_min, c.rtt_samples ? (unsigned) (c.rtt_sum / c.rtt_samples) : 0, c.rtt_max);
+        }
+        else if(type == RTRANS_TYPE_JOIN){
+                printf("Join from %04x.\n", slave);
+                transport->request_stats(port, slave);
+                transport->schedule(port, slave);
+        }
+}
+
+static void on_signal(int sig){
+        (void) sig;
+        stopped = 1;
+}
+
+/** Split a comma separated list in place */
+static size_t split(char *list, char *out[], size_t max){
+        size_t n = 0;
+        char *tok;
+
+        for(tok = strtok(list, ","); tok && n < max; tok = strtok(0, ",")){
+                out[n++] = tok;
+        }
+        return n;
+}
+
+int main(int argc, char *argv[]){
+        char ttys[256] = "/dev/ttyUSB3", addrs[256] = "c088";
+        char *tty[MAX_PORTS], *addr[MAX_PORTS];
+        unsigned baud   = (argc > 2) ? atoi(argv[2]) : 9600;
+        double probe    = (argc > 4) ? atof(argv[4]) : 0.5;
+        const char *trace = (argc > 5 && strcmp(argv[5], "-") != 0) ? argv[5] : 0;
+        std::vector<FILE *> traces;
+        std::vector<int> fds;
+        rt_multi_config mcfg;
+        size_t count, naddr, i;
+
+        if(argc > 1){
+                snprintf(ttys, sizeof(ttys), "%s", argv[1]);
+        }
+        if(argc > 3){
+                snprintf(addrs, sizeof(addrs), "%s", argv[3]);
+        }
+        count = split(ttys, tty, MAX_PORTS);
+        naddr = split(addrs, addr, MAX_PORTS);
+        if(count == 0 || naddr != count){
+                fprintf(stderr, "usage: %s [tty[,tty...]] [baud] [address[,address...]] [probe_seconds] "
+                        "[trace_file] [workers]\n", argv[0]);
+                return 2;
+        }
+        rt_multi_config_init(&mcfg);
+        if(argc > 6){
+                mcfg.workers = atoi(argv[6]);
+        }
+        rt_multi_master master(mcfg, cb, 0);
+        transport = &master;
+
+        for(i = 0; i < count; i++){
+                rt_master_config cfg;
+                char path[512];
+                int fd;
+
+                if((fd = rt_serial_open(tty[i], baud)) < 0){
+                        perror(tty[i]);
+                        return 1;
+                }
+                fds.push_back(fd);
+                rt_master_config_init(&cfg, strtoul(addr[i], 0, 16));
+                cfg.baud = baud;
+                if(trace){
+                        if(count > 1){
+                                snprintf(path, sizeof(path), "%s.%zu", trace, i);
+                        }
+                        else{
+                                snprintf(path, sizeof(path), "%s", trace);
+                        }
+                        if((cfg.trace = fopen(path, "wb")) == 0){
+                                perror(path);
+                                return 1;
+                        }
+                        traces.push_back(cfg.trace);
+                }
+                master.add_port(fd, cfg);
+                master.master(i).probe(probe * 1000);
+        }
+        signal(SIGINT, on_signal);
+
+        master.start();
+        while(!stopped){
+                for(i = 0; i < count && !master.failed(i); i++){
+                }
+                if(i < count){
+                        fprintf(stderr, "%s: serial line failed\n", tty[i]);
+                        break;
+                }
+                usleep(100000);
+        }
+        master.stop();
+
+        for(i = 0; i < count; i++){
+                const rt_master_stats &s = master.master(i).statistics();
+                if(count > 1){
+                        printf("%s: ", tty[i]);
+                }
+                printf("%lu segments, %lu packages, %lu polls, %lu bad frames, %lu expired\n",
+                       s.segments, s.packages, s.polls, s.bad_frames + s.bad_checksum, s.expired);
+                printf("%lu polls unanswered, %lu cycles, last %lu ms\n", s.timeouts, s.cycles, s.cycle_ms);
+        }
+        for(i = 0; i < traces.size(); i++){
+                fclose(traces[i]);
+        }
+        for(i = 0; i < fds.size(); i++){
+                close(fds[i]);
+        }
+        return 0;
+}
@@ -0,0 +1,1181 @@
+#include "rt_master.h"
+#include "checksum.h"
+#include "delta.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Bytes read from the serial line per read() */
+#define RT_MASTER_READ_CHUNK    (512)
+
+/* Pass a priority 1 node advances per scheduled poll */
+#define RT_MASTER_STRIDE        (1 << 16)
+
+/* Serial bytes a TX16 or RX16 frame adds around its payload, unescaped */
+#define RT_MASTER_API_OVERHEAD  (9)
+
+/* Serial bytes of a POLL or ACK segment with a CRC-16 trailer */
+#define RT_MASTER_CONTROL_BYTES (RT_MASTER_API_OVERHEAD + sizeof(rt_out_header) + 2)
+
+/* Serial bytes expected of a poll and its answer before a slave sent one:
+   the poll and the ACK of a single segment. Guessing high would hold back
+   the first round of polls to many slaves for nothing.
+*/
+#define RT_MASTER_ANSWER_GUESS  (2 * RT_MASTER_CONTROL_BYTES)
+
+static uint64_t rt_master_monotonic(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void rt_master_config_init(rt_master_config *cfg, uint16_t addr){
+        cfg->addr          = addr;
+        cfg->max_nodes     = 1024;
+        cfg->flows         = 2;
+        cfg->max_segments  = 16;
+        cfg->tx_buffer     = 16384;
+        cfg->poll_timeout  = RT_MASTER_POLL_TIMEOUT;
+        cfg->flow_timeout  = RT_MASTER_FLOW_TIMEOUT;
+        cfg->probe_every   = RT_MASTER_PROBE_EVERY;
+        cfg->poll_window   = RT_MASTER_POLL_WINDOW;
+        cfg->poll_interval = 0;
+        cfg->backoff_max   = RT_MASTER_BACKOFF_MAX;
+        cfg->baud          = 0;
+        cfg->airtime       = RT_MASTER_AIRTIME;
+        cfg->ack_delay     = RT_MASTER_ACK_DELAY;
+        cfg->set_timeout   = RT_MASTER_SET_TIMEOUT;
+        cfg->escaped       = false;
+        cfg->clock         = 0;
+        cfg->trace         = 0;
+}
+
+rt_master::rt_master(int fd, const rt_master_config &cfg, rt_master_callback cb, void *ctx){
+        size_t i, per_flow = cfg.max_segments * (2 + RTRANS_XBEE_MAX_PAYLOAD);
+        size_t package = cfg.max_segments * RTRANS_XBEE_MAX_PAYLOAD;
+
+        this->cfg         = cfg;
+        this->fd          = fd;
+        this->callback    = cb;
+        this->ctx         = ctx;
+        this->frame_no    = 0;
+        this->stopped     = false;
+        this->node_count  = 0;
+        this->probe_until = 0;
+        this->ready_count = 0;
+        this->scheduled   = 0;
+        this->outstanding = 0;
+        this->pass        = 0;
+        this->credit      = 0;
+        this->resp_srtt   = 0;
+        this->resp_var    = 0;
+        this->cycle       = 0;
+        this->cycle_left  = 0;
+        this->ack_due_count = 0;
+        this->stats       = rt_master_stats();
+        xa_parser_init(&this->parser, cfg.escaped);
+        tw_init(&this->wheel, now());
+        tw_timer_init(&this->probe_timer, probe_expired, this, 0);
+        tw_timer_init(&this->sched_timer, sched_expired, this, 0);
+        this->credit_at   = this->wheel.now;
+        this->cycle_start = this->wheel.now;
+
+        /* every slot up front: nodes, their flows and the flows' segment buffers */
+        this->nodes.resize(cfg.max_nodes);
+        this->ready.resize(cfg.max_nodes);
+        this->ack_due.resize(cfg.max_nodes);
+        this->index.assign(0x10000, 0);
+        this->flow_pool.resize((size_t) cfg.max_nodes * cfg.flows);
+        this->arena.assign(this->flow_pool.size() * per_flow, 0);
+        for(i = 0; i < this->flow_pool.size(); i++){
+                flow &f = this->flow_pool[i];
+                f.used  = false;
+                tw_timer_init(&f.expire, flow_expired, this, &f);
+                f.have  = &this->arena[i * per_flow];
+                f.naked = f.have + cfg.max_segments;
+                f.data  = f.naked + cfg.max_segments;
+        }
+        for(i = 0; i < this->nodes.size(); i++){
+                this->nodes[i].flows = &this->flow_pool[i * cfg.flows];
+                tw_timer_init(&this->nodes[i].poll_retx, poll_expired, this, &this->nodes[i]);
+                tw_timer_init(&this->nodes[i].ack_timer, ack_expired, this, &this->nodes[i]);
+                tw_timer_init(&this->nodes[i].set_timer, set_expired, this, &this->nodes[i]);
+        }
+
+        /* reassembled package, then room to decode it into */
+        this->scratch.resize(package * 5);
+        this->tx_store.resize(cfg.tx_buffer);
+        rb_init(&this->tx_queue, this->tx_store.data(), this->tx_store.size());
+
+        if(cfg.trace){
+                rt_trace_file h;
+                h.magic   = RT_TRACE_MAGIC;
+                h.version = RT_TRACE_VERSION;
+                h.role    = RT_TRACE_MASTER;
+                h.addr    = cfg.addr;
+                fwrite(&h, sizeof(h), 1, cfg.trace);
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+uint64_t rt_master::now() const{
+        return this->cfg.clock ? this->cfg.clock() : rt_master_monotonic();
+}
+
+/** Return the node of a slave, taking a free slot for a new one if create
+    is set; 0 if it is unknown or there is no free slot.
+*/
+rt_master::node *rt_master::find(uint16_t addr, bool create){
+        uint16_t i = this->index[addr];
+        node *n;
+
+        if(i > 0){
+                return &this->nodes[i - 1];
+        }
+        if(!create || this->node_count == this->cfg.max_nodes || addr == RT_MASTER_BROADCAST){
+                return 0;
+        }
+        n = &this->nodes[this->node_count++];
+        n->addr          = addr;
+        n->checksum      = RTRANS_CHECKSUM_SUM8;
+        n->caps          = 0;
+        n->ack           = ACK_NONE;
+        n->ack_listed    = false;
+        n->recent_count  = 0;
+        n->recent_next   = 0;
+        n->poll_open     = false;
+        n->set_ct        = 0;
+        n->sched         = SCHED_NONE;
+        this->index[addr] = this->node_count;
+        return n;
+}
+
+/** Write a frame to the trace; stdio buffers it, the caller flushes */
+void rt_master::trace(uint8_t kind, uint16_t peer, const uint8_t *frame, size_t len){
+        rt_trace_record r;
+
+        r.time = now();
+        r.peer = peer;
+        r.kind = kind;
+        r.len  = len;
+        fwrite(&r, sizeof(r), 1, this->cfg.trace);
+        fwrite(frame, 1, len, this->cfg.trace);
+}
+
+/** Build a segment for a slave, known (nd) or not, with the header and
+    trailer it takes and queue it for the coordinator
+*/
+void rt_master::send_segment(const node *nd, uint16_t dst, uint8_t type, uint16_t pkg_no,
+                             uint8_t seg_ct, uint8_t seg_no, const uint8_t *payload, size_t len){
+        uint8_t pkt[RTRANS_XBEE_MAX_PAYLOAD];
+        uint8_t out[XA_MAX_ENCODED];
+        rt_out_header h;
+        size_t n = 0;
+
+        if(sizeof(rt_out_header) + len + 2 > sizeof(pkt)){
+                return;
+        }
+        h.master = this->cfg.addr;
+        h.slave  = dst;
+        h.pkg_no = pkg_no;
+        h.type   = type;
+        h.seg_ct = seg_ct;
+        h.seg_no = seg_no;
+        h.len    = len;
+        if(nd && (nd->caps & RTRANS_CAP_COMPACT)){
+                n = rt_compact_encode(pkt, &h, RTRANS_COMPACT_MASTER);
+        }
+        if(n == 0){
+                memcpy(pkt, &h, sizeof(rt_out_header));
+                n = sizeof(rt_out_header);
+        }
+        if(len > 0){
+                memcpy(&pkt[n], payload, len);
+        }
+        n += len;
+        if(nd && nd->checksum == RTRANS_CHECKSUM_CRC16){
+                uint16_t crc = cs_crc16(CS_CRC16_INIT, pkt, n);
+                pkt[n++] = crc;
+                pkt[n++] = crc >> 8;
+        }
+        else{
+                pkt[n] = 0xff - cs_sum8(0, pkt, n);
+                n++;
+        }
+
+        if(rb_put(&this->tx_queue, out, xa_tx16_encode(out, this->cfg.escaped, 0, dst, pkt, n)) == 0){
+                this->stats.tx_dropped++;
+                return;
+        }
+        this->stats.tx_frames++;
+        if(this->cfg.trace){
+                trace(RT_TRACE_TX, dst, pkt, n);
+        }
+}
+
+/** Send a segment of a package to a slave, known (n) or not, with its
+    pending cumulative ACK if it is a POLL or SET and there is room.
+    Returns whether the ACK went along.
+*/
+bool rt_master::send_pkg(node *n, uint16_t dst, uint8_t type, uint16_t pkg_no,
+                         uint8_t seg_ct, uint8_t seg_no, const uint8_t *payload, size_t len){
+        uint8_t buf[RTRANS_XBEE_MAX_PAYLOAD];
+        size_t k;
+
+        if(n && n->ack != ACK_NONE && (type == RTRANS_TYPE_POLL || type == RTRANS_TYPE_SET)){
+                k = ack_build(n, buf);
+                if(k > 0 && sizeof(rt_out_header) + k + len + 2 <= sizeof(buf)){
+                        if(len > 0){
+                                memcpy(&buf[k], payload, len);
+                        }
+                        tw_cancel(&this->wheel, &n->ack_timer);
+                        n->ack = ACK_NONE;
+                        this->stats.piggybacked++;
+                        send_segment(n, dst, type | RTRANS_FLAG_ACK, pkg_no, seg_ct, seg_no, buf, k + len);
+                        return true;
+                }
+        }
+        send_segment(n, dst, type, pkg_no, seg_ct, seg_no, payload, len);
+        return false;
+}
+
+void rt_master::send(uint16_t dst, uint8_t type, const uint8_t *payload, size_t len){
+        send_pkg(find(dst, false), dst, type, this->frame_no++, 1, 0, payload, len);
+}
+
+/** Poll a node: the last poll again if the slave neither answered nor
+    acknowledged it, otherwise a new one
+*/
+void rt_master::send_poll(node *n){
+        this->stats.polls++;
+        n->poll_sent = now();
+        n->polled_at = n->poll_sent;
+        if(n->poll_open){
+                this->stats.retransmits++;
+        }
+        else{
+                n->poll_pkg = this->frame_no++;
+                n->poll_open = true;
+                n->poll_acked = false;
+        }
+        if(send_pkg(n, n->addr, RTRANS_TYPE_POLL, n->poll_pkg, 1, 0, 0, 0)){
+                n->poll_acked = true;
+                n->poll_ack = n->ack_pkg;
+        }
+}
+
+bool rt_master::set(uint16_t slave, const uint8_t *payload, size_t len){
+        node *n = find(slave, true);
+
+        if(!n){
+                this->stats.no_slot++;
+                return false;
+        }
+        if(len > sizeof(n->set_data)){
+                return false;
+        }
+        memcpy(n->set_data, payload, len);
+        n->set_len   = len;
+        n->set_ct    = (len > RTRANS_SET_PAYLOAD) ? (len + RTRANS_SET_PAYLOAD - 1) / RTRANS_SET_PAYLOAD : 1;
+        n->set_pkg   = this->frame_no++;
+        n->set_acked = 0;
+        n->set_tries = 0;
+        set_send(n);
+        return true;
+}
+
+/** Send the segments of a node's SET it has not acknowledged yet */
+void rt_master::set_send(node *n){
+        uint8_t i;
+        size_t k;
+
+        for(i = 0; i < n->set_ct; i++){
+                if(n->set_acked & (1 << i)){
+                        continue;
+                }
+                if(n->set_tries > 0){
+                        this->stats.retransmits++;
+                }
+                k = i * RTRANS_SET_PAYLOAD;
+                send_pkg(n, n->addr, RTRANS_TYPE_SET, n->set_pkg, n->set_ct, i, &n->set_data[k],
+                         (i == n->set_ct - 1) ? n->set_len - k : RTRANS_SET_PAYLOAD);
+        }
+        n->set_tries++;
+        tw_add(&this->wheel, &n->set_timer, now() + this->cfg.set_timeout);
+}
+
+/** The slave acknowledged a POLL or a SET segment */
+void rt_master::acked(node *n, uint16_t pkg_no, uint8_t seg_no){
+        if(n->poll_open && n->poll_pkg == pkg_no){
+                n->poll_open = false;
+        }
+        if(n->set_ct > 0 && n->set_pkg == pkg_no && seg_no < n->set_ct){
+                n->set_acked |= 1 << seg_no;
+                if(n->set_acked == (1 << n->set_ct) - 1){
+                        this->stats.sets++;
+                        n->set_ct = 0;
+                        tw_cancel(&this->wheel, &n->set_timer);
+                }
+        }
+}
+
+/** Index of a package among the node's last RTRANS_DUP_WINDOW, or -1 */
+int rt_master::recent_find(const node *n, uint16_t pkg_no) const{
+        uint8_t i;
+
+        for(i = 0; i < n->recent_count; i++){
+                if(n->recent[i] == pkg_no){
+                        return i;
+                }
+        }
+        return -1;
+}
+
+/** Remember a package delivered, in place of the oldest */
+void rt_master::remember(node *n, uint16_t pkg_no, uint8_t seg_ct){
+        n->recent[n->recent_next] = pkg_no;
+        n->recent_ct[n->recent_next] = seg_ct;
+        n->recent_next = (n->recent_next + 1) % RTRANS_DUP_WINDOW;
+        if(n->recent_count < RTRANS_DUP_WINDOW){
+                n->recent_count++;
+        }
+}
+
+void rt_master::probe(uint32_t ms){
+        uint64_t t = now();
+        this->probe_until = t + ms;
+        tw_add(&this->wheel, &this->probe_timer, t);
+}
+
+void rt_master::poll(uint16_t slave){
+        node *n = find(slave, true);
+
+        if(n){
+                if(n->sched != SCHED_NONE){
+                        return;
+                }
+                tw_add(&this->wheel, &n->poll_retx, now() + this->cfg.poll_timeout);
+                send_poll(n);
+                return;
+        }
+        this->stats.polls++;
+        send(slave, RTRANS_TYPE_POLL, 0, 0);
+}
+
+bool rt_master::schedule(uint16_t slave, uint8_t priority){
+        node *n = find(slave, true);
+
+        if(!n){
+                this->stats.no_slot++;
+                return false;
+        }
+        n->priority = priority ? priority : 1;
+        if(n->sched != SCHED_NONE){
+                return true;
+        }
+        /* an unscheduled node may still have a poll of its own running */
+        tw_cancel(&this->wheel, &n->poll_retx);
+        n->fails  = 0;
+        n->pass   = this->pass;
+        n->answer = RT_MASTER_ANSWER_GUESS;
+        n->cycle  = this->cycle - 1;
+        if(this->scheduled == 0){
+                this->cycle_start = now();
+        }
+        this->scheduled++;
+        this->cycle_left++;
+        make_ready(n);
+        return true;
+}
+
+void rt_master::unschedule(uint16_t slave){
+        node *n = find(slave, false);
+        uint16_t pos, moved;
+
+        if(!n || n->sched == SCHED_NONE){
+                return;
+        }
+        if(n->sched == SCHED_READY){
+                /* fill the hole with the last node of the heap */
+                pos = n->heap_pos;
+                moved = this->ready[--this->ready_count];
+                if(pos < this->ready_count){
+                        this->ready[pos] = moved;
+                        heap_up(pos);
+                        heap_down(this->nodes[moved].heap_pos);
+                }
+        }
+        else if(n->sched == SCHED_POLLED){
+                this->outstanding--;
+        }
+        tw_cancel(&this->wheel, &n->poll_retx);
+        n->sched = SCHED_NONE;
+        this->scheduled--;
+        if(n->cycle != this->cycle){
+                n->cycle = this->cycle;
+                turn_over(0);
+        }
+}
+
+/** Move the node at pos of the ready heap up to its place */
+void rt_master::heap_up(uint16_t pos){
+        uint16_t i = this->ready[pos];
+        uint64_t p = this->nodes[i].pass;
+
+        while(pos > 0){
+                uint16_t parent = (pos - 1) / 2;
+                if(this->nodes[this->ready[parent]].pass <= p){
+                        break;
+                }
+                this->ready[pos] = this->ready[parent];
+                this->nodes[this->ready[pos]].heap_pos = pos;
+                pos = parent;
+        }
+        this->ready[pos] = i;
+        this->nodes[i].heap_pos = pos;
+}
+
+/** Move the node at pos of the ready heap down to its place */
+void rt_master::heap_down(uint16_t pos){
+        uint16_t i = this->ready[pos];
+        uint64_t p = this->nodes[i].pass;
+
+        for(;;){
+                size_t child = 2 * (size_t) pos + 1;
+                if(child >= this->ready_count){
+                        break;
+                }
+                if(child + 1 < this->ready_count &&
+                   this->nodes[this->ready[child + 1]].pass < this->nodes[this->ready[child]].pass){
+                        child++;
+                }
+                if(p <= this->nodes[this->ready[child]].pass){
+                        break;
+                }
+                this->ready[pos] = this->ready[child];
+                this->nodes[this->ready[pos]].heap_pos = pos;
+                pos = child;
+        }
+        this->ready[pos] = i;
+        this->nodes[i].heap_pos = pos;
+}
+
+/** Queue a node for its next poll. A node which was away does not get to
+    catch up on the turns it missed.
+*/
+void rt_master::make_ready(node *n){
+        tw_cancel(&this->wheel, &n->poll_retx);
+        if(n->pass < this->pass){
+                n->pass = this->pass;
+        }
+        n->sched = SCHED_READY;
+        this->ready[this->ready_count] = n - this->nodes.data();
+        heap_up(this->ready_count++);
+}
+
+/** Keep a node out of the scheduler for a while */
+void rt_master::park(node *n, uint64_t ms){
+        n->sched = SCHED_PARKED;
+        tw_add(&this->wheel, &n->poll_retx, now() + ms);
+}
+
+/** A node had its turn in the cycle (0 if the node left the scheduler);
+    close the cycle once every node had one. Nodes backing off do not
+    hold up the next cycle.
+*/
+void rt_master::turn_over(node *n){
+        uint64_t t;
+        size_t i;
+
+        if(n){
+                if(n->cycle == this->cycle){
+                        return;
+                }
+                n->cycle = this->cycle;
+        }
+        if(this->cycle_left > 0 && --this->cycle_left > 0){
+                return;
+        }
+        t = now();
+        this->stats.cycles++;
+        this->stats.cycle_ms = t - this->cycle_start;
+        this->cycle++;
+        this->cycle_start = t;
+        for(i = 0; i < this->node_count; i++){
+                node *c = &this->nodes[i];
+                if(c->sched == SCHED_NONE){
+                        continue;
+                }
+                if(c->sched == SCHED_PARKED && c->fails > 0){
+                        c->cycle = this->cycle;
+                }
+                else{
+                        this->cycle_left++;
+                }
+        }
+}
+
+/** A scheduled node delivered a DATA package */
+void rt_master::collected(node *n){
+        if(n->sched == SCHED_POLLED){
+                this->outstanding--;
+                n->answer = (3 * n->answer + ((n->answer_rx > n->answer_tx) ? n->answer_rx : n->answer_tx)) / 4;
+                n->fails  = 0;
+                turn_over(n);
+                if(this->cfg.poll_interval > 0){
+                        park(n, this->cfg.poll_interval);
+                }
+                else{
+                        make_ready(n);
+                }
+        }
+        else if(n->sched == SCHED_PARKED && n->fails > 0){
+                /* a late answer: it is alive after all */
+                n->fails = 0;
+                make_ready(n);
+        }
+}
+
+/** Time to wait for the answer to a scheduled poll */
+uint32_t rt_master::response_timeout() const{
+        uint32_t t;
+
+        if(this->resp_srtt == 0){
+                return this->cfg.poll_timeout;
+        }
+        t = (this->resp_srtt >> 3) + this->resp_var;
+        if(t < RT_MASTER_RESPONSE_MIN){
+                t = RT_MASTER_RESPONSE_MIN;
+        }
+        return (t > this->cfg.poll_timeout) ? this->cfg.poll_timeout : t;
+}
+
+/** Update the response time estimate with a new sample, as the slave's
+    rt_rtt_sample: srtt is kept scaled by 8 and the variation by 4.
+*/
+void rt_master::response_sample(uint32_t ms){
+        int32_t delta;
+
+        if(ms > this->cfg.poll_timeout){
+                ms = this->cfg.poll_timeout;
+        }
+        if(ms == 0){
+                ms = 1;
+        }
+        if(this->resp_srtt == 0){
+                this->resp_srtt = ms << 3;
+                this->resp_var  = ms << 1;
+        }
+        else{
+                delta = (int32_t) ms - (int32_t) (this->resp_srtt >> 3);
+                this->resp_srtt += delta;
+                if(delta < 0){
+                        delta = -delta;
+                }
+                this->resp_var += delta - (this->resp_var >> 2);
+        }
+        this->stats.response_ms = this->resp_srtt >> 3;
+}
+
+/** Poll ready nodes, lowest pass first, while the window and the airtime
+    budget allow
+*/
+void rt_master::dispatch(){
+        int64_t rate = (int64_t) this->cfg.baud * this->cfg.airtime;   // bytes * 1000000 per ms
+        uint64_t t = now();
+
+        if(rate > 0){
+                this->credit += (int64_t) (t - this->credit_at) * rate;
+                if(this->credit > 100 * rate){
+                        this->credit = 100 * rate;
+                }
+        }
+        this->credit_at = t;
+
+        while(this->ready_count > 0 && this->outstanding < this->cfg.poll_window){
+                node *n;
+
+                /* spent: come back when the line has caught up */
+                if(rate > 0 && this->credit <= 0){
+                        if(!tw_pending(&this->sched_timer)){
+                                this->stats.throttled++;
+                                tw_add(&this->wheel, &this->sched_timer, t + 1 + (-this->credit) / rate);
+                        }
+                        return;
+                }
+
+                n = &this->nodes[this->ready[0]];
+                this->ready[0] = this->ready[--this->ready_count];
+                if(this->ready_count > 0){
+                        heap_down(0);
+                }
+                this->pass = n->pass;
+                n->pass += RT_MASTER_STRIDE / n->priority;
+                n->sched = SCHED_POLLED;
+                n->answer_rx = 0;
+                n->answer_tx = RT_MASTER_CONTROL_BYTES;
+                this->outstanding++;
+                this->credit -= (int64_t) n->answer * 1000000;
+                tw_add(&this->wheel, &n->poll_retx, t + response_timeout());
+                send_poll(n);
+        }
+}
+
+/** No data came back in time: ask again, or for a scheduled node, give
+    it up for now. A node which missed one poll goes back in line, one
+    which keeps missing them backs off. A parked node is ready again.
+*/
+void rt_master::poll_expired(void *ctx, void *arg){
+        rt_master *m = (rt_master *) ctx;
+        node *n = (node *) arg;
+        uint64_t wait;
+
+        if(n->sched == SCHED_NONE){
+                m->poll(n->addr);
+        }
+        else if(n->sched == SCHED_PARKED){
+                m->make_ready(n);
+        }
+        else if(n->sched == SCHED_POLLED){
+                /* its next turn is a new poll, and a late answer no sample */
+                m->stats.timeouts++;
+                m->outstanding--;
+                n->poll_open = false;
+                n->polled_at = 0;
+                if(n->fails < 16){
+                        n->fails++;
+                }
+                m->turn_over(n);
+                if(n->fails == 1){
+                        m->make_ready(n);
+                }
+                else{
+                        wait = (uint64_t) m->cfg.poll_timeout << (n->fails - 2);
+                        m->park(n, (wait < m->cfg.backoff_max) ? wait : m->cfg.backoff_max);
+                }
+        }
+}
+
+/** The airtime budget allows polling again */
+void rt_master::sched_expired(void *ctx, void *arg){
+        (void) arg;
+        ((rt_master *) ctx)->dispatch();
+}
+
+/** A segment of a package arrived from a slave which takes cumulative
+    ACKs. The ACK is due now if the package is complete or it covers
+    RT_MASTER_ACK_EVERY new segments, otherwise ack_delay after the first
+    of them. An ACK pending for an older package goes out first.
+*/
+void rt_master::ack_segment(node *n, uint16_t pkg_no, bool complete){
+        if(n->ack != ACK_NONE && n->ack_pkg != pkg_no){
+                ack_send(n);
+        }
+        if(n->ack == ACK_NONE){
+                n->ack_new = 0;
+        }
+        n->ack_pkg = pkg_no;
+        if(complete || ++n->ack_new >= RT_MASTER_ACK_EVERY || this->cfg.ack_delay == 0){
+                ack_mark_due(n);
+        }
+        else if(n->ack == ACK_NONE){
+                n->ack = ACK_WAITING;
+                tw_add(&this->wheel, &n->ack_timer, now() + this->cfg.ack_delay);
+        }
+}
+
+/** Have the node's ACK sent at the end of the loop */
+void rt_master::ack_mark_due(node *n){
+        tw_cancel(&this->wheel, &n->ack_timer);
+        n->ack = ACK_DUE;
+        if(!n->ack_listed){
+                n->ack_listed = true;
+                this->ack_due[this->ack_due_count++] = n - this->nodes.data();
+        }
+}
+
+/** Write the node's pending ACK as an rt_ack_header and its bitmap.
+    Returns its length, 0 if there is nothing left to acknowledge.
+*/
+size_t rt_master::ack_build(node *n, uint8_t *out){
+        rt_ack_header *a = (rt_ack_header *) out;
+        uint8_t *map = out + sizeof(rt_ack_header);
+        uint8_t i, k;
+        int r;
+
+        a->pkg_no  = n->ack_pkg;
+        a->map_len = 0;
+        for(i = 0; i < this->cfg.flows; i++){
+                flow *f = &n->flows[i];
+                if(!f->used || f->pkg_no != n->ack_pkg){
+                        continue;
+                }
+                for(a->count = 0; a->count < f->seg_ct && f->have[a->count]; a->count++){
+                }
+                for(k = a->count + 1; k < f->seg_ct; k++){
+                        if(!f->have[k]){
+                                continue;
+                        }
+                        while(a->map_len <= (k - a->count) / 8){
+                                map[a->map_len++] = 0;
+                        }
+                        map[(k - a->count) / 8] |= 1 << ((k - a->count) % 8);
+                }
+                return sizeof(rt_ack_header) + a->map_len;
+        }
+        if((r = recent_find(n, n->ack_pkg)) >= 0){
+                a->count = n->recent_ct[r];
+                return sizeof(rt_ack_header);
+        }
+        return 0;
+}
+
+/** Send the node's pending ACK on its own */
+void rt_master::ack_send(node *n){
+        uint8_t buf[RTRANS_XBEE_MAX_PAYLOAD];
+        const rt_ack_header *a = (const rt_ack_header *) buf;
+
+        tw_cancel(&this->wheel, &n->ack_timer);
+        n->ack = ACK_NONE;
+        if(ack_build(n, buf) == 0){
+                return;
+        }
+        send_segment(n, n->addr, RTRANS_TYPE_ACK, a->pkg_no, 0, a->count,
+                     buf + sizeof(rt_ack_header), a->map_len);
+        this->stats.acks++;
+        if(n->sched == SCHED_POLLED){
+                n->answer_tx += RT_MASTER_CONTROL_BYTES + a->map_len;
+        }
+}
+
+/** Send the ACKs which came due and no poll took along */
+void rt_master::ack_flush(){
+        uint16_t i;
+
+        for(i = 0; i < this->ack_due_count; i++){
+                node *n = &this->nodes[this->ack_due[i]];
+                n->ack_listed = false;
+                if(n->ack == ACK_DUE){
+                        ack_send(n);
+                }
+        }
+        this->ack_due_count = 0;
+}
+
+/** No more segments came in for a while: acknowledge what did */
+void rt_master::ack_expired(void *ctx, void *arg){
+        ((rt_master *) ctx)->ack_mark_due((node *) arg);
+}
+
+/** SET segments are still unacknowledged: send them again, or give up */
+void rt_master::set_expired(void *ctx, void *arg){
+        rt_master *m = (rt_master *) ctx;
+        node *n = (node *) arg;
+
+        if(n->set_ct == 0){
+                return;
+        }
+        if(n->set_tries >= RT_MASTER_SET_TRIES){
+                m->stats.sets_lost++;
+                n->set_ct = 0;
+                return;
+        }
+        m->set_send(n);
+}
+
+/** The package stopped arriving, give up on it */
+void rt_master::flow_expired(void *ctx, void *arg){
+        ((rt_master *) ctx)->stats.expired++;
+        ((flow *) arg)->used = false;
+}
+
+/** Broadcast the next PROBE while probing */
+void rt_master::probe_expired(void *ctx, void *arg){
+        rt_master *m = (rt_master *) ctx;
+        uint64_t t = m->now();
+        (void) arg;
+
+        if(t < m->probe_until){
+                m->send_segment(0, RT_MASTER_BROADCAST, RTRANS_TYPE_PROBE,
+                                m->frame_no++, 1, 0, 0, 0);
+                tw_add(&m->wheel, &m->probe_timer, t + m->cfg.probe_every);
+        }
+}
+
+/** Handle one frame from a slave */
+void rt_master::handle(uint16_t src, const uint8_t *frame, size_t len){
+        const rt_out_header *h = (const rt_out_header *) frame;
+        const uint8_t *payload = frame + sizeof(rt_out_header);
+        const uint8_t *trailer;
+        rt_out_header compact;
+        size_t n;
+        bool good;
+        node *nd = 0;
+
+        if(this->cfg.trace){
+                trace(RT_TRACE_RX, src, frame, len);
+        }
+        if(rt_frame_full(frame, len, this->cfg.addr)){
+                /* the trailer after the payload is either checksum */
+                if(len < sizeof(rt_out_header) + 1){
+                        this->stats.bad_checksum++;
+                        return;
+                }
+                n = sizeof(rt_out_header) + h->len;
+                if(len < n + 1 || len > n + 2){
+                        this->stats.bad_checksum++;
+                        return;
+                }
+        }
+        else{
+                /* a compact header, from a slave which took ours and so
+                   joined; its trailer is the checksum it joined with */
+                nd = find(src, false);
+                if(nd == 0 || !(nd->caps & RTRANS_CAP_COMPACT) ||
+                   !rt_compact_decode(&compact, frame, len, RTRANS_COMPACT_SLAVE,
+                                      (nd->checksum == RTRANS_CHECKSUM_CRC16) ? 2 : 1, this->cfg.addr, src)){
+                        this->stats.bad_checksum++;
+                        return;
+                }
+                h = &compact;
+                payload = frame + RTRANS_COMPACT_SLAVE;
+                n = RTRANS_COMPACT_SLAVE + h->len;
+        }
+        trailer = frame + n;
+        if(len == n + 2){
+                good = cs_crc16(CS_CRC16_INIT, frame, n) == (trailer[0] | (trailer[1] << 8));
+        }
+        else{
+                good = cs_sum8(trailer[0], frame, n) == 0xff;
+        }
+        if(!good){
+                this->stats.bad_checksum++;
+                return;
+        }
+        if(nd == 0 && (nd = find(h->slave, true)) == 0){
+                this->stats.no_slot++;
+                return;
+        }
+        nd->checksum = (len == n + 2) ? RTRANS_CHECKSUM_CRC16 : RTRANS_CHECKSUM_SUM8;
+        if(nd->sched == SCHED_POLLED){
+                nd->answer_rx += RT_MASTER_API_OVERHEAD + len;
+        }
+        if(h->type == RTRANS_TYPE_ACK){
+                acked(nd, h->pkg_no, h->seg_no);
+                return;
+        }
+        if(h->type == RTRANS_TYPE_NAK){
+                return;
+        }
+        this->stats.segments++;
+
+        /* a slave announces what it takes each time it joins, and numbers
+           its packages from 0 again */
+        if(h->type == RTRANS_TYPE_JOIN){
+                nd->caps = (h->len > 0) ? payload[0] : 0;
+                nd->recent_count = 0;
+        }
+
+        /* ack the segment, unless the slave takes cumulative ACKs */
+        if(!(nd->caps & RTRANS_CAP_CACK)){
+                send_segment(nd, h->slave, RTRANS_TYPE_ACK, h->pkg_no, 1, h->seg_no, 0, 0);
+                this->stats.acks++;
+                if(nd->sched == SCHED_POLLED){
+                        nd->answer_tx += RT_MASTER_CONTROL_BYTES;
+                }
+        }
+
+        /* a late copy of a package delivered neither answers a poll nor
+           starts a new one. Its ACK was lost, and with it the poll it went
+           along with, if that is still unanswered and the copy came in
+           later than an answer to the poll would have; copies the slave
+           sent before the poll got there arrive sooner on a busy line. */
+        if(recent_find(nd, h->pkg_no) >= 0){
+                this->stats.duplicates++;
+                if(nd->caps & RTRANS_CAP_CACK){
+                        ack_segment(nd, h->pkg_no, true);
+                }
+                if(nd->poll_open && nd->poll_acked && nd->poll_ack == h->pkg_no &&
+                   now() - nd->poll_sent > (this->resp_srtt >> 3)){
+                        send_poll(nd);
+                }
+                return;
+        }
+
+        /* the data we were waiting for is coming in; a scheduled poll stays
+           outstanding until the whole package is in */
+        if((h->type & RTRANS_TYPE_MASK) == RTRANS_TYPE_DATA){
+                uint64_t t = now();
+                nd->poll_open = false;
+                if(nd->polled_at){
+                        response_sample(t - nd->polled_at);
+                        nd->polled_at = 0;
+                }
+                if(nd->sched == SCHED_POLLED){
+                        tw_add(&this->wheel, &nd->poll_retx, t + this->cfg.poll_timeout);
+                }
+                else if(nd->sched == SCHED_NONE){
+                        tw_cancel(&this->wheel, &nd->poll_retx);
+                }
+        }
+
+        if(h->seg_ct <= 1){
+                remember(nd, h->pkg_no, 1);
+                if(nd->caps & RTRANS_CAP_CACK){
+                        ack_segment(nd, h->pkg_no, true);
+                }
+                if((h->type & RTRANS_TYPE_MASK) == RTRANS_TYPE_DATA){
+                        collected(nd);
+                }
+                deliver(h->slave, h->type, payload, h->len);
+        }
+        else{
+                reassemble(nd, h, payload);
+        }
+}
+
+/** Store a segment of a multi-segment package in the node's flow slot and
+    deliver the package once it is complete; segments may arrive in any
+    order
+*/
+void rt_master::reassemble(node *nd, const rt_out_header *h, const uint8_t *payload){
+        flow *f = 0, *oldest = 0;
+        uint8_t i;
+        size_t k;
+
+        if(h->seg_ct > this->cfg.max_segments || h->seg_no >= h->seg_ct || h->len > RTRANS_XBEE_MAX_PAYLOAD){
+                this->stats.no_slot++;
+                return;
+        }
+        for(i = 0; i < this->cfg.flows && !f; i++){
+                flow *c = &nd->flows[i];
+                if(c->used && c->pkg_no == h->pkg_no){
+                        f = c;
+                }
+                else if(!c->used){
+                        oldest = c;
+                }
+                else if(!oldest || (oldest->used && c->expire.expires < oldest->expire.expires)){
+                        oldest = c;
+                }
+        }
+        if(!f){
+                /* take a free slot, or give up on the stalest package */
+                f = oldest;
+                if(f->used){
+                        this->stats.expired++;
+                }
+                f->used   = true;
+                f->pkg_no = h->pkg_no;
+                f->type   = h->type;
+                f->seg_ct = h->seg_ct;
+                f->count  = 0;
+                memset(f->have, 0, 2 * this->cfg.max_segments);
+        }
+        tw_add(&this->wheel, &f->expire, now() + this->cfg.flow_timeout);
+
+        if(f->have[h->seg_no]){
+                this->stats.duplicates++;
+                if(nd->caps & RTRANS_CAP_CACK){
+                        ack_segment(nd, h->pkg_no, false);
+                }
+                return;
+        }
+        memcpy(&f->data[h->seg_no * RTRANS_XBEE_MAX_PAYLOAD], payload, h->len);
+        f->have[h->seg_no] = h->len + 1;
+        f->count++;
+
+        /* selectively NAK the gaps below this segment */
+        for(i = 0; i < h->seg_no; i++){
+                if(!f->have[i] && !f->naked[i]){
+                        f->naked[i] = 1;
+                        send_segment(nd, nd->addr, RTRANS_TYPE_NAK, h->pkg_no, 1, i, 0, 0);
+                        this->stats.naks++;
+                }
+        }
+        if((nd->caps & RTRANS_CAP_CACK) && f->count < f->seg_ct){
+                ack_segment(nd, h->pkg_no, false);
+        }
+
+        if(f->count == f->seg_ct){
+                for(i = 0, k = 0; i < f->seg_ct; i++){
+                        memcpy(&this->scratch[k], &f->data[i * RTRANS_XBEE_MAX_PAYLOAD], f->have[i] - 1);
+                        k += f->have[i] - 1;
+                }
+                f->used = false;
+                tw_cancel(&this->wheel, &f->expire);
+                remember(nd, f->pkg_no, f->seg_ct);
+                if(nd->caps & RTRANS_CAP_CACK){
+                        ack_segment(nd, h->pkg_no, true);
+                }
+                if((f->type & RTRANS_TYPE_MASK) == RTRANS_TYPE_DATA){
+                        collected(nd);
+                }
+                deliver(nd->addr, f->type, this->scratch.data(), k);
+        }
+}
+
+/** Decode a package as its flags say and hand it to the callback */
+void rt_master::deliver(uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        size_t package = this->cfg.max_segments * RTRANS_XBEE_MAX_PAYLOAD;
+
+        /* undo delta coding; a varint covers at most 4 bytes of the original */
+        if(type < RTRANS_TYPE_ACK && (type & RTRANS_FLAG_DELTA)){
+                uint8_t *out = &this->scratch[package];
+                len = delta_decode(payload, len, out, 4 * package);
+                if(len == 0){
+                        this->stats.bad_coding++;
+                        return;
+                }
+                payload = out;
+                type &= ~RTRANS_FLAG_DELTA;
+                this->stats.coded++;
+        }
+
+        /* split a batch into its records, each a length byte and its data */
+        if(type < RTRANS_TYPE_ACK && (type & RTRANS_FLAG_BATCH)){
+                size_t i, n;
+                type &= RTRANS_TYPE_MASK;
+                for(i = 0; i < len; i += 1 + n){
+                        n = payload[i];
+                        if(i + 1 + n > len){
+                                this->stats.bad_coding++;
+                                return;
+                        }
+                }
+                for(i = 0; i < len; i += 1 + n){
+                        n = payload[i];
+                        this->stats.batched++;
+                        deliver(slave, type, &payload[i + 1], n);
+                }
+                return;
+        }
+
+        this->stats.packages++;
+        if(this->callback){
+                this->callback(this->ctx, slave, type, payload, len);
+        }
+}
+
+/** Write as much of the tx queue as the serial line takes. Returns false
+    if the line failed.
+*/
+bool rt_master::flush(){
+        uint8_t buf[RT_MASTER_READ_CHUNK];
+        size_t n;
+        ssize_t w;
+
+        while(this->tx_queue.avail > 0){
+                n = (this->tx_queue.avail < sizeof(buf)) ? this->tx_queue.avail : sizeof(buf);
+                rb_peek(&this->tx_queue, buf, n);
+                w = write(this->fd, buf, n);
+                if(w < 0 && errno == EINTR){
+                        continue;
+                }
+                if(w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                        return true;
+                }
+                if(w <= 0){
+                        this->stats.tx_errors++;
+                        return false;
+                }
+                rb_del(&this->tx_queue, w);
+        }
+        return true;
+}
+
+bool rt_master::loop(int timeout){
+        uint8_t buf[RT_MASTER_READ_CHUNK];
+        struct pollfd p;
+        uint64_t t = now(), due = tw_next(&this->wheel);
+        ssize_t r, i;
+        int rc;
+        xa_rx16 rx;
+
+        /* do not sleep past the next timer */
+        if(due <= t){
+                timeout = 0;
+        }
+        else if(due - t < (uint64_t) timeout){
+                timeout = due - t;
+        }
+
+        p.fd = this->fd;
+        p.events = POLLIN | (this->tx_queue.avail > 0 ? POLLOUT : 0);
+        p.revents = 0;
+        rc = ::poll(&p, 1, timeout);
+        if(rc < 0 && errno != EINTR){
+                return false;
+        }
+
+        if(rc > 0 && (p.revents & (POLLIN | POLLHUP))){
+                while((r = read(this->fd, buf, sizeof(buf))) > 0){
+                        for(i = 0; i < r; i++){
+                                int got = xa_parse(&this->parser, buf[i]);
+                                if(got == 0){
+                                        continue;
+                                }
+                                this->stats.rx_frames++;
+                                if(got < 0){
+                                        this->stats.bad_frames++;
+                                }
+                                else if(xa_rx16_decode(&this->parser, &rx)){
+                                        handle(rx.src, rx.data, rx.len);
+                                }
+                        }
+                }
+                if(r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)){
+                        return false;
+                }
+        }
+
+        tw_advance(&this->wheel, now());
+        dispatch();
+        ack_flush();
+        return flush();
+}
+
+void rt_master::run(){
+        this->stopped = false;
+        while(!this->stopped && loop(100)){
+        }
+}
+
+int rt_serial_open(const char *tty, unsigned baud){
+        struct termios t;
+        speed_t speed;
+        int fd;
+
+        switch(baud){
+                case 9600:   speed = B9600;   break;
+                case 19200:  speed = B19200;  break;
+                case 38400:  speed = B38400;  break;
+                case 57600:  speed = B57600;  break;
+                case 115200: speed = B115200; break;
+                case 230400: speed = B230400; break;
+                default:
+                        errno = EINVAL;
+                        return -1;
+        }
+        if((fd = open(tty, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0){
+                return -1;
+        }
+        if(tcgetattr(fd, &t) < 0){
+                close(fd);
+                return -1;
+        }
+        cfmakeraw(&t);
+        cfsetispeed(&t, speed);
+        cfsetospeed(&t, speed);
+        t.c_cflag |= CLOCAL | CREAD;
+        t.c_cflag &= ~(CSTOPB | CRTSCTS);
+        if(tcsetattr(fd, TCSANOW, &t) < 0){
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
@@ -0,0 +1,299 @@
+#ifndef _rt_master_h_
+#define _rt_master_h_
+
+#include "rtrans_proto.h"
+#include "rt_trace.h"
+#include "ringbuffer.h"
+#include "xbee_api.h"
+#include "timer_wheel.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+
+/* Timeouts (ms) of the default configuration, as in master/rtrans.py */
+#define RT_MASTER_POLL_TIMEOUT  (2000)  // poll again if no DATA came back
+#define RT_MASTER_FLOW_TIMEOUT  (5000)  // drop a package missing segments
+#define RT_MASTER_PROBE_EVERY   (500)   // interval of PROBE broadcasts
+#define RT_MASTER_BACKOFF_MAX   (60000) // longest wait before polling a silent slave again
+#define RT_MASTER_RESPONSE_MIN  (100)   // shortest wait for the answer to a scheduled poll
+#define RT_MASTER_ACK_DELAY     (RTRANS_ACK_DELAY)  // longest an ACK waits for more segments or a poll
+#define RT_MASTER_ACK_EVERY     (2)     // segments after which an ACK goes out without waiting
+#define RT_MASTER_SET_TIMEOUT   (1000)  // send unacknowledged SET segments again
+#define RT_MASTER_SET_TRIES     (5)     // times a SET is sent in all before giving up
+
+/* Poll scheduler defaults */
+#define RT_MASTER_POLL_WINDOW   (4)     // polls outstanding at once
+#define RT_MASTER_AIRTIME       (80)    // percent of the serial line polls may fill
+
+/* Broadcast address */
+#define RT_MASTER_BROADCAST     (0xffff)
+
+/* Payload callback, called once per package or batched record. JOIN is
+   reported as soon as a slave answers a probe.
+*/
+typedef void (*rt_master_callback)(void *ctx, uint16_t slave, uint8_t type,
+                                   const uint8_t *payload, size_t len);
+
+/* Millisecond clock, monotonic */
+typedef uint64_t (*rt_master_clock)();
+
+/* Runtime configuration; everything is allocated from it up front */
+typedef struct rt_master_config_s {
+    uint16_t        addr;           // our 16-bit address
+    uint16_t        max_nodes;      // slaves tracked at once
+    uint8_t         flows;          // packages reassembled at once, per slave
+    uint8_t         max_segments;   // largest package, in segments
+    size_t          tx_buffer;      // bytes of encoded frames waiting for the serial line
+    uint32_t        poll_timeout;
+    uint32_t        flow_timeout;
+    uint32_t        probe_every;
+    uint8_t         poll_window;    // scheduled polls outstanding at once
+    uint32_t        poll_interval;  // least time between two scheduled polls of a slave
+    uint32_t        backoff_max;
+    uint32_t        baud;           // coordinator's serial rate, 0 for no airtime budget
+    uint8_t         airtime;        // percent of baud scheduled polls and their answers may use
+    uint32_t        ack_delay;      // hold-back of cumulative ACKs, up to RTRANS_ACK_DELAY; 0 sends them at once
+    uint32_t        set_timeout;
+    bool            escaped;        // the coordinator runs in escaped API mode (ATAP2)
+    rt_master_clock clock;          // 0 for CLOCK_MONOTONIC
+    FILE            *trace;         // every frame sent and received is traced to it (see rt_trace.h), 0 for none
+} rt_master_config;
+
+/* Fill in the defaults for a master at the given address */
+void rt_master_config_init(rt_master_config *cfg, uint16_t addr);
+
+/* Master statistics */
+typedef struct rt_master_stats_s {
+    unsigned long rx_frames;    // API frames from the coordinator
+    unsigned long bad_frames;   // API frames with a bad checksum
+    unsigned long segments;     // valid segments received
+    unsigned long duplicates;   // segments received more than once, or of a package delivered
+    unsigned long bad_checksum; // segments dropped on checksum
+    unsigned long acks;         // ACK frames sent
+    unsigned long piggybacked;  // ACKs sent along with a POLL or SET
+    unsigned long naks;         // NAKs sent
+    unsigned long polls;        // POLLs sent, retries included
+    unsigned long retransmits;  // POLLs and SET segments sent again under the same package number
+    unsigned long sets;         // SETs acknowledged by the slave
+    unsigned long sets_lost;    // SETs given up unacknowledged
+    unsigned long timeouts;     // scheduled polls left unanswered
+    unsigned long response_ms;  // smoothed time from a poll to its answer
+    unsigned long throttled;    // times the airtime budget held scheduled polls back
+    unsigned long cycles;       // scheduling cycles completed: every slave had its turn
+    unsigned long cycle_ms;     // duration of the last cycle
+    unsigned long packages;     // packages delivered to the callback
+    unsigned long coded;        // packages which were delta coded
+    unsigned long batched;      // packages which arrived in a batch
+    unsigned long bad_coding;   // coded or batched packages which failed to decode
+    unsigned long expired;      // incomplete packages dropped
+    unsigned long no_slot;      // segments dropped for lack of a node or flow slot
+    unsigned long tx_frames;    // frames queued for the coordinator
+    unsigned long tx_dropped;   // frames dropped because the tx buffer was full
+    unsigned long tx_errors;    // writes to the serial line which failed
+} rt_master_stats;
+
+/** Base-station side of the protocol for one coordinator radio: a single
+    loop over the serial line, with preallocated state (see the README).
+*/
+class rt_master {
+
+private:
+        /* Package being reassembled */
+        struct flow {
+                bool     used;
+                uint16_t pkg_no;
+                uint8_t  type;
+                uint8_t  seg_ct;
+                uint8_t  count;         // segments received
+                tw_timer expire;        // drops the package if it stops arriving
+                uint8_t  *have;         // per segment: length + 1, 0 if missing
+                uint8_t  *naked;        // per segment: a NAK was sent
+                uint8_t  *data;         // max_segments slots of RTRANS_XBEE_MAX_PAYLOAD bytes
+        };
+
+        /* Scheduler state of a node */
+        enum sched_state {
+                SCHED_NONE,             // not scheduled
+                SCHED_READY,            // waiting for its turn
+                SCHED_POLLED,           // poll outstanding
+                SCHED_PARKED            // waiting out poll_interval or a backoff
+        };
+
+        /* ACK state of a node */
+        enum ack_state {
+                ACK_NONE,               // nothing to acknowledge
+                ACK_WAITING,            // ack_timer runs for more segments
+                ACK_DUE                 // to be sent at the end of the loop, unless a poll takes it
+        };
+
+        /* Slave known to the master */
+        struct node {
+                uint16_t addr;
+                uint8_t  checksum;      // RTRANS_CHECKSUM_* the slave last used
+                uint8_t  caps;          // RTRANS_CAP_* from its JOIN
+                uint8_t  ack;           // ack_state
+                bool     ack_listed;    // in the ack_due list
+                uint16_t ack_pkg;       // package the pending ACK is for
+                uint8_t  ack_new;       // segments the pending ACK covers which were not acked yet
+                tw_timer ack_timer;
+                tw_timer poll_retx;     // pending while a poll is outstanding or the node is parked
+                uint16_t recent[RTRANS_DUP_WINDOW];     // packages delivered lately
+                uint8_t  recent_ct[RTRANS_DUP_WINDOW];  // and their segments
+                uint8_t  recent_count;
+                uint8_t  recent_next;   // entry to reuse next
+                uint16_t poll_pkg;      // package number of the last poll
+                bool     poll_open;     // neither answered nor acknowledged yet
+                bool     poll_acked;    // it carried the ACK of package poll_ack
+                uint16_t poll_ack;
+                uint64_t poll_sent;     // time it last went out
+                uint16_t set_pkg;       // SET being sent,
+                uint8_t  set_ct;        // its segments, 0 for none,
+                uint8_t  set_acked;     // bitmap of those acknowledged
+                uint8_t  set_tries;
+                uint8_t  set_len;
+                tw_timer set_timer;
+                uint8_t  set_data[RTRANS_SET_MAX_SEGMENTS * RTRANS_SET_PAYLOAD];
+                uint8_t  sched;         // sched_state
+                uint8_t  priority;
+                uint8_t  fails;         // scheduled polls in a row left unanswered
+                uint16_t heap_pos;      // place in the ready heap
+                uint32_t cycle;         // last cycle the node had its turn in
+                uint64_t polled_at;     // time of the outstanding poll, 0 once answered or given up
+                uint64_t pass;          // the lowest ready pass goes next
+                uint32_t answer;        // serial bytes a poll and its answer take, averaged
+                uint32_t answer_rx;     // serial bytes of the answer coming in,
+                uint32_t answer_tx;     // and of the poll and ACKs going out
+                flow     *flows;
+        };
+
+        rt_master_config      cfg;
+        int                   fd;
+        rt_master_callback    callback;
+        void                  *ctx;
+        uint16_t              frame_no;
+        bool                  stopped;
+        xa_parser             parser;
+        std::vector<node>     nodes;
+        uint16_t              node_count;
+        std::vector<uint16_t> index;        // address to node number + 1
+        std::vector<flow>     flow_pool;
+        std::vector<uint8_t>  arena;        // flow bitmaps and segment slots
+        std::vector<uint8_t>  tx_store;
+        ringbuffer            tx_queue;
+        std::vector<uint8_t>  scratch;      // reassembled and decoded packages
+        timer_wheel           wheel;        // poll, flow and probe timers
+        tw_timer              probe_timer;
+        uint64_t              probe_until;
+        std::vector<uint16_t> ready;        // heap of ready node numbers, by pass
+        uint16_t              ready_count;
+        uint16_t              scheduled;    // nodes in the scheduler
+        uint16_t              outstanding;  // scheduled polls outstanding
+        uint64_t              pass;         // pass of the last node polled
+        int64_t               credit;       // airtime budget left, bytes * 1000000
+        uint64_t              credit_at;    // time the budget was last topped up
+        tw_timer              sched_timer;  // wakes the scheduler once the budget allows
+        uint32_t              resp_srtt;    // smoothed response time, scaled by 8
+        uint32_t              resp_var;     // its variation, scaled by 4
+        uint32_t              cycle;
+        uint16_t              cycle_left;   // nodes yet to have their turn this cycle
+        uint64_t              cycle_start;
+        std::vector<uint16_t> ack_due;      // node numbers with an ACK due
+        uint16_t              ack_due_count;
+        rt_master_stats       stats;
+
+        uint64_t now() const;
+        node *find(uint16_t addr, bool create);
+        void send_segment(const node *n, uint16_t dst, uint8_t type, uint16_t pkg_no,
+                          uint8_t seg_ct, uint8_t seg_no, const uint8_t *payload, size_t len);
+        bool send_pkg(node *n, uint16_t dst, uint8_t type, uint16_t pkg_no,
+                      uint8_t seg_ct, uint8_t seg_no, const uint8_t *payload, size_t len);
+        void send_poll(node *n);
+        void set_send(node *n);
+        void acked(node *n, uint16_t pkg_no, uint8_t seg_no);
+        int recent_find(const node *n, uint16_t pkg_no) const;
+        void remember(node *n, uint16_t pkg_no, uint8_t seg_ct);
+        void trace(uint8_t kind, uint16_t peer, const uint8_t *frame, size_t len);
+        void handle(uint16_t src, const uint8_t *frame, size_t len);
+        void reassemble(node *n, const rt_out_header *h, const uint8_t *payload);
+        void deliver(uint16_t slave, uint8_t type, const uint8_t *payload, size_t len);
+        void ack_segment(node *n, uint16_t pkg_no, bool complete);
+        void ack_mark_due(node *n);
+        size_t ack_build(node *n, uint8_t *out);
+        void ack_send(node *n);
+        void ack_flush();
+        bool flush();
+        void heap_up(uint16_t pos);
+        void heap_down(uint16_t pos);
+        void make_ready(node *n);
+        void park(node *n, uint64_t ms);
+        void turn_over(node *n);
+        void collected(node *n);
+        uint32_t response_timeout() const;
+        void response_sample(uint32_t ms);
+        void dispatch();
+        static void poll_expired(void *ctx, void *arg);
+        static void flow_expired(void *ctx, void *arg);
+        static void probe_expired(void *ctx, void *arg);
+        static void sched_expired(void *ctx, void *arg);
+        static void ack_expired(void *ctx, void *arg);
+        static void set_expired(void *ctx, void *arg);
+
+public:
+        /* Run over a serial port, pty or socket; fd is put in non-blocking
+           mode and stays owned by the caller.
+        */
+        rt_master(int fd, const rt_master_config &cfg, rt_master_callback cb, void *ctx);
+
+        /* Send a single segment package; a POLL or SET carries a pending
+           cumulative ACK if there is room */
+        void send(uint16_t dst, uint8_t type, const uint8_t *payload, size_t len);
+
+        /* Send a SET of up to RTRANS_SET_MAX_SEGMENTS segments, replacing
+           one to the same slave still unacknowledged. False if it is too
+           long or there is no free node slot.
+        */
+        bool set(uint16_t slave, const uint8_t *payload, size_t len);
+
+        /* Broadcast PROBE every probe_every ms for the next ms milliseconds */
+        void probe(uint32_t ms);
+
+        /* Ask a slave for data, asking again every poll_timeout ms until it
+           arrives. Scheduled slaves are left to the scheduler.
+        */
+        void poll(uint16_t slave);
+
+        /* Ask a slave for its counters; they come back to the callback as
+           a STATS package holding an rt_counters */
+        void request_stats(uint16_t slave) { send(slave, RTRANS_TYPE_STATS, 0, 0); }
+
+        /* Hand a slave to the poll scheduler, or change its priority (1 to
+           255). Returns false if there is no free node slot.
+        */
+        bool schedule(uint16_t slave, uint8_t priority = 1);
+
+        /* Take a slave out of the poll scheduler */
+        void unschedule(uint16_t slave);
+
+        /* Read and handle whatever the coordinator sent, run due timers and
+           write out queued frames, waiting at most timeout ms for input.
+           Returns false if the serial line failed or was closed.
+        */
+        bool loop(int timeout);
+
+        /* Call loop() until stop() */
+        void run();
+        void stop() { stopped = true; }
+
+        /* Bytes of encoded frames waiting to be written */
+        size_t pending() const { return tx_queue.avail; }
+
+        const rt_master_stats &statistics() const { return stats; }
+};
+
+/* Open a serial port at the given baud rate in raw 8N1 mode.
+   Returns the fd, or -1 with errno set.
+*/
+int rt_serial_open(const char *tty, unsigned baud);
+
+#endif
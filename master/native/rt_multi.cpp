@@ -0,0 +1,376 @@
+#include "rt_multi.h"
+#include <string.h>
+#include <chrono>
+
+/* Packages in a worker's queue from one port it takes before it looks at the next */
+#define RT_MULTI_BATCH          (16)
+
+/* Longest a worker sleeps before it looks at its queues again, ms; a
+   missed wake-up costs no more than this */
+#define RT_MULTI_IDLE           (10)
+
+/* Bytes of each command queue, a power of two; a SET is the longest command */
+#define RT_MULTI_COMMANDS       (4096)
+
+/* Commands */
+#define RT_MULTI_POLL           (0)
+#define RT_MULTI_SCHEDULE       (1)
+#define RT_MULTI_UNSCHEDULE     (2)
+#define RT_MULTI_SET            (3)
+#define RT_MULTI_STATS          (4)
+#define RT_MULTI_PROBE          (5)
+
+/* Package queued to a worker, followed by its payload */
+typedef struct rt_multi_pkg_s {
+    uint16_t slave;
+    uint8_t  type;
+    uint8_t  port;
+} rt_multi_pkg;
+
+/* The worker or I/O thread running, so commands go to its own queue */
+static thread_local const void *current_owner;
+static thread_local int current_worker = -1;
+static thread_local int current_port = -1;
+
+void rt_multi_config_init(rt_multi_config *cfg){
+        cfg->workers     = RT_MULTI_WORKERS;
+        cfg->queue_bytes = RT_MULTI_QUEUE;
+}
+
+rt_multi_master::rt_multi_master(const rt_multi_config &cfg, rt_multi_callback cb, void *ctx){
+        unsigned i;
+
+        this->cfg      = cfg;
+        this->callback = cb;
+        this->ctx      = ctx;
+        this->running  = false;
+        this->stopping = false;
+        this->refused  = 0;
+        for(i = 0; i < cfg.workers; i++){
+                worker *w = new worker;
+                w->number    = i;
+                w->sleeping  = false;
+                w->delivered = 0;
+                this->workers.push_back(w);
+        }
+}
+
+rt_multi_master::~rt_multi_master(){
+        size_t i;
+
+        stop();
+        for(i = 0; i < this->ports.size(); i++){
+                delete this->ports[i]->master;
+                delete [] this->ports[i]->to_worker;
+                delete [] this->ports[i]->commands;
+                delete this->ports[i];
+        }
+        for(i = 0; i < this->workers.size(); i++){
+                delete this->workers[i];
+        }
+}
+
+int rt_multi_master::add_port(int fd, const rt_master_config &cfg){
+        /* the largest package is a delta coded one, four times its segments */
+        size_t largest = sizeof(rt_multi_pkg) + 4 * cfg.max_segments * RTRANS_XBEE_MAX_PAYLOAD;
+        port *p;
+
+        if(this->running || (this->cfg.queue_bytes & (this->cfg.queue_bytes - 1)) != 0 ||
+           sr_record_size(largest) > this->cfg.queue_bytes / 2 || this->ports.size() > 0xff){
+                return -1;
+        }
+        p = new port;
+        p->owner     = this;
+        p->number    = this->ports.size();
+        p->master    = new rt_master(fd, cfg, io_callback, p);
+        p->to_worker = 0;
+        p->commands  = 0;
+        p->queued    = 0;
+        p->stalls    = 0;
+        p->run       = 0;
+        p->failed    = false;
+        this->ports.push_back(p);
+        return p->number;
+}
+
+void rt_multi_master::start(){
+        size_t q = this->cfg.queue_bytes, producers = this->workers.size() + this->ports.size() + 1;
+        size_t i, k;
+
+        if(this->running){
+                return;
+        }
+        this->stopping = false;
+        this->running  = true;
+
+        /* a queue to each worker, and one from each worker, I/O thread
+           and the rest of the application */
+        for(i = 0; i < this->ports.size(); i++){
+                port *p = this->ports[i];
+                if(!p->to_worker){
+                        p->store.assign(this->workers.size() * q + producers * RT_MULTI_COMMANDS, 0);
+                        p->to_worker = new spsc_ring[this->workers.size()];
+                        p->commands  = new spsc_ring[producers];
+                        for(k = 0; k < this->workers.size(); k++){
+                                sr_init(&p->to_worker[k], &p->store[k * q], q);
+                        }
+                        for(k = 0; k < producers; k++){
+                                sr_init(&p->commands[k], &p->store[this->workers.size() * q + k * RT_MULTI_COMMANDS],
+                                        RT_MULTI_COMMANDS);
+                        }
+                }
+        }
+        for(i = 0; i < this->workers.size(); i++){
+                this->workers[i]->thread = std::thread(&rt_multi_master::worker_main, this, this->workers[i]);
+        }
+        for(i = 0; i < this->ports.size(); i++){
+                this->ports[i]->thread = std::thread(&rt_multi_master::io_main, this, this->ports[i]);
+        }
+}
+
+void rt_multi_master::stop(){
+        size_t i;
+
+        if(!this->running){
+                return;
+        }
+        this->stopping = true;
+        for(i = 0; i < this->ports.size(); i++){
+                this->ports[i]->thread.join();
+        }
+        for(i = 0; i < this->workers.size(); i++){
+                worker *w = this->workers[i];
+                {
+                        std::lock_guard<std::mutex> lk(w->lock);
+                        w->wake.notify_one();
+                }
+                w->thread.join();
+        }
+        this->running = false;
+}
+
+/** I/O thread: the port's master loop, and the commands queued to it */
+void rt_multi_master::io_main(port *p){
+        current_owner = this;
+        current_port  = p->number;
+        while(!this->stopping){
+                run_commands(p);
+                if(!p->master->loop(RT_MULTI_IO_TICK)){
+                        p->failed = true;
+                        break;
+                }
+        }
+        current_port = -1;
+}
+
+/** Run a command on a port's master */
+void rt_multi_master::apply(port *p, const rt_multi_cmd &c, const uint8_t *payload, size_t len){
+        switch(c.op){
+                case RT_MULTI_POLL:       p->master->poll(c.slave); break;
+                case RT_MULTI_SCHEDULE:   p->master->schedule(c.slave, c.arg); break;
+                case RT_MULTI_UNSCHEDULE: p->master->unschedule(c.slave); break;
+                case RT_MULTI_SET:        p->master->set(c.slave, payload, len); break;
+                case RT_MULTI_STATS:      p->master->request_stats(c.slave); break;
+                case RT_MULTI_PROBE:      p->master->probe(c.arg); break;
+        }
+        p->run.fetch_add(1, std::memory_order_relaxed);
+}
+
+void rt_multi_master::run_commands(port *p){
+        size_t i, producers = this->workers.size() + this->ports.size() + 1;
+
+        for(i = 0; i < producers; i++){
+                const uint8_t *rec;
+                size_t n;
+                while((rec = sr_peek(&p->commands[i], &n)) != 0){
+                        rt_multi_cmd c;
+                        memcpy(&c, rec, sizeof(c));
+                        apply(p, c, rec + sizeof(c), n - sizeof(c));
+                        sr_release(&p->commands[i]);
+                }
+        }
+}
+
+/** rt_master callback on an I/O thread: queue the package to the worker
+    of its slave, waiting for room if need be, or call back right away
+    without workers
+*/
+void rt_multi_master::io_callback(void *ctx, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len){
+        port *p = (port *) ctx;
+        rt_multi_master *m = p->owner;
+        worker *w;
+        spsc_ring *r;
+        uint8_t *rec;
+        rt_multi_pkg h;
+
+        if(m->workers.empty()){
+                m->callback(m->ctx, p->number, slave, type, payload, len);
+                return;
+        }
+        w = m->workers[(slave ^ (p->number << 8)) % m->workers.size()];
+        r = &p->to_worker[w->number];
+        if((rec = sr_reserve(r, sizeof(h) + len)) == 0){
+                p->stalls.fetch_add(1, std::memory_order_relaxed);
+                while((rec = sr_reserve(r, sizeof(h) + len)) == 0){
+                        if(m->stopping){
+                                return;
+                        }
+                        std::this_thread::yield();
+                }
+        }
+        h.slave = slave;
+        h.type  = type;
+        h.port  = p->number;
+        memcpy(rec, &h, sizeof(h));
+        memcpy(rec + sizeof(h), payload, len);
+        sr_commit(r);
+        p->queued.fetch_add(1, std::memory_order_relaxed);
+
+        /* pairs with the fence in worker_main: either the worker sees the
+           package, or we see it asleep */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(w->sleeping.load(std::memory_order_relaxed)){
+                std::lock_guard<std::mutex> lk(w->lock);
+                w->wake.notify_one();
+        }
+}
+
+/** Call back with up to RT_MULTI_BATCH packages from each port; false if
+    there were none
+*/
+bool rt_multi_master::drain(worker *w){
+        bool any = false;
+        size_t i, k;
+
+        for(i = 0; i < this->ports.size(); i++){
+                spsc_ring *r = &this->ports[i]->to_worker[w->number];
+                for(k = 0; k < RT_MULTI_BATCH; k++){
+                        const uint8_t *rec;
+                        size_t n;
+                        rt_multi_pkg h;
+                        if((rec = sr_peek(r, &n)) == 0){
+                                break;
+                        }
+                        memcpy(&h, rec, sizeof(h));
+                        this->callback(this->ctx, h.port, h.slave, h.type, rec + sizeof(h), n - sizeof(h));
+                        sr_release(r);
+                        w->delivered.fetch_add(1, std::memory_order_relaxed);
+                        any = true;
+                }
+        }
+        return any;
+}
+
+void rt_multi_master::worker_main(worker *w){
+        size_t i;
+
+        current_owner  = this;
+        current_worker = w->number;
+        while(true){
+                if(drain(w)){
+                        continue;
+                }
+                if(this->stopping){
+                        /* the I/O threads are done by now; finish what they queued */
+                        while(drain(w)){
+                        }
+                        break;
+                }
+                std::unique_lock<std::mutex> lk(w->lock);
+                w->sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                bool idle = !this->stopping;
+                for(i = 0; i < this->ports.size() && idle; i++){
+                        idle = sr_empty(&this->ports[i]->to_worker[w->number]);
+                }
+                if(idle){
+                        w->wake.wait_for(lk, std::chrono::milliseconds(RT_MULTI_IDLE));
+                }
+                w->sleeping.store(false, std::memory_order_relaxed);
+        }
+        current_worker = -1;
+}
+
+/** Queue a command to a port's I/O thread, on the queue of the thread
+    issuing it; run it right away before start() and on the port's own
+    I/O thread
+*/
+bool rt_multi_master::command(int port, uint8_t op, uint16_t slave, uint32_t arg, const uint8_t *payload, size_t len){
+        rt_multi_cmd c;
+        spsc_ring *r;
+        uint8_t *rec;
+        size_t producer;
+
+        if(port < 0 || (size_t) port >= this->ports.size() || len > RTRANS_SET_MAX_SEGMENTS * RTRANS_SET_PAYLOAD){
+                return false;
+        }
+        c.op    = op;
+        c.pad   = 0;
+        c.slave = slave;
+        c.arg   = arg;
+        if(!this->running || (current_owner == this && current_port == port)){
+                apply(this->ports[port], c, payload, len);
+                return true;
+        }
+        if(current_owner == this && current_worker >= 0){
+                producer = current_worker;
+        }
+        else if(current_owner == this && current_port >= 0){
+                producer = this->workers.size() + current_port;
+        }
+        else{
+                producer = this->workers.size() + this->ports.size();
+        }
+        r = &this->ports[port]->commands[producer];
+        if((rec = sr_reserve(r, sizeof(c) + len)) == 0){
+                this->refused.fetch_add(1, std::memory_order_relaxed);
+                return false;
+        }
+        memcpy(rec, &c, sizeof(c));
+        if(len > 0){
+                memcpy(rec + sizeof(c), payload, len);
+        }
+        sr_commit(r);
+        return true;
+}
+
+bool rt_multi_master::poll(int port, uint16_t slave){
+        return command(port, RT_MULTI_POLL, slave, 0, 0, 0);
+}
+
+bool rt_multi_master::schedule(int port, uint16_t slave, uint8_t priority){
+        return command(port, RT_MULTI_SCHEDULE, slave, priority, 0, 0);
+}
+
+bool rt_multi_master::unschedule(int port, uint16_t slave){
+        return command(port, RT_MULTI_UNSCHEDULE, slave, 0, 0, 0);
+}
+
+bool rt_multi_master::set(int port, uint16_t slave, const uint8_t *payload, size_t len){
+        return command(port, RT_MULTI_SET, slave, 0, payload, len);
+}
+
+bool rt_multi_master::request_stats(int port, uint16_t slave){
+        return command(port, RT_MULTI_STATS, slave, 0, 0, 0);
+}
+
+bool rt_multi_master::probe(int port, uint32_t ms){
+        return command(port, RT_MULTI_PROBE, 0, ms, 0, 0);
+}
+
+rt_multi_stats rt_multi_master::statistics() const{
+        rt_multi_stats s = rt_multi_stats();
+        size_t i;
+
+        for(i = 0; i < this->ports.size(); i++){
+                s.queued   += this->ports[i]->queued.load(std::memory_order_relaxed);
+                s.stalls   += this->ports[i]->stalls.load(std::memory_order_relaxed);
+                s.commands += this->ports[i]->run.load(std::memory_order_relaxed);
+                s.failed   += this->ports[i]->failed.load(std::memory_order_relaxed) ? 1 : 0;
+        }
+        for(i = 0; i < this->workers.size(); i++){
+                s.delivered += this->workers[i]->delivered.load(std::memory_order_relaxed);
+        }
+        s.refused = this->refused.load(std::memory_order_relaxed);
+        return s;
+}
@@ -0,0 +1,152 @@
+#ifndef _rt_multi_h_
+#define _rt_multi_h_
+
+#include "rt_master.h"
+#include "spsc_ring.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Defaults */
+#define RT_MULTI_WORKERS        (2)     // callback threads
+#define RT_MULTI_QUEUE          (65536) // bytes of each queue between an I/O thread and a worker
+#define RT_MULTI_IO_TICK        (10)    // longest an I/O thread sleeps before it looks for commands, ms
+
+/* Payload callback, as rt_master_callback, with the port the package came in on */
+typedef void (*rt_multi_callback)(void *ctx, int port, uint16_t slave, uint8_t type,
+                                  const uint8_t *payload, size_t len);
+
+typedef struct rt_multi_config_s {
+    unsigned workers;       // callback threads, 0 to call back on the I/O threads
+    size_t   queue_bytes;   // of packages, per I/O thread and worker; a power of two
+} rt_multi_config;
+
+/* Command queued to an I/O thread, followed by its payload */
+typedef struct rt_multi_cmd_s {
+    uint8_t  op;
+    uint8_t  pad;
+    uint16_t slave;
+    uint32_t arg;
+} rt_multi_cmd;
+
+/* Fill in the defaults */
+void rt_multi_config_init(rt_multi_config *cfg);
+
+/* Statistics, summed over the ports and workers */
+typedef struct rt_multi_stats_s {
+    unsigned long queued;       // packages handed to the workers
+    unsigned long stalls;       // times an I/O thread waited for room in a worker's queue
+    unsigned long delivered;    // packages the workers called back with
+    unsigned long commands;     // commands run by the I/O threads
+    unsigned long refused;      // commands dropped on a full queue
+    unsigned long failed;       // ports whose serial line failed or closed
+} rt_multi_stats;
+
+/** Master for several coordinator radios at once. Each port has an
+    rt_master of its own, run by an I/O thread which does nothing but read
+    frames, reassemble and ACK segments and run the poll scheduler, so the
+    slaves get their ACKs in time however long the application takes over
+    a package. Completed packages are copied into a lock-free queue to one
+    of the worker threads, which run the callback; a slave's packages
+    always go to the same worker, so they are handled in order. Each I/O
+    thread has a queue to each worker, and each worker one back to each I/O
+    thread for the commands it issues (poll(), set() and so on), so every
+    queue has one producer and one consumer. An I/O thread waits for room
+    if a worker falls a whole queue behind.
+
+    Ports are added, and their rt_master set up, before start(); after
+    that, the master of a port belongs to its I/O thread, and the commands
+    below are the way to reach it, from the callback or one other thread.
+    With no workers, the callback runs on the I/O thread of its port, as
+    with a bare rt_master.
+*/
+class rt_multi_master {
+
+private:
+        struct worker;
+
+        /* Coordinator radio and its I/O thread */
+        struct port {
+                rt_multi_master       *owner;
+                int                   number;
+                rt_master             *master;
+                std::thread           thread;
+                std::vector<uint8_t>  store;
+                spsc_ring             *to_worker;   // one per worker
+                spsc_ring             *commands;    // one per worker, and one for other threads
+                std::atomic<unsigned long> queued;
+                std::atomic<unsigned long> stalls;
+                std::atomic<unsigned long> run;     // commands run
+                std::atomic<bool>     failed;
+        };
+
+        /* Callback thread */
+        struct worker {
+                int                   number;
+                std::thread           thread;
+                std::mutex            lock;
+                std::condition_variable wake;
+                std::atomic<bool>     sleeping;
+                std::atomic<unsigned long> delivered;
+        };
+
+        rt_multi_config       cfg;
+        rt_multi_callback     callback;
+        void                  *ctx;
+        std::vector<port *>   ports;
+        std::vector<worker *> workers;
+        std::atomic<bool>     running;
+        std::atomic<bool>     stopping;
+        std::atomic<unsigned long> refused;
+
+        static void io_callback(void *ctx, uint16_t slave, uint8_t type, const uint8_t *payload, size_t len);
+        void io_main(port *p);
+        void apply(port *p, const rt_multi_cmd &c, const uint8_t *payload, size_t len);
+        void run_commands(port *p);
+        void worker_main(worker *w);
+        bool drain(worker *w);
+        bool command(int port, uint8_t op, uint16_t slave, uint32_t arg, const uint8_t *payload, size_t len);
+
+public:
+        rt_multi_master(const rt_multi_config &cfg, rt_multi_callback cb, void *ctx);
+        ~rt_multi_master();
+
+        /* Add a coordinator on a serial port, pty or socket, before start().
+           Returns its port number, or -1 if a package of cfg does not fit
+           the queues.
+        */
+        int add_port(int fd, const rt_master_config &cfg);
+
+        /* The master of a port, to set up before start() or read after stop() */
+        rt_master &master(int port) { return *this->ports[port]->master; }
+
+        size_t port_count() const { return this->ports.size(); }
+
+        /* Start the I/O and worker threads */
+        void start();
+
+        /* Stop the I/O threads, let the workers call back with what they
+           have queued, and wait for all of them */
+        void stop();
+
+        /* Commands to the master of a port, run by its I/O thread; false
+           if the queue to it is full or the arguments do not fit
+        */
+        bool poll(int port, uint16_t slave);
+        bool schedule(int port, uint16_t slave, uint8_t priority = 1);
+        bool unschedule(int port, uint16_t slave);
+        bool set(int port, uint16_t slave, const uint8_t *payload, size_t len);
+        bool request_stats(int port, uint16_t slave);
+        bool probe(int port, uint32_t ms);
+
+        /* Whether a port's serial line failed or was closed */
+        bool failed(int port) const { return this->ports[port]->failed.load(); }
+
+        rt_multi_stats statistics() const;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "spsc_ring.h"
+#include <string.h>
+
+/* Length of the marker which sends the reader back to the front */
+#define SR_SKIP                 (0xffffffffUL)
+
+void sr_init(spsc_ring *r, uint8_t *buffer, size_t size){
+        r->buf      = buffer;
+        r->size     = size;
+        r->reserved = 0;
+        r->peeked   = 0;
+        r->head.store(0, std::memory_order_relaxed);
+        r->tail.store(0, std::memory_order_relaxed);
+}
+
+uint8_t *sr_reserve(spsc_ring *r, size_t n){
+        size_t head = r->head.load(std::memory_order_relaxed);
+        size_t tail = r->tail.load(std::memory_order_acquire);
+        size_t off = head & (r->size - 1), need = sr_record_size(n), skip = 0;
+        uint32_t len = n;
+
+        if(off + need > r->size){
+                skip = r->size - off;
+        }
+        if(need + skip > r->size - (head - tail)){
+                return 0;
+        }
+        if(skip){
+                uint32_t mark = SR_SKIP;
+                memcpy(&r->buf[off], &mark, sizeof(mark));
+                off = 0;
+        }
+        memcpy(&r->buf[off], &len, sizeof(len));
+        r->reserved = skip + need;
+        return &r->buf[off + sizeof(len)];
+}
+
+void sr_commit(spsc_ring *r){
+        r->head.store(r->head.load(std::memory_order_relaxed) + r->reserved, std::memory_order_release);
+        r->reserved = 0;
+}
+
+const uint8_t *sr_peek(spsc_ring *r, size_t *n){
+        size_t tail = r->tail.load(std::memory_order_relaxed);
+        size_t head = r->head.load(std::memory_order_acquire);
+        size_t off, skip = 0;
+        uint32_t len;
+
+        if(tail == head){
+                return 0;
+        }
+        off = tail & (r->size - 1);
+        memcpy(&len, &r->buf[off], sizeof(len));
+        if(len == SR_SKIP){
+                skip = r->size - off;
+                off = 0;
+                memcpy(&len, &r->buf[off], sizeof(len));
+        }
+        r->peeked = skip + sr_record_size(len);
+        *n = len;
+        return &r->buf[off + sizeof(len)];
+}
+
+void sr_release(spsc_ring *r){
+        r->tail.store(r->tail.load(std::memory_order_relaxed) + r->peeked, std::memory_order_release);
+        r->peeked = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef _spsc_ring_h_
+#define _spsc_ring_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/* Lock-free queue of variable-length records between exactly one producer
+   and one consumer thread. Records are written and read in place: the
+   producer reserves room, fills it in and commits it, the consumer peeks
+   at the oldest record and releases it once done. Each record takes a
+   4-byte length and its data rounded up to 4 bytes, and never wraps: one
+   which does not fit before the end of the buffer starts over at the
+   front, behind a marker. The two ends only share the byte counters,
+   each written by one side, a cache line apart.
+*/
+
+#define SR_ALIGN                (4)
+#define SR_LINE                 (64)    // cache line size
+
+typedef struct spsc_ring_s {
+    uint8_t             *buf;
+    size_t              size;       // a power of two
+    std::atomic<size_t> head;       // bytes committed, written by the producer
+    size_t              reserved;   // producer: bytes the pending reservation takes, skip included
+    uint8_t             gap[SR_LINE];   // keeps head and tail off each other's cache line
+    std::atomic<size_t> tail;       // bytes released, written by the consumer
+    size_t              peeked;     // consumer: bytes the record peeked at takes
+} spsc_ring;
+
+/* Initialize a ring on the given array of size bytes, a power of two
+   and a multiple of SR_ALIGN, aligned to SR_ALIGN.
+*/
+void sr_init(spsc_ring *r, uint8_t *buffer, size_t size);
+
+/* Bytes a record of n bytes takes in the ring, at most; a ring fits any
+   record of up to half its size.
+*/
+static inline size_t sr_record_size(size_t n){
+        return (sizeof(uint32_t) + n + SR_ALIGN - 1) & ~(size_t) (SR_ALIGN - 1);
+}
+
+/* Producer: reserve n contiguous bytes for the next record.
+   Returns 0 if the ring is too full. Nothing is added until sr_commit.
+*/
+uint8_t *sr_reserve(spsc_ring *r, size_t n);
+
+/* Producer: add the record filled in after sr_reserve */
+void sr_commit(spsc_ring *r);
+
+/* Consumer: return the oldest record and its length in n, or 0 if the
+   ring is empty. It stays in the ring until sr_release.
+*/
+const uint8_t *sr_peek(spsc_ring *r, size_t *n);
+
+/* Consumer: remove the record returned by sr_peek */
+void sr_release(spsc_ring *r);
+
+/* Whether the ring holds no record; exact for the consumer, a snapshot
+   for anyone else */
+static inline bool sr_empty(const spsc_ring *r){
+        return r->head.load(std::memory_order_acquire) == r->tail.load(std::memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include "timer_wheel.h"
+
+/** Link the timer into the slot it belongs to, given the current tick */
+static void tw_place(timer_wheel *w, tw_timer *t){
+        uint64_t delta = t->expires - w->now;
+        tw_timer *head;
+        int level = 0;
+
+        if(delta > TW_MAX_DELAY){
+                t->expires = w->now + TW_MAX_DELAY;
+                delta = TW_MAX_DELAY;
+        }
+        while(delta >= (1ULL << (TW_BITS * (level + 1)))){
+                level++;
+        }
+        head = &w->slot[level][(t->expires >> (TW_BITS * level)) & (TW_SLOTS - 1)];
+
+        t->next = head;
+        t->prev = head->prev;
+        head->prev->next = t;
+        head->prev = t;
+}
+
+static void tw_unlink(tw_timer *t){
+        t->prev->next = t->next;
+        t->next->prev = t->prev;
+        t->prev = 0;
+        t->next = 0;
+}
+
+/** Move every timer of a slot down to the levels below */
+static void tw_cascade(timer_wheel *w, int level, size_t index){
+        tw_timer *head = &w->slot[level][index];
+
+        while(head->next != head){
+                tw_timer *t = head->next;
+                tw_unlink(t);
+                tw_place(w, t);
+        }
+}
+
+void tw_init(timer_wheel *w, uint64_t now){
+        int l, s;
+
+        w->now = now;
+        w->count = 0;
+        for(l = 0; l < TW_LEVELS; l++){
+                for(s = 0; s < TW_SLOTS; s++){
+                        w->slot[l][s].next = &w->slot[l][s];
+                        w->slot[l][s].prev = &w->slot[l][s];
+                }
+        }
+}
+
+void tw_timer_init(tw_timer *t, tw_callback fn, void *ctx, void *arg){
+        t->next    = 0;
+        t->prev    = 0;
+        t->expires = 0;
+        t->fn      = fn;
+        t->ctx     = ctx;
+        t->arg     = arg;
+}
+
+void tw_add(timer_wheel *w, tw_timer *t, uint64_t expires){
+        if(tw_pending(t)){
+                tw_unlink(t);
+        }
+        else{
+                w->count++;
+        }
+        t->expires = (expires > w->now) ? expires : w->now + 1;
+        tw_place(w, t);
+}
+
+void tw_cancel(timer_wheel *w, tw_timer *t){
+        if(tw_pending(t)){
+                tw_unlink(t);
+                w->count--;
+        }
+}
+
+size_t tw_advance(timer_wheel *w, uint64_t now){
+        size_t fired = 0;
+        int level;
+
+        /* nothing to do on the way, skip straight there */
+        if(w->count == 0){
+                if(now > w->now){
+                        w->now = now;
+                }
+                return 0;
+        }
+
+        while(w->now < now){
+                tw_timer *head;
+
+                w->now++;
+
+                /* a level wrapped around: bring down the next slot of the one above */
+                for(level = 1; level < TW_LEVELS; level++){
+                        if((w->now >> (TW_BITS * (level - 1))) & (TW_SLOTS - 1)){
+                                break;
+                        }
+                        tw_cascade(w, level, (w->now >> (TW_BITS * level)) & (TW_SLOTS - 1));
+                }
+
+                head = &w->slot[0][w->now & (TW_SLOTS - 1)];
+                while(head->next != head){
+                        tw_timer *t = head->next;
+                        tw_unlink(t);
+                        w->count--;
+                        fired++;
+                        t->fn(t->ctx, t->arg);
+                }
+
+                if(w->count == 0){
+                        w->now = now;
+                }
+        }
+        return fired;
+}
+
+uint64_t tw_next(const timer_wheel *w){
+        uint64_t base = w->now, next = UINT64_MAX;
+        size_t i;
+        int level;
+
+        if(w->count == 0){
+                return UINT64_MAX;
+        }
+
+        /* the nearest occupied slot of each level: exact on level 0, the
+           time the slot cascades on the others */
+        for(level = 0; level < TW_LEVELS; level++){
+                unsigned shift = TW_BITS * level;
+                for(i = 1; i <= TW_SLOTS; i++){
+                        uint64_t when = ((base >> shift) + i) << shift;
+                        const tw_timer *head = &w->slot[level][(when >> shift) & (TW_SLOTS - 1)];
+                        if(when >= next){
+                                break;
+                        }
+                        if(head->next != head){
+                                next = when;
+                                break;
+                        }
+                }
+        }
+        return next;
+}
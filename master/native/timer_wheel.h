@@ -0,0 +1,66 @@
+#ifndef _timer_wheel_h_
+#define _timer_wheel_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Hierarchical timer wheel with millisecond ticks. Level 0 has one slot per
+   tick for the next 64 ms, each higher level one slot per 64 slots of the
+   level below, so four levels reach about 4.6 hours ahead; later timers
+   are clamped to that. Timers live in intrusive lists, so adding,
+   re-arming and cancelling are O(1) and nothing is allocated. Timers of a
+   higher level are moved down when the lower level wraps around to them.
+*/
+
+#define TW_BITS                 (6)
+#define TW_SLOTS                (1 << TW_BITS)
+#define TW_LEVELS               (4)
+#define TW_MAX_DELAY            ((1ULL << (TW_BITS * TW_LEVELS)) - 1)
+
+typedef void (*tw_callback)(void *ctx, void *arg);
+
+/* Timer, embedded in whatever it times */
+typedef struct tw_timer_s {
+    struct tw_timer_s *next;
+    struct tw_timer_s *prev;    // 0 when the timer is not pending
+    uint64_t          expires;  // tick the timer fires at
+    tw_callback       fn;
+    void              *ctx;
+    void              *arg;
+} tw_timer;
+
+typedef struct timer_wheel_s {
+    uint64_t now;                           // last tick processed
+    size_t   count;                         // pending timers
+    tw_timer slot[TW_LEVELS][TW_SLOTS];     // list heads
+} timer_wheel;
+
+/* Start an empty wheel at the given time */
+void tw_init(timer_wheel *w, uint64_t now);
+
+/* Set up a timer calling fn(ctx, arg) when it fires */
+void tw_timer_init(tw_timer *t, tw_callback fn, void *ctx, void *arg);
+
+/* Arm the timer to fire at the given time, moving it if it is pending.
+   Times not after the last tick processed fire on the next one.
+*/
+void tw_add(timer_wheel *w, tw_timer *t, uint64_t expires);
+
+/* Disarm the timer; nothing happens if it is not pending */
+void tw_cancel(timer_wheel *w, tw_timer *t);
+
+static inline bool tw_pending(const tw_timer *t){
+        return t->prev != 0;
+}
+
+/* Process every tick up to now, calling the timers which expire; they may
+   re-arm themselves or add others. Returns the number of timers fired.
+*/
+size_t tw_advance(timer_wheel *w, uint64_t now);
+
+/* Return a time at or before the next expiry, to sleep until;
+   UINT64_MAX if no timer is pending.
+*/
+uint64_t tw_next(const timer_wheel *w);
+
+#endif
@@ -0,0 +1,128 @@
+#include "xbee_api.h"
+
+#define XA_STATE_START          (0)
+#define XA_STATE_LEN_HI         (1)
+#define XA_STATE_LEN_LO         (2)
+#define XA_STATE_DATA           (3)
+#define XA_STATE_SUM            (4)
+
+/** Whether b has to be escaped on the line */
+static inline bool xa_special(uint8_t b){
+        return b == XA_START || b == XA_ESCAPE || b == 0x11 || b == 0x13;
+}
+
+/** Append b to out, escaped if need be; returns the new length */
+static inline size_t xa_put(uint8_t *out, size_t n, bool escaped, uint8_t b){
+        if(escaped && xa_special(b)){
+                out[n++] = XA_ESCAPE;
+                b ^= 0x20;
+        }
+        out[n++] = b;
+        return n;
+}
+
+/** Frame the API identifier, the fixed fields and the data */
+static size_t xa_encode(uint8_t *out, bool escaped, const uint8_t *head, size_t head_len,
+                        const uint8_t *data, size_t len){
+        size_t i, n = 0, total = head_len + len;
+        uint8_t sum = 0;
+
+        if(total > XA_MAX_FRAME){
+                return 0;
+        }
+        out[n++] = XA_START;
+        n = xa_put(out, n, escaped, total >> 8);
+        n = xa_put(out, n, escaped, total);
+        for(i = 0; i < head_len; i++){
+                n = xa_put(out, n, escaped, head[i]);
+                sum += head[i];
+        }
+        for(i = 0; i < len; i++){
+                n = xa_put(out, n, escaped, data[i]);
+                sum += data[i];
+        }
+        return xa_put(out, n, escaped, 0xff - sum);
+}
+
+void xa_parser_init(xa_parser *p, bool escaped){
+        p->escaped = escaped;
+        p->esc     = false;
+        p->state   = XA_STATE_START;
+        p->len     = 0;
+        p->pos     = 0;
+        p->sum     = 0;
+}
+
+int xa_parse(xa_parser *p, uint8_t c){
+        /* a start delimiter always begins a new frame */
+        if(c == XA_START && (p->escaped || p->state == XA_STATE_START)){
+                p->state = XA_STATE_LEN_HI;
+                p->esc = false;
+                return 0;
+        }
+        if(p->state == XA_STATE_START){
+                return 0;
+        }
+        if(p->escaped){
+                if(c == XA_ESCAPE){
+                        p->esc = true;
+                        return 0;
+                }
+                if(p->esc){
+                        c ^= 0x20;
+                        p->esc = false;
+                }
+        }
+
+        switch(p->state){
+                case XA_STATE_LEN_HI:
+                        p->len = c << 8;
+                        p->state = XA_STATE_LEN_LO;
+                        return 0;
+                case XA_STATE_LEN_LO:
+                        p->len |= c;
+                        p->pos = 0;
+                        p->sum = 0;
+                        p->state = (p->len > 0) ? XA_STATE_DATA : XA_STATE_START;
+                        return 0;
+                case XA_STATE_DATA:
+                        if(p->pos < XA_MAX_FRAME){
+                                p->data[p->pos] = c;
+                        }
+                        p->sum += c;
+                        if(++p->pos == p->len){
+                                p->state = XA_STATE_SUM;
+                        }
+                        return 0;
+                default:
+                        p->state = XA_STATE_START;
+                        if((uint8_t) (p->sum + c) != 0xff || p->len > XA_MAX_FRAME){
+                                return -1;
+                        }
+                        return 1;
+        }
+}
+
+bool xa_rx16_decode(const xa_parser *p, xa_rx16 *rx){
+        if(p->len < 5 || p->data[0] != XA_RX16){
+                return false;
+        }
+        rx->src     = (p->data[1] << 8) | p->data[2];
+        rx->rssi    = p->data[3];
+        rx->options = p->data[4];
+        rx->data    = &p->data[5];
+        rx->len     = p->len - 5;
+        return true;
+}
+
+size_t xa_tx16_encode(uint8_t *out, bool escaped, uint8_t frame_id, uint16_t dst,
+                      const uint8_t *data, size_t len){
+        uint8_t head[5] = { XA_TX16, frame_id, (uint8_t) (dst >> 8), (uint8_t) dst, 0 };
+        return xa_encode(out, escaped, head, sizeof(head), data, len);
+}
+
+size_t xa_rx16_encode(uint8_t *out, bool escaped, uint16_t src, uint8_t rssi,
+                      const uint8_t *data, size_t len){
+        uint8_t head[5] = { XA_RX16, (uint8_t) (src >> 8), (uint8_t) src, rssi, 0 };
+        return xa_encode(out, escaped, head, sizeof(head), data, len);
+}
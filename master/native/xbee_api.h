@@ -0,0 +1,77 @@
+#ifndef _xbee_api_h_
+#define _xbee_api_h_
+
+#include <stdint.h>
+#include <string.h>
+
+/* XBee 802.15.4 API framing on the serial line to the coordinator radio:
+
+     0x7e, length (2 bytes, big endian), frame data, checksum
+
+   where the frame data starts with the API identifier and the checksum is
+   0xff minus the sum of the frame data. In escaped mode (ATAP2) 0x7e, 0x7d,
+   0x11 and 0x13 after the start delimiter are sent as 0x7d and the byte
+   xor 0x20.
+*/
+
+#define XA_START                (0x7e)
+#define XA_ESCAPE               (0x7d)
+
+/* API identifiers */
+#define XA_TX16                 (0x01)
+#define XA_AT_COMMAND           (0x08)
+#define XA_RX16                 (0x81)
+#define XA_AT_RESPONSE          (0x88)
+#define XA_TX_STATUS            (0x89)
+
+/* Largest frame data handled, well above the 100 byte RF payload */
+#define XA_MAX_FRAME            (128)
+
+/* Largest encoded frame: delimiter, length, data and checksum, all escaped */
+#define XA_MAX_ENCODED          (1 + 2 * (2 + XA_MAX_FRAME + 1))
+
+/* Incremental frame parser */
+typedef struct xa_parser_s {
+    bool     escaped;               // the radio runs in escaped mode
+    bool     esc;                   // the next byte is escaped
+    uint8_t  state;                 // field being read
+    uint16_t len;                   // frame data length
+    uint16_t pos;                   // frame data bytes read
+    uint8_t  sum;                   // running checksum
+    uint8_t  data[XA_MAX_FRAME];    // frame data of the last frame
+} xa_parser;
+
+/* Received 16-bit address frame, pointing into the parser */
+typedef struct xa_rx16_s {
+    uint16_t      src;
+    uint8_t       rssi;
+    uint8_t       options;
+    const uint8_t *data;
+    uint8_t       len;
+} xa_rx16;
+
+/* Reset the parser, expecting escaped or unescaped frames */
+void xa_parser_init(xa_parser *p, bool escaped);
+
+/* Feed one byte from the serial line.
+   Returns 1 if it completed a good frame, now in p->data[0..p->len),
+   -1 if it completed a frame with a bad checksum or one too long to hold,
+   0 otherwise.
+*/
+int xa_parse(xa_parser *p, uint8_t c);
+
+/* Decode the frame in the parser as an RX16 frame; false if it is not one */
+bool xa_rx16_decode(const xa_parser *p, xa_rx16 *rx);
+
+/* Encode a TX16 request for len bytes of data to dst into out, which holds
+   XA_MAX_ENCODED bytes. A frame id of 0 asks for no TX status.
+   Returns the encoded length, 0 if the data is too long.
+*/
+size_t xa_tx16_encode(uint8_t *out, bool escaped, uint8_t frame_id, uint16_t dst,
+                      const uint8_t *data, size_t len);
+
+/* Encode an RX16 frame, as the radio hands it to the host; see xa_tx16_encode */
+size_t xa_rx16_encode(uint8_t *out, bool escaped, uint16_t src, uint8_t rssi,
+                      const uint8_t *data, size_t len);
+
+#endif
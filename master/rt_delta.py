@@ -0,0 +1,51 @@
+import struct
+
+# Decoder for delta + varint coded payloads (see common/delta.h):
+#   varint   length of the original payload
+#   byte     number of fields
+#   bytes    field widths (1, 2 or 4), two per byte, low nibble first
+#   varints  zigzag coded difference of each field from the same field
+#            of the previous record, record by record
+#   bytes    trailing bytes after the last whole record
+
+def _varint(data, pos):
+    v = 0
+    for i in range(0, 5):
+        if pos + i >= len(data):
+            break
+        b = ord(data[pos + i])
+        v |= (b & 0x7f) << (7 * i)
+        if not b & 0x80:
+            return v, pos + i + 1
+    raise ValueError("truncated varint")
+
+def delta_decode(data):
+    length, pos = _varint(data, 0)
+    count = ord(data[pos])
+    pos += 1
+    widths = []
+    for i in range(0, count):
+        w = (ord(data[pos + i / 2]) >> (4 if i & 1 else 0)) & 0xf
+        if w not in (1, 2, 4):
+            raise ValueError("bad field width %d" % w)
+        widths.append(w)
+    pos += (count + 1) / 2
+    
+    record = sum(widths)
+    whole = length - length % record if record > 0 else 0
+    fmt = { 1: "<B", 2: "<H", 4: "<I" }
+    prev = [0] * count
+    out = []
+    o = 0
+    while o < whole:
+        for f in range(0, count):
+            z, pos = _varint(data, pos)
+            d = (z >> 1) ^ -(z & 1)
+            prev[f] = (prev[f] + d) & ((1 << (8 * widths[f])) - 1)
+            out.append(struct.pack(fmt[widths[f]], prev[f]))
+            o += widths[f]
+    
+    if len(data) - pos != length - o:
+        raise ValueError("bad length")
+    out.append(data[pos:])
+    return "".join(out)
@@ -1,13 +1,38 @@
 import struct
 
+# CRC-16/CCITT-FALSE (poly 0x1021, init 0xffff), same as common/checksum.cpp
+def _crc16_table():
+    tab = []
+    for i in range(0, 256):
+        c = i << 8
+        for b in range(0, 8):
+            c = ((c << 1) ^ 0x1021) if c & 0x8000 else (c << 1)
+        tab.append(c & 0xffff)
+    return tab
+
+_crc16_tab = _crc16_table()
+
+def crc16(data, crc=0xffff):
+    for c in data:
+        crc = ((crc << 8) & 0xffff) ^ _crc16_tab[(crc >> 8) ^ ord(c)]
+    return crc
+
 # transport layer segment
 class rt_pkt:
     
     hdr_fields = ['master', 'slave', 'pkg_no', 'pkg_type', 'seg_ct', 'seg_no', 'payload', 'checksum']
 
-    def __init__(self, raw=None, parms=None):
+    # crc selects the 2 byte CRC-16 trailer instead of the 1 byte additive checksum
+    # when building a packet; parsed packets use whichever trailer they carry.
+    # compact builds a packet with a compact header (see rtrans_proto.h) where
+    # it can. Given the master's address, a raw packet which does not start
+    # with it is parsed as one with a compact header from slave src, ending
+    # in the trailer crc selects
+    def __init__(self, raw=None, parms=None, crc=False, compact=False, master=None, src=None):
     
         self.checksum_good = True
+        self.crc = crc
+        self.compact = compact
     
         # call appropriate helper
         if raw != None and parms != None:
@@ -15,7 +40,10 @@ class rt_pkt:
         elif raw == None and parms == None:
             raise Exception("Need to specify either raw or parms")
         elif raw != None:
-            self._parse_raw(raw)
+            if master != None and len(raw) >= 2 and struct.unpack("<H", raw[0:2])[0] != master:
+                self._parse_compact(raw, master, src)
+            else:
+                self._parse_raw(raw)
         elif parms != None:
             self._parse_parms(parms)
             
@@ -27,20 +55,59 @@ class rt_pkt:
         header_tuple = struct.unpack("<HHHBBBB", raw[0:10])
         for i in range(0, len(header_tuple)-1):
             self.parsed[rt_pkt.hdr_fields[i]] = header_tuple[i]
-        self.parsed['payload'] = raw[10:10+header_tuple[len(header_tuple)-1]]
-        self.parsed['checksum'] = raw[10+header_tuple[len(header_tuple)-1]:]
+        plen = header_tuple[len(header_tuple)-1]
+        self.parsed['payload'] = raw[10:10+plen]
+        self.parsed['checksum'] = raw[10+plen:]
         
-        # verify checksum
-        acc = 0
-        for i in range(0, len(raw)):
-            acc = (acc + ord(raw[i])) & 0xff
-        if acc != 0xff:
+        # the trailer length tells which checksum the sender used
+        self.crc = len(self.parsed['checksum']) == 2
+        if self.crc:
+            if crc16(raw[0:10+plen]) != struct.unpack("<H", self.parsed['checksum'])[0]:
+                self.checksum_good = False
+        elif len(self.parsed['checksum']) == 1:
+            acc = 0
+            for i in range(0, len(raw)):
+                acc = (acc + ord(raw[i])) & 0xff
+            if acc != 0xff:
+                self.checksum_good = False
+        else:
             self.checksum_good = False
         
+    # compact header from a slave: type, seg_ct << 4 | seg_no, 1 byte pkg_no;
+    # the payload is whatever comes before the trailer
+    def _parse_compact(self, raw, master, src):
+    
+        self.compact = True
+        self.raw = raw
+        n = 2 if self.crc else 1
+        if len(raw) < 3 + n:
+            self.parsed = {}
+            self.checksum_good = False
+            return
+        t, seg, pkg_no = struct.unpack("<BBB", raw[0:3])
+        self.parsed = { 'master':   master,
+                        'slave':    src,
+                        'pkg_no':   pkg_no,
+                        'pkg_type': t,
+                        'seg_ct':   seg >> 4,
+                        'seg_no':   seg & 0x0f,
+                        'payload':  raw[3:len(raw)-n],
+                        'checksum': raw[len(raw)-n:]
+                      }
+        if self.crc:
+            if crc16(raw[0:len(raw)-n]) != struct.unpack("<H", self.parsed['checksum'])[0]:
+                self.checksum_good = False
+        else:
+            acc = 0
+            for i in range(0, len(raw)):
+                acc = (acc + ord(raw[i])) & 0xff
+            if acc != 0xff:
+                self.checksum_good = False
+        
     def _parse_parms(self, parms):
     
         # default format string: no payload
-        fmt = ("<HHHBBBB", "<HHHBBBBB")
+        fmt = "<HHHBBBB"
     
         # create dictionary
         self.parsed = {}
@@ -51,21 +118,34 @@ class rt_pkt:
         l = [self.parsed[i] for i in rt_pkt.hdr_fields if i != 'checksum' and i != 'payload']
         l.append(len(parms['payload']))
         
+        # a compact header from the master: type, seg_ct << 4 | seg_no, 2 byte
+        # pkg_no, unless the segment fields do not fit or the first two bytes
+        # would read as the master's address
+        if self.compact:
+            seg = (parms['seg_ct'] << 4) | parms['seg_no']
+            if parms['seg_ct'] > 0x0f or parms['seg_no'] > 0x0f or \
+               parms['pkg_type'] | (seg << 8) == parms['master']:
+                self.compact = False
+            else:
+                fmt = "<BBH"
+                l = [parms['pkg_type'], seg, parms['pkg_no']]
+        
         # if there is a payload, add it to the field list and change the format string
         if len(parms['payload']) > 0:
-            fmt = ("<HHHBBBBs", "<HHHBBBBsB")
+            fmt += "%ds" % len(parms['payload'])
             l.append(parms['payload'])
             
-        # compute the checksum
-        raw = struct.pack(fmt[0], *l)
-        acc = 0
-        for i in range(0, len(raw)):
-            acc = (acc + ord(raw[i])) & 0xff
-        self.parsed['checksum'] = 0xff - (acc & 0xff)
-        l.append(self.parsed['checksum'])
-        
-        # construct the packet
-        self.raw = struct.pack(fmt[1], *l)
+        # compute the checksum and construct the packet
+        raw = struct.pack(fmt, *l)
+        if self.crc:
+            self.parsed['checksum'] = crc16(raw)
+            self.raw = raw + struct.pack("<H", self.parsed['checksum'])
+        else:
+            acc = 0
+            for i in range(0, len(raw)):
+                acc = (acc + ord(raw[i])) & 0xff
+            self.parsed['checksum'] = 0xff - (acc & 0xff)
+            self.raw = raw + struct.pack("<B", self.parsed['checksum'])
         
     def __getitem__(self, key):
         return self.parsed[key]
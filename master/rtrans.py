@@ -1,6 +1,7 @@
 #!/usr/bin/env python
 
 from rt_pkt import rt_pkt
+from rt_delta import delta_decode
 from serial import Serial
 from xbee import XBee
 import time, struct, threading, random
@@ -16,8 +17,47 @@ class rt:
               'POLL':  2,
               'DATA':  3,
               'SET':   4,
-              'ERR':   5
+              'ERR':   5,
+              'STATS': 6
             }
+    
+    # flags or'ed into the type of application packets
+    pflag = { 'ACK': 0x80, 'DELTA': 0x40, 'BATCH': 0x20 }
+    
+    # capabilities a slave announces in the first payload byte of its JOIN
+    pcap = { 'CACK': 0x01, 'COMPACT': 0x02 }
+    
+    # payload of a STATS package from a slave (rt_counters in rtrans_proto.h),
+    # and what version 2 added at the end
+    stats_format = "<BI17HI"
+    stats_fields = ( 'version', 'elapsed',
+                     'tx_packages', 'tx_segments', 'tx_retransmits', 'tx_timeouts',
+                     'tx_dropped', 'tx_queue_full',
+                     'rx_packets', 'rx_acks', 'rx_naks', 'rx_bad_checksum',
+                     'rx_bad_length', 'rx_queue_full',
+                     'tx_queue_hwm', 'rx_queue_hwm',
+                     'rtt_min', 'rtt_max', 'rtt_samples', 'rtt_sum' )
+    stats_v2_format = "<H"
+    stats_v2_fields = ( 'rx_duplicates', )
+    
+    # largest payload of a segment, with a CRC-16 trailer
+    max_payload = 100 - 10 - 2
+    
+    # packages of each slave remembered to recognise copies (RTRANS_DUP_WINDOW)
+    dup_window = 8
+    
+    # SETs go out in segments of set_payload bytes, at most set_max_segments
+    # of them, and unacknowledged segments again every set_timeout (s) up to
+    # set_tries times in all
+    set_payload = max_payload
+    set_max_segments = 255 // set_payload
+    set_timeout = 1.0
+    set_tries = 5
+    
+    # cumulative ACKs wait at most this long (s) for more segments or a poll,
+    # and go out after this many segments regardless
+    ack_delay = 0.05
+    ack_every = 2
 
     def __init__(self, tty, baud, addr, callback, loss=0.0, probe_time=5):
         self.tty  = Serial(tty, baudrate=baud)
@@ -27,6 +67,15 @@ class rt:
         self._data = {}
         self._timer = {}
         self._waiting = {}
+        self._crc = {}
+        self._caps = {}
+        self._acks = {}
+        # guards _acks, and changes to _data and _timer, which timers make too
+        self._ack_lock = threading.Lock()
+        self._recent = {}
+        self._polls = {}
+        self._resp = 0.0
+        self._sets = {}
         self._callback = callback
         self._loss = loss
         self._probe_time = probe_time
@@ -40,16 +89,105 @@ class rt:
                'seg_no':   seg_no,
                'payload':  payload
              }
+        # answer each slave with the checksum it uses itself, and in compact
+        # headers if it takes them
+        crc = self._crc.get(dest, False)
+        compact = (self._caps.get(dest, 0) & rt.pcap['COMPACT']) != 0
         if random.random() > self._loss:
-            self.xbee.tx(dest_addr=struct.pack(">H", dest), data=rt_pkt(parms=rp).raw)
+            self.xbee.tx(dest_addr=struct.pack(">H", dest), data=rt_pkt(parms=rp, crc=crc, compact=compact).raw)
 
     def _ack(self, pkt):
         #print("ACKing %04x/%d.%d" % (pkt['slave'], pkt['pkg_no'], pkt['seg_no']))
         self._send(pkt['slave'], rt.ptype['ACK'], pkt['pkg_no'], 1, pkt['seg_no'], "")
+
+    def _nak(self, pkt, seg_no):
+        #print("NAKing %04x/%d.%d" % (pkt['slave'], pkt['pkg_no'], seg_no))
+        self._send(pkt['slave'], rt.ptype['NAK'], pkt['pkg_no'], 1, seg_no, "")
+    
+    def _ack_later(self, slave, pkg_no, seg_ct, complete):
+        # note a segment for a cumulative ACK; returns True if it is due now,
+        # otherwise a timer sends it ack_delay after the first segment it covers
+        with self._ack_lock:
+            a = self._acks.get(slave)
+            if a is not None and a['pkg_no'] != pkg_no:
+                self._ack_send(slave, a)
+                a = None
+            if a is None:
+                a = { 'pkg_no': pkg_no, 'new': 0, 'complete': False, 'timer': None }
+                self._acks[slave] = a
+            a['seg_ct'] = seg_ct
+            a['complete'] = a['complete'] or complete
+            a['new'] += 1
+            if complete or a['new'] >= rt.ack_every:
+                return True
+            if a['timer'] is None:
+                a['timer'] = threading.Timer(rt.ack_delay, rt._ack_flush, [self, slave, a])
+                a['timer'].start()
+            return False
+    
+    def _ack_build(self, slave, a):
+        # segments of the package in a row from the first, and a bitmap of
+        # those which arrived past them; None if nothing is left to ACK
+        pid = (slave, a['pkg_no'])
+        if pid in self._data:
+            segs = self._data[pid]['segs']
+            count = 0
+            while count < a['seg_ct'] and count in segs:
+                count += 1
+            bits = 0
+            for k in segs:
+                if k > count:
+                    bits |= 1 << (k - count)
+            bitmap = ""
+            while bits:
+                bitmap += chr(bits & 0xff)
+                bits >>= 8
+            return (count, bitmap)
+        if a['complete']:
+            return (a['seg_ct'], "")
+        return None
+    
+    def _ack_send(self, slave, a):
+        # send a pending ACK on its own; the caller holds the lock
+        del self._acks[slave]
+        if a['timer'] is not None:
+            a['timer'].cancel()
+        ack = self._ack_build(slave, a)
+        if ack is not None:
+            self._send(slave, rt.ptype['ACK'], a['pkg_no'], 0, ack[0], ack[1])
+    
+    def _ack_flush(self, slave, a=None):
+        # send the slave's pending ACK, if it is still the one the timer was for
+        with self._ack_lock:
+            cur = self._acks.get(slave)
+            if cur is not None and (a is None or cur is a):
+                self._ack_send(slave, cur)
+    
+    def _next_pkg(self):
+        n = self._frame
+        self._frame = (self._frame + 1) & 0xffff
+        return n
     
     def send(self, dest, pkg_type, payload):
-        self._send(dest, pkg_type, self._frame, 1, 0, payload)
-        self._frame += 1
+        self._send_pkg(dest, pkg_type, self._next_pkg(), 1, 0, payload)
+    
+    def _send_pkg(self, dest, pkg_type, pkg_no, seg_ct, seg_no, payload):
+        # a POLL or SET takes the slave's pending cumulative ACK along;
+        # returns the package it acknowledged, if it did
+        acked = None
+        if pkg_type in (rt.ptype['POLL'], rt.ptype['SET']):
+            with self._ack_lock:
+                a = self._acks.get(dest)
+                ack = self._ack_build(dest, a) if a is not None else None
+                if ack is not None and 4 + len(ack[1]) + len(payload) <= rt.max_payload:
+                    del self._acks[dest]
+                    if a['timer'] is not None:
+                        a['timer'].cancel()
+                    payload = struct.pack("<HBB", a['pkg_no'], ack[0], len(ack[1])) + ack[1] + payload
+                    pkg_type |= rt.pflag['ACK']
+                    acked = a['pkg_no']
+        self._send(dest, pkg_type, pkg_no, seg_ct, seg_no, payload)
+        return acked
         
     def wait(self):
         while True:
@@ -61,21 +199,49 @@ class rt:
                 break
                 
     def _ptimer(self, pid, delay=5.0, cb=None):
+        # (re)start the timer of pid; the callback gets the timer as well,
+        # see _timer_fired
         if cb == None:
             cb = rt._flow_expire
-        if pid in self._timer:
-            self._timer[pid].cancel()
-        self._timer[pid] = threading.Timer(delay, cb, [self, pid])
-        self._timer[pid].start()
+        t = threading.Timer(delay, cb)
+        t.args = [self, pid, t]
+        with self._ack_lock:
+            old = self._timer.get(pid)
+            if old is not None:
+                old.cancel()
+            self._timer[pid] = t
+        t.start()
+    
+    def _ptimer_cancel(self, pid):
+        with self._ack_lock:
+            t = self._timer.pop(pid, None)
+        if t is not None:
+            t.cancel()
+    
+    def _timer_fired(self, pid, t):
+        # forget the timer which fired; False if it was cancelled or replaced
+        # in the meantime, and the callback has nothing left to do
+        with self._ack_lock:
+            if self._timer.get(pid) is not t:
+                return False
+            del self._timer[pid]
+            return True
                 
-    def _flow_expire(self, pid):
+    def _flow_expire(self, pid, t):
+        with self._ack_lock:
+            if self._timer.get(pid) is not t:
+                return
+            del self._timer[pid]
+            self._data.pop(pid, None)
         print("Flow %04x/%d expired" % pid)
-        del self._data[pid]
-        del self._timer[pid]
         
-    def _poll_retx(self, pid):
-        del self._timer[pid]
-        self.poll(pid)
+    def _poll_retx(self, pid, t):
+        if self._timer_fired(pid, t):
+            self.poll(pid)
+    
+    def _set_retx(self, pid, t):
+        if self._timer_fired(pid, t):
+            self._set_send(pid[1])
         
     def _recv_frame(self, x):
         if x['id'] == 'rx':
@@ -85,46 +251,150 @@ class rt:
     def _proc_frame(self, x):  
         if x['id'] == 'rx':
         
-            # parse incoming packet
-            pkt = rt_pkt(raw=x['rf_data'])
+            # parse incoming packet, dropping it if it is corrupt; a compact
+            # header comes only from a slave which joined asking for them,
+            # with the checksum it joined with
+            src = struct.unpack(">H", x['source_addr'])[0]
+            pkt = rt_pkt(raw=x['rf_data'], crc=self._crc.get(src, False), master=self.addr, src=src)
+            if not pkt.checksum_good:
+                return
+            if pkt.compact and not self._caps.get(src, 0) & rt.pcap['COMPACT']:
+                return
+            self._crc[pkt['slave']] = pkt.crc
+            
+            # a slave acknowledges SET segments, and polls it got twice
+            if pkt['pkg_type'] == rt.ptype['ACK']:
+                self._acked(pkt)
+                return
+            if pkt['pkg_type'] == rt.ptype['NAK']:
+                return
+            
+            # a slave announces what it takes each time it joins, and numbers
+            # its packages from 0 again
+            if pkt['pkg_type'] == rt.ptype['JOIN']:
+                self._caps[pkt['slave']] = ord(pkt['payload'][0]) if len(pkt['payload']) > 0 else 0
+                self._recent.pop(pkt['slave'], None)
+            cack = self._caps.get(pkt['slave'], 0) & rt.pcap['CACK']
+            is_data = pkt['pkg_type'] & ~(rt.pflag['DELTA'] | rt.pflag['BATCH']) == rt.ptype['DATA']
+            is_pkg = is_data or pkt['pkg_type'] == rt.ptype['STATS']
                     
-            # ack the packet
-            self._ack(pkt)                    
+            # ack the packet; DATA and STATS from a slave which takes cumulative
+            # ACKs are acked once delivered or as the ACK comes due
+            if not (cack and is_pkg):
+                self._ack(pkt)
                     
             # if the packet was a join, poll the node for data
             if pkt['pkg_type'] == rt.ptype['JOIN']:
                 self._slaves[pkt['slave']] = pkt['slave']
                         
-            # handle data packet
-            elif pkt['pkg_type'] == rt.ptype['DATA']:
+            # a copy of a package delivered already: our ACK was lost, and with
+            # it the poll it went along with, if that is still unanswered and
+            # the copy came in later than an answer to the poll would have
+            elif is_pkg and pkt['pkg_no'] in self._recent.get(pkt['slave'], ()):
+                p = self._polls.get(pkt['slave'])
+                if cack:
+                    self._ack_later(pkt['slave'], pkt['pkg_no'], pkt['seg_ct'], True)
+                if p is not None and p['open'] and p['ack'] == pkt['pkg_no'] and \
+                   time.time() - p['sent'] > self._resp:
+                    self.poll(pkt['slave'])
+                elif cack:
+                    self._ack_flush(pkt['slave'])
+            
+            # handle data (or stats) packet
+            elif is_pkg:
                 #print("Got data segment %04x/%d.%d" % (pkt['slave'], pkt['pkg_no'], pkt['seg_no']))
                 pid = (pkt['slave'], pkt['pkg_no'])
                 
                 # check if we were waiting for this slave's data
-                if pkt['seg_no'] == 0 and pkt['slave'] in self._waiting:
-                    self._timer[pkt['slave']].cancel()
-                    del self._timer[pkt['slave']]
+                if is_data and pkt['slave'] in self._waiting:
+                    self._ptimer_cancel(pkt['slave'])
                     del self._waiting[pkt['slave']]
+                # and keep a smoothed time from a poll to its answer
+                p = self._polls.get(pkt['slave'])
+                if is_data and p is not None and p['open']:
+                    p['open'] = False
+                    self._resp += (time.time() - p['sent'] - self._resp) / 8
                 
-                # add segment to the corresponding buffer and call the callback if it is complete
-                if pkt['seg_no'] == 0 and pkt['seg_ct'] == 1:
-                    self._callback(pkt['slave'], pkt['pkg_type'], pkt['payload'])
-                elif pkt['seg_no'] == 0:
-                    self._data[pid] = [pkt]
-                    self._ptimer(pid)
-                elif pid in self._data:
-                    self._timer[pid].cancel()
-                    l = self._data[pid]
-                    if l[len(l)-1]['seg_no'] == pkt['seg_no'] - 1:
-                        l.append(pkt)
-                        if pkt['seg_no'] == pkt['seg_ct'] - 1:
-                            payload = "".join([pp['payload'] for pp in l])
-                            self._callback(pkt['slave'], pkt['pkg_type'], payload)
-                            del self._data[pid]
+                # add segment to the corresponding buffer and call the callback if it is complete;
+                # segments may arrive in any order since the slave keeps several in flight
+                if pkt['seg_ct'] == 1:
+                    if cack:
+                        self._ack_later(pkt['slave'], pkt['pkg_no'], 1, True)
+                    self._remember(pkt['slave'], pkt['pkg_no'])
+                    self._deliver(pkt['slave'], pkt['pkg_type'], pkt['payload'])
+                    if cack:
+                        self._ack_flush(pkt['slave'])
+                else:
+                    with self._ack_lock:
+                        flow = self._data.setdefault(pid, { 'segs': {}, 'naked': {} })
+                        flow['segs'][pkt['seg_no']] = pkt
+                    
+                    # selectively NAK the gaps below this segment so they are retransmitted early
+                    for i in range(0, pkt['seg_no']):
+                        if i not in flow['segs'] and i not in flow['naked']:
+                            flow['naked'][i] = True
+                            self._nak(pkt, i)
+                    
+                    if len(flow['segs']) == pkt['seg_ct']:
+                        self._ptimer_cancel(pid)
+                        payload = "".join([flow['segs'][i]['payload'] for i in range(0, pkt['seg_ct'])])
+                        with self._ack_lock:
+                            self._data.pop(pid, None)
+                        if cack:
+                            self._ack_later(pkt['slave'], pkt['pkg_no'], pkt['seg_ct'], True)
+                        self._remember(pkt['slave'], pkt['pkg_no'])
+                        self._deliver(pkt['slave'], pkt['pkg_type'], payload)
+                        if cack:
+                            self._ack_flush(pkt['slave'])
                     else:
                         self._ptimer(pid)
-                else:
-                    print("[rt] unexpected segment %04x/%d.%d" % (pkt['slave'], pkt['pkg_no'], pkt['seg_no']))
+                        if cack and self._ack_later(pkt['slave'], pkt['pkg_no'], pkt['seg_ct'], False):
+                            self._ack_flush(pkt['slave'])
+                
+    def _remember(self, slave, pkg_no):
+        r = self._recent.setdefault(slave, [])
+        r.append(pkg_no)
+        if len(r) > rt.dup_window:
+            del r[0]
+    
+    def _acked(self, pkt):
+        # the slave got a poll, or a segment of a SET
+        p = self._polls.get(pkt['slave'])
+        if p is not None and p['pkg_no'] == pkt['pkg_no']:
+            p['open'] = False
+        s = self._sets.get(pkt['slave'])
+        if s is not None and s['pkg_no'] == pkt['pkg_no']:
+            s['acked'][pkt['seg_no']] = True
+            if len(s['acked']) == len(s['segs']):
+                del self._sets[pkt['slave']]
+                self._ptimer_cancel(('set', pkt['slave']))
+    
+    def _deliver(self, slave, pkg_type, payload):
+        # undo delta coding before handing the package to the application
+        if pkg_type & rt.pflag['DELTA']:
+            try:
+                payload = delta_decode(payload)
+            except (ValueError, IndexError):
+                print("Bad delta coding from %04x" % slave)
+                return
+            pkg_type &= ~rt.pflag['DELTA']
+        
+        # split a batch into its records, each a length byte and its data
+        if pkg_type & rt.pflag['BATCH']:
+            pkg_type &= ~rt.pflag['BATCH']
+            records = []
+            i = 0
+            while i < len(payload):
+                n = ord(payload[i])
+                if i + 1 + n > len(payload):
+                    print("Bad batch from %04x" % slave)
+                    return
+                records.append(payload[i+1:i+1+n])
+                i += 1 + n
+            for r in records:
+                self._callback(slave, pkg_type, r)
+            return
+        self._callback(slave, pkg_type, payload)
                 
     def probe(self):
         self._slaves = {}
@@ -136,10 +406,62 @@ class rt:
             self._callback(i, rt.ptype['JOIN'], "")
         
     def poll(self, addr):
+        # a poll the slave neither answered nor acknowledged goes again under
+        # its own number, so a slave which did get it does not answer twice
+        p = self._polls.get(addr)
+        if p is None or not p['open']:
+            p = { 'pkg_no': self._next_pkg(), 'open': True, 'ack': None }
+            self._polls[addr] = p
+            print("Sending poll to %04x" % addr)
+        else:
+            print("Sending poll to %04x again" % addr)
         self._waiting[addr] = addr
         self._ptimer(addr, delay=2.0, cb=rt._poll_retx)
-        print("Sending poll to %04x" % addr)
-        self.send(addr, rt.ptype['POLL'], "")
+        p['sent'] = time.time()
+        acked = self._send_pkg(addr, rt.ptype['POLL'], p['pkg_no'], 1, 0, "")
+        if acked is not None:
+            p['ack'] = acked
+    
+    def set(self, addr, payload):
+        # the slave acknowledges each segment and those it does not are sent
+        # again; a newer SET to the slave replaces one still unacknowledged
+        if len(payload) > rt.set_max_segments * rt.set_payload:
+            return False
+        segs = [payload[i:i+rt.set_payload] for i in range(0, len(payload), rt.set_payload)] or [""]
+        self._sets[addr] = { 'pkg_no': self._next_pkg(), 'segs': segs, 'acked': {}, 'tries': 0 }
+        self._set_send(addr)
+        return True
+    
+    def _set_send(self, addr):
+        s = self._sets.get(addr)
+        if s is None:
+            return
+        if s['tries'] == rt.set_tries:
+            print("SET to %04x not acknowledged" % addr)
+            del self._sets[addr]
+            return
+        for i in range(0, len(s['segs'])):
+            if i not in s['acked']:
+                self._send_pkg(addr, rt.ptype['SET'], s['pkg_no'], len(s['segs']), i, s['segs'][i])
+        s['tries'] += 1
+        self._ptimer(('set', addr), delay=rt.set_timeout, cb=rt._set_retx)
+    
+    def stats(self, addr):
+        # the counters come back to the callback as a STATS package, see decode_stats
+        self.send(addr, rt.ptype['STATS'], "")
+    
+    @staticmethod
+    def decode_stats(payload):
+        # dict of the counters in a STATS payload, plus the average RTT in ms
+        n = struct.calcsize(rt.stats_format)
+        if len(payload) < n:
+            return None
+        s = dict(zip(rt.stats_fields, struct.unpack(rt.stats_format, payload[:n])))
+        m = struct.calcsize(rt.stats_v2_format)
+        if s['version'] >= 2 and len(payload) >= n + m:
+            s.update(zip(rt.stats_v2_fields, struct.unpack(rt.stats_v2_format, payload[n:n+m])))
+        s['rtt_avg'] = s['rtt_sum'] / s['rtt_samples'] if s['rtt_samples'] else 0
+        return s
     
     def _end(self):    
         self.xbee.halt()
@@ -0,0 +1,287 @@
+#include "rt_spill.h"
+#include "checksum.h"
+#include <string.h>
+
+#define RT_SPILL_NONE           ((size_t) -1)
+
+#if defined(__AVR__)
+
+#include <avr/eeprom.h>
+
+uint8_t rt_eeprom_store::read(size_t addr){
+        return eeprom_read_byte((const uint8_t *) (this->base + addr));
+}
+
+void rt_eeprom_store::write(size_t addr, uint8_t value){
+        eeprom_update_byte((uint8_t *) (this->base + addr), value);
+}
+
+#endif
+
+rt_spill_log::rt_spill_log(rt_spill_store &store){
+        this->store = &store;
+        this->head = 0;
+        this->tail = 0;
+        this->records = 0;
+        this->seq = 0;
+        this->pos = RT_SPILL_NONE;
+        memset(&this->stats, 0, sizeof(this->stats));
+}
+
+/** Whether a whole record with a good CRC and sum starts at the given offset;
+    if so, its seq and payload length are returned.
+*/
+bool rt_spill_log::valid(size_t at, uint16_t *record_seq, uint8_t *len){
+        uint8_t hdr[RT_SPILL_HEADER], chunk[16];
+        size_t size = this->store->size();
+        uint16_t crc;
+        uint8_t sum, i, n;
+
+        if(at + RT_SPILL_HEADER > size){
+                return false;
+        }
+        for(i = 0; i < RT_SPILL_HEADER; i++){
+                hdr[i] = this->store->read(at + i);
+        }
+        if(at + RT_SPILL_HEADER + hdr[3] > size){
+                return false;
+        }
+        crc = cs_crc16(CS_CRC16_INIT, hdr, 4);
+        sum = cs_sum8(0, hdr, 4);
+        at += RT_SPILL_HEADER;
+        for(n = hdr[3]; n > 0; n -= i){
+                for(i = 0; i < sizeof(chunk) && i < n; i++){
+                        chunk[i] = this->store->read(at++);
+                }
+                crc = cs_crc16(crc, chunk, i);
+                sum = cs_sum8(sum, chunk, i);
+        }
+        if(crc != (hdr[4] | (hdr[5] << 8)) || sum != hdr[6]){
+                return false;
+        }
+        *record_seq = hdr[0] | (hdr[1] << 8);
+        *len = hdr[3];
+        return true;
+}
+
+/** Offset a record of n bytes would be written at, or RT_SPILL_NONE if
+    it does not fit. The records in the log take the bytes from tail up
+    to head, wrapping around; an empty log goes on from head, so the
+    writes keep moving through the store.
+*/
+size_t rt_spill_log::place(size_t n) const{
+        size_t size = this->store->size();
+
+        if(n > size){
+                return RT_SPILL_NONE;
+        }
+        if(this->records == 0){
+                return (this->head + n <= size) ? this->head : 0;
+        }
+        if(this->head > this->tail){
+                if(this->head + n <= size){
+                        return this->head;
+                }
+                return (n <= this->tail) ? 0 : RT_SPILL_NONE;
+        }
+        return (this->head + n <= this->tail) ? this->head : RT_SPILL_NONE;
+}
+
+/** Bytes free in the store, less what a record which does not fit before
+    the end of the store may leave unused there.
+*/
+size_t rt_spill_log::room(size_t largest) const{
+        size_t size = this->store->size();
+        size_t used = 0;
+
+        if(this->records > 0){
+                used = (this->head > this->tail) ? this->head - this->tail : size - this->tail + this->head;
+        }
+        if(this->records > 0 && this->head <= this->tail){
+                return size - used;
+        }
+        return (size - used > largest) ? size - used - largest : 0;
+}
+
+/** Count the records which follow one another in seq order from the one
+    at the given offset, each either right after the one before or, once,
+    at the front. Each is checked once. The end of the last one is
+    returned in end, and the end of those before the front in run.
+*/
+uint16_t rt_spill_log::chain(size_t at, size_t *end, size_t *run){
+        size_t first = at;
+        uint16_t s, expect, n = 0;
+        uint8_t len;
+        bool wrapped = false;
+
+        if(!this->valid(at, &expect, &len)){
+                return 0;
+        }
+        for(;;){
+                ++n;
+                ++expect;
+                *end = at + RT_SPILL_HEADER + len;
+                if(!wrapped){
+                        *run = *end;
+                }
+                if(this->valid(*end, &s, &len) && s == expect){
+                        at = *end;
+                        continue;
+                }
+                if(wrapped || first == 0 || !(this->valid(0, &s, &len) && s == expect)){
+                        break;
+                }
+                wrapped = true;
+                at = 0;
+        }
+        return n;
+}
+
+/** Find the records left in the store: the longest run of them in seq
+    order. Bytes which happen to pass the checks look like a record too,
+    but not like one followed by the next, so the longest run is the log.
+    A run is only its own suffix from any of its records but the first, so
+    the scan goes on past the records it found, and reads the store about
+    once per byte and twice per record.
+*/
+void rt_spill_log::begin(){
+        size_t size = this->store->size();
+        size_t at, end, run, head = 0, oldest = RT_SPILL_NONE;
+        uint16_t n, longest = 0;
+
+        this->records = 0;
+        this->pos = RT_SPILL_NONE;
+        for(at = 0; at + RT_SPILL_HEADER <= size; at = (n > 1) ? run : at + 1){
+                n = this->chain(at, &end, &run);
+                if(n > longest){
+                        longest = n;
+                        oldest = at;
+                        head = end;
+                }
+        }
+        if(oldest == RT_SPILL_NONE){
+                this->head = 0;
+                this->tail = 0;
+                this->seq = 0;
+                return;
+        }
+        this->tail = oldest;
+        this->head = head;
+        this->seq = this->store->read(oldest) | (this->store->read(oldest + 1) << 8);
+        this->seq += longest;
+        this->records = longest;
+        this->stats.recovered += this->records;
+}
+
+void rt_spill_log::clear(){
+        while(!this->empty()){
+                this->pop();
+        }
+}
+
+bool rt_spill_log::append(uint8_t type, const uint8_t *payload, uint8_t len){
+        if(!this->append_begin(type, len)){
+                return false;
+        }
+        this->append_data(payload, len);
+        this->append_commit();
+        return true;
+}
+
+/** Start a record: the payload is written first and the header, its
+    checks last, once it is complete, so a record cut short is never found.
+*/
+bool rt_spill_log::append_begin(uint8_t type, uint8_t len){
+        uint8_t hdr[4] = { (uint8_t) this->seq, (uint8_t) (this->seq >> 8), type, len };
+
+        this->pos = this->place(RT_SPILL_HEADER + len);
+        if(this->pos == RT_SPILL_NONE){
+                ++this->stats.full;
+                return false;
+        }
+        this->type = type;
+        this->crc = cs_crc16(CS_CRC16_INIT, hdr, sizeof(hdr));
+        this->sum = cs_sum8(0, hdr, sizeof(hdr));
+        this->head = this->pos + RT_SPILL_HEADER;
+        return true;
+}
+
+void rt_spill_log::append_data(const uint8_t *data, uint8_t n){
+        uint8_t i;
+
+        this->crc = cs_crc16(this->crc, data, n);
+        this->sum = cs_sum8(this->sum, data, n);
+        for(i = 0; i < n; i++){
+                this->store->write(this->head++, data[i]);
+        }
+}
+
+void rt_spill_log::append_commit(){
+        uint8_t hdr[RT_SPILL_HEADER];
+        uint8_t i;
+
+        hdr[0] = this->seq;
+        hdr[1] = this->seq >> 8;
+        hdr[2] = this->type;
+        hdr[3] = this->head - this->pos - RT_SPILL_HEADER;
+        hdr[4] = this->crc;
+        hdr[5] = this->crc >> 8;
+        hdr[6] = this->sum;
+        for(i = 0; i < RT_SPILL_HEADER; i++){
+                this->store->write(this->pos + i, hdr[i]);
+        }
+        if(this->records == 0){
+                this->tail = this->pos;
+        }
+        this->pos = RT_SPILL_NONE;
+        ++this->seq;
+        ++this->records;
+        ++this->stats.appended;
+}
+
+bool rt_spill_log::peek(uint8_t *type, uint8_t *payload, uint8_t max, uint8_t *len){
+        uint8_t i;
+
+        if(this->records == 0){
+                return false;
+        }
+        *type = this->store->read(this->tail + 2);
+        *len = this->store->read(this->tail + 3);
+        if(*len <= max){
+                for(i = 0; i < *len; i++){
+                        payload[i] = this->store->read(this->tail + RT_SPILL_HEADER + i);
+                }
+        }
+        return true;
+}
+
+void rt_spill_log::peek_data(uint8_t offset, uint8_t *data, uint8_t n){
+        size_t at = this->tail + RT_SPILL_HEADER + offset;
+        uint8_t i;
+
+        for(i = 0; i < n; i++){
+                data[i] = this->store->read(at + i);
+        }
+}
+
+/** Clear the oldest record by spoiling its CRC, and move on to the next */
+void rt_spill_log::pop(){
+        size_t next;
+        uint16_t s;
+        uint8_t len;
+
+        if(this->records == 0){
+                return;
+        }
+        len = this->store->read(this->tail + 3);
+        this->store->write(this->tail + 4, ~this->store->read(this->tail + 4));
+        ++this->stats.drained;
+        if(--this->records == 0){
+                return;
+        }
+        next = this->tail + RT_SPILL_HEADER + len;
+        if(!(this->valid(next, &s, &len) && s == (uint16_t) (this->seq - this->records))){
+                next = 0;
+        }
+        this->tail = next;
+}
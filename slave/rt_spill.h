@@ -0,0 +1,125 @@
+#ifndef _rt_spill_h_
+#define _rt_spill_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Spill log: DATA packages the driver could not get to the master, kept
+   in persistent storage until it can (see rt_basic_state::rt_spill()).
+   The log is append-only: each package is written once as a record,
+   oldest first, wrapping around the end of the store, and cleared with a
+   single byte write once it is back in the transmit queue, so every byte
+   of the store wears at the same rate. A record is
+
+       seq     2 bytes, little endian: numbers the records in order
+       type    1 byte: package type, with its flags
+       len     1 byte: payload bytes
+       crc     2 bytes, little endian: CRC-16 of the above and the payload
+       sum     1 byte: 8-bit sum of the same bytes
+       payload len bytes
+
+   with no index or pointer stored anywhere else: begin() finds the
+   records left by an earlier run by their CRC and sum, which together let
+   about one offset in 2^24 of stray bytes through, and their order by seq.
+   A record which does not fit before the end of the store starts over at
+   the front. Records are cleared by spoiling their CRC; one being written
+   or cleared when the power goes is lost or sent twice, respectively.
+*/
+
+#define RT_SPILL_HEADER         (7)
+
+/* Byte-addressed persistent storage for a spill log */
+class rt_spill_store {
+
+public:
+        virtual size_t size() const = 0;
+        virtual uint8_t read(size_t addr) = 0;
+        virtual void write(size_t addr, uint8_t value) = 0;
+};
+
+#if defined(__AVR__)
+/** The AVR's EEPROM from base, for size bytes. Bytes are only written
+    when they change; each takes 3.4 ms, during which the sketch waits.
+    The EEPROM is rated for 100000 writes per byte.
+*/
+class rt_eeprom_store : public rt_spill_store {
+
+private:
+        size_t base;
+        size_t length;
+
+public:
+        rt_eeprom_store(size_t base, size_t size) : base(base), length(size) {}
+
+        virtual size_t size() const { return length; }
+        virtual uint8_t read(size_t addr);
+        virtual void write(size_t addr, uint8_t value);
+};
+#endif
+
+/* Counters of a spill log, since it was created */
+typedef struct rt_spill_stats_s {
+    uint16_t appended;      // packages written
+    uint16_t drained;       // packages taken back out
+    uint16_t full;          // packages refused for lack of room
+    uint16_t recovered;     // packages found by begin()
+} rt_spill_stats;
+
+class rt_spill_log {
+
+private:
+        rt_spill_store  *store;
+        size_t          head;       // where the next record goes
+        size_t          tail;       // the oldest record
+        uint16_t        records;
+        uint16_t        seq;        // of the next record
+        size_t          pos;        // record being appended
+        uint8_t         type;
+        uint16_t        crc;
+        uint8_t         sum;
+        rt_spill_stats  stats;
+
+        bool valid(size_t at, uint16_t *record_seq, uint8_t *len);
+        size_t place(size_t n) const;
+        uint16_t chain(size_t at, size_t *end, size_t *run);
+
+public:
+        rt_spill_log(rt_spill_store &store);
+
+        /* Take over the records found in the store */
+        void begin();
+
+        /* Drop every record */
+        void clear();
+
+        bool empty() const { return records == 0; }
+
+        /* Bytes of records which fit in one after the other for sure, none
+           of them larger than largest bytes */
+        size_t room(size_t largest) const;
+        uint16_t count() const { return records; }
+        const rt_spill_stats &statistics() const { return stats; }
+
+        /* Add a package of len bytes. Returns false if the store is full. */
+        bool append(uint8_t type, const uint8_t *payload, uint8_t len);
+
+        /* Add a package written piecewise: append_begin() returns false if
+           it does not fit, otherwise append_data() adds len bytes in all
+           and append_commit() adds the record. */
+        bool append_begin(uint8_t type, uint8_t len);
+        void append_data(const uint8_t *data, uint8_t n);
+        void append_commit();
+
+        /* Read the oldest package, leaving it in the log. Returns false
+           if the log is empty; a payload longer than max is not copied,
+           but its length is still returned. */
+        bool peek(uint8_t *type, uint8_t *payload, uint8_t max, uint8_t *len);
+
+        /* Copy n bytes of the oldest package's payload, from offset on */
+        void peek_data(uint8_t offset, uint8_t *data, uint8_t n);
+
+        /* Clear the oldest package */
+        void pop();
+};
+
+#endif
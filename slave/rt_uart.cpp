@@ -0,0 +1,129 @@
+#include "rt_uart.h"
+
+#if defined(__AVR__)
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#if !defined(UDR0)
+#error "rt_uart needs a USART0"
+#endif
+
+#if defined(USART_RX_vect)
+#define RT_UART_RX_VECT         USART_RX_vect
+#else
+#define RT_UART_RX_VECT         USART0_RX_vect
+#endif
+
+#define RT_UART_RX_MASK         (RT_UART_RX_BUFFER - 1)
+
+static_assert(RT_UART_RX_BUFFER >= 2 && RT_UART_RX_BUFFER <= 256 && (RT_UART_RX_BUFFER & RT_UART_RX_MASK) == 0,
+              "RT_UART_RX_BUFFER must be a power of two from 2 to 256");
+
+/* Written by the interrupt: rx_head and rx_overruns; by read(): rx_tail */
+static volatile uint8_t  rx_buffer[RT_UART_RX_BUFFER];
+static volatile uint8_t  rx_head;
+static volatile uint8_t  rx_tail;
+static volatile uint16_t rx_overruns;
+static bool              tx_written;    // TXC will be set once the last byte is out
+
+/* Weak, as this file is built into every sketch with the library: where
+   Serial is used, its own handler takes the interrupt instead */
+ISR(RT_UART_RX_VECT, __attribute__((weak))){
+        uint8_t status = UCSR0A;
+        uint8_t c = UDR0;
+        uint8_t next = (rx_head + 1) & RT_UART_RX_MASK;
+
+        if(status & _BV(DOR0)){
+                ++rx_overruns;
+        }
+        if(status & _BV(FE0)){
+                return;
+        }
+        if(next == rx_tail){
+                ++rx_overruns;
+                return;
+        }
+        rx_buffer[rx_head] = c;
+        rx_head = next;
+}
+
+/** Open the port at a rate, as HardwareSerial does: double speed, unless
+    the divisor is too large for it. Bytes received so far are dropped.
+*/
+void rt_uart::begin(uint32_t baud){
+        uint16_t ubrr = (F_CPU / 4 / baud - 1) / 2;
+
+        flush();
+        UCSR0B = 0;
+        if(ubrr > 4095){
+                UCSR0A = 0;
+                ubrr = (F_CPU / 8 / baud - 1) / 2;
+        }
+        else{
+                UCSR0A = _BV(U2X0);
+        }
+        UBRR0  = ubrr;
+        UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);    // 8N1
+        rx_head = rx_tail = 0;
+        tx_written = false;
+        UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+        this->rate = baud;
+}
+
+void rt_uart::end(){
+        flush();
+        UCSR0B = 0;
+        this->rate = 0;
+}
+
+int rt_uart::available(){
+        return (uint8_t) (rx_head - rx_tail) & RT_UART_RX_MASK;
+}
+
+int rt_uart::peek(){
+        return (rx_head == rx_tail) ? -1 : rx_buffer[rx_tail];
+}
+
+int rt_uart::read(){
+        uint8_t c;
+
+        if(rx_head == rx_tail){
+                return -1;
+        }
+        c = rx_buffer[rx_tail];
+        rx_tail = (rx_tail + 1) & RT_UART_RX_MASK;
+        return c;
+}
+
+size_t rt_uart::write(uint8_t c){
+        if(this->rate == 0){
+                return 0;
+        }
+        while(!(UCSR0A & _BV(UDRE0)));
+        /* clear TXC (by writing it) so flush() can wait for this byte */
+        UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+        UDR0 = c;
+        tx_written = true;
+        return 1;
+}
+
+/** Wait until the last byte written is out */
+void rt_uart::flush(){
+        if(this->rate == 0 || !tx_written){
+                return;
+        }
+        while(!(UCSR0A & _BV(TXC0)));
+}
+
+uint16_t rt_uart::overruns() const{
+        uint8_t sreg = SREG;
+        uint16_t n;
+
+        cli();
+        n = rx_overruns;
+        SREG = sreg;
+        return n;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef _rt_uart_h_
+#define _rt_uart_h_
+
+#include <Arduino.h>
+
+/* Receive buffer in bytes, a power of two of at most 256; holds 11 ms
+   of input at 115200 baud with the default */
+#ifndef RT_UART_RX_BUFFER
+#define RT_UART_RX_BUFFER       (128)
+#endif
+
+/** Stream over the hardware UART (USART0, pins 0 and 1 on an Uno) for the
+    XBee, in place of SoftwareSerial. Received bytes are moved into a
+    buffer by the receive interrupt, so none are lost while the sketch is
+    busy and interrupts stay enabled while sending, which SoftwareSerial
+    cannot do above 9600 baud. Sending waits for the transmitter, one byte
+    at a time. It owns the USART and its interrupt: a sketch using it
+    cannot use Serial (which would take the interrupt, so nothing would be
+    received), and there is one rt_uart per sketch.
+    On the host it is a stream to the simulated radio which tells it the
+    rate it was opened at, so it stops hearing it at any other.
+*/
+class rt_uart : public Stream {
+
+private:
+        uint32_t rate;
+
+public:
+        rt_uart() : rate(0) {}
+
+        /* Open the port at a rate, or change the rate of an open one */
+        void begin(uint32_t baud);
+        void end();
+        uint32_t baud() const { return rate; }
+
+        virtual int available();
+        virtual int read();
+        virtual int peek();
+        virtual size_t write(uint8_t c);
+        virtual void flush();
+        using Stream::write;
+
+        /* Bytes dropped on a full receive buffer, or by the USART */
+        uint16_t overruns() const;
+};
+
+#endif
@@ -3,93 +3,308 @@
 
 #include "XBee.h"
 #include "ringbuffer.h"
-#include "SoftwareSerial.h"
+#include "checksum.h"
+#include "delta.h"
+#include "xbee_init.h"
+#include "rtrans_proto.h"
+#include "rt_trace.h"
+#include "rt_spill.h"
 #include <stdint.h>
 
-/* Retransmit limit and timeout */
+/* Retransmit limit and timeouts (ms) of the default configuration.
+   RTRANS_RETX_TIMEOUT is used until the first round-trip time sample; after
+   that the timeout follows the smoothed RTT estimate, doubling on every
+   timeout up to RTRANS_RTO_MAX.
+*/
 #define RTRANS_RETX_LIMIT       (4)
-#define RTRANS_RETX_TIMEOUT     (200)
+#define RTRANS_RETX_TIMEOUT     (2000)
+#define RTRANS_RTO_MIN          (100)
+#define RTRANS_RTO_MAX          (8000)
 
-/* Packet and window sizes */
+/* Timeout (ms) and attempts for each AT command sent while coming up */
+#define RTRANS_AT_TIMEOUT       (500)
+#define RTRANS_AT_TRIES         (4)
+
+/* Packet and window sizes of the default configuration */
 #define RTRANS_PACKET_SIZE      (100)
 #define RTRANS_PAYLOAD_SIZE     (RTRANS_PACKET_SIZE - sizeof(rt_out_header) - 1)
 #define RTRANS_ABBREV_SIZE      (RTRANS_PAYLOAD_SIZE + sizeof(rt_in_header))
 #define RTRANS_MAX_SEGMENTS     (6)
+#define RTRANS_WINDOW_SIZE      (4)
 #define RTRANS_PACKET_BUFFER    (RTRANS_MAX_SEGMENTS * RTRANS_PACKET_SIZE)
 #define RTRANS_ABBREV_BUFFER    (RTRANS_ABBREV_SIZE * 2)
 
-/* Special uuid for no master configured */
-#define RTRANS_NO_MASTER        (0xffff)
-
-/* Packet types */
-#define RTRANS_TYPE_PROBE       (0)   // from master to slave only - broadcast message to detect slaves
-#define RTRANS_TYPE_JOIN        (1)   // from slave to master only - response to 
-#define RTRANS_TYPE_POLL        (2)   // from master to slave only - request for data
-#define RTRANS_TYPE_DATA        (3)   // from slave to master only - response containing sensing data
-#define RTRANS_TYPE_SET         (4)   // from master to slave only - set control params
-#define RTRANS_TYPE_ERR         (5)   // from slave to master only - report high-priority hardware error
-#define RTRANS_TYPE_ACK         (254) // general acknowledgment pkt - confirm join, ack data, ack set
-#define RTRANS_TYPE_NAK         (255) // negative acknowledgment - refuse join, retx request, error
-
-/* Outgoing packet header */
-typedef struct __attribute__ ((__packed__)) rt_out_header_s {
-    uint16_t master;    // master mac
-    uint16_t slave;     // slave mac
-    uint16_t pkg_no;    // package number
-    uint8_t  type;      // message type
-    uint8_t  seg_ct;    // number of segments in package
-    uint8_t  seg_no;    // segment number
-    uint8_t  len;       // payload length
-} rt_out_header;
-
-/* Incoming packet header */
-typedef struct __attribute__ ((__packed__)) rt_in_header_s {
-    uint16_t master;    // master mac
-    uint16_t slave;     // slave mac
-    uint8_t  type;      // message type
-    uint8_t  len;       // payload length
-} rt_in_header;
+/* Driver status, see rt_status() */
+#define RTRANS_STATUS_IDLE      (0)   // rt_init has not been called
+#define RTRANS_STATUS_CONFIG    (1)   // configuring the XBee in AT command mode
+#define RTRANS_STATUS_ADDRESS   (2)   // reading the serial number (ATSL)
+#define RTRANS_STATUS_ASSIGN    (3)   // assigning the 16-bit address (ATMY)
+#define RTRANS_STATUS_READY     (4)   // up, packets can be sent and received
+#define RTRANS_STATUS_FAILED    (5)   // the XBee did not answer, or refused the command
+
+/* Transmit classes. ERR packages go to a queue of their own whose segments
+   are sent ahead of any DATA still waiting, see tx_urgent.
+*/
+#define RTRANS_TX_BULK          (0)
+#define RTRANS_TX_URGENT        (1)
+#define RTRANS_TX_CLASSES       (2)
+
+/* Transmit window slot, one per segment in flight */
+typedef struct rt_tx_slot_s {
+    size_t        offset;   // offset of the segment from the front of its class's queue
+    uint8_t       cls;      // transmit class, RTRANS_TX_*
+    uint8_t       pkg_no;   // package number
+    uint8_t       seg_no;   // segment number
+    uint8_t       len;      // payload length
+    uint8_t       tx_ct;    // number of times the segment has been sent
+    bool          done;     // acked or cancelled, waiting for the window to slide
+    uint32_t      sent;     // time of the last transmission
+    uint32_t      timeout;  // retransmit deadline
+} rt_tx_slot;
+
+/* POLL or SET segment handed on, remembered to recognise copies */
+typedef struct rt_rx_seen_s {
+    uint16_t      master;   // RTRANS_NO_MASTER for an unused entry
+    uint16_t      pkg_no;
+    uint8_t       seg_no;
+} rt_rx_seen;
+
+/* Frame received, with its header in either format */
+typedef struct rt_rx_frame_s {
+    const rt_out_header *h; // the header: in the frame, or compact decoded
+    rt_out_header  compact; // a compact header decoded, addresses filled in
+    const uint8_t *data;    // the frame in the XBee frame buffer
+    uint8_t        hlen;    // header bytes on the air, the payload follows
+    uint8_t        trailer; // checksum bytes after the payload
+} rt_rx_frame;
+
+/* Round-trip time estimate, for diagnostics */
+typedef struct rt_rtt_estimate_s {
+    uint16_t srtt;          // smoothed round-trip time in ms, 0 before the first sample
+    uint16_t rttvar;        // round-trip time variation in ms
+    uint16_t rto;           // current retransmit timeout in ms, including backoff
+    uint8_t  backoff;       // number of times the timeout has been doubled
+} rt_rtt_estimate;
 
 /* Callback function */
 typedef void (*rt_callback)(rt_in_header *header, uint8_t payload[]);
 
+/* Compile-time configuration of rt_basic_state. To tune the footprint for a
+   board, derive from rt_default_config and override the members to change:
+
+       struct my_config : rt_default_config {
+           static const uint8_t max_segments = 2;
+           static const size_t  tx_buffer    = 2 * RTRANS_PACKET_SIZE;
+       };
+       rt_basic_state<my_config> rtrans_state(xs, callback);
+*/
+struct rt_default_config {
+    static const uint8_t  packet_size  = RTRANS_PACKET_SIZE;      // largest segment on the air
+    static const uint8_t  max_segments = RTRANS_MAX_SEGMENTS;     // largest package, in segments
+    static const uint8_t  window       = RTRANS_WINDOW_SIZE;      // segments in flight
+    static const size_t   tx_buffer    = RTRANS_PACKET_BUFFER;    // transmit queue bytes
+    static const size_t   tx_urgent    = 2 * RTRANS_PACKET_SIZE;  // transmit queue bytes for ERR, 0 to queue them with DATA
+    static const size_t   rx_buffer    = RTRANS_ABBREV_BUFFER;    // receive queue bytes, without rx_direct
+    static const uint8_t  rx_window    = RTRANS_DUP_WINDOW;       // POLL/SET segments remembered to drop copies
+    static const uint8_t  set_segments = RTRANS_SET_MAX_SEGMENTS; // largest SET package, in segments
+    static const uint8_t  retx_limit   = RTRANS_RETX_LIMIT;       // retransmissions before giving up
+    static const uint16_t retx_timeout = RTRANS_RETX_TIMEOUT;     // timeout before the first RTT sample
+    static const uint16_t rto_min      = RTRANS_RTO_MIN;
+    static const uint16_t rto_max      = RTRANS_RTO_MAX;
+    static const uint8_t  checksum     = RTRANS_CHECKSUM_SUM8;    // trailer of outgoing frames
+    static const bool     batching     = true;                    // room to coalesce small DATA sends
+    static const bool     rx_direct    = true;                    // run the callback on the received frame
+    static const bool     stats_reply  = true;                    // answer STATS requests from the master
+    static const bool     compact      = true;                    // compact headers with masters which take them
+    static const size_t   trace_buffer = 0;                       // bytes of frame trace, 0 for none (see rt_trace_read())
+    static const uint8_t  spill_record = 0;                       // largest DATA package kept in a spill log (see rt_spill()), 0 for none
+};
+
+/* ATmega328 nodes (2 KB RAM): two-segment packages, no receive queue (rx_direct)
+   and no spill log; 888 bytes of driver state on the host (rtrans_size) */
+struct rt_small_config : rt_default_config {
+    static const uint8_t  max_segments = 2;
+    static const uint8_t  window       = 2;
+    static const size_t   tx_buffer    = 2 * RTRANS_PACKET_SIZE;
+    static const size_t   tx_urgent    = 32;                      // ERR payloads up to 21 bytes
+    static const uint8_t  rx_window    = 4;
+    static const uint8_t  set_segments = 1;
+    static const bool     batching     = false;
+    static const uint8_t  spill_record = 0;
+};
+
+/* ATmega2560 and larger boards (8 KB RAM and up): bigger packages and window */
+struct rt_large_config : rt_default_config {
+    static const uint8_t  max_segments = 16;
+    static const uint8_t  window       = 8;
+    static const size_t   tx_buffer    = 24 * RTRANS_PACKET_SIZE;
+    static const size_t   rx_buffer    = 4 * RTRANS_ABBREV_SIZE;
+    static const uint8_t  spill_record = 255;
+};
+
 /* Driver state and data */
-class rt_state {
+template <class CFG>
+class rt_basic_state {
+
+public:
+        /* Derived sizes */
+        static const uint8_t trailer_size = (CFG::checksum == RTRANS_CHECKSUM_CRC16) ? 2 : 1;
+        static const uint8_t payload_size = CFG::packet_size - sizeof(rt_out_header) - trailer_size;
+        static const uint8_t abbrev_size  = payload_size + sizeof(rt_in_header);
+        static const size_t  rx_queue_size = CFG::rx_direct ? 1 : CFG::rx_buffer;
+        static const uint8_t join_caps = RTRANS_CAP_CACK | (CFG::compact ? RTRANS_CAP_COMPACT : 0);
 
 private:
+        static_assert(CFG::packet_size <= RTRANS_XBEE_MAX_PAYLOAD, "packet_size exceeds the XBee frame payload");
+        static_assert(CFG::checksum == RTRANS_CHECKSUM_SUM8 || CFG::checksum == RTRANS_CHECKSUM_CRC16,
+                      "checksum must be RTRANS_CHECKSUM_SUM8 or RTRANS_CHECKSUM_CRC16");
+        static_assert(CFG::packet_size > sizeof(rt_out_header) + trailer_size, "packet_size leaves no room for payload");
+        static_assert(CFG::max_segments > 0, "max_segments must be at least 1");
+        static_assert(CFG::window > 0, "window must be at least 1");
+        static_assert(CFG::tx_buffer >= (size_t) CFG::max_segments * CFG::packet_size,
+                      "tx_buffer cannot hold a package of max_segments");
+        static_assert(CFG::tx_urgent == 0 || CFG::tx_urgent > sizeof(rt_out_header) + trailer_size,
+                      "tx_urgent cannot hold a segment");
+        static_assert(CFG::rx_direct || CFG::rx_buffer >= abbrev_size, "rx_buffer cannot hold a full incoming packet");
+        static_assert(CFG::rx_window > 0, "rx_window must be at least 1");
+        static_assert(CFG::set_segments > 0 && CFG::set_segments <= RTRANS_SET_MAX_SEGMENTS,
+                      "set_segments must be 1 to RTRANS_SET_MAX_SEGMENTS");
+        static_assert(CFG::rto_min > 0 && CFG::rto_min <= CFG::retx_timeout && CFG::retx_timeout <= CFG::rto_max,
+                      "timeouts must satisfy 0 < rto_min <= retx_timeout <= rto_max");
+        static_assert(CFG::rto_max <= 8191, "rto_max does not fit the scaled RTT estimate");
+        static_assert(CFG::retx_limit < 255, "retx_limit must fit the per-segment send count");
+        static_assert(!CFG::stats_reply || sizeof(rt_counters) <= payload_size, "rt_counters do not fit a segment");
+        static_assert(CFG::trace_buffer == 0 || CFG::trace_buffer >= sizeof(rt_trace_record) + RTRANS_XBEE_MAX_PAYLOAD,
+                      "trace_buffer cannot hold a frame");
+
         XBee          xbee;
+        Stream        *serial;
+        xbee_set_baud serial_baud;    // changes the rate of serial, 0 if it cannot
+        uint8_t       status;
+        uint8_t       init_tries;     // attempts of the current AT command
+        uint32_t      init_timeout;   // deadline of the current AT command
+        xbee_init_state xbee_cfg;
         uint16_t      slave;
         uint16_t      master;
+        bool          tx_compact;     // the master sends compact headers, so we do
         rt_callback   rx_callback;
-        uint8_t       retx_ct;
         uint8_t       tx_pkg_no;
-        bool          tx_waiting;
-        uint8_t       tx_wait_pkg;
-        uint8_t       tx_wait_seg;
-        unsigned long tx_timeout;
-        ringbuffer    tx_queue;
+        rt_tx_slot    tx_window[CFG::window + 1];     // DATA takes at most window slots
+        uint8_t       tx_inflight;
+        size_t        tx_next[RTRANS_TX_CLASSES];     // offset of the first segment not in the window
+        bool          tx_cancel[RTRANS_TX_CLASSES];
+        uint8_t       tx_cancel_pkg[RTRANS_TX_CLASSES];
+        uint16_t      rtt_srtt;       // smoothed RTT, scaled by 8
+        uint16_t      rtt_var;        // RTT variation, scaled by 4
+        uint8_t       rtt_backoff;
+        delta_layout  tx_layout;      // record layout of DATA payloads, for coding
+        uint16_t      tx_batch_window;    // ms to hold small DATA sends, 0 for no batching
+        uint32_t      tx_batch_deadline;  // time the open batch goes out
+        uint8_t       tx_batch_count;     // records in the open batch
+        uint8_t       tx_batch_len;       // bytes in the open batch
+        uint8_t       tx_batch[CFG::batching ? payload_size : 1];
+        rt_counters   counters;
+        uint32_t      counters_since; // time of the last rt_stats_reset()
+        ringbuffer    tx_queue[RTRANS_TX_CLASSES];
         ringbuffer    rx_queue;
-        uint8_t       rtrans_tx_buffer[RTRANS_PACKET_BUFFER];
-        uint8_t       rtrans_rx_buffer[RTRANS_ABBREV_BUFFER];
+        uint8_t       rtrans_tx_buffer[CFG::tx_buffer];
+        uint8_t       rtrans_tx_urgent[CFG::tx_urgent ? CFG::tx_urgent : 1];
+        uint8_t       rtrans_rx_buffer[rx_queue_size];
+        rt_rx_seen    rx_seen[CFG::rx_window];
+        uint8_t       rx_seen_next;   // entry to reuse next
+        uint16_t      rx_set_master;  // SET package being assembled, RTRANS_NO_MASTER for none
+        uint16_t      rx_set_pkg;
+        uint8_t       rx_set_ct;
+        uint8_t       rx_set_have;    // bitmap of the segments in
+        uint8_t       rx_set_len;     // package length, once the last segment is in
+        uint8_t       rtrans_rx_set[(CFG::set_segments > 1) ? CFG::set_segments * RTRANS_SET_PAYLOAD : 1];
+        ringbuffer    trace_queue;
+        bool          trace_lost;     // records were dropped since the last one
+        uint8_t       rtrans_trace[CFG::trace_buffer ? CFG::trace_buffer : 1];
+        rt_spill_log  *spill;         // 0 for none
+        bool          spill_outage;   // DATA timed out, and the master has not been heard since
+        bool          spill_probe;    // the oldest package in the log, or the JOIN, is queued to find out if it gets through
+        bool          spill_join;     // a JOIN ran out of retransmissions, to be sent again first
+        uint8_t       spill_probe_pkg;
         
-        static unsigned long rt_time();
+        static uint32_t rt_time();
+        static bool rt_time_reached(uint32_t deadline);
+        void rt_init_request();
+        void rt_init_response(AtCommandResponse &at);
+        void rt_init_step();
+        void rt_setup(Stream &xs, xbee_set_baud set_baud, rt_callback cb_func);
+        uint16_t rt_rto(uint8_t backoff) const;
+        void rt_rtt_sample(uint32_t rtt);
         void rt_fsm_event(uint8_t type, const void *data);
-        void rt_queue_incoming(const rt_out_header *pkt);
-        void rt_handle_incoming(const unsigned char *data);
-        void rt_tx_queued();
-        uint8_t rt_read_incoming(unsigned char *at_buffer, size_t at_len);
+        void rt_fsm_ack(uint16_t pkg_no, uint8_t count, const uint8_t *map, uint8_t map_len);
+        static void rt_frame_build(uint8_t *frame, const rt_out_header *h, const uint8_t *payload);
+        static bool rt_frame_verify(const rt_rx_frame *f, uint8_t *copy, uint8_t skip = 0);
+        bool rt_queue_incoming(const rt_rx_frame *f, uint8_t skip = 0);
+        void rt_dispatch(const rt_rx_frame *f, uint8_t skip = 0);
+        void rt_handle_incoming(uint16_t src, const unsigned char *data, uint8_t length);
+        bool rt_rx_duplicate(const rt_out_header *pkt) const;
+        void rt_rx_remember(const rt_out_header *pkt);
+        void rt_rx_forget();
+        void rt_rx_set(const rt_rx_frame *f, uint8_t skip);
+        void rt_ack_now(const rt_out_header *pkt);
+        void rt_tx_segment(uint8_t slot);
+        void rt_tx_fill();
+        void rt_tx_slide();
+        void rt_tx_restart();
+        void rt_tx_cancel(uint8_t slot);
+        uint8_t rt_read_incoming();
         void rt_rx_pop();
         void rt_check_timeouts();
         void rt_send_now(const rt_out_header *pkt);
+        bool rt_tx_fits(const ringbuffer *queue, size_t length, size_t segments);
+        size_t rt_send_package(uint8_t type, const uint8_t *payload, size_t length, bool from_log = false);
+        bool rt_batch_flush();
+        size_t rt_send_data(uint8_t type, const uint8_t *payload, size_t length);
+        bool rt_spill_ready() const { return CFG::spill_record > 0 && this->spill != 0; }
+        bool rt_spill_package(uint8_t type, const uint8_t *payload, size_t length);
+        size_t rt_tx_package(size_t offset, uint8_t *type, size_t *length);
+        bool rt_spill_copy(size_t offset);
+        bool rt_spill_expired(uint8_t slot);
+        void rt_spill_queued();
+        void rt_spill_reached();
+        void rt_spill_acked(uint8_t pkg_no);
+        void rt_spill_drain();
+        size_t rt_spill_flush(uint8_t *seg, uint8_t len, uint8_t count);
+        void rt_trace(uint8_t kind, uint16_t peer, const uint8_t *data, uint8_t len);
         
         
 public:
-        rt_state(SoftwareSerial &xs, rt_callback cb_func);
-        void rt_init();
+        typedef CFG config;
+        
+        /* Over a serial port with a begin(baud), which rt_init() may speed up */
+        template <class SERIAL>
+        rt_basic_state(SERIAL &xs, rt_callback cb_func) { rt_setup(xs, &xbee_baud_of<SERIAL>, cb_func); }
+
+        /* Over any other stream, passed as a Stream &, left at its rate */
+        rt_basic_state(Stream &xs, rt_callback cb_func) { rt_setup(xs, 0, cb_func); }
+
+        void rt_init(bool configure = false, uint32_t baud = XBEE_DEFAULT_BAUD);
+        uint8_t rt_status() const;
         void rt_loop();
         size_t rt_send(uint8_t type, const uint8_t *payload, size_t length);
+        bool rt_compress(const uint8_t *widths, uint8_t count);
+        bool rt_batch(uint16_t window);
+        bool rt_spill(rt_spill_log *log);
         void rt_join(uint16_t addr);
+        void rt_rtt(rt_rtt_estimate *est) const;
+        void rt_stats(rt_counters *out) const;
+        void rt_stats_reset();
+        void rt_trace_header(rt_trace_file *out) const;
+        size_t rt_trace_read(uint8_t *buf, size_t n);
         
 };
 
+/* Driver with the default configuration */
+typedef rt_basic_state<rt_default_config> rt_state;
+
+#include "rtrans_impl.h"
+
+/* The default configuration is instantiated once, in rtrans.cpp */
+extern template class rt_basic_state<rt_default_config>;
+
 #endif
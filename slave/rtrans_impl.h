@@ -0,0 +1,1662 @@
+#ifndef _rtrans_impl_h_
+#define _rtrans_impl_h_
+
+/* Member definitions of rt_basic_state, included at the end of rtrans.h */
+
+
+/** Get current timestamp in milliseconds. This is millis() truncated to
+    32 bits, so it wraps after about 50 days; only ever compare timestamps
+    through rt_time_reached(), which is correct across the wrap as long as
+    the deadline is less than 24 days away.
+*/
+template <class CFG>
+uint32_t rt_basic_state<CFG>::rt_time(){
+        return (uint32_t) millis();
+}
+
+/** Returns true once the current time is at or past the deadline */
+template <class CFG>
+bool rt_basic_state<CFG>::rt_time_reached(uint32_t deadline){
+        return (int32_t) (rt_time() - deadline) >= 0;
+}
+
+/** Current retransmit timeout in ms, doubled the given number of times
+    and including the time the master may hold back a cumulative ACK
+*/
+template <class CFG>
+uint16_t rt_basic_state<CFG>::rt_rto(uint8_t backoff) const{
+        uint32_t rto;
+        
+        if(this->rtt_srtt == 0){
+                rto = CFG::retx_timeout;
+        }
+        else{
+                rto = (this->rtt_srtt >> 3) + this->rtt_var + RTRANS_ACK_DELAY;
+                if(rto < CFG::rto_min){
+                        rto = CFG::rto_min;
+                }
+        }
+        rto <<= backoff;
+        return (rto > CFG::rto_max) ? CFG::rto_max : rto;
+}
+
+/** Update the smoothed RTT estimate with a new sample (Jacobson/Karels, in
+    fixed point: srtt is kept scaled by 8 and the variation by 4, so that
+    srtt/8 + var is srtt + 4 * rttvar).
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_rtt_sample(uint32_t rtt){
+        int16_t delta;
+        
+        if(rtt > CFG::rto_max){
+                rtt = CFG::rto_max;
+        }
+        if(rtt == 0){
+                rtt = 1;
+        }
+        
+        if(this->counters.rtt_samples == 0 || rtt < this->counters.rtt_min){
+                this->counters.rtt_min = rtt;
+        }
+        if(rtt > this->counters.rtt_max){
+                this->counters.rtt_max = rtt;
+        }
+        ++this->counters.rtt_samples;
+        this->counters.rtt_sum += rtt;
+        
+        if(this->rtt_srtt == 0){
+                this->rtt_srtt = rtt << 3;
+                this->rtt_var  = rtt << 1;
+        }
+        else{
+                delta = rtt - (this->rtt_srtt >> 3);
+                this->rtt_srtt += delta;
+                if(delta < 0){
+                        delta = -delta;
+                }
+                this->rtt_var += delta - (this->rtt_var >> 2);
+        }
+}
+
+/** Report the current round-trip time estimate */
+template <class CFG>
+void rt_basic_state<CFG>::rt_rtt(rt_rtt_estimate *est) const{
+        est->srtt    = this->rtt_srtt >> 3;
+        est->rttvar  = this->rtt_var >> 2;
+        est->rto     = rt_rto(this->rtt_backoff);
+        est->backoff = this->rtt_backoff;
+}
+
+/** Copy the counters kept since the last rt_stats_reset() */
+template <class CFG>
+void rt_basic_state<CFG>::rt_stats(rt_counters *out) const{
+        *out = this->counters;
+        out->elapsed = rt_time() - this->counters_since;
+}
+
+/** Zero the counters and the high-water marks */
+template <class CFG>
+void rt_basic_state<CFG>::rt_stats_reset(){
+        memset(&this->counters, 0, sizeof(this->counters));
+        this->counters.version = RTRANS_STATS_VERSION;
+        this->counters_since = rt_time();
+}
+
+/** Add a record to the frame trace, dropping the oldest ones to make room */
+template <class CFG>
+void rt_basic_state<CFG>::rt_trace(uint8_t kind, uint16_t peer, const uint8_t *data, uint8_t len){
+        rt_trace_record r;
+        
+        if(CFG::trace_buffer == 0){
+                return;
+        }
+        while(rb_free(&this->trace_queue) < sizeof(r) + len){
+                rb_peek(&this->trace_queue, (uint8_t *) &r, sizeof(r));
+                rb_del(&this->trace_queue, sizeof(r) + r.len);
+                this->trace_lost = true;
+        }
+        r.time = rt_time();
+        r.peer = peer;
+        r.kind = kind | (this->trace_lost ? RT_TRACE_LOST : 0);
+        r.len  = len;
+        rb_put(&this->trace_queue, (const uint8_t *) &r, sizeof(r));
+        rb_put(&this->trace_queue, data, len);
+        this->trace_lost = false;
+}
+
+/** Fill in the header a trace file written from rt_trace_read() starts with */
+template <class CFG>
+void rt_basic_state<CFG>::rt_trace_header(rt_trace_file *out) const{
+        out->magic   = RT_TRACE_MAGIC;
+        out->version = RT_TRACE_VERSION;
+        out->role    = RT_TRACE_SLAVE;
+        out->addr    = this->slave;
+}
+
+/** Take the oldest records of the frame trace kept with a trace_buffer
+    configuration, as many whole ones as fit n bytes, to write them out
+    (to an SD card or the serial monitor) after an rt_trace_header(). Every
+    frame sent or received and every rt_send() call is traced; when the
+    sketch does not keep up, the oldest records are dropped and the next
+    one is marked RT_TRACE_LOST.
+    Returns the number of bytes copied.
+*/
+template <class CFG>
+size_t rt_basic_state<CFG>::rt_trace_read(uint8_t *buf, size_t n){
+        rt_trace_record r;
+        size_t k = 0;
+        
+        while(CFG::trace_buffer > 0 && rb_peek(&this->trace_queue, (uint8_t *) &r, sizeof(r)) == sizeof(r) &&
+              k + sizeof(r) + r.len <= n){
+                k += rb_get(&this->trace_queue, buf + k, sizeof(r) + r.len);
+        }
+        return k;
+}
+
+/** Handle an event which affects the state machine. ACKs release a single
+    segment of the window; NAKs ask for a single segment to be retransmitted
+    right away instead of waiting for its timer.
+
+    Segments sent back to back queue behind each other on the serial line to
+    the XBee, so the later ones take longer than the round trip measured on
+    the first. As in TCP (RFC 6298, 5.3), an ACK restarts the timers of the
+    segments still outstanding, so they only expire once the ACKs stop.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_fsm_event(uint8_t type, const void *data){
+        const rt_out_header *p = (const rt_out_header *) data;
+        uint8_t i;
+        
+        // find the window slot this ack/nak refers to
+        for(i = 0; i < this->tx_inflight; i++){
+                if(p->pkg_no == this->tx_window[i].pkg_no && p->seg_no == this->tx_window[i].seg_no){
+                        break;
+                }
+        }
+        if(i == this->tx_inflight || this->tx_window[i].done){
+                return;
+        }
+        
+        // handle the event
+        switch(type){
+                case RTRANS_TYPE_ACK: {
+                        // Karn's rule: only segments sent once give an unambiguous sample,
+                        // but any ACK shows the link is back and ends the backoff
+                        if(this->tx_window[i].tx_ct == 1 && this->tx_window[i].cls == RTRANS_TX_BULK){
+                                rt_rtt_sample(rt_time() - this->tx_window[i].sent);
+                        }
+                        this->rtt_backoff = 0;
+                        this->tx_window[i].done = true;
+                        rt_spill_acked(this->tx_window[i].pkg_no);
+                        rt_tx_restart();
+                        break;
+                }
+                case RTRANS_TYPE_NAK: {
+                        if(this->tx_window[i].tx_ct > CFG::retx_limit){
+                                rt_tx_cancel(i);
+                        }
+                        else{
+                                rt_tx_segment(i);
+                        }
+                        break;
+                }
+        }
+        
+        rt_tx_slide();
+}
+
+/** Handle a cumulative ACK: every segment of the package below count, and
+    those past it whose bit is set in the map, arrived. The RTT sample comes
+    from the newest of them sent only once.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_fsm_ack(uint16_t pkg_no, uint8_t count, const uint8_t *map, uint8_t map_len){
+        rt_tx_slot *newest = 0;
+        bool acked = false;
+        uint8_t i, k;
+        
+        for(i = 0; i < this->tx_inflight; i++){
+                rt_tx_slot *s = &this->tx_window[i];
+                if(s->done || s->pkg_no != pkg_no){
+                        continue;
+                }
+                if(s->seg_no >= count){
+                        k = s->seg_no - count;
+                        if(k / 8 >= map_len || !(map[k / 8] & (1 << (k % 8)))){
+                                continue;
+                        }
+                }
+                if(s->tx_ct == 1 && s->cls == RTRANS_TX_BULK && (!newest || (int32_t) (s->sent - newest->sent) > 0)){
+                        newest = s;
+                }
+                s->done = true;
+                acked = true;
+        }
+        if(!acked){
+                return;
+        }
+        
+        if(newest){
+                rt_rtt_sample(rt_time() - newest->sent);
+        }
+        this->rtt_backoff = 0;
+        rt_spill_acked(pkg_no);
+        rt_tx_restart();
+        rt_tx_slide();
+}
+
+/** Write a frame: the header, the payload and the checksum trailer of our
+    configuration, checksumming the payload while copying it. If payload is
+    0 the payload has already been written into the frame.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_frame_build(uint8_t *frame, const rt_out_header *h, const uint8_t *payload){
+        uint8_t *body = frame + sizeof(rt_out_header);
+        uint8_t *trailer = body + h->len;
+        
+        memcpy(frame, h, sizeof(rt_out_header));
+        if(CFG::checksum == RTRANS_CHECKSUM_CRC16){
+                uint16_t crc = cs_crc16(CS_CRC16_INIT, frame, sizeof(rt_out_header));
+                crc = payload ? cs_crc16_copy(crc, body, payload, h->len) : cs_crc16(crc, body, h->len);
+                trailer[0] = crc;
+                trailer[1] = crc >> 8;
+        }
+        else{
+                uint8_t acc = cs_sum8(0, frame, sizeof(rt_out_header));
+                acc = payload ? cs_sum8_copy(acc, body, payload, h->len) : cs_sum8(acc, body, h->len);
+                trailer[0] = 0xff - acc;
+        }
+}
+
+/** Verify the checksum of a received frame. If copy is set, the payload
+    past its first skip bytes is copied there in the same pass.
+*/
+template <class CFG>
+bool rt_basic_state<CFG>::rt_frame_verify(const rt_rx_frame *f, uint8_t *copy, uint8_t skip){
+        const uint8_t *payload = f->data + f->hlen;
+        const uint8_t *cs = payload + f->h->len;
+        uint8_t len = f->h->len;
+        
+        if(f->trailer == 2){
+                uint16_t crc = cs_crc16(CS_CRC16_INIT, f->data, f->hlen + skip);
+                crc = copy ? cs_crc16_copy(crc, copy, payload + skip, len - skip) : cs_crc16(crc, payload + skip, len - skip);
+                return crc == (cs[0] | (cs[1] << 8));
+        }
+        else{
+                uint8_t acc = cs_sum8(cs[0], f->data, f->hlen + skip);
+                acc = copy ? cs_sum8_copy(acc, copy, payload + skip, len - skip) : cs_sum8(acc, payload + skip, len - skip);
+                return acc == 0xff;
+        }
+}
+
+/** Push the retransmit deadlines of the segments in flight to at least one
+    timeout from now. Urgent segments keep theirs: with DATA flowing there
+    is an ACK for every few segments, which would hold a lost ERR back.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_tx_restart(){
+        uint32_t deadline = rt_time() + rt_rto(this->rtt_backoff);
+        uint8_t i;
+        
+        for(i = 0; i < this->tx_inflight; i++){
+                rt_tx_slot *s = &this->tx_window[i];
+                if(!s->done && s->tx_ct > 0 && s->cls == RTRANS_TX_BULK && (int32_t) (deadline - s->timeout) > 0){
+                        s->timeout = deadline;
+                }
+        }
+}
+
+/** Add an event to the callback queue, leaving out the first skip bytes of
+    the payload (a piggybacked ACK). The checksum is verified while the
+    payload is copied in, and the entry only committed if it is good.
+    Returns whether the packet was queued.
+*/
+template <class CFG>
+bool rt_basic_state<CFG>::rt_queue_incoming(const rt_rx_frame *f, uint8_t skip){
+        const rt_out_header *pkt = f->h;
+        uint8_t *entry;
+        
+        // Build abbreviated header
+        rt_in_header  hdr_tmp = {
+                .master = pkt->master,
+                .slave  = pkt->slave,
+                .type   = (uint8_t) (pkt->type & ~RTRANS_FLAG_ACK),
+                .len    = (uint8_t) (pkt->len - skip)
+        };
+
+        // Reserve room for header and payload
+        entry = rb_reserve(&this->rx_queue, sizeof(rt_in_header) + hdr_tmp.len);
+        if(entry == 0){
+                if(!rt_frame_verify(f, 0)){
+                        ++this->counters.rx_bad_checksum;
+                        return false;
+                }
+                ++this->counters.rx_queue_full;
+                return false;
+        }
+        
+        // Copy header and payload to ringbuffer
+        memcpy(entry, &hdr_tmp, sizeof(rt_in_header));
+        if(!rt_frame_verify(f, entry + sizeof(rt_in_header), skip)){
+                ++this->counters.rx_bad_checksum;
+                return false;
+        }
+        rb_commit(&this->rx_queue, sizeof(rt_in_header) + hdr_tmp.len);
+        if(this->rx_queue.avail > this->counters.rx_queue_hwm){
+                this->counters.rx_queue_hwm = this->rx_queue.avail;
+        }
+        return true;
+}
+
+/** Run the callback on a received frame whose checksum has been verified,
+    leaving out the first skip bytes of the payload (a piggybacked ACK).
+    The payload is handed over where it lies in the XBee frame buffer.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_dispatch(const rt_rx_frame *f, uint8_t skip){
+        rt_in_header hdr = {
+                .master = f->h->master,
+                .slave  = f->h->slave,
+                .type   = (uint8_t) (f->h->type & ~RTRANS_FLAG_ACK),
+                .len    = (uint8_t) (f->h->len - skip)
+        };
+        
+        ++this->counters.rx_packets;
+        this->rx_callback(&hdr, (uint8_t *) f->data + f->hlen + skip);
+}
+
+/** Whether a POLL or SET segment is a copy of one handed on recently */
+template <class CFG>
+bool rt_basic_state<CFG>::rt_rx_duplicate(const rt_out_header *pkt) const{
+        uint8_t i;
+        
+        for(i = 0; i < CFG::rx_window; i++){
+                const rt_rx_seen *e = &this->rx_seen[i];
+                if(e->master == pkt->master && e->pkg_no == pkt->pkg_no && e->seg_no == pkt->seg_no){
+                        return true;
+                }
+        }
+        return false;
+}
+
+/** Remember a POLL or SET segment in place of the oldest one */
+template <class CFG>
+void rt_basic_state<CFG>::rt_rx_remember(const rt_out_header *pkt){
+        rt_rx_seen *e = &this->rx_seen[this->rx_seen_next];
+        
+        e->master = pkt->master;
+        e->pkg_no = pkt->pkg_no;
+        e->seg_no = pkt->seg_no;
+        this->rx_seen_next = (this->rx_seen_next + 1) % CFG::rx_window;
+}
+
+/** Forget every packet remembered, and any SET half assembled */
+template <class CFG>
+void rt_basic_state<CFG>::rt_rx_forget(){
+        uint8_t i;
+        
+        for(i = 0; i < CFG::rx_window; i++){
+                this->rx_seen[i].master = RTRANS_NO_MASTER;
+        }
+        this->rx_seen_next = 0;
+        this->rx_set_master = RTRANS_NO_MASTER;
+}
+
+/** Store a verified segment of a multi-segment SET, leaving out the first
+    skip bytes of its payload, and hand the package on once every segment is
+    in. Only one package is assembled at a time; a segment of another one
+    starts over, as the master gives up on a SET when it sends a newer one.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_rx_set(const rt_rx_frame *f, uint8_t skip){
+        const rt_out_header *pkt = f->h;
+        const uint8_t *payload = f->data + f->hlen + skip;
+        uint8_t n = pkt->len - skip;
+        uint8_t *entry;
+        
+        if(CFG::set_segments < 2){
+                return;
+        }
+        if(pkt->master != this->rx_set_master || pkt->pkg_no != this->rx_set_pkg){
+                this->rx_set_master = pkt->master;
+                this->rx_set_pkg = pkt->pkg_no;
+                this->rx_set_ct = pkt->seg_ct;
+                this->rx_set_have = 0;
+        }
+        memcpy(&this->rtrans_rx_set[pkt->seg_no * RTRANS_SET_PAYLOAD], payload, n);
+        this->rx_set_have |= 1 << pkt->seg_no;
+        if(pkt->seg_no == this->rx_set_ct - 1){
+                this->rx_set_len = pkt->seg_no * RTRANS_SET_PAYLOAD + n;
+        }
+        if(this->rx_set_have != (1 << this->rx_set_ct) - 1){
+                return;
+        }
+        
+        rt_in_header hdr = {
+                .master = pkt->master,
+                .slave  = pkt->slave,
+                .type   = RTRANS_TYPE_SET,
+                .len    = this->rx_set_len
+        };
+        this->rx_set_master = RTRANS_NO_MASTER;
+        if(CFG::rx_direct){
+                ++this->counters.rx_packets;
+                this->rx_callback(&hdr, this->rtrans_rx_set);
+                return;
+        }
+        entry = rb_reserve(&this->rx_queue, sizeof(rt_in_header) + hdr.len);
+        if(entry == 0){
+                ++this->counters.rx_queue_full;
+                return;
+        }
+        memcpy(entry, &hdr, sizeof(rt_in_header));
+        memcpy(entry + sizeof(rt_in_header), this->rtrans_rx_set, hdr.len);
+        rb_commit(&this->rx_queue, sizeof(rt_in_header) + hdr.len);
+        if(this->rx_queue.avail > this->counters.rx_queue_hwm){
+                this->counters.rx_queue_hwm = this->rx_queue.avail;
+        }
+}
+
+/** Acknowledge a POLL or SET segment to the master which sent it */
+template <class CFG>
+void rt_basic_state<CFG>::rt_ack_now(const rt_out_header *pkt){
+        uint8_t frame[sizeof(rt_out_header) + 2];
+        rt_out_header h;
+        
+        h.master = pkt->master;
+        h.slave  = this->slave;
+        h.pkg_no = pkt->pkg_no;
+        h.type   = RTRANS_TYPE_ACK;
+        h.seg_ct = 1;
+        h.seg_no = pkt->seg_no;
+        h.len    = 0;
+        rt_frame_build(frame, &h, 0);
+        rt_send_now((const rt_out_header *) frame);
+}
+
+/** Process an incoming packet of the given length from src. A compact
+    header is only taken from our master, with our trailer; the first one
+    which checks out shows the master takes them from us as well.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_handle_incoming(uint16_t src, const unsigned char *data, uint8_t length){
+        const rt_out_header *pkt;
+        rt_rx_frame f;
+        
+        rt_trace(RT_TRACE_RX, src, data, length);
+        f.data = data;
+        if(rt_frame_full(data, length, src)){
+                // whatever follows the payload is the checksum; its size tells which one
+                pkt = (const rt_out_header *) data;
+                if(length < sizeof(rt_out_header) + 1 || length < sizeof(rt_out_header) + pkt->len + 1){
+                        ++this->counters.rx_bad_length;
+                        return;
+                }
+                f.h = pkt;
+                f.hlen = sizeof(rt_out_header);
+                f.trailer = length - sizeof(rt_out_header) - pkt->len;
+                if(f.trailer > 2){
+                        ++this->counters.rx_bad_length;
+                        return;
+                }
+        }
+        else if(CFG::compact && src == this->master &&
+                rt_compact_decode(&f.compact, data, length, RTRANS_COMPACT_MASTER, trailer_size, src, this->slave)){
+                f.h = &f.compact;
+                f.hlen = RTRANS_COMPACT_MASTER;
+                f.trailer = trailer_size;
+                if(!this->tx_compact && rt_frame_verify(&f, 0)){
+                        this->tx_compact = true;
+                }
+        }
+        else{
+                ++this->counters.rx_bad_length;
+                return;
+        }
+        pkt = f.h;
+        data = f.data + f.hlen;
+        
+        // handle packet
+        switch(pkt->type){
+                case RTRANS_TYPE_PROBE:
+                        /* A master which probes may have just started, numbering its
+                           packages from 0 again */
+                        if(!CFG::rx_direct){
+                                if(!rt_queue_incoming(&f)){
+                                        return;
+                                }
+                        }
+                        else if(rt_frame_verify(&f, 0)){
+                                rt_dispatch(&f);
+                        }
+                        else{
+                                ++this->counters.rx_bad_checksum;
+                                return;
+                        }
+                        rt_rx_forget();
+                        break;
+                        
+                case RTRANS_TYPE_POLL:
+                case RTRANS_TYPE_SET:
+                case RTRANS_TYPE_POLL | RTRANS_FLAG_ACK:
+                case RTRANS_TYPE_SET | RTRANS_FLAG_ACK: {
+                        /* Act on a piggybacked ACK, then pass on the packet without it,
+                           unless it is a copy of one already passed on */
+                        const rt_ack_header *ack = (const rt_ack_header *) data;
+                        uint8_t skip = 0;
+                        bool dup;
+                        if(pkt->type & RTRANS_FLAG_ACK){
+                                if(pkt->len < sizeof(rt_ack_header) || pkt->len < sizeof(rt_ack_header) + ack->map_len){
+                                        ++this->counters.rx_bad_length;
+                                        return;
+                                }
+                                skip = sizeof(rt_ack_header) + ack->map_len;
+                        }
+                        if(pkt->seg_ct > 1){
+                                uint8_t n = pkt->len - skip;
+                                if((pkt->type & RTRANS_TYPE_MASK) != RTRANS_TYPE_SET || pkt->seg_ct > CFG::set_segments ||
+                                   pkt->seg_no >= pkt->seg_ct || n > RTRANS_SET_PAYLOAD ||
+                                   (pkt->seg_no < pkt->seg_ct - 1 && n != RTRANS_SET_PAYLOAD)){
+                                        ++this->counters.rx_bad_length;
+                                        return;
+                                }
+                        }
+                        
+                        dup = rt_rx_duplicate(pkt);
+                        if(!CFG::rx_direct && !dup && pkt->seg_ct <= 1){
+                                if(!rt_queue_incoming(&f, skip)){
+                                        return;
+                                }
+                        }
+                        else if(!rt_frame_verify(&f, 0)){
+                                ++this->counters.rx_bad_checksum;
+                                return;
+                        }
+                        rt_spill_reached();
+                        if(skip){
+                                ++this->counters.rx_acks;
+                                rt_fsm_ack(ack->pkg_no, ack->count, (const uint8_t *) (ack + 1), ack->map_len);
+                        }
+                        
+                        /* our ACK of the first copy was lost, or the answer to it is slow */
+                        if(dup){
+                                ++this->counters.rx_duplicates;
+                                rt_ack_now(pkt);
+                                return;
+                        }
+                        rt_rx_remember(pkt);
+                        if((pkt->type & RTRANS_TYPE_MASK) == RTRANS_TYPE_SET){
+                                rt_ack_now(pkt);
+                        }
+                        if(pkt->seg_ct > 1){
+                                rt_rx_set(&f, skip);
+                        }
+                        else if(CFG::rx_direct){
+                                rt_dispatch(&f, skip);
+                        }
+                        break;
+                }
+                        
+                case RTRANS_TYPE_STATS:
+                        /* Answer with a snapshot of the counters, as a package of its own */
+                        if(!rt_frame_verify(&f, 0)){
+                                ++this->counters.rx_bad_checksum;
+                                return;
+                        }
+                        if(CFG::stats_reply){
+                                rt_counters c;
+                                rt_stats(&c);
+                                rt_send(RTRANS_TYPE_STATS, (const uint8_t *) &c, sizeof(c));
+                        }
+                        break;
+                        
+                case RTRANS_TYPE_ACK:
+                case RTRANS_TYPE_NAK:
+                        /* Pass event to the FSM */
+                        if(!rt_frame_verify(&f, 0)){
+                                ++this->counters.rx_bad_checksum;
+                                return;
+                        }
+                        if(pkt->type == RTRANS_TYPE_ACK){
+                                ++this->counters.rx_acks;
+                        }
+                        else{
+                                ++this->counters.rx_naks;
+                        }
+                        if(pkt->type == RTRANS_TYPE_ACK && pkt->seg_ct == 0){
+                                rt_fsm_ack(pkt->pkg_no, pkt->seg_no, data, pkt->len);
+                        }
+                        else{
+                                rt_fsm_event(pkt->type, pkt);
+                        }
+                        break;
+        }
+}
+
+/** (Re)transmit the segment held in the given window slot. Urgent segments
+    back off on their own retransmissions only, not on the timeouts of the
+    DATA around them.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_tx_segment(uint8_t slot){
+        rt_tx_slot *s = &this->tx_window[slot];
+        
+        // segments are stored contiguously, so send straight from the queue
+        const uint8_t *pkt = rb_peek_ptr(&this->tx_queue[s->cls], s->offset, sizeof(rt_out_header) + s->len + trailer_size);
+        if(s->tx_ct == 0){
+                ++this->counters.tx_segments;
+        }
+        else{
+                ++this->counters.tx_retransmits;
+        }
+        ++s->tx_ct;
+        s->sent = rt_time();
+        s->timeout = s->sent + rt_rto((s->cls == RTRANS_TX_URGENT) ? s->tx_ct - 1 : this->rtt_backoff);
+        
+        rt_send_now((const rt_out_header *) pkt);
+}
+
+/** Open window slots for queued segments and send them, until either the
+    window is full or every queued segment is in flight. Urgent segments go
+    first and may take the slot beyond the window which DATA never gets, so
+    an ERR does not wait for the DATA ahead of it.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_tx_fill(){
+        uint8_t i, cls, bulk = 0;
+        
+        for(i = 0; i < this->tx_inflight; i++){
+                bulk += (this->tx_window[i].cls == RTRANS_TX_BULK);
+        }
+        
+        while(this->tx_inflight < CFG::window + 1){
+                if(this->tx_queue[RTRANS_TX_URGENT].avail > this->tx_next[RTRANS_TX_URGENT]){
+                        cls = RTRANS_TX_URGENT;
+                }
+                else if(bulk < CFG::window && this->tx_queue[RTRANS_TX_BULK].avail > this->tx_next[RTRANS_TX_BULK]){
+                        cls = RTRANS_TX_BULK;
+                        ++bulk;
+                }
+                else{
+                        break;
+                }
+                
+                rt_tx_slot *s = &this->tx_window[this->tx_inflight];
+                const rt_out_header *hdr = (const rt_out_header *) rb_peek_ptr(&this->tx_queue[cls], this->tx_next[cls], sizeof(rt_out_header));
+                
+                s->offset = this->tx_next[cls];
+                s->cls    = cls;
+                s->pkg_no = hdr->pkg_no;
+                s->seg_no = hdr->seg_no;
+                s->len    = hdr->len;
+                s->tx_ct  = 0;
+                
+                // segments of a cancelled package never go on the air
+                if(this->tx_cancel[cls] && s->pkg_no == this->tx_cancel_pkg[cls]){
+                        s->done = true;
+                }
+                else{
+                        this->tx_cancel[cls] = false;
+                        s->done = false;
+                }
+                
+                this->tx_next[cls] += sizeof(rt_out_header) + s->len + trailer_size;
+                if(!s->done){
+                        rt_tx_segment(this->tx_inflight);
+                }
+                ++this->tx_inflight;
+        }
+}
+
+/** Remove finished segments from the window and their queues. A segment
+    can go once it is at the front of its class's queue, so finished ERR
+    segments do not wait for the DATA segments sent before them.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_tx_slide(){
+        uint8_t i = 0, j, cls;
+        size_t n;
+        
+        while(i < this->tx_inflight){
+                if(!this->tx_window[i].done || this->tx_window[i].offset != 0){
+                        ++i;
+                        continue;
+                }
+                cls = this->tx_window[i].cls;
+                n = sizeof(rt_out_header) + this->tx_window[i].len + trailer_size;
+                rb_del(&this->tx_queue[cls], n);
+                
+                --this->tx_inflight;
+                for(j = i; j < this->tx_inflight; j++){
+                        this->tx_window[j] = this->tx_window[j + 1];
+                }
+                for(j = 0; j < this->tx_inflight; j++){
+                        if(this->tx_window[j].cls == cls){
+                                this->tx_window[j].offset -= n;
+                        }
+                }
+                this->tx_next[cls] -= n;
+        }
+}
+
+/** Give up on the package of the segment in the given window slot: finish
+    its segments in the window and skip the ones which have not been sent
+    yet.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_tx_cancel(uint8_t slot){
+        uint8_t cls = this->tx_window[slot].cls;
+        uint8_t pkg_no = this->tx_window[slot].pkg_no;
+        uint8_t i;
+        
+        for(i = 0; i < this->tx_inflight; i++){
+                if(this->tx_window[i].pkg_no == pkg_no){
+                        this->tx_window[i].done = true;
+                }
+        }
+        this->tx_cancel[cls] = true;
+        this->tx_cancel_pkg[cls] = pkg_no;
+        ++this->counters.tx_dropped;
+}
+        
+/** Send raw packet without modifying state. Frames are built and queued
+    with the full header; to a master which takes compact ones, the compact
+    header goes over the end of the full one for the send and the checksum
+    is redone, from the difference of the headers for the 8-bit sum, and the
+    bytes are put back afterwards for a retransmission.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_send_now(const rt_out_header *pkt){
+        if(CFG::compact && this->tx_compact && pkt->master == this->master){
+                uint8_t hdr[RTRANS_COMPACT_SLAVE];
+                uint8_t n = rt_compact_encode(hdr, pkt, RTRANS_COMPACT_SLAVE);
+                
+                if(n > 0){
+                        uint8_t len = pkt->len;
+                        uint8_t *frame = (uint8_t *) pkt + sizeof(rt_out_header) - n;
+                        uint8_t *trailer = frame + n + len;
+                        uint8_t saved[RTRANS_COMPACT_SLAVE + 2];
+                        
+                        memcpy(saved, frame, n);
+                        memcpy(saved + n, trailer, trailer_size);
+                        if(CFG::checksum == RTRANS_CHECKSUM_CRC16){
+                                memcpy(frame, hdr, n);
+                                uint16_t crc = cs_crc16(CS_CRC16_INIT, frame, n + len);
+                                trailer[0] = crc;
+                                trailer[1] = crc >> 8;
+                        }
+                        else{
+                                trailer[0] += cs_sum8(0, (const uint8_t *) pkt, sizeof(rt_out_header)) - cs_sum8(0, hdr, n);
+                                memcpy(frame, hdr, n);
+                        }
+                        Tx16Request tx = Tx16Request(this->master, frame, n + len + trailer_size);
+                        this->xbee.send(tx);
+                        rt_trace(RT_TRACE_TX, this->master, frame, n + len + trailer_size);
+                        memcpy(frame, saved, n);
+                        memcpy(trailer, saved + n, trailer_size);
+                        return;
+                }
+        }
+        Tx16Request tx = Tx16Request(pkt->master, (uint8_t *) pkt, sizeof(rt_out_header) + pkt->len + trailer_size);
+        this->xbee.send(tx);
+        rt_trace(RT_TRACE_TX, pkt->master, (const uint8_t *) pkt, sizeof(rt_out_header) + pkt->len + trailer_size);
+}
+
+/** Read from the XBee serial interface
+    Returns:
+      0 if no packet was received
+      1 for a radio packet
+      2 for an AT response packet
+      3 for any other API frame (such as a TX status)
+*/
+template <class CFG>
+uint8_t rt_basic_state<CFG>::rt_read_incoming(){
+
+        this->xbee.readPacket();
+  
+        if(this->xbee.getResponse().isAvailable()) {
+                if(this->xbee.getResponse().getApiId() == RX_16_RESPONSE){
+                        /* rx data */
+                        Rx16Response rx16 = Rx16Response();
+                        this->xbee.getResponse().getRx16Response(rx16);
+                        rt_handle_incoming(rx16.getRemoteAddress16(), rx16.getData(), rx16.getDataLength());          
+                        return 1;
+                }
+                else if(this->xbee.getResponse().getApiId() == AT_COMMAND_RESPONSE){
+                        /* AT response */
+                        AtCommandResponse atResponse = AtCommandResponse();
+                        this->xbee.getResponse().getAtCommandResponse(atResponse);
+                        rt_init_response(atResponse);
+                        return 2;
+                }
+                return 3;
+        }
+        
+        return 0;
+
+}
+
+/** Pop every packet waiting in the rx queue and run the callback on each,
+    in place in the ringbuffer. Nothing is queued with rx_direct.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_rx_pop(){
+        /* we need at least one header in the ringbuffer */
+        while(this->rx_queue.avail >= sizeof(rt_in_header)){
+                /* entries never wrap, so header and payload can be used where they are */
+                const rt_in_header *pkt = (const rt_in_header *) rb_peek_ptr(&this->rx_queue, 0, sizeof(rt_in_header));
+                size_t n = pkt ? sizeof(rt_in_header) + pkt->len : 0;
+                const uint8_t *entry = pkt ? rb_peek_ptr(&this->rx_queue, 0, n) : 0;
+                if(entry == 0){
+                        /* an entry cut short: nothing after it can be found, so start over */
+                        ++this->counters.rx_bad_length;
+                        rb_del(&this->rx_queue, this->rx_queue.avail);
+                        return;
+                }
+                
+                /* run the callback, then drop the entry */
+                ++this->counters.rx_packets;
+                this->rx_callback((rt_in_header *) entry, (uint8_t *) entry + sizeof(rt_in_header));
+                rb_del(&this->rx_queue, n);
+        }
+}
+
+/** Initializes the XBee and the rtrans driver, for the constructors
+    Params:
+      xs:        the stream to use to communicate with the XBee, such as a
+                 SoftwareSerial or an rt_uart
+      set_baud:  changes the rate of xs, 0 if it cannot be changed
+      cb_func:   the callback function which will receive PROBE/POLL/SET events
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_setup(Stream &xs, xbee_set_baud set_baud, rt_callback cb_func){
+        uint8_t i;
+        
+        this->xbee.setSerial(xs);
+        this->serial = &xs;
+        this->serial_baud = set_baud;
+        this->status = RTRANS_STATUS_IDLE;
+        this->slave = 0;
+        this->rx_callback = cb_func;
+        this->master = RTRANS_NO_MASTER;
+        this->tx_compact = false;
+        this->tx_pkg_no = 0;
+        this->tx_inflight = 0;
+        for(i = 0; i < RTRANS_TX_CLASSES; i++){
+                this->tx_next[i] = 0;
+                this->tx_cancel[i] = false;
+        }
+        this->rtt_srtt = 0;
+        this->rtt_var = 0;
+        this->rtt_backoff = 0;
+        this->tx_layout.count = 0;
+        this->tx_batch_window = 0;
+        this->tx_batch_count = 0;
+        this->tx_batch_len = 0;
+        rb_init(&this->tx_queue[RTRANS_TX_BULK], rtrans_tx_buffer, CFG::tx_buffer);
+        rb_init(&this->tx_queue[RTRANS_TX_URGENT], rtrans_tx_urgent, CFG::tx_urgent);
+        rb_init(&this->rx_queue, rtrans_rx_buffer, rx_queue_size);
+        rb_init(&this->trace_queue, rtrans_trace, CFG::trace_buffer);
+        this->trace_lost = false;
+        this->spill = 0;
+        this->spill_outage = false;
+        this->spill_probe = false;
+        this->spill_join = false;
+        rt_rx_forget();
+        rt_stats_reset();
+}
+
+/** Starts bringing up the XBee and the driver, without waiting for it;
+    rt_loop() carries on from there and rt_status() tells how far it got.
+    Params:
+      configure: first set channel, PAN ID, and API mode as xbee_init()
+                 does, for a radio which is still in transparent mode
+      baud:      with configure, then switch the radio and the serial port
+                 to this rate, if the port's rate can be changed
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_init(bool configure, uint32_t baud){
+        this->init_tries = 0;
+        if(configure){
+                xbee_init_begin(&this->xbee_cfg, *this->serial, baud, this->serial_baud);
+                this->status = RTRANS_STATUS_CONFIG;
+        }
+        else{
+                this->status = RTRANS_STATUS_ADDRESS;
+                rt_init_request();
+        }
+}
+
+/** Returns how far the driver has come up, one of RTRANS_STATUS_* */
+template <class CFG>
+uint8_t rt_basic_state<CFG>::rt_status() const{
+        return this->status;
+}
+
+/** (Re)send the AT command of the current bring-up step: ask the XBee for
+    our serial number, or assign its low 16 bits as our address.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_init_request(){
+        uint8_t at_cmd_sl[2] = {'S', 'L'};
+        uint8_t at_cmd_my[2] = {'M', 'Y'};
+        uint8_t addr[2] = {(uint8_t) (this->slave >> 8), (uint8_t) this->slave};
+        
+        if(this->status == RTRANS_STATUS_ADDRESS){
+                AtCommandRequest at_cmd_sl_req = AtCommandRequest(at_cmd_sl);
+                this->xbee.send(at_cmd_sl_req);
+        }
+        else{
+                AtCommandRequest at_cmd_my_req = AtCommandRequest(at_cmd_my, addr, 2);
+                this->xbee.send(at_cmd_my_req);
+        }
+        ++this->init_tries;
+        this->init_timeout = rt_time() + RTRANS_AT_TIMEOUT;
+}
+
+/** Handle an AT response. Only the answer to the command of the current
+    bring-up step counts; late answers to earlier attempts are ignored. A
+    refused command is sent again at once, and the bring-up fails once it
+    has been tried RTRANS_AT_TRIES times.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_init_response(AtCommandResponse &at){
+        const uint8_t *cmd = at.getCommand();
+        const uint8_t *value = at.getValue();
+        bool current = (this->status == RTRANS_STATUS_ADDRESS && cmd[0] == 'S' && cmd[1] == 'L') ||
+                       (this->status == RTRANS_STATUS_ASSIGN && cmd[0] == 'M' && cmd[1] == 'Y');
+        
+        if(!at.isOk()){
+                if(!current){
+                        return;
+                }
+                if(this->init_tries >= RTRANS_AT_TRIES){
+                        this->status = RTRANS_STATUS_FAILED;
+                }
+                else{
+                        rt_init_request();
+                }
+                return;
+        }
+        
+        if(this->status == RTRANS_STATUS_ADDRESS && cmd[0] == 'S' && cmd[1] == 'L' && at.getValueLength() >= 4){
+                /* Assign the 16-bit address */
+                this->slave = value[3] | (value[2] << 8);
+                this->status = RTRANS_STATUS_ASSIGN;
+                this->init_tries = 0;
+                rt_init_request();
+        }
+        else if(this->status == RTRANS_STATUS_ASSIGN && cmd[0] == 'M' && cmd[1] == 'Y'){
+                this->status = RTRANS_STATUS_READY;
+        }
+}
+
+/** Advance the bring-up started by rt_init() */
+template <class CFG>
+void rt_basic_state<CFG>::rt_init_step(){
+        switch(this->status){
+                case RTRANS_STATUS_CONFIG:
+                        if(xbee_init_poll(&this->xbee_cfg) == XBEE_INIT_BUSY){
+                                return;
+                        }
+                        // even if the radio did not take the configuration it may
+                        // already be in API mode; the address lookup will tell
+                        this->status = RTRANS_STATUS_ADDRESS;
+                        this->init_tries = 0;
+                        rt_init_request();
+                        break;
+                        
+                case RTRANS_STATUS_ADDRESS:
+                case RTRANS_STATUS_ASSIGN:
+                        rt_read_incoming();
+                        if(this->status != RTRANS_STATUS_READY && rt_time_reached(this->init_timeout)){
+                                if(this->init_tries >= RTRANS_AT_TRIES){
+                                        this->status = RTRANS_STATUS_FAILED;
+                                }
+                                else{
+                                        rt_init_request();
+                                }
+                        }
+                        break;
+        }
+}
+
+/** Checks if a timeout has occurred on any segment in the window; if so,
+    either retransmits the segment or cancels the rest of its package
+    depending on whether it has met the retx count threshold. The timeout
+    is doubled once per pass in which any bulk segment expired, since
+    segments sent back to back tend to expire together.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_check_timeouts(){
+        uint8_t i;
+        bool expired = false;
+        
+        for(i = 0; i < this->tx_inflight; i++){
+                rt_tx_slot *s = &this->tx_window[i];
+                if(!s->done && rt_time_reached(s->timeout)){
+                        ++this->counters.tx_timeouts;
+                        if(s->cls == RTRANS_TX_BULK){
+                                if(!expired && rt_rto(this->rtt_backoff) < CFG::rto_max){
+                                        ++this->rtt_backoff;
+                                }
+                                expired = true;
+                        }
+                        
+                        if(s->tx_ct > CFG::retx_limit){
+                                if(s->cls == RTRANS_TX_BULK){
+                                        rt_spill_expired(i);
+                                }
+                                rt_tx_cancel(i);
+                        }
+                        else{
+                                rt_tx_segment(i);
+                        }
+                }
+        }
+        rt_tx_slide();
+}
+
+/** Handles all of the processing of the rtrans driver. You should be calling
+    this function once in the main arduino loop() subroutine. Until the
+    driver is up it only advances the bring-up started by rt_init().
+    Every frame the XBee has received is handled in one call; the callback
+    may send, but must not call rt_loop() itself.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_loop(void){
+        if(this->status != RTRANS_STATUS_READY){
+                rt_init_step();
+                return;
+        }
+        
+        // pop each packet as it is queued, so that a burst cannot overflow the rx queue
+        while(rt_read_incoming()){
+                rt_rx_pop();
+        }
+        rt_check_timeouts();
+        if(this->tx_batch_count > 0 && rt_time_reached(this->tx_batch_deadline)){
+                rt_batch_flush();
+        }
+        rt_spill_drain();
+        rt_tx_fill();
+        
+}
+
+/** Adds a new package to the transmit queue. Returns the total number of
+    segments to be transmitted, or 0 if the package can't be transmitted
+    (too large, queue full, or the driver is not up yet). DATA packages are
+    delta coded on the way if rt_compress() set a layout and that makes them
+    smaller.
+    
+    With batching on (see rt_batch()), DATA packages which fit a segment are
+    held back and sent together with the ones that follow; they count as one
+    segment here. Any other package sends the open batch first, so packages
+    still go out in the order they were given.
+    
+    The exception are ERR packages: they are queued apart from DATA in the
+    tx_urgent queue, and their segments are sent before any segment still
+    waiting in the transmit queue. An ERR which does not fit there (or a
+    configuration without one) is queued with the DATA.
+    
+    With a spill log (see rt_spill()), DATA which finds the transmit queue
+    full, or is sent while the master is out of reach, goes to the log
+    instead and counts as one segment here.
+*/
+template <class CFG>
+size_t rt_basic_state<CFG>::rt_send(uint8_t type, const uint8_t *payload, size_t length){
+        bool batch = this->tx_batch_window > 0 && type == RTRANS_TYPE_DATA && length < payload_size;
+        
+        /* Our own address is not known before the driver is up */
+        if(this->status != RTRANS_STATUS_READY){
+            return 0;
+        }
+        if(CFG::trace_buffer > 0){
+            uint8_t call[RT_TRACE_SEND_LEN] = { type, (uint8_t) length, (uint8_t) (length >> 8) };
+            rt_trace(RT_TRACE_SEND, this->master, call, sizeof(call));
+        }
+        
+        /* Close the open batch if this package does not join it */
+        if(this->tx_batch_count > 0 && (!batch || this->tx_batch_len + 1 + length > payload_size)){
+            if(!rt_batch_flush()){
+                return 0;
+            }
+        }
+        if(!batch){
+            return (type == RTRANS_TYPE_DATA) ? rt_send_data(type, payload, length) : rt_send_package(type, payload, length);
+        }
+        
+        /* Append the record: its length, then its data */
+        if(this->tx_batch_count == 0){
+            this->tx_batch_deadline = rt_time() + this->tx_batch_window;
+        }
+        this->tx_batch[this->tx_batch_len++] = length;
+        if(length > 0){
+            memcpy(&this->tx_batch[this->tx_batch_len], payload, length);
+        }
+        this->tx_batch_len += length;
+        ++this->tx_batch_count;
+        
+        /* Send it as soon as no other record fits */
+        if(this->tx_batch_len + 1 >= payload_size){
+            rt_batch_flush();
+        }
+        return 1;
+}
+
+/** Queue the open batch as a single DATA package; a batch of one record is
+    sent as the plain package it was. Returns false if the transmit queue is
+    full, in which case the batch is kept to be tried again.
+*/
+template <class CFG>
+bool rt_basic_state<CFG>::rt_batch_flush(){
+        size_t n;
+        
+        if(this->tx_batch_count == 0){
+            return true;
+        }
+        if(this->tx_batch_count == 1){
+            n = rt_send_data(RTRANS_TYPE_DATA, &this->tx_batch[1], this->tx_batch_len - 1);
+        }
+        else{
+            n = rt_send_data(RTRANS_TYPE_DATA | RTRANS_FLAG_BATCH, this->tx_batch, this->tx_batch_len);
+        }
+        if(n == 0){
+            // tx queue full (counted in tx_queue_full); the next rt_loop tries again
+            return false;
+        }
+        this->tx_batch_count = 0;
+        this->tx_batch_len = 0;
+        return true;
+}
+
+/** Queue a DATA package, or put it in the spill log: behind the packages
+    already there, while the master is out of reach, or if the transmit
+    queue is full. A package the log cannot take is queued as without one.
+*/
+template <class CFG>
+size_t rt_basic_state<CFG>::rt_send_data(uint8_t type, const uint8_t *payload, size_t length){
+        bool behind = rt_spill_ready() && (this->spill_outage || !this->spill->empty());
+        size_t n;
+        
+        if(behind && rt_spill_package(type, payload, length)){
+            return 1;
+        }
+        n = rt_send_package(type, payload, length);
+        if(n == 0 && !behind && rt_spill_package(type, payload, length)){
+            return 1;
+        }
+        return n;
+}
+
+/** Hold small DATA packages for up to window ms and send them together in
+    one segment, each as a record of a length byte and its data; window 0
+    sends what is held and turns batching off. Returns false if the
+    configuration has no room for batching.
+*/
+template <class CFG>
+bool rt_basic_state<CFG>::rt_batch(uint16_t window){
+        if(!CFG::batching){
+            return false;
+        }
+        if(window == 0){
+            rt_batch_flush();
+        }
+        this->tx_batch_window = window;
+        return true;
+}
+
+/** Returns whether a package of length bytes in the given number of
+    segments fits the queue, each segment in one piece. Committing to a
+    copy of the ringbuffer state only moves indices, so nothing is written
+    to the buffer.
+*/
+template <class CFG>
+bool rt_basic_state<CFG>::rt_tx_fits(const ringbuffer *queue, size_t length, size_t segments){
+        ringbuffer dry_run = *queue;
+        size_t i, n;
+        
+        for(i = 0; i < segments; i++){
+            n = (length > payload_size) ? payload_size : length;
+            if(rb_reserve(&dry_run, sizeof(rt_out_header) + n + trailer_size) == 0){
+                return false;
+            }
+            rb_commit(&dry_run, sizeof(rt_out_header) + n + trailer_size);
+            length -= n;
+        }
+        return true;
+}
+
+/** Segment a package into the transmit queue, see rt_send(). With
+    from_log, the payload is the oldest package in the spill log, read
+    straight into the queue and not coded.
+*/
+template <class CFG>
+size_t rt_basic_state<CFG>::rt_send_package(uint8_t type, const uint8_t *payload, size_t length, bool from_log){
+        uint8_t cls = (CFG::tx_urgent > 0 && (type & RTRANS_TYPE_MASK) == RTRANS_TYPE_ERR) ? RTRANS_TX_URGENT : RTRANS_TX_BULK;
+        ringbuffer *queue = &this->tx_queue[cls];
+        rt_out_header h;
+        delta_encoder enc;
+        size_t i, expected_segments = 0;
+        bool coded = false;
+        
+        /* Code the payload if that saves space; sizing it is a dry run of the encoder */
+        if(type == RTRANS_TYPE_DATA && !from_log && this->tx_layout.count > 0){
+            size_t n = delta_coded_size(&this->tx_layout, payload, length);
+            if(n < length){
+                delta_encode_begin(&enc, &this->tx_layout, payload, length);
+                type |= RTRANS_FLAG_DELTA;
+                length = n;
+                coded = true;
+            }
+        }
+        
+        /* Calculate how many segments we will need (could do this better if the atmega had a FPU,
+           probably still can do it better but I don't feel like figuring it out)
+        */
+        i = length;
+        do{
+            i -= (i > payload_size) ? payload_size : i;
+            ++expected_segments;
+        } while(i > 0);
+        
+        /* Make sure that the segment count is within the maximum */
+        if(expected_segments > CFG::max_segments){
+            return 0;
+        }
+        
+        /* An ERR which does not fit the urgent queue waits with the DATA instead */
+        if(cls == RTRANS_TX_URGENT && !rt_tx_fits(queue, length, expected_segments)){
+            cls = RTRANS_TX_BULK;
+            queue = &this->tx_queue[cls];
+        }
+        if(!rt_tx_fits(queue, length, expected_segments)){
+            ++this->counters.tx_queue_full;
+            return 0;
+        }
+        
+        /* Prepare the header */
+        h.master = this->master;
+        h.slave  = this->slave;
+        h.pkg_no = this->tx_pkg_no++;
+        h.type   = type;
+        h.seg_ct = expected_segments;
+        
+        /* Construct segments directly in the queue */
+        for(i = 0; i < expected_segments; i++){
+             uint8_t *seg;
+             size_t n;
+          
+             /* Segment-specific header fields */
+             h.len = (length > payload_size) ? payload_size : length;
+             h.seg_no = i;
+             n = sizeof(rt_out_header) + h.len + trailer_size;
+             
+             /* Copy (or code) header and payload into the reserved space, checksumming on the way */
+             seg = rb_reserve(queue, n);
+             if(coded){
+                 delta_encode(&enc, seg + sizeof(rt_out_header), h.len);
+                 rt_frame_build(seg, &h, 0);
+             }
+             else if(from_log){
+                 this->spill->peek_data(i * payload_size, seg + sizeof(rt_out_header), h.len);
+                 rt_frame_build(seg, &h, 0);
+             }
+             else{
+                 rt_frame_build(seg, &h, &payload[i * payload_size]);
+             }
+             
+             rb_commit(queue, n);
+             length -= h.len;
+        }
+        
+        ++this->counters.tx_packages;
+        if(cls == RTRANS_TX_BULK && queue->avail > this->counters.tx_queue_hwm){
+            this->counters.tx_queue_hwm = queue->avail;
+        }
+        return expected_segments;
+}
+
+/** Delta code DATA payloads made of records with the given field widths
+    (1, 2 or 4 bytes each, little endian) from now on; count 0 turns coding
+    off. Returns false if the layout is not supported.
+*/
+template <class CFG>
+bool rt_basic_state<CFG>::rt_compress(const uint8_t *widths, uint8_t count){
+        return delta_layout_init(&this->tx_layout, widths, count);
+}
+
+template <class CFG>
+void rt_basic_state<CFG>::rt_join(uint16_t addr){
+        uint8_t caps = join_caps;
+        
+        this->master = addr;
+        this->tx_compact = false;
+        rt_send(RTRANS_TYPE_JOIN, &caps, 1);
+}
+
+/** Keep DATA which cannot get to the master in the given log, and send
+    it once the master is heard from again; 0 stops using a log, leaving
+    what is in it. The sketch calls begin() on the log first, to take over
+    the packages an earlier run left there. Returns false if the
+    configuration keeps no packages (spill_record 0).
+    
+    The master is taken to be out of reach once a DATA segment runs out of
+    retransmissions. Its package goes to the log, if all of it is still
+    queued, and so does every DATA package sent from then on. Meanwhile
+    the oldest package in the log is sent on its own whenever nothing else
+    is queued, and left in the log; the first ACK, or POLL or SET, from
+    the master ends the outage, and the log is moved to the transmit queue
+    as fast as the queue empties, in order and with small packages put
+    together in batches of a segment (as with rt_batch()). Packages of
+    more than spill_record bytes are never kept. A JOIN which runs out of
+    retransmissions, as after a reset in the outage, is the probe instead,
+    and goes before the log: the master would take packages numbered from
+    0 again without it for copies of earlier ones.
+*/
+template <class CFG>
+bool rt_basic_state<CFG>::rt_spill(rt_spill_log *log){
+        if(CFG::spill_record == 0){
+            return false;
+        }
+        this->spill = log;
+        this->spill_outage = false;
+        this->spill_probe = false;
+        this->spill_join = false;
+        return true;
+}
+
+/** Add a DATA package to the spill log, if there is one and it takes it */
+template <class CFG>
+bool rt_basic_state<CFG>::rt_spill_package(uint8_t type, const uint8_t *payload, size_t length){
+        return rt_spill_ready() && length <= CFG::spill_record && this->spill->append(type, payload, length);
+}
+
+/** Size the package whose first segment is offset bytes into the bulk
+    queue, its segments following each other. Returns the offset past it,
+    with its type and payload bytes, or 0 if it is not all there.
+*/
+template <class CFG>
+size_t rt_basic_state<CFG>::rt_tx_package(size_t offset, uint8_t *type, size_t *length){
+        const ringbuffer *queue = &this->tx_queue[RTRANS_TX_BULK];
+        const rt_out_header *h;
+        uint8_t i, seg_ct = 1;
+        
+        *length = 0;
+        for(i = 0; i < seg_ct; i++){
+            if(offset + sizeof(rt_out_header) > queue->avail){
+                return 0;
+            }
+            h = (const rt_out_header *) rb_peek_ptr(queue, offset, sizeof(rt_out_header));
+            if(i == 0){
+                *type = h->type;
+                seg_ct = h->seg_ct;
+            }
+            *length += h->len;
+            offset += sizeof(rt_out_header) + h->len + trailer_size;
+        }
+        return offset;
+}
+
+/** Copy the package whose first segment is offset bytes into the bulk
+    queue to the spill log, if it takes it
+*/
+template <class CFG>
+bool rt_basic_state<CFG>::rt_spill_copy(size_t offset){
+        ringbuffer *queue = &this->tx_queue[RTRANS_TX_BULK];
+        const rt_out_header *h;
+        size_t length, end;
+        uint8_t type;
+        
+        end = rt_tx_package(offset, &type, &length);
+        if(end == 0 || (type & RTRANS_TYPE_MASK) != RTRANS_TYPE_DATA || length > CFG::spill_record ||
+           !this->spill->append_begin(type, length)){
+            return false;
+        }
+        while(offset < end){
+            h = (const rt_out_header *) rb_peek_ptr(queue, offset, sizeof(rt_out_header));
+            this->spill->append_data(rb_peek_ptr(queue, offset + sizeof(rt_out_header), h->len), h->len);
+            offset += sizeof(rt_out_header) + h->len + trailer_size;
+        }
+        this->spill->append_commit();
+        return true;
+}
+
+/** A bulk segment in the given window slot ran out of retransmissions:
+    the master is out of reach. Its package goes to the spill log if it is
+    DATA and all of its segments are still in the transmit queue, and so
+    do the packages queued behind the window (see rt_spill_queued()); a
+    JOIN is sent again later. Returns whether the package is kept, as the
+    probe is already.
+*/
+template <class CFG>
+bool rt_basic_state<CFG>::rt_spill_expired(uint8_t slot){
+        ringbuffer *queue = &this->tx_queue[RTRANS_TX_BULK];
+        uint8_t pkg_no = this->tx_window[slot].pkg_no;
+        const rt_out_header *h;
+        uint8_t i;
+        
+        if(!rt_spill_ready()){
+            return false;
+        }
+        this->spill_outage = true;
+        rt_spill_queued();
+        if(this->spill_probe && pkg_no == this->spill_probe_pkg){
+            this->spill_probe = false;
+            return true;
+        }
+        for(i = 0; i < this->tx_inflight; i++){
+            if(this->tx_window[i].cls == RTRANS_TX_BULK && this->tx_window[i].pkg_no == pkg_no && this->tx_window[i].seg_no == 0){
+                break;
+            }
+        }
+        if(i == this->tx_inflight){
+            return false;
+        }
+        h = (const rt_out_header *) rb_peek_ptr(queue, this->tx_window[i].offset, sizeof(rt_out_header));
+        if(h->type == RTRANS_TYPE_JOIN){
+            this->spill_join = true;
+            return true;
+        }
+        return rt_spill_copy(this->tx_window[i].offset);
+}
+
+/** Move the DATA packages queued behind the window to the spill log, as
+    the master is out of reach: those past the last package which cannot
+    go there, or which is partly in the window already. They leave the
+    queue together, so they go only if the log has room for them all.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_spill_queued(){
+        ringbuffer *queue = &this->tx_queue[RTRANS_TX_BULK];
+        const rt_out_header *h;
+        size_t offset, next, cut, length, bytes = 0;
+        uint8_t type;
+        
+        /* the rest of a package partly in the window stays */
+        offset = this->tx_next[RTRANS_TX_BULK];
+        while(offset < queue->avail){
+            h = (const rt_out_header *) rb_peek_ptr(queue, offset, sizeof(rt_out_header));
+            if(h->seg_no == 0){
+                break;
+            }
+            offset += sizeof(rt_out_header) + h->len + trailer_size;
+        }
+        
+        /* size the packages, starting over past any which cannot go */
+        cut = offset;
+        while(offset < queue->avail){
+            next = rt_tx_package(offset, &type, &length);
+            if(next == 0){
+                return;
+            }
+            if((type & RTRANS_TYPE_MASK) != RTRANS_TYPE_DATA || length > CFG::spill_record){
+                cut = next;
+                bytes = 0;
+            }
+            else{
+                bytes += RT_SPILL_HEADER + length;
+            }
+            offset = next;
+        }
+        if(bytes == 0 || bytes > this->spill->room(RT_SPILL_HEADER + CFG::spill_record)){
+            return;
+        }
+        
+        for(offset = cut; offset < queue->avail; offset = rt_tx_package(offset, &type, &length)){
+            rt_spill_copy(offset);
+        }
+        rb_truncate(queue, queue->avail - cut);
+}
+
+/** The master was heard from: if that ends an outage, the segments in
+    flight were sent during it, and go again now rather than once their
+    timers, backed off all through the outage, expire.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_spill_reached(){
+        uint8_t i;
+        
+        if(!this->spill_outage){
+            return;
+        }
+        this->spill_outage = false;
+        for(i = 0; i < this->tx_inflight; i++){
+            if(!this->tx_window[i].done && this->tx_window[i].cls == RTRANS_TX_BULK && this->tx_window[i].tx_ct > 0){
+                rt_tx_segment(i);
+            }
+        }
+}
+
+/** An ACK came for the given package, so the master is in reach; if the
+    package was the probe, the JOIN is through or the package out of the
+    log.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_spill_acked(uint8_t pkg_no){
+        rt_spill_reached();
+        if(CFG::spill_record > 0 && this->spill_probe && pkg_no == this->spill_probe_pkg){
+            this->spill_probe = false;
+            if(this->spill_join){
+                this->spill_join = false;
+            }
+            else if(this->spill){
+                this->spill->pop();
+            }
+        }
+}
+
+/** Queue a batch put together from the spill log in seg, a segment
+    reserved in the bulk queue for a whole payload; a batch of one record is
+    sent as the plain package it was. The segment goes where a reservation
+    of its actual size would, which is elsewhere if the whole payload only
+    fit at the front of the queue.
+*/
+template <class CFG>
+size_t rt_basic_state<CFG>::rt_spill_flush(uint8_t *seg, uint8_t len, uint8_t count){
+        ringbuffer *queue = &this->tx_queue[RTRANS_TX_BULK];
+        uint8_t *body = seg + sizeof(rt_out_header);
+        uint8_t *frame;
+        rt_out_header h;
+        size_t n;
+        
+        h.type = RTRANS_TYPE_DATA | RTRANS_FLAG_BATCH;
+        if(count == 1){
+            h.type = RTRANS_TYPE_DATA;
+            memmove(body, body + 1, --len);
+        }
+        n = sizeof(rt_out_header) + len + trailer_size;
+        frame = rb_reserve(queue, n);
+        if(frame != seg){
+            memmove(frame + sizeof(rt_out_header), body, len);
+        }
+        h.master = this->master;
+        h.slave  = this->slave;
+        h.pkg_no = this->tx_pkg_no++;
+        h.seg_ct = 1;
+        h.seg_no = 0;
+        h.len    = len;
+        rt_frame_build(frame, &h, 0);
+        rb_commit(queue, n);
+        
+        ++this->counters.tx_packages;
+        if(queue->avail > this->counters.tx_queue_hwm){
+            this->counters.tx_queue_hwm = queue->avail;
+        }
+        return 1;
+}
+
+/** Move packages from the spill log to the transmit queue, see rt_spill().
+    Records are read from the store straight into the queue, small ones
+    into a segment reserved for the batch they go in. A package which could
+    never be queued is dropped.
+*/
+template <class CFG>
+void rt_basic_state<CFG>::rt_spill_drain(){
+        ringbuffer *queue;
+        uint8_t *seg = 0;
+        uint8_t type, len, batch_len = 0, batch_count = 0;
+        size_t n;
+        
+        if(!rt_spill_ready() || this->spill_probe){
+            return;
+        }
+        queue = &this->tx_queue[RTRANS_TX_BULK];
+        if(this->spill_join){
+            len = join_caps;
+            if(rt_send_package(RTRANS_TYPE_JOIN, &len, 1) > 0){
+                this->spill_probe = true;
+                this->spill_probe_pkg = this->tx_pkg_no - 1;
+            }
+            return;
+        }
+        if(this->spill_outage && queue->avail > 0){
+            return;
+        }
+        while(this->spill->peek(&type, 0, 0, &len)){
+            /* Small packages go together, in a segment reserved before their first record */
+            if(CFG::batching && !this->spill_outage && type == RTRANS_TYPE_DATA && len < payload_size){
+                if(batch_count > 0 && batch_len + 1 + len > payload_size){
+                    rt_spill_flush(seg, batch_len, batch_count);
+                    batch_count = 0;
+                    batch_len = 0;
+                }
+                if(batch_count == 0){
+                    if(!rt_tx_fits(queue, payload_size, 1)){
+                        break;
+                    }
+                    seg = rb_reserve(queue, sizeof(rt_out_header) + payload_size + trailer_size);
+                }
+                seg[sizeof(rt_out_header) + batch_len++] = len;
+                this->spill->peek_data(0, &seg[sizeof(rt_out_header) + batch_len], len);
+                batch_len += len;
+                ++batch_count;
+                this->spill->pop();
+                continue;
+            }
+            if(batch_count > 0){
+                rt_spill_flush(seg, batch_len, batch_count);
+                batch_count = 0;
+                batch_len = 0;
+            }
+            
+            n = rt_send_package(type, 0, len, true);
+            if(n == 0 && queue->avail > 0){
+                break;
+            }
+            if(n > 0 && this->spill_outage){
+                this->spill_probe = true;
+                this->spill_probe_pkg = this->tx_pkg_no - 1;
+                break;
+            }
+            if(n == 0){
+                ++this->counters.tx_dropped;
+            }
+            this->spill->pop();
+        }
+        if(batch_count > 0){
+            rt_spill_flush(seg, batch_len, batch_count);
+        }
+}
+
+#endif
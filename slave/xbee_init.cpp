@@ -1,55 +1,172 @@
 #include "xbee_init.h"
 
-bool xbee_wait_for_ok(SoftwareSerial &xs){
-        const char okcr[] = "OK\r";
-        bool err = false;
-
-        /* wait for 3 bytes */
-        while(xs.available() < 3);
-
-        /* verify that it was an OK */
-        for(int i = 0; i < 3; i++){
-                char c = xs.read();
-                if(c != okcr[i]){
-                        err = true;
-                }
+#define XBEE_PHASE_SEND         (0)
+#define XBEE_PHASE_WAIT         (1)
+#define XBEE_PHASE_SETTLE       (2)
+
+static const char okcr[] = "OK\r";
+
+static const char *const commands[] = {
+        "+++",
+        "ATRE\r",
+        "ATFR\r",
+        "+++",
+        "ATCH0C\r",
+        "ATID3332\r",
+        "ATAP2\r",
+        "ATAC\r",
+        0,              // ATBD, built from the rate
+        "ATCN\r"
+};
+
+#define XBEE_COMMAND_COUNT      (sizeof(commands) / sizeof(commands[0]))
+#define XBEE_STEP_RESET         (2)
+#define XBEE_STEP_BAUD          (8)
+
+/* The radio restarts after ATFR and leaves command mode after ATCN */
+static bool xbee_settle_after(uint8_t step){
+        return step == XBEE_STEP_RESET || step == XBEE_COMMAND_COUNT - 1;
+}
+
+/* Whether the radio is to be switched to another rate */
+static bool xbee_baud_change(const xbee_init_state *st){
+        return st->set_baud != 0 && st->baud != XBEE_DEFAULT_BAUD;
+}
+
+/** Write ATBD with the code of a standard rate, or the rate itself in hex
+    for any other, which the radio takes as is
+*/
+static void xbee_write_baud(Stream &xs, uint32_t baud){
+        uint32_t code;
+        int shift;
+
+        switch(baud){
+                case 1200:   code = 0; break;
+                case 2400:   code = 1; break;
+                case 4800:   code = 2; break;
+                case 9600:   code = 3; break;
+                case 19200:  code = 4; break;
+                case 38400:  code = 5; break;
+                case 57600:  code = 6; break;
+                case 115200: code = 7; break;
+                default:     code = baud; break;
         }
 
-        return !err;
+        xs.write("ATBD");
+        for(shift = 28; shift > 0 && (code >> shift) == 0; shift -= 4);
+        for(; shift >= 0; shift -= 4){
+                xs.write((uint8_t) "0123456789ABCDEF"[(code >> shift) & 0xf]);
+        }
+        xs.write((uint8_t) '\r');
+}
+
+static bool xbee_time_reached(uint32_t deadline){
+        return (int32_t) ((uint32_t) millis() - deadline) >= 0;
 }
 
-bool xbee_command(SoftwareSerial &xs, const char command[]){
-        /* Clear garbage from the buffer */
-        while(xs.available())
-                xs.read();
-                
-        /* Write the command */
-        xs.write(command);
-        
-        return xbee_wait_for_ok(xs);
+void xbee_init_begin(xbee_init_state *st, Stream &xs, uint32_t baud, xbee_set_baud set_baud){
+        st->xs       = &xs;
+        st->set_baud = set_baud;
+        st->baud     = baud;
+        st->fast     = false;
+        st->step     = 0;
+        st->matched  = 0;
+        st->phase    = XBEE_PHASE_SEND;
+        st->ok       = true;
+        st->status   = XBEE_INIT_BUSY;
+        st->deadline = millis();
 }
 
-bool xbee_init(SoftwareSerial &xs){
-        bool ok = true;
-        const char *commands[] = {
-                "+++",
-                "ATRE\r",
-                "ATFR\r",
-                "+++",
-                "ATCH0C\r",
-                "ATID3332\r",
-                "ATAP2\r",
-                "ATAC\r",
-                "ATCN\r"
-        };
-        int i;
-        for(i = 0; i < 3; i++){
-                ok &= xbee_command(xs, commands[i]);
+uint8_t xbee_init_poll(xbee_init_state *st){
+        Stream &xs = *st->xs;
+
+        while(st->status == XBEE_INIT_BUSY){
+                switch(st->phase){
+                        case XBEE_PHASE_SEND:
+                                if(st->step == XBEE_STEP_BAUD && !xbee_baud_change(st)){
+                                        ++st->step;
+                                        break;
+                                }
+
+                                /* Clear garbage from the buffer */
+                                while(xs.available())
+                                        xs.read();
+
+                                if(commands[st->step]){
+                                        xs.write(commands[st->step]);
+                                }
+                                else{
+                                        xbee_write_baud(xs, st->baud);
+                                }
+                                st->matched  = 0;
+                                st->deadline = millis() + XBEE_OK_TIMEOUT;
+                                st->phase    = XBEE_PHASE_WAIT;
+                                break;
+
+                        case XBEE_PHASE_WAIT:
+                                /* verify that it was an OK, as far as it has arrived */
+                                while(st->matched < 3 && xs.available()){
+                                        if(xs.read() != okcr[st->matched]){
+                                                st->ok = false;
+                                        }
+                                        ++st->matched;
+                                }
+                                if(st->matched < 3){
+                                        if(!xbee_time_reached(st->deadline)){
+                                                return st->status;
+                                        }
+                                        if(st->step == 0 && xbee_baud_change(st) && !st->fast){
+                                                /* only the MCU was reset, the radio is still at the rate we left it at */
+                                                st->fast  = true;
+                                                st->set_baud(xs, st->baud);
+                                                st->phase = XBEE_PHASE_SEND;
+                                                break;
+                                        }
+                                        st->status = XBEE_INIT_TIMEOUT;
+                                        return st->status;
+                                }
+
+                                if(st->step == XBEE_COMMAND_COUNT - 1 && xbee_baud_change(st)){
+                                        /* the radio takes the new rate as it leaves command mode */
+                                        st->set_baud(xs, st->baud);
+                                }
+
+                                if(xbee_settle_after(st->step)){
+                                        st->deadline = millis() + XBEE_SETTLE_TIME;
+                                        st->phase    = XBEE_PHASE_SETTLE;
+                                }
+                                else{
+                                        st->phase = XBEE_PHASE_SEND;
+                                }
+                                ++st->step;
+                                break;
+
+                        case XBEE_PHASE_SETTLE:
+                                if(!xbee_time_reached(st->deadline)){
+                                        return st->status;
+                                }
+                                if(st->step == XBEE_COMMAND_COUNT){
+                                        st->status = st->ok ? XBEE_INIT_OK : XBEE_INIT_ERROR;
+                                }
+                                else if(st->fast){
+                                        /* the rate was never written (ATWR), so the restart undid it */
+                                        st->fast = false;
+                                        st->set_baud(xs, XBEE_DEFAULT_BAUD);
+                                }
+                                st->phase = XBEE_PHASE_SEND;
+                                break;
+                }
         }
-        delay(1000);
-        for(i = 3; i < 9; i++){
-                ok &= xbee_command(xs, commands[i]);
+
+        return st->status;
+}
+
+bool xbee_init(Stream &xs, uint32_t baud, xbee_set_baud set_baud){
+        xbee_init_state st;
+
+        xbee_init_begin(&st, xs, baud, set_baud);
+        while(xbee_init_poll(&st) == XBEE_INIT_BUSY){
+                delay(1);
         }
-        delay(1000);
-        return ok;
+        return st.status == XBEE_INIT_OK;
 }
@@ -2,15 +2,63 @@
 #define _xbee_init_h_
 
 #include <Arduino.h>
-#include <SoftwareSerial.h>
 
-/** Send a plain AT mode command to the xbee. Returns true
-    if the OK\r response was received, false otherwise. Before
-    sending AT commands, be sure to send the +++ sequence.
+/* Time to wait for an OK\r; the first +++ takes the guard time (1 s) */
+#define XBEE_OK_TIMEOUT         (2000)
+
+/* Pause after leaving command mode or resetting the radio */
+#define XBEE_SETTLE_TIME        (1000)
+
+/* Serial rate of a radio which has not been configured */
+#define XBEE_DEFAULT_BAUD       (9600)
+
+/* Progress of xbee_init_poll */
+#define XBEE_INIT_BUSY          (0)   // still configuring
+#define XBEE_INIT_OK            (1)   // every command was acknowledged
+#define XBEE_INIT_ERROR         (2)   // finished, but some command was not acknowledged
+#define XBEE_INIT_TIMEOUT       (3)   // the radio stopped answering, gave up
+
+/* Changes the rate of the serial port behind a stream */
+typedef void (*xbee_set_baud)(Stream &xs, uint32_t baud);
+
+/** xbee_set_baud for any serial port class with a begin(baud), such as
+    SoftwareSerial, HardwareSerial or rt_uart
+*/
+template <class SERIAL>
+void xbee_baud_of(Stream &xs, uint32_t baud){
+        static_cast<SERIAL &>(xs).begin(baud);
+}
+
+/* State of a configuration in progress */
+typedef struct xbee_init_state_s {
+    Stream          *xs;
+    xbee_set_baud   set_baud;   // 0 if the rate cannot be changed
+    uint32_t        baud;       // rate to leave the radio and the port at
+    uint8_t         step;       // command being run
+    uint8_t         matched;    // bytes of the response received
+    uint8_t         phase;      // sending, waiting for OK or settling
+    bool            ok;         // no command failed so far
+    bool            fast;       // the radio answered at baud, not XBEE_DEFAULT_BAUD
+    uint8_t         status;     // XBEE_INIT_*
+    uint32_t        deadline;   // end of the current wait
+} xbee_init_state;
+
+/** Start setting channel, PAN ID, and API mode without blocking;
+    call xbee_init_poll until it stops returning XBEE_INIT_BUSY.
+    Given a set_baud for the port, the radio is also switched to baud
+    (ATBD) once configured, and the port with it; a radio left at baud
+    by an earlier run is found there if it does not answer at
+    XBEE_DEFAULT_BAUD. The port must be open at XBEE_DEFAULT_BAUD.
+*/
+void xbee_init_begin(xbee_init_state *st, Stream &xs,
+                     uint32_t baud = XBEE_DEFAULT_BAUD, xbee_set_baud set_baud = 0);
+
+/** Advance the configuration as far as possible without waiting.
+    Returns one of the XBEE_INIT_* codes.
 */
-bool xbee_command(SoftwareSerial &xs, const char command[]);
+uint8_t xbee_init_poll(xbee_init_state *st);
 
-/** Sets channel, PAN ID, and API mode */
-bool xbee_init(SoftwareSerial &xs);
+/** Sets channel, PAN ID, and API mode, blocking until done */
+bool xbee_init(Stream &xs, uint32_t baud = XBEE_DEFAULT_BAUD, xbee_set_baud set_baud = 0);
 
 #endif